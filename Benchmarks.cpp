@@ -0,0 +1,269 @@
+#include "Benchmarks.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "DrawSort.h"
+#include "TransformSystem.h"
+#include "SoftwareOcclusionCuller.h"
+#include "CpuFeatures.h"
+
+void runDrawSortBenchmark(size_t keyCount, int iterations) {
+	// Fixed seed so every run sorts the same keys
+	std::mt19937 random(1234);
+	std::uniform_int_distribution<uint32_t> pipelineDist(0, 1);
+	std::uniform_int_distribution<uint32_t> materialDist(0, 255);
+	std::uniform_int_distribution<uint32_t> geometryDist(0, 4095);
+	std::uniform_real_distribution<float> depthDist(0.0f, 1.0f);
+
+	std::vector<uint64_t> sourceKeys(keyCount);
+	for (size_t i = 0; i < keyCount; i++) {
+		sourceKeys[i] = makeDrawKey(pipelineDist(random), materialDist(random), geometryDist(random), depthDist(random));
+	}
+
+	std::vector<uint64_t> keys(keyCount), tempKeys(keyCount);
+	std::vector<uint32_t> values(keyCount), tempValues(keyCount);
+
+	// Radix Sort
+	double radixSeconds = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		keys = sourceKeys;
+		for (size_t j = 0; j < keyCount; j++) {
+			values[j] = static_cast<uint32_t>(j);
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		radixSortDrawKeys(keys, values, tempKeys, tempValues);
+		radixSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	if (!std::is_sorted(keys.begin(), keys.end())) {
+		throw std::runtime_error("Radix sort produced unsorted keys!");
+	}
+
+	// std::sort of the same keys as a baseline
+	double stdSortSeconds = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		keys = sourceKeys;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		std::sort(keys.begin(), keys.end());
+		stdSortSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	double radixMs = radixSeconds * 1000.0 / iterations;
+	double stdSortMs = stdSortSeconds * 1000.0 / iterations;
+
+	std::cout << "Draw key sort (" << keyCount << " keys, " << iterations << " iterations)\n";
+	std::cout << "\tradix sort : " << radixMs << " ms (" << (keyCount / (radixMs / 1000.0)) / 1e6 << " Mkeys/s)\n";
+	std::cout << "\tstd::sort  : " << stdSortMs << " ms (" << (keyCount / (stdSortMs / 1000.0)) / 1e6 << " Mkeys/s)\n";
+}
+
+static void runTransformBenchmark(size_t objectCount, int iterations, bool uniformScales) {
+	// Fixed seed so every run builds the same hierarchy. Groups of 16: a root, children of the root, and grandchildren
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> positionDist(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> scaleDist(0.5f, 2.0f);
+	std::uniform_real_distribution<float> angleDist(0.0f, 6.2831853f);
+
+	std::vector<int> parents(objectCount);
+	std::vector<glm::vec3> positions(objectCount), scales(objectCount), axes(objectCount);
+	for (size_t i = 0; i < objectCount; i++) {
+		size_t groupFirst = i - i % 16;
+		parents[i] = i == groupFirst ? -1 : (i % 16 < 6 ? static_cast<int>(groupFirst) : static_cast<int>(groupFirst + 1 + i % 5));
+		positions[i] = glm::vec3(positionDist(random), positionDist(random), positionDist(random));
+		scales[i] = uniformScales ? glm::vec3(scaleDist(random)) : glm::vec3(scaleDist(random), scaleDist(random), scaleDist(random));
+		axes[i] = glm::normalize(glm::vec3(positionDist(random), positionDist(random), positionDist(random)));
+	}
+
+	TransformSystem transforms;
+	for (size_t i = 0; i < objectCount; i++) {
+		transforms.add(positions[i], glm::angleAxis(angleDist(random), axes[i]), scales[i], parents[i]);
+	}
+
+	// Object buffer order is the transform order here, a real scene gathers them in draw order
+	std::vector<uint32_t> ids(objectCount);
+	for (size_t i = 0; i < objectCount; i++) {
+		ids[i] = static_cast<uint32_t>(i);
+	}
+	std::vector<ObjectTransform> output(objectCount);
+
+	// Every object rotates every iteration
+	double setSeconds = 0.0;
+	double updateSeconds = 0.0;
+	double writeSeconds = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t j = 0; j < objectCount; j++) {
+			transforms.setRotation(static_cast<uint32_t>(j), glm::angleAxis(0.01f * i, axes[j]));
+		}
+		auto setEnd = std::chrono::high_resolution_clock::now();
+		transforms.update();
+		auto updateEnd = std::chrono::high_resolution_clock::now();
+		transforms.write(ids.data(), objectCount, output.data());
+		auto writeEnd = std::chrono::high_resolution_clock::now();
+
+		setSeconds += std::chrono::duration<double>(setEnd - start).count();
+		updateSeconds += std::chrono::duration<double>(updateEnd - setEnd).count();
+		writeSeconds += std::chrono::duration<double>(writeEnd - updateEnd).count();
+	}
+
+	// Same work one glm::mat4 at a time, as the renderer used to do per model
+	std::vector<glm::mat4> worlds(objectCount);
+	std::vector<ObjectTransform> reference(objectCount);
+	double glmSeconds = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t j = 0; j < objectCount; j++) {
+			glm::mat4 local = glm::translate(glm::mat4(1.0f), positions[j]) * glm::mat4_cast(glm::angleAxis(0.01f * i, axes[j])) * glm::scale(glm::mat4(1.0f), scales[j]);
+			worlds[j] = parents[j] >= 0 ? worlds[parents[j]] * local : local;
+			packObjectTransform(worlds[j], &reference[j]);
+		}
+		glmSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Both paths ran the same last iteration, so their results should agree
+	float maxError = 0.0f;
+	for (size_t i = 0; i < objectCount; i++) {
+		for (int row = 0; row < 3; row++) {
+			glm::vec4 modelDifference = glm::abs(output[i].model[row] - reference[i].model[row]) / glm::max(glm::abs(reference[i].model[row]), glm::vec4(1.0f));
+			glm::vec4 normalDifference = glm::abs(output[i].normal[row] - reference[i].normal[row]) / glm::max(glm::abs(reference[i].normal[row]), glm::vec4(1.0f));
+			glm::vec4 difference = glm::max(modelDifference, normalDifference);
+			maxError = std::max(maxError, std::max(std::max(difference.x, difference.y), std::max(difference.z, difference.w)));
+		}
+	}
+	if (maxError > 1e-3f) {
+		throw std::runtime_error("Transform system results don't match glm!");
+	}
+
+	double setMs = setSeconds * 1000.0 / iterations;
+	double updateMs = updateSeconds * 1000.0 / iterations;
+	double writeMs = writeSeconds * 1000.0 / iterations;
+	double glmMs = glmSeconds * 1000.0 / iterations;
+
+	std::cout << "\t" << (uniformScales ? "one scale per object" : "scale per axis") << "\n";
+	std::cout << "\t\tset rotations    : " << setMs << " ms\n";
+	std::cout << "\t\tSIMD update      : " << updateMs << " ms (" << (objectCount / (updateMs / 1000.0)) / 1e6 << " Mobjects/s)\n";
+	std::cout << "\t\twrite to buffer  : " << writeMs << " ms (with normal matrices)\n";
+	std::cout << "\t\tupdate + write   : " << updateMs + writeMs << " ms\n";
+	std::cout << "\t\tglm per object   : " << glmMs << " ms (" << (objectCount / (glmMs / 1000.0)) / 1e6 << " Mobjects/s)\n";
+}
+
+void runTransformBenchmark(size_t objectCount, int iterations) {
+	std::cout << "Transform update (" << objectCount << " moving objects, " << iterations << " iterations, "
+		<< (cpuSupportsAvx2() ? "AVX2" : "SSE") << " write)\n";
+
+	// Scale per axis takes the full inverse for the normal matrices, one scale per object skips it
+	runTransformBenchmark(objectCount, iterations, false);
+	runTransformBenchmark(objectCount, iterations, true);
+}
+
+void runOcclusionBenchmark(size_t occluderCount, size_t boxCount, int iterations) {
+	// Occluder mesh: a unit wall in the XY plane split into a 32x32 grid, 2048 triangles
+	const uint32_t gridSize = 32;
+	std::vector<glm::vec3> wallPositions;
+	std::vector<uint32_t> wallIndices;
+	for (uint32_t y = 0; y <= gridSize; y++) {
+		for (uint32_t x = 0; x <= gridSize; x++) {
+			wallPositions.push_back(glm::vec3(static_cast<float>(x) / gridSize - 0.5f, static_cast<float>(y) / gridSize - 0.5f, 0.0f));
+		}
+	}
+	for (uint32_t y = 0; y < gridSize; y++) {
+		for (uint32_t x = 0; x < gridSize; x++) {
+			uint32_t corner = y * (gridSize + 1) + x;
+			wallIndices.insert(wallIndices.end(), { corner, corner + 1, corner + gridSize + 2, corner, corner + gridSize + 2, corner + gridSize + 1 });
+		}
+	}
+
+	// Fixed seed so every run builds the same scene. Camera at the origin looking down -Z, walls in front of it and boxes
+	// scattered through and behind them
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> spreadDist(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> wallSizeDist(4.0f, 12.0f);
+	std::uniform_real_distribution<float> wallDepthDist(10.0f, 60.0f);
+	std::uniform_real_distribution<float> boxSizeDist(0.2f, 2.0f);
+	std::uniform_real_distribution<float> boxDepthDist(5.0f, 200.0f);
+
+	// Rows of a 3x4 world matrix, as TransformSystem keeps them
+	auto worldRows = [](glm::vec3 position, glm::vec3 scale) {
+		return std::vector<glm::vec4> { glm::vec4(scale.x, 0.0f, 0.0f, position.x), glm::vec4(0.0f, scale.y, 0.0f, position.y), glm::vec4(0.0f, 0.0f, scale.z, position.z) };
+	};
+
+	std::vector<std::vector<glm::vec4>> wallRows;
+	for (size_t i = 0; i < occluderCount; i++) {
+		float depth = wallDepthDist(random);
+		glm::vec3 position(spreadDist(random) * depth * 0.5f, spreadDist(random) * depth * 0.3f, -depth);
+		wallRows.push_back(worldRows(position, glm::vec3(wallSizeDist(random), wallSizeDist(random), 1.0f)));
+	}
+
+	std::vector<std::vector<glm::vec4>> boxRows;
+	std::vector<OcclusionBox> boxes;
+	for (size_t i = 0; i < boxCount; i++) {
+		float depth = boxDepthDist(random);
+		glm::vec3 position(spreadDist(random) * depth * 0.5f, spreadDist(random) * depth * 0.3f, -depth);
+		boxRows.push_back(worldRows(position, glm::vec3(boxSizeDist(random), boxSizeDist(random), boxSizeDist(random))));
+	}
+	for (const auto& rows : boxRows) {
+		boxes.push_back({ glm::vec3(-0.5f), glm::vec3(0.5f), rows.data() });
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+	projection[1][1] *= -1;
+	glm::mat4 viewProjection = projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	std::vector<uint32_t> threadCounts = { 1 };
+	if (std::thread::hardware_concurrency() > 1) {
+		threadCounts.push_back(std::thread::hardware_concurrency());
+	}
+
+	std::cout << "Software occlusion culling (" << occluderCount << " occluders, " << occluderCount * wallIndices.size() / 3 << " triangles, "
+		<< boxCount << " boxes, " << iterations << " iterations)\n";
+
+	std::vector<uint8_t> singleThreadVisible;
+	for (uint32_t threads : threadCounts) {
+		SoftwareOcclusionCuller culler;
+		culler.setThreadCount(threads);
+
+		std::vector<uint8_t> visible(boxCount);
+		double rasterSeconds = 0.0;
+		double testSeconds = 0.0;
+		for (int i = 0; i < iterations; i++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			culler.beginFrame(viewProjection, 0.1f);
+			for (const auto& rows : wallRows) {
+				culler.addOccluder(wallPositions, wallIndices, rows.data());
+			}
+			culler.rasterize();
+			auto rasterEnd = std::chrono::high_resolution_clock::now();
+			culler.testBoxes(boxes.data(), boxes.size(), visible.data());
+			auto testEnd = std::chrono::high_resolution_clock::now();
+
+			rasterSeconds += std::chrono::duration<double>(rasterEnd - start).count();
+			testSeconds += std::chrono::duration<double>(testEnd - rasterEnd).count();
+		}
+
+		// Threads only split the work, they must agree with the single threaded results
+		if (singleThreadVisible.empty()) {
+			singleThreadVisible = visible;
+		} else if (visible != singleThreadVisible) {
+			throw std::runtime_error("Multithreaded occlusion results don't match the single threaded ones!");
+		}
+
+		const SoftwareOcclusionStats& stats = culler.getStats();
+		double rasterMs = rasterSeconds * 1000.0 / iterations;
+		double testMs = testSeconds * 1000.0 / iterations;
+
+		std::cout << "\t" << threads << (threads == 1 ? " thread" : " threads") << " (" << culler.getWidth() << "x" << culler.getHeight() << " depth buffer)\n";
+		std::cout << "\t\toccluder raster : " << rasterMs << " ms (" << (stats.occluderTriangles / (rasterMs / 1000.0)) / 1e6 << " Mtris/s, "
+			<< stats.trianglesRasterized << " of " << stats.occluderTriangles << " on screen)\n";
+		std::cout << "\t\tbox test       : " << testMs << " ms (" << (boxCount / (testMs / 1000.0)) / 1e6 << " Mboxes/s, "
+			<< stats.objectsCulled << " of " << stats.objectsTested << " culled)\n";
+	}
+}
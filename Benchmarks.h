@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// Stand-alone CPU micro benchmarks, run from the command line (see main.cpp) and printed to stdout
+
+// Sorts keyCount random draw keys `iterations` times with the radix sort and with std::sort for comparison
+void runDrawSortBenchmark(size_t keyCount = 100000, int iterations = 100);
+
+// Moves every one of objectCount transforms (roots with a few levels of children) each iteration and rebuilds their
+// world matrices with TransformSystem, then with plain glm matrices per object for comparison. Runs once with a scale
+// per axis and once with one scale per object, which skips most of the normal matrix work
+void runTransformBenchmark(size_t objectCount = 100000, int iterations = 100);
+
+// Rasterizes occluderCount wall meshes into the software occlusion culler's depth buffer and tests boxCount random boxes
+// against it each iteration, with one thread and then one per hardware thread, reporting occluder triangles and boxes
+// per second
+void runOcclusionBenchmark(size_t occluderCount = 50, size_t boxCount = 100000, int iterations = 50);
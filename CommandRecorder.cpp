@@ -0,0 +1,187 @@
+#include "CommandRecorder.h"
+
+#include <cstring>
+#include <algorithm>
+
+CommandRecorder::CommandRecorder() {
+	commandBuffer = nullptr;
+	invalidate();
+}
+
+void CommandRecorder::begin(VkCommandBuffer newCommandBuffer) {
+	commandBuffer = newCommandBuffer;
+	invalidate();
+}
+
+void CommandRecorder::invalidate() {
+	for (auto& bindPointState : bindPointStates) {
+		bindPointState.pipeline = VK_NULL_HANDLE;
+		bindPointState.layout = VK_NULL_HANDLE;
+		for (auto& descriptorSet : bindPointState.descriptorSets) {
+			descriptorSet = VK_NULL_HANDLE;
+		}
+	}
+
+	for (uint32_t i = 0; i < MAX_RECORDER_VERTEX_BINDINGS; i++) {
+		vertexBuffers[i] = VK_NULL_HANDLE;
+		vertexBufferOffsets[i] = 0;
+	}
+
+	indexBuffer = VK_NULL_HANDLE;
+	indexBufferOffset = 0;
+	indexBufferType = VK_INDEX_TYPE_UINT32;
+
+	pushConstantLayout = VK_NULL_HANDLE;
+	memset(pushConstantValid, 0, sizeof(pushConstantValid));
+}
+
+void CommandRecorder::resetStats() {
+	stats = CommandRecorderStats();
+}
+
+CommandRecorderStats CommandRecorder::getStats() {
+	return stats;
+}
+
+void CommandRecorder::bindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline) {
+	BindPointState& state = getBindPointState(bindPoint);
+	if (state.pipeline == pipeline) {
+		stats.elided++;
+		return;
+	}
+
+	vkCmdBindPipeline(commandBuffer, bindPoint, pipeline);
+	state.pipeline = pipeline;
+	stats.issued++;
+}
+
+void CommandRecorder::bindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const VkDescriptorSet* descriptorSets) {
+	BindPointState& state = getBindPointState(bindPoint);
+
+	// Sets bound with another layout may have been disturbed, don't trust any of them
+	if (state.layout != layout) {
+		for (auto& descriptorSet : state.descriptorSets) {
+			descriptorSet = VK_NULL_HANDLE;
+		}
+		state.layout = layout;
+	}
+
+	// Only sets that differ need binding. Find the smallest contiguous range covering them so it's still a single call
+	uint32_t firstChanged = setCount;
+	uint32_t lastChanged = 0;
+	for (uint32_t i = 0; i < setCount; i++) {
+		uint32_t setIndex = firstSet + i;
+		if (setIndex >= MAX_RECORDER_DESCRIPTOR_SETS || state.descriptorSets[setIndex] != descriptorSets[i]) {
+			firstChanged = std::min(firstChanged, i);
+			lastChanged = i;
+		}
+	}
+
+	if (firstChanged == setCount) {
+		stats.elided++;
+		return;
+	}
+
+	vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, firstSet + firstChanged, lastChanged - firstChanged + 1, descriptorSets + firstChanged, 0, nullptr);
+	stats.issued++;
+
+	for (uint32_t i = firstChanged; i <= lastChanged; i++) {
+		uint32_t setIndex = firstSet + i;
+		if (setIndex < MAX_RECORDER_DESCRIPTOR_SETS) {
+			state.descriptorSets[setIndex] = descriptorSets[i];
+		}
+	}
+}
+
+void CommandRecorder::bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets) {
+	bool changed = false;
+	for (uint32_t i = 0; i < bindingCount; i++) {
+		uint32_t binding = firstBinding + i;
+		if (binding >= MAX_RECORDER_VERTEX_BINDINGS || vertexBuffers[binding] != buffers[i] || vertexBufferOffsets[binding] != offsets[i]) {
+			changed = true;
+			break;
+		}
+	}
+
+	if (!changed) {
+		stats.elided++;
+		return;
+	}
+
+	vkCmdBindVertexBuffers(commandBuffer, firstBinding, bindingCount, buffers, offsets);
+	stats.issued++;
+
+	for (uint32_t i = 0; i < bindingCount; i++) {
+		uint32_t binding = firstBinding + i;
+		if (binding < MAX_RECORDER_VERTEX_BINDINGS) {
+			vertexBuffers[binding] = buffers[i];
+			vertexBufferOffsets[binding] = offsets[i];
+		}
+	}
+}
+
+void CommandRecorder::bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType) {
+	if (indexBuffer == buffer && indexBufferOffset == offset && indexBufferType == indexType) {
+		stats.elided++;
+		return;
+	}
+
+	vkCmdBindIndexBuffer(commandBuffer, buffer, offset, indexType);
+	indexBuffer = buffer;
+	indexBufferOffset = offset;
+	indexBufferType = indexType;
+	stats.issued++;
+}
+
+void CommandRecorder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stageFlags, uint32_t offset, uint32_t size, const void* values) {
+	// Push constant contents don't survive a switch to an incompatible layout
+	if (pushConstantLayout != layout) {
+		memset(pushConstantValid, 0, sizeof(pushConstantValid));
+		pushConstantLayout = layout;
+	}
+
+	bool inRange = offset + size <= MAX_RECORDER_PUSH_CONSTANT_SIZE;
+	if (inRange && memcmp(pushConstantData + offset, values, size) == 0) {
+		bool allValid = true;
+		for (uint32_t i = offset; i < offset + size; i++) {
+			allValid = allValid && pushConstantValid[i];
+		}
+
+		if (allValid) {
+			stats.elided++;
+			return;
+		}
+	}
+
+	vkCmdPushConstants(commandBuffer, layout, stageFlags, offset, size, values);
+	stats.issued++;
+
+	if (inRange) {
+		memcpy(pushConstantData + offset, values, size);
+		memset(pushConstantValid + offset, 1, size);
+	}
+}
+
+void CommandRecorder::draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
+	vkCmdDraw(commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+	stats.draws++;
+	stats.triangles += static_cast<uint64_t>(vertexCount / 3) * instanceCount;
+}
+
+void CommandRecorder::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
+	vkCmdDrawIndexed(commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	stats.draws++;
+	stats.triangles += static_cast<uint64_t>(indexCount / 3) * instanceCount;
+}
+
+void CommandRecorder::drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+	vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, drawCount, stride);
+	stats.draws += drawCount;
+}
+
+CommandRecorder::~CommandRecorder() {
+}
+
+CommandRecorder::BindPointState& CommandRecorder::getBindPointState(VkPipelineBindPoint bindPoint) {
+	return bindPointStates[bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? 1 : 0];
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+
+const uint32_t MAX_RECORDER_DESCRIPTOR_SETS = 4;		// Minimum maxBoundDescriptorSets guaranteed by the spec
+const uint32_t MAX_RECORDER_VERTEX_BINDINGS = 4;
+const uint32_t MAX_RECORDER_PUSH_CONSTANT_SIZE = 128;	// Minimum maxPushConstantsSize guaranteed by the spec
+
+// Bind/push calls issued to the command buffer vs dropped because the state was already set
+struct CommandRecorderStats {
+	uint32_t issued = 0;
+	uint32_t elided = 0;
+	uint32_t draws = 0;
+	uint64_t triangles = 0;			// Triangles submitted by the draws (all instances)
+};
+
+// Thin wrapper over vkCmd* state setting calls. Keeps a shadow copy of the state currently bound on the command buffer
+// and skips any call that wouldn't change it
+class CommandRecorder {
+public:
+	CommandRecorder();
+
+	// Start tracking a new command buffer (bound state is forgotten, counters are kept until resetStats)
+	void begin(VkCommandBuffer newCommandBuffer);
+	// Forget the shadow state, for when something outside the recorder changed the command buffer's state
+	void invalidate();
+
+	void resetStats();
+	CommandRecorderStats getStats();
+
+	void bindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline);
+	void bindDescriptorSets(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t setCount, const VkDescriptorSet* descriptorSets);
+	void bindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* buffers, const VkDeviceSize* offsets);
+	void bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType);
+	void pushConstants(VkPipelineLayout layout, VkShaderStageFlags stageFlags, uint32_t offset, uint32_t size, const void* values);
+
+	void draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+	void drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+	// Instance counts are only known to the GPU, so these add to the draws but not the triangles
+	void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+
+	~CommandRecorder();
+
+private:
+	VkCommandBuffer commandBuffer;
+
+	// Graphics and compute have separate bind points, so separate state
+	struct BindPointState {
+		VkPipeline pipeline;
+		VkPipelineLayout layout;
+		VkDescriptorSet descriptorSets[MAX_RECORDER_DESCRIPTOR_SETS];
+	} bindPointStates[2];
+
+	VkBuffer vertexBuffers[MAX_RECORDER_VERTEX_BINDINGS];
+	VkDeviceSize vertexBufferOffsets[MAX_RECORDER_VERTEX_BINDINGS];
+
+	VkBuffer indexBuffer;
+	VkDeviceSize indexBufferOffset;
+	VkIndexType indexBufferType;
+
+	VkPipelineLayout pushConstantLayout;
+	uint8_t pushConstantData[MAX_RECORDER_PUSH_CONSTANT_SIZE];
+	bool pushConstantValid[MAX_RECORDER_PUSH_CONSTANT_SIZE];
+
+	CommandRecorderStats stats;
+
+	BindPointState& getBindPointState(VkPipelineBindPoint bindPoint);
+};
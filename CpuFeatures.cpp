@@ -0,0 +1,35 @@
+#include "CpuFeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The CPU has to support AVX2, and the OS save the AVX registers on a context switch (XCR0 bits 1 and 2)
+static bool detectAvx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+
+	__cpuid(info, 1);
+	bool osSavesAvx = (info[2] & (1 << 27)) != 0;
+	bool hasAvx = (info[2] & (1 << 28)) != 0;
+	if (!osSavesAvx || !hasAvx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+bool cpuSupportsAvx2() {
+	static const bool supported = detectAvx2();
+	return supported;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Instruction sets the CPU running the program supports, for the kernels built with more than the project's baseline
+// (files like SoftwareOcclusionCullerAvx2.cpp, which are only called when these say so). Checked once and cached
+bool cpuSupportsAvx2();
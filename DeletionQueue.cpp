@@ -0,0 +1,98 @@
+#include "DeletionQueue.h"
+
+#include "GpuMemory.h"
+
+DeletionQueue::DeletionQueue() {
+	device = nullptr;
+}
+
+void DeletionQueue::init(VkDevice newDevice) {
+	device = newDevice;
+}
+
+void DeletionQueue::pushBuffer(VkBuffer buffer, VkDeviceMemory memory, uint64_t lastUseValue) {
+	Deletion deletion = { };
+	deletion.lastUseValue = lastUseValue;
+	deletion.buffer = buffer;
+	deletion.memory = memory;
+	deletions.push_back(deletion);
+}
+
+void DeletionQueue::pushImage(VkImage image, VkDeviceMemory memory, VkImageView imageView, uint64_t lastUseValue) {
+	Deletion deletion = { };
+	deletion.lastUseValue = lastUseValue;
+	deletion.image = image;
+	deletion.imageView = imageView;
+	deletion.memory = memory;
+	deletions.push_back(deletion);
+}
+
+void DeletionQueue::pushDescriptorSet(VkDescriptorSet descriptorSet, std::vector<VkDescriptorSet>* freeList, uint64_t lastUseValue) {
+	Deletion deletion = { };
+	deletion.lastUseValue = lastUseValue;
+	deletion.descriptorSet = descriptorSet;
+	deletion.freeList = freeList;
+	deletions.push_back(deletion);
+}
+
+void DeletionQueue::pushFramebuffer(VkFramebuffer framebuffer, uint64_t lastUseValue) {
+	Deletion deletion = { };
+	deletion.lastUseValue = lastUseValue;
+	deletion.framebuffer = framebuffer;
+	deletions.push_back(deletion);
+}
+
+void DeletionQueue::pushSwapchain(VkSwapchainKHR swapchain, uint64_t lastUseValue) {
+	Deletion deletion = { };
+	deletion.lastUseValue = lastUseValue;
+	deletion.swapchain = swapchain;
+	deletions.push_back(deletion);
+}
+
+void DeletionQueue::flush(uint64_t completedValue) {
+	// Pushed in timeline order, so everything that can go is at the front
+	size_t done = 0;
+	while (done < deletions.size() && deletions[done].lastUseValue <= completedValue) {
+		destroy(deletions[done]);
+		done++;
+	}
+	deletions.erase(deletions.begin(), deletions.begin() + done);
+}
+
+void DeletionQueue::flushAll() {
+	for (const auto& deletion : deletions) {
+		destroy(deletion);
+	}
+	deletions.clear();
+}
+
+size_t DeletionQueue::getPendingCount() {
+	return deletions.size();
+}
+
+DeletionQueue::~DeletionQueue() {
+}
+
+void DeletionQueue::destroy(const Deletion& deletion) {
+	if (deletion.framebuffer != VK_NULL_HANDLE) {
+		vkDestroyFramebuffer(device, deletion.framebuffer, nullptr);
+	}
+	if (deletion.imageView != VK_NULL_HANDLE) {
+		vkDestroyImageView(device, deletion.imageView, nullptr);
+	}
+	if (deletion.image != VK_NULL_HANDLE) {
+		vkDestroyImage(device, deletion.image, nullptr);
+	}
+	if (deletion.buffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device, deletion.buffer, nullptr);
+	}
+	if (deletion.memory != VK_NULL_HANDLE) {
+		GpuMemoryTracker::free(device, deletion.memory);
+	}
+	if (deletion.descriptorSet != VK_NULL_HANDLE) {
+		deletion.freeList->push_back(deletion.descriptorSet);
+	}
+	if (deletion.swapchain != VK_NULL_HANDLE) {
+		vkDestroySwapchainKHR(device, deletion.swapchain, nullptr);
+	}
+}
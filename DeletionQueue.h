@@ -0,0 +1,54 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <cstdint>
+
+// Vulkan objects that are no longer needed but may still be used by work in flight. Each is pushed with the GPU timeline
+// value of the last submission that may use it, and destroyed once the timeline has passed that value rather than
+// waiting for the device to go idle
+class DeletionQueue {
+public:
+	DeletionQueue();
+
+	void init(VkDevice newDevice);
+
+	// lastUseValue = timeline value of the latest submission that may be using the object
+	void pushBuffer(VkBuffer buffer, VkDeviceMemory memory, uint64_t lastUseValue);
+	void pushImage(VkImage image, VkDeviceMemory memory, VkImageView imageView, uint64_t lastUseValue);
+	// Sets come from pools without FREE_DESCRIPTOR_SET_BIT, so they're handed back to freeList to be rewritten and reused
+	void pushDescriptorSet(VkDescriptorSet descriptorSet, std::vector<VkDescriptorSet>* freeList, uint64_t lastUseValue);
+	void pushFramebuffer(VkFramebuffer framebuffer, uint64_t lastUseValue);
+	// Swapchain must already be retired (passed as oldSwapchain to its replacement)
+	void pushSwapchain(VkSwapchainKHR swapchain, uint64_t lastUseValue);
+
+	// Destroys everything whose last use is at or before the value the timeline has reached
+	void flush(uint64_t completedValue);
+	// Device must be idle
+	void flushAll();
+
+	size_t getPendingCount();
+
+	~DeletionQueue();
+
+private:
+	VkDevice device;
+
+	struct Deletion {
+		uint64_t lastUseValue;
+		VkBuffer buffer;
+		VkImage image;
+		VkImageView imageView;
+		VkDeviceMemory memory;
+		VkDescriptorSet descriptorSet;
+		std::vector<VkDescriptorSet>* freeList;
+		VkFramebuffer framebuffer;
+		VkSwapchainKHR swapchain;
+	};
+
+	std::vector<Deletion> deletions;			// In the order they were pushed, so lastUseValue never decreases
+
+	void destroy(const Deletion& deletion);
+};
@@ -0,0 +1,123 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+
+// Upper limit on how large a single chained pool is allowed to grow
+const uint32_t MAX_SETS_PER_POOL = 4096;
+
+DescriptorAllocator::DescriptorAllocator() {
+	device = nullptr;
+	currentPool = VK_NULL_HANDLE;
+	setsPerPool = 0;
+	poolFlags = 0;
+}
+
+void DescriptorAllocator::init(VkDevice newDevice, uint32_t initialSetsPerPool, const std::vector<DescriptorPoolRatio>& newPoolRatios, VkDescriptorPoolCreateFlags newPoolFlags) {
+	device = newDevice;
+	setsPerPool = initialSetsPerPool;
+	poolRatios = newPoolRatios;
+	poolFlags = newPoolFlags;
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+	if (currentPool == VK_NULL_HANDLE) {
+		currentPool = grabPool();
+	}
+
+	VkDescriptorSetAllocateInfo setAllocInfo = { };
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = currentPool;
+	setAllocInfo.descriptorSetCount = 1;
+	setAllocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet descriptorSet;
+	VkResult result = vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet);
+
+	// Current pool is full, chain a new one and try again
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+		currentPool = grabPool();
+		setAllocInfo.descriptorPool = currentPool;
+
+		result = vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet);
+	}
+
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate a Descriptor Set!");
+	}
+
+	return descriptorSet;
+}
+
+void DescriptorAllocator::resetPools() {
+	// Resetting a pool frees every set allocated from it in one call
+	for (auto pool : usedPools) {
+		vkResetDescriptorPool(device, pool, 0);
+		freePools.push_back(pool);
+	}
+
+	usedPools.clear();
+	currentPool = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::destroyPools() {
+	for (auto pool : usedPools) {
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+	for (auto pool : freePools) {
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+
+	usedPools.clear();
+	freePools.clear();
+	currentPool = VK_NULL_HANDLE;
+}
+
+size_t DescriptorAllocator::getPoolCount() {
+	return usedPools.size() + freePools.size();
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+}
+
+VkDescriptorPool DescriptorAllocator::grabPool() {
+	VkDescriptorPool pool;
+
+	// Reuse a reset pool if there is one, otherwise make a new one (growing each time so long-running chains stay short)
+	if (!freePools.empty()) {
+		pool = freePools.back();
+		freePools.pop_back();
+	} else {
+		pool = createPool(setsPerPool);
+		setsPerPool = std::min(setsPerPool * 2, MAX_SETS_PER_POOL);
+	}
+
+	usedPools.push_back(pool);
+
+	return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t setCount) {
+	// Size each descriptor type relative to the number of sets the pool can hold
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const auto& poolRatio : poolRatios) {
+		VkDescriptorPoolSize poolSize = { };
+		poolSize.type = poolRatio.type;
+		poolSize.descriptorCount = std::max(1u, static_cast<uint32_t>(poolRatio.ratio * setCount));
+		poolSizes.push_back(poolSize);
+	}
+
+	VkDescriptorPoolCreateInfo poolCreateInfo = { };
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolCreateInfo.flags = poolFlags;
+	poolCreateInfo.maxSets = setCount;
+	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolCreateInfo.pPoolSizes = poolSizes.data();
+
+	VkDescriptorPool pool;
+	VkResult result = vkCreateDescriptorPool(device, &poolCreateInfo, nullptr, &pool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Pool!");
+	}
+
+	return pool;
+}
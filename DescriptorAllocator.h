@@ -0,0 +1,45 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <stdexcept>
+
+// How many descriptors of a type to reserve per descriptor set in each pool
+struct DescriptorPoolRatio {
+	VkDescriptorType type;
+	float ratio;
+};
+
+// Hands out descriptor sets from a chain of pools. When the current pool runs out a new (larger) one is created,
+// so callers never have to size pools up front. resetPools() returns every set at once (used for per-frame pools)
+class DescriptorAllocator {
+public:
+	DescriptorAllocator();
+
+	void init(VkDevice newDevice, uint32_t initialSetsPerPool, const std::vector<DescriptorPoolRatio>& newPoolRatios, VkDescriptorPoolCreateFlags newPoolFlags = 0);
+
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	void resetPools();
+	void destroyPools();
+
+	size_t getPoolCount();
+
+	~DescriptorAllocator();
+
+private:
+	VkDevice device;
+
+	uint32_t setsPerPool;
+	VkDescriptorPoolCreateFlags poolFlags;
+	std::vector<DescriptorPoolRatio> poolRatios;
+
+	VkDescriptorPool currentPool;
+	std::vector<VkDescriptorPool> usedPools;		// Pools that have handed out sets since the last reset
+	std::vector<VkDescriptorPool> freePools;		// Reset pools ready to be reused
+
+	VkDescriptorPool grabPool();
+	VkDescriptorPool createPool(uint32_t setCount);
+};
@@ -0,0 +1,86 @@
+#include "DrawSort.h"
+
+#include <cstring>
+#include <algorithm>
+
+uint64_t makeDrawKey(uint32_t pipeline, uint32_t material, uint32_t geometry, float normalizedDepth) {
+	const uint64_t depthMax = (1ull << DRAW_KEY_DEPTH_BITS) - 1;
+
+	// Clamp depth into [0, 1] and quantize, nearer objects get smaller keys so they are drawn first (better early-Z rejection)
+	float clampedDepth = std::min(std::max(normalizedDepth, 0.0f), 1.0f);
+	uint64_t depth = static_cast<uint64_t>(clampedDepth * depthMax);
+
+	uint64_t key = 0;
+	key |= (static_cast<uint64_t>(pipeline) & ((1ull << DRAW_KEY_PIPELINE_BITS) - 1)) << (DRAW_KEY_MATERIAL_BITS + DRAW_KEY_DEPTH_BITS + DRAW_KEY_GEOMETRY_BITS);
+	key |= (static_cast<uint64_t>(material) & ((1ull << DRAW_KEY_MATERIAL_BITS) - 1)) << (DRAW_KEY_DEPTH_BITS + DRAW_KEY_GEOMETRY_BITS);
+	key |= depth << DRAW_KEY_GEOMETRY_BITS;
+	key |= static_cast<uint64_t>(geometry) & ((1ull << DRAW_KEY_GEOMETRY_BITS) - 1);
+
+	return key;
+}
+
+void radixSortDrawKeys(uint64_t* keys, uint32_t* values, uint64_t* tempKeys, uint32_t* tempValues, size_t count) {
+	if (count < 2) {
+		return;
+	}
+
+	// Build the histogram for all 8 bytes in a single read of the keys
+	size_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+
+	for (size_t i = 0; i < count; i++) {
+		uint64_t key = keys[i];
+		for (int pass = 0; pass < 8; pass++) {
+			histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	uint64_t* srcKeys = keys;
+	uint32_t* srcValues = values;
+	uint64_t* dstKeys = tempKeys;
+	uint32_t* dstValues = tempValues;
+
+	for (int pass = 0; pass < 8; pass++) {
+		size_t* histogram = histograms[pass];
+
+		// Every key has the same value in this byte, order wouldn't change so skip the pass
+		if (histogram[(srcKeys[0] >> (pass * 8)) & 0xFF] == count) {
+			continue;
+		}
+
+		// Turn counts into starting offsets (exclusive prefix sum)
+		size_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++) {
+			size_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		// Scatter into buckets (stable, so earlier passes' ordering is kept within a bucket)
+		for (size_t i = 0; i < count; i++) {
+			size_t destination = histogram[(srcKeys[i] >> (pass * 8)) & 0xFF]++;
+			dstKeys[destination] = srcKeys[i];
+			dstValues[destination] = srcValues[i];
+		}
+
+		std::swap(srcKeys, dstKeys);
+		std::swap(srcValues, dstValues);
+	}
+
+	// Odd number of passes leaves the result in the temp arrays
+	if (srcKeys != keys) {
+		memcpy(keys, srcKeys, sizeof(uint64_t) * count);
+		memcpy(values, srcValues, sizeof(uint32_t) * count);
+	}
+}
+
+void radixSortDrawKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& tempKeys, std::vector<uint32_t>& tempValues) {
+	if (tempKeys.size() < keys.size()) {
+		tempKeys.resize(keys.size());
+	}
+	if (tempValues.size() < values.size()) {
+		tempValues.resize(values.size());
+	}
+
+	radixSortDrawKeys(keys.data(), values.data(), tempKeys.data(), tempValues.data(), keys.size());
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Layout of a 64-bit draw key, most significant field first so sorting by key groups draws by the most expensive state change:
+// | pipeline (4) | material / texture (16) | quantized front-to-back depth (24) | geometry buffer (20) |
+// Depth goes above geometry because every mesh has its own buffers, so geometry would never tie and depth never count.
+// Geometry only groups draws of the same material at the same quantized depth
+const int DRAW_KEY_PIPELINE_BITS = 4;
+const int DRAW_KEY_MATERIAL_BITS = 16;
+const int DRAW_KEY_GEOMETRY_BITS = 20;
+const int DRAW_KEY_DEPTH_BITS = 24;
+
+uint64_t makeDrawKey(uint32_t pipeline, uint32_t material, uint32_t geometry, float normalizedDepth);
+
+// LSD radix sort (8 bits per pass) of keys with a 32-bit payload. Passes where every key has the same byte are skipped.
+// Sorted result is left in keys / values, temp arrays must hold at least count elements
+void radixSortDrawKeys(uint64_t* keys, uint32_t* values, uint64_t* tempKeys, uint32_t* tempValues, size_t count);
+
+// Convenience wrapper that sizes the temp arrays itself (they are kept by the caller so they are only allocated once)
+void radixSortDrawKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& tempKeys, std::vector<uint32_t>& tempValues);
@@ -0,0 +1,80 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Share of the target aimed for, leaving room for noise in the timings
+static const double TARGET_HEADROOM = 0.9;
+// Smoothing of the cost per area for samples more / less expensive than the current estimate
+static const double COST_RISE_RATE = 0.5;
+static const double COST_FALL_RATE = 0.05;
+// Smaller changes than this are ignored unless the pass is over its target, so the scale doesn't jitter
+static const float SCALE_DEADBAND = 0.02f;
+// Most the scale goes up by per sample (it goes down as far as it needs to straight away)
+static const float MAX_SCALE_INCREASE = 0.05f;
+
+DynamicResolution::DynamicResolution() {
+	targetMs = 0.0;
+	minScale = DEFAULT_MIN_RESOLUTION_SCALE;
+	maxScale = 1.0f;
+	scale = 1.0f;
+	costPerArea = 0.0;
+	changeCount = 0;
+}
+
+void DynamicResolution::setTarget(double newTargetMs, float newMinScale, float newMaxScale) {
+	targetMs = newTargetMs;
+	maxScale = std::min(std::max(newMaxScale, 0.01f), 1.0f);
+	minScale = std::min(std::max(newMinScale, 0.01f), maxScale);
+	reset();
+}
+
+bool DynamicResolution::isEnabled() {
+	return targetMs > 0.0;
+}
+
+double DynamicResolution::getTargetMs() {
+	return targetMs;
+}
+
+void DynamicResolution::addSample(double sceneMs, float usedScale) {
+	if (!isEnabled() || sceneMs <= 0.0 || usedScale <= 0.0f) {
+		return;
+	}
+
+	// Pass time is mostly per pixel work, so take it to scale with the area
+	double sampleCost = sceneMs / (static_cast<double>(usedScale) * usedScale);
+	if (costPerArea <= 0.0) {
+		costPerArea = sampleCost;
+	} else {
+		double rate = sampleCost > costPerArea ? COST_RISE_RATE : COST_FALL_RATE;
+		costPerArea += (sampleCost - costPerArea) * rate;
+	}
+
+	float desired = static_cast<float>(std::sqrt(targetMs * TARGET_HEADROOM / costPerArea));
+	desired = std::min(std::max(desired, minScale), std::min(scale + MAX_SCALE_INCREASE, maxScale));
+
+	bool overTarget = sceneMs > targetMs && desired < scale;
+	if (!overTarget && std::abs(desired - scale) < SCALE_DEADBAND && desired != minScale && desired != maxScale) {
+		return;
+	}
+
+	if (desired != scale) {
+		scale = desired;
+		changeCount++;
+	}
+}
+
+float DynamicResolution::getScale() {
+	return isEnabled() ? scale : maxScale;
+}
+
+size_t DynamicResolution::getChangeCount() {
+	return changeCount;
+}
+
+void DynamicResolution::reset() {
+	scale = maxScale;
+	costPerArea = 0.0;
+	changeCount = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Smallest resolution scale the controller goes down to unless told otherwise
+const float DEFAULT_MIN_RESOLUTION_SCALE = 0.5f;
+
+// Picks the resolution scale of the scene pass from its GPU time, so the pass holds a target time instead of dropping
+// frames when the load spikes. Pass time is modelled as cost per unit of area (scale squared), which is smoothed: a
+// more expensive sample is taken up quickly, a cheaper one slowly, so the scale drops straight away and creeps back up.
+// Bookkeeping only, the renderer feeds it timings and sizes the viewport with the scale it hands back
+class DynamicResolution {
+public:
+	DynamicResolution();
+
+	// targetMs: GPU time the scene pass should take (<= 0 turns scaling off, the scale then stays at maxScale)
+	void setTarget(double newTargetMs, float newMinScale = DEFAULT_MIN_RESOLUTION_SCALE, float newMaxScale = 1.0f);
+	bool isEnabled();
+	double getTargetMs();
+
+	// sceneMs: GPU time of a scene pass rendered at usedScale (timings are read back frames late, so that's rarely the
+	// current scale)
+	void addSample(double sceneMs, float usedScale);
+
+	// Scale (of both width and height) to render the next frame at, between minScale and maxScale
+	float getScale();
+	size_t getChangeCount();				// Times the scale has changed
+
+	void reset();
+
+private:
+	double targetMs;
+	float minScale;
+	float maxScale;
+
+	float scale;
+	double costPerArea;						// Smoothed ms per unit of scale squared (0 = no samples yet)
+	size_t changeCount;
+};
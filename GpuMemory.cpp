@@ -0,0 +1,196 @@
+#include "GpuMemory.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <iostream>
+#include <iomanip>
+
+// Warn once a heap passes this share of its budget
+static const double MEMORY_WARNING_FRACTION = 0.9;
+// Without VK_EXT_memory_budget the whole heap can't be assumed free for this process, treat this share of it as the budget
+static const double MEMORY_BUDGET_FRACTION_WITHOUT_EXTENSION = 0.8;
+
+struct TrackedAllocation {
+	VkDeviceSize size;
+	uint32_t heapIndex;
+	MemoryCategory category;
+};
+
+static std::mutex memoryMutex;
+static VkPhysicalDevice memoryPhysicalDevice = nullptr;
+static bool memoryBudgetExtension = false;
+static VkPhysicalDeviceMemoryProperties memoryProperties = { };
+
+static std::unordered_map<VkDeviceMemory, TrackedAllocation> trackedAllocations;
+static VkDeviceSize categoryBytes[static_cast<size_t>(MemoryCategory::Count)] = { };
+static uint32_t categoryAllocations[static_cast<size_t>(MemoryCategory::Count)] = { };
+static VkDeviceSize heapBytes[VK_MAX_MEMORY_HEAPS] = { };
+static int heapWarningLevel[VK_MAX_MEMORY_HEAPS] = { };		// 0 = fine, 1 = close to budget, 2 = over budget
+
+static double toMiB(VkDeviceSize bytes) {
+	return bytes / (1024.0 * 1024.0);
+}
+
+// Budget and usage of every heap. Call with memoryMutex held
+static void queryHeapBudgets(VkDeviceSize* budgets, VkDeviceSize* usages) {
+	if (memoryBudgetExtension) {
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = { };
+		budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2 properties = { };
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		properties.pNext = &budgetProperties;
+
+		vkGetPhysicalDeviceMemoryProperties2(memoryPhysicalDevice, &properties);
+
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			budgets[i] = budgetProperties.heapBudget[i];
+			usages[i] = budgetProperties.heapUsage[i];
+		}
+	} else {
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			budgets[i] = static_cast<VkDeviceSize>(memoryProperties.memoryHeaps[i].size * MEMORY_BUDGET_FRACTION_WITHOUT_EXTENSION);
+			usages[i] = heapBytes[i];
+		}
+	}
+}
+
+const char* getMemoryCategoryName(MemoryCategory category) {
+	switch (category) {
+	case MemoryCategory::Texture:		return "Texture";
+	case MemoryCategory::Geometry:		return "Geometry";
+	case MemoryCategory::Attachment:	return "Attachment";
+	case MemoryCategory::Uniform:		return "Uniform";
+	case MemoryCategory::Staging:		return "Staging";
+	default:							return "Unknown";
+	}
+}
+
+void GpuMemoryTracker::init(VkPhysicalDevice physicalDevice, bool budgetExtension) {
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	memoryPhysicalDevice = physicalDevice;
+	memoryBudgetExtension = budgetExtension;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+VkResult GpuMemoryTracker::allocate(VkDevice device, const VkMemoryAllocateInfo* allocateInfo, MemoryCategory category, VkDeviceMemory* memory) {
+	uint32_t heapIndex = 0;
+	if (allocateInfo->memoryTypeIndex < memoryProperties.memoryTypeCount) {
+		heapIndex = memoryProperties.memoryTypes[allocateInfo->memoryTypeIndex].heapIndex;
+	}
+
+	// Check the heap has room before allocating, so the warning comes before the budget is actually exceeded
+	{
+		std::lock_guard<std::mutex> lock(memoryMutex);
+
+		if (memoryProperties.memoryHeapCount > 0) {
+			VkDeviceSize budgets[VK_MAX_MEMORY_HEAPS] = { };
+			VkDeviceSize usages[VK_MAX_MEMORY_HEAPS] = { };
+			queryHeapBudgets(budgets, usages);
+
+			VkDeviceSize projected = usages[heapIndex] + allocateInfo->allocationSize;
+			int level = projected > budgets[heapIndex] ? 2 : (projected > budgets[heapIndex] * MEMORY_WARNING_FRACTION ? 1 : 0);
+
+			// Only warn when things get worse, not on every allocation
+			if (level > heapWarningLevel[heapIndex]) {
+				std::cout << "Warning: " << getMemoryCategoryName(category) << " allocation of " << toMiB(allocateInfo->allocationSize) << " MiB takes heap " << heapIndex
+					<< (level == 2 ? " over" : " close to") << " its budget (" << toMiB(projected) << " / " << toMiB(budgets[heapIndex]) << " MiB)\n";
+			}
+			heapWarningLevel[heapIndex] = level;
+		}
+	}
+
+	VkResult result = vkAllocateMemory(device, allocateInfo, nullptr, memory);
+	if (result != VK_SUCCESS) {
+		std::cout << "Warning: " << getMemoryCategoryName(category) << " allocation of " << toMiB(allocateInfo->allocationSize) << " MiB failed (heap " << heapIndex << ")\n";
+		return result;
+	}
+
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	TrackedAllocation allocation = { allocateInfo->allocationSize, heapIndex, category };
+	trackedAllocations[*memory] = allocation;
+
+	categoryBytes[static_cast<size_t>(category)] += allocation.size;
+	categoryAllocations[static_cast<size_t>(category)]++;
+	heapBytes[heapIndex] += allocation.size;
+
+	return result;
+}
+
+void GpuMemoryTracker::free(VkDevice device, VkDeviceMemory memory) {
+	if (memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	vkFreeMemory(device, memory, nullptr);
+
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	auto it = trackedAllocations.find(memory);
+	if (it == trackedAllocations.end()) {
+		return;
+	}
+
+	categoryBytes[static_cast<size_t>(it->second.category)] -= it->second.size;
+	categoryAllocations[static_cast<size_t>(it->second.category)]--;
+	heapBytes[it->second.heapIndex] -= it->second.size;
+
+	trackedAllocations.erase(it);
+}
+
+VkDeviceSize GpuMemoryTracker::getCategoryUsage(MemoryCategory category) {
+	std::lock_guard<std::mutex> lock(memoryMutex);
+	return categoryBytes[static_cast<size_t>(category)];
+}
+
+uint32_t GpuMemoryTracker::getCategoryAllocationCount(MemoryCategory category) {
+	std::lock_guard<std::mutex> lock(memoryMutex);
+	return categoryAllocations[static_cast<size_t>(category)];
+}
+
+std::vector<MemoryHeapUsage> GpuMemoryTracker::getHeapUsage() {
+	std::lock_guard<std::mutex> lock(memoryMutex);
+
+	VkDeviceSize budgets[VK_MAX_MEMORY_HEAPS] = { };
+	VkDeviceSize usages[VK_MAX_MEMORY_HEAPS] = { };
+	queryHeapBudgets(budgets, usages);
+
+	std::vector<MemoryHeapUsage> heaps;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+		MemoryHeapUsage heap = { };
+		heap.size = memoryProperties.memoryHeaps[i].size;
+		heap.budget = budgets[i];
+		heap.usage = usages[i];
+		heap.tracked = heapBytes[i];
+		heap.deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		heap.fromBudgetExtension = memoryBudgetExtension;
+		heaps.push_back(heap);
+	}
+
+	return heaps;
+}
+
+void GpuMemoryTracker::printReport(std::ostream& out) {
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(2);
+
+	out << "GPU memory by category:\n";
+	for (size_t i = 0; i < static_cast<size_t>(MemoryCategory::Count); i++) {
+		MemoryCategory category = static_cast<MemoryCategory>(i);
+		out << "\t" << getMemoryCategoryName(category) << ": " << toMiB(getCategoryUsage(category)) << " MiB in " << getCategoryAllocationCount(category) << " allocations\n";
+	}
+
+	out << "GPU memory by heap" << (memoryBudgetExtension ? " (VK_EXT_memory_budget)" : " (no budget extension, budget is 80% of heap)") << ":\n";
+	std::vector<MemoryHeapUsage> heaps = getHeapUsage();
+	for (size_t i = 0; i < heaps.size(); i++) {
+		double percent = heaps[i].budget > 0 ? 100.0 * heaps[i].usage / heaps[i].budget : 0.0;
+		out << "\tHeap " << i << (heaps[i].deviceLocal ? " (device local)" : " (host)") << ": " << toMiB(heaps[i].usage) << " / " << toMiB(heaps[i].budget) << " MiB budget ("
+			<< percent << "%), " << toMiB(heaps[i].tracked) << " MiB tracked, heap size " << toMiB(heaps[i].size) << " MiB\n";
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
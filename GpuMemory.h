@@ -0,0 +1,45 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <ostream>
+
+// What a device memory allocation is used for
+enum class MemoryCategory : uint32_t {
+	Texture,
+	Geometry,
+	Attachment,
+	Uniform,			// Per-frame shader data (uniform and object buffers)
+	Staging,
+	Count
+};
+
+const char* getMemoryCategoryName(MemoryCategory category);
+
+struct MemoryHeapUsage {
+	VkDeviceSize size;				// Total size of the heap
+	VkDeviceSize budget;			// How much this process can use (VK_EXT_memory_budget, else a share of the heap size)
+	VkDeviceSize usage;				// Used by this process as reported by the driver (tracked bytes without the extension)
+	VkDeviceSize tracked;			// Allocated through the tracker
+	bool deviceLocal;
+	bool fromBudgetExtension;
+};
+
+// Accounting for every device memory allocation. All vkAllocateMemory / vkFreeMemory calls go through allocate / free,
+// which keep live bytes per category and per heap and warn when a heap gets close to its budget
+class GpuMemoryTracker {
+public:
+	// budgetExtension: VK_EXT_memory_budget is enabled on the device
+	static void init(VkPhysicalDevice physicalDevice, bool budgetExtension);
+
+	static VkResult allocate(VkDevice device, const VkMemoryAllocateInfo* allocateInfo, MemoryCategory category, VkDeviceMemory* memory);
+	static void free(VkDevice device, VkDeviceMemory memory);
+
+	static VkDeviceSize getCategoryUsage(MemoryCategory category);
+	static uint32_t getCategoryAllocationCount(MemoryCategory category);
+	static std::vector<MemoryHeapUsage> getHeapUsage();
+
+	static void printReport(std::ostream& out);
+};
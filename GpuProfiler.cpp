@@ -0,0 +1,238 @@
+#include "GpuProfiler.h"
+
+#include <fstream>
+#include <iostream>
+
+GpuProfiler::GpuProfiler() {
+	device = nullptr;
+	queryPool = VK_NULL_HANDLE;
+	enabled = false;
+	timestampPeriod = 1.0;
+	timestampMask = ~0ull;
+	frameCount = 0;
+	maxScopesPerFrame = 0;
+	recordingSlot = 0;
+	frameSlot = 0;
+	statisticsWindow = 512;
+}
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamilyIndex, uint32_t newFrameCount, uint32_t newMaxScopesPerFrame) {
+	device = newDevice;
+	frameCount = newFrameCount;
+	maxScopesPerFrame = newMaxScopesPerFrame;
+
+	// Queue family must support timestamps (timestampValidBits of 0 means it doesn't)
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+	if (validBits == 0) {
+		std::cout << "GPU profiler disabled: queue family has no timestamp support\n";
+		return;
+	}
+	timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+	// One slot per frame in flight + one for immediate (upload) scopes, each slot holds a begin and end query per scope
+	uint32_t slotCount = frameCount + 1;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo = { };
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = slotCount * maxScopesPerFrame * 2;
+
+	VkResult result = vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &queryPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Timestamp Query Pool!");
+	}
+
+	slotScopes.resize(slotCount);
+	enabled = true;
+}
+
+void GpuProfiler::destroy() {
+	if (queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+	enabled = false;
+}
+
+bool GpuProfiler::isEnabled() {
+	return enabled;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	if (!enabled) {
+		return;
+	}
+
+	// The frame's previous submission has completed, so last use of this slot is finished and reading doesn't have to wait
+	readSlot(frameIndex, false);
+	resetSlot(commandBuffer, frameIndex);
+
+	frameSlot = frameIndex;
+	recordingSlot = frameIndex;
+}
+
+int GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const std::string& name) {
+	if (!enabled || slotScopes[recordingSlot].size() >= maxScopesPerFrame) {
+		return -1;
+	}
+
+	PendingScope scope = { };
+	scope.scopeId = getScopeId(name);
+	scope.firstQuery = (recordingSlot * maxScopesPerFrame + static_cast<uint32_t>(slotScopes[recordingSlot].size())) * 2;
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, scope.firstQuery);
+
+	slotScopes[recordingSlot].push_back(scope);
+
+	return static_cast<int>(slotScopes[recordingSlot].size()) - 1;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, int scope) {
+	if (!enabled || scope < 0) {
+		return;
+	}
+
+	// Bottom of pipe: timestamp is written once all earlier work in the command buffer has finished
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, slotScopes[recordingSlot][scope].firstQuery + 1);
+}
+
+void GpuProfiler::beginImmediate(VkCommandBuffer commandBuffer) {
+	if (!enabled) {
+		return;
+	}
+
+	recordingSlot = frameCount;
+	resetSlot(commandBuffer, recordingSlot);
+}
+
+void GpuProfiler::endImmediate() {
+	recordingSlot = frameSlot;
+}
+
+void GpuProfiler::resolveImmediate() {
+	if (!enabled) {
+		return;
+	}
+
+	readSlot(frameCount, true);
+}
+
+std::vector<GpuScopeTiming> GpuProfiler::getTimings() {
+	std::vector<GpuScopeTiming> timings;
+
+	for (size_t i = 0; i < scopeNames.size(); i++) {
+		GpuScopeTiming timing = { };
+		timing.name = scopeNames[i];
+		timing.samples = scopeStats[i].getSampleCount();
+		timing.lastMs = scopeLastMs[i];
+		timing.minMs = scopeStats[i].getMin();
+		timing.avgMs = scopeStats[i].getAverage();
+		timing.p50Ms = scopeStats[i].getPercentile(50.0);
+		timing.p95Ms = scopeStats[i].getPercentile(95.0);
+		timing.p99Ms = scopeStats[i].getPercentile(99.0);
+		timing.maxMs = scopeStats[i].getMax();
+		timings.push_back(timing);
+	}
+
+	return timings;
+}
+
+bool GpuProfiler::takeLatestMs(const std::string& name, double* milliseconds) {
+	auto it = scopeIds.find(name);
+	if (it == scopeIds.end() || scopeLastTaken[it->second]) {
+		return false;
+	}
+
+	scopeLastTaken[it->second] = true;
+	*milliseconds = scopeLastMs[it->second];
+	return true;
+}
+
+void GpuProfiler::resetStatistics(size_t windowSize) {
+	statisticsWindow = windowSize;
+	for (auto& stats : scopeStats) {
+		stats = RollingStatistics(statisticsWindow);
+	}
+}
+
+void GpuProfiler::writeCsv(const std::string& fileName) {
+	if (scopeNames.empty()) {
+		return;
+	}
+
+	std::ofstream file(fileName);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + fileName + " for writing!");
+	}
+
+	file << "scope,samples,last_ms,min_ms,avg_ms,p99_ms,max_ms\n";
+	for (const auto& timing : getTimings()) {
+		file << timing.name << ',' << timing.samples << ',' << timing.lastMs << ',' << timing.minMs << ',' << timing.avgMs << ',' << timing.p99Ms << ',' << timing.maxMs << '\n';
+	}
+}
+
+GpuProfiler::~GpuProfiler() {
+}
+
+uint32_t GpuProfiler::getScopeId(const std::string& name) {
+	auto it = scopeIds.find(name);
+	if (it != scopeIds.end()) {
+		return it->second;
+	}
+
+	uint32_t scopeId = static_cast<uint32_t>(scopeNames.size());
+	scopeIds[name] = scopeId;
+	scopeNames.push_back(name);
+	scopeStats.push_back(RollingStatistics(statisticsWindow));
+	scopeLastMs.push_back(0.0);
+	scopeLastTaken.push_back(true);
+
+	return scopeId;
+}
+
+void GpuProfiler::resetSlot(VkCommandBuffer commandBuffer, uint32_t slot) {
+	// Queries have to be reset before they can be written again
+	vkCmdResetQueryPool(commandBuffer, queryPool, slot * maxScopesPerFrame * 2, maxScopesPerFrame * 2);
+	slotScopes[slot].clear();
+}
+
+void GpuProfiler::readSlot(uint32_t slot, bool wait) {
+	std::vector<PendingScope>& scopes = slotScopes[slot];
+	if (scopes.empty()) {
+		return;
+	}
+
+	// Scopes were written in order, so their queries are contiguous from the start of the slot
+	uint32_t firstQuery = slot * maxScopesPerFrame * 2;
+	uint32_t queryCount = static_cast<uint32_t>(scopes.size()) * 2;
+	std::vector<uint64_t> timestamps(queryCount);
+
+	VkQueryResultFlags resultFlags = VK_QUERY_RESULT_64_BIT | (wait ? VK_QUERY_RESULT_WAIT_BIT : 0);
+	VkResult result = vkGetQueryPoolResults(device, queryPool, firstQuery, queryCount, sizeof(uint64_t) * queryCount, timestamps.data(), sizeof(uint64_t), resultFlags);
+
+	// Not ready yet (shouldn't happen once the submission has completed), drop this frame's samples rather than stall
+	if (result != VK_SUCCESS) {
+		scopes.clear();
+		return;
+	}
+
+	for (size_t i = 0; i < scopes.size(); i++) {
+		uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestampMask;
+		double milliseconds = ticks * timestampPeriod / 1000000.0;
+
+		scopeStats[scopes[i].scopeId].addSample(milliseconds);
+		scopeLastMs[scopes[i].scopeId] = milliseconds;
+		scopeLastTaken[scopes[i].scopeId] = false;
+	}
+
+	scopes.clear();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+#include <map>
+#include <stdexcept>
+
+#include "Statistics.h"
+
+// Rolling GPU time of one named scope, in milliseconds
+struct GpuScopeTiming {
+	std::string name;
+	size_t samples;
+	double lastMs;
+	double minMs;
+	double avgMs;
+	double p50Ms;
+	double p95Ms;
+	double p99Ms;
+	double maxMs;
+};
+
+// Timestamp query based GPU profiler. Scopes written into a frame's command buffer are read back the next time that
+// frame slot comes round (its previous submission has completed by then), so reading results never stalls the CPU
+class GpuProfiler {
+public:
+	GpuProfiler();
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamilyIndex, uint32_t newFrameCount, uint32_t newMaxScopesPerFrame = 32);
+	void destroy();
+
+	// False if the queue can't write timestamps, every call is then a no-op
+	bool isEnabled();
+
+	// Call right after beginning the frame's command buffer (outside a render pass). Collects the results recorded the
+	// last time this frame slot was used, then resets its queries
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+	// Returns a handle for endScope (-1 if the scope couldn't be recorded)
+	int beginScope(VkCommandBuffer commandBuffer, const std::string& name);
+	void endScope(VkCommandBuffer commandBuffer, int scope);
+
+	// Scopes in one-off command buffers (uploads) use their own queries. Record scopes between beginImmediate / endImmediate,
+	// then call resolveImmediate once the submission is known to have finished
+	void beginImmediate(VkCommandBuffer commandBuffer);
+	void endImmediate();
+	void resolveImmediate();
+
+	std::vector<GpuScopeTiming> getTimings();
+	// Latest time of the named scope, false if none has been read back since the last call for it
+	bool takeLatestMs(const std::string& name, double* milliseconds);
+	// Drop all samples so far and keep up to windowSize samples per scope from now on
+	void resetStatistics(size_t windowSize);
+	void writeCsv(const std::string& fileName);
+
+	~GpuProfiler();
+
+private:
+	VkDevice device;
+	VkQueryPool queryPool;
+
+	bool enabled;
+	double timestampPeriod;				// Nanoseconds per timestamp tick
+	uint64_t timestampMask;				// Only timestampValidBits of each value are meaningful
+
+	uint32_t frameCount;
+	uint32_t maxScopesPerFrame;
+
+	// Queries are split into slots of maxScopesPerFrame * 2, one per frame in flight plus one for immediate scopes
+	struct PendingScope {
+		uint32_t scopeId;
+		uint32_t firstQuery;
+	};
+	std::vector<std::vector<PendingScope>> slotScopes;		// Scopes written into each slot since it was last reset
+	uint32_t recordingSlot;
+	uint32_t frameSlot;					// Slot of the frame being recorded (restored by endImmediate)
+
+	std::vector<std::string> scopeNames;
+	std::vector<RollingStatistics> scopeStats;
+	size_t statisticsWindow;
+	std::vector<double> scopeLastMs;
+	std::vector<bool> scopeLastTaken;	// scopeLastMs has been handed out by takeLatestMs
+	std::map<std::string, uint32_t> scopeIds;
+
+	uint32_t getScopeId(const std::string& name);
+	void resetSlot(VkCommandBuffer commandBuffer, uint32_t slot);
+	void readSlot(uint32_t slot, bool wait);
+};
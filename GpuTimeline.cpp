@@ -0,0 +1,175 @@
+#include "GpuTimeline.h"
+
+#include <limits>
+#include <algorithm>
+
+GpuTimeline::GpuTimeline() {
+	device = nullptr;
+	queue = nullptr;
+	timelineSemaphore = false;
+	semaphore = VK_NULL_HANDLE;
+	getSemaphoreCounterValue = nullptr;
+	waitSemaphores = nullptr;
+	lastSubmittedValue = 0;
+	completedValue = 0;
+}
+
+void GpuTimeline::init(VkDevice newDevice, VkQueue newQueue, bool timelineSemaphores) {
+	device = newDevice;
+	queue = newQueue;
+	timelineSemaphore = timelineSemaphores;
+
+	if (!timelineSemaphore) {
+		return;
+	}
+
+	// Extension functions aren't exported by the loader, fetch them from the device
+	getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+	waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+	if (getSemaphoreCounterValue == nullptr || waitSemaphores == nullptr) {
+		throw std::runtime_error("Failed to load the Timeline Semaphore functions!");
+	}
+
+	VkSemaphoreTypeCreateInfoKHR typeCreateInfo = { };
+	typeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	typeCreateInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = { };
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreCreateInfo.pNext = &typeCreateInfo;
+
+	VkResult result = vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphore);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Timeline Semaphore!");
+	}
+}
+
+void GpuTimeline::destroy() {
+	if (semaphore != VK_NULL_HANDLE) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+		semaphore = VK_NULL_HANDLE;
+	}
+
+	for (const auto& pending : pendingFences) {
+		vkDestroyFence(device, pending.fence, nullptr);
+	}
+	pendingFences.clear();
+
+	for (VkFence fence : freeFences) {
+		vkDestroyFence(device, fence, nullptr);
+	}
+	freeFences.clear();
+}
+
+VkResult GpuTimeline::submit(const VkSubmitInfo& submitInfo, uint64_t* signalValue) {
+	uint64_t value = lastSubmittedValue + 1;
+	VkResult result;
+
+	if (timelineSemaphore) {
+		// Timeline semaphore goes after the submission's own (binary) signal semaphores, whose values are ignored
+		std::vector<VkSemaphore> signalSemaphores(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+		signalSemaphores.push_back(semaphore);
+		std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+		signalValues.back() = value;
+
+		VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = { };
+		timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineSubmitInfo.pNext = submitInfo.pNext;
+		timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+		timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+		VkSubmitInfo timelineSubmit = submitInfo;
+		timelineSubmit.pNext = &timelineSubmitInfo;
+		timelineSubmit.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		timelineSubmit.pSignalSemaphores = signalSemaphores.data();
+
+		result = vkQueueSubmit(queue, 1, &timelineSubmit, VK_NULL_HANDLE);
+	} else {
+		VkFence fence;
+		if (!freeFences.empty()) {
+			fence = freeFences.back();
+			freeFences.pop_back();
+		} else {
+			VkFenceCreateInfo fenceCreateInfo = { };
+			fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			result = vkCreateFence(device, &fenceCreateInfo, nullptr, &fence);
+			if (result != VK_SUCCESS) {
+				return result;
+			}
+		}
+
+		result = vkQueueSubmit(queue, 1, &submitInfo, fence);
+		if (result == VK_SUCCESS) {
+			pendingFences.push_back({ value, fence });
+		} else {
+			freeFences.push_back(fence);
+		}
+	}
+
+	if (result == VK_SUCCESS) {
+		lastSubmittedValue = value;
+		*signalValue = value;
+	}
+	return result;
+}
+
+uint64_t GpuTimeline::getLastSubmittedValue() {
+	return lastSubmittedValue;
+}
+
+uint64_t GpuTimeline::getCompletedValue() {
+	if (timelineSemaphore) {
+		uint64_t value = 0;
+		getSemaphoreCounterValue(device, semaphore, &value);
+		completedValue = std::max(completedValue, value);
+		return completedValue;
+	}
+
+	// Submissions complete in order, so stop at the first fence that hasn't signalled
+	while (!pendingFences.empty() && vkGetFenceStatus(device, pendingFences.front().fence) == VK_SUCCESS) {
+		completedValue = pendingFences.front().value;
+		vkResetFences(device, 1, &pendingFences.front().fence);
+		freeFences.push_back(pendingFences.front().fence);
+		pendingFences.pop_front();
+	}
+	return completedValue;
+}
+
+bool GpuTimeline::isComplete(uint64_t value) {
+	return value <= completedValue || value <= getCompletedValue();
+}
+
+void GpuTimeline::wait(uint64_t value) {
+	if (isComplete(value)) {
+		return;
+	}
+
+	if (timelineSemaphore) {
+		VkSemaphoreWaitInfoKHR waitInfo = { };
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+		waitSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max());
+	} else {
+		// Every submission up to the one that signals value
+		std::vector<VkFence> fences;
+		for (const auto& pending : pendingFences) {
+			fences.push_back(pending.fence);
+			if (pending.value >= value) {
+				break;
+			}
+		}
+		vkWaitForFences(device, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+
+	getCompletedValue();
+}
+
+bool GpuTimeline::usesTimelineSemaphore() {
+	return timelineSemaphore;
+}
+
+GpuTimeline::~GpuTimeline() {
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <deque>
+#include <stdexcept>
+
+// GPU progress on one queue as a single increasing value. Every submission made through submit() signals the next value
+// when it completes, so "is this work done" for anything (a frame, an upload, a resource's last use) is just a comparison
+// with the value the GPU has reached, with no fence per piece of work to create, reset and track. Uses a timeline
+// semaphore (VK_KHR_timeline_semaphore, core in Vulkan 1.2) when the device has one, otherwise a fence per submission
+// stands in for each value
+class GpuTimeline {
+public:
+	GpuTimeline();
+
+	// timelineSemaphores: VK_KHR_timeline_semaphore and its feature are enabled on the device
+	void init(VkDevice newDevice, VkQueue newQueue, bool timelineSemaphores);
+	// Device must be idle
+	void destroy();
+
+	// Submits to the queue, also signalling the next value once the work completes (written to signalValue)
+	VkResult submit(const VkSubmitInfo& submitInfo, uint64_t* signalValue);
+
+	// Value of the latest submission, anything already submitted is finished once the GPU reaches it
+	uint64_t getLastSubmittedValue();
+	// Value the GPU has reached, every submission up to it has completed
+	uint64_t getCompletedValue();
+	bool isComplete(uint64_t value);
+	// Blocks until the GPU reaches value
+	void wait(uint64_t value);
+
+	bool usesTimelineSemaphore();
+
+	~GpuTimeline();
+
+private:
+	VkDevice device;
+	VkQueue queue;
+
+	bool timelineSemaphore;
+	VkSemaphore semaphore;
+	PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+	PFN_vkWaitSemaphoresKHR waitSemaphores;
+
+	uint64_t lastSubmittedValue;
+	uint64_t completedValue;					// Last value seen complete
+
+	// Without timeline semaphores: fence of each submission not yet seen complete, in value order
+	struct PendingFence {
+		uint64_t value;
+		VkFence fence;
+	};
+	std::deque<PendingFence> pendingFences;
+	std::vector<VkFence> freeFences;			// Signalled and reset, ready for another submission
+};
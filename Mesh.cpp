@@ -5,23 +5,38 @@ Mesh::Mesh() : vertexCount(0), indexCount(0) {
 	physicalDevice = nullptr;
 	vertexBuffer = nullptr;
 	vertexBufferMemory = nullptr;
+	positionBuffer = nullptr;
+	positionBufferMemory = nullptr;
 	indexBuffer = nullptr;
 	indexBufferMemory = nullptr;
 	texId = -1;
+	boundsMin = glm::vec3(0.0f);
+	boundsMax = glm::vec3(0.0f);
 
 	model.model = glm::mat4(1.0f);
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int newTexId) {
-	vertexCount = (int)vertices->size();
-	indexCount = (int)indices->size();
+Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, UploadQueue& uploadQueue, std::vector<Vertex> vertices, std::vector<uint32_t> indices, int newTexId) {
+	vertexCount = (int)vertices.size();
+	indexCount = (int)indices.size();
 	physicalDevice = newPhysicalDevice;
 	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
 
 	model.model = glm::mat4(1.0f);
 	texId = newTexId;
+
+	// Bounding box is used to find each draw's distance from the camera when sorting
+	boundsMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+	boundsMax = boundsMin;
+	for (const auto& vertex : vertices) {
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+	}
+
+	// Upload queue keeps the data until it's been staged
+	createPositionBuffer(uploadQueue, vertices);
+	createVertexBuffer(uploadQueue, std::move(vertices));
+	createIndexBuffer(uploadQueue, std::move(indices));
 }
 
 void Mesh::setModel(glm::mat4 newmodel) {
@@ -36,6 +51,22 @@ int Mesh::getTexId() {
 	return texId;
 }
 
+void Mesh::setTexId(int newTexId) {
+	texId = newTexId;
+}
+
+glm::vec3 Mesh::getBoundsMin() {
+	return boundsMin;
+}
+
+glm::vec3 Mesh::getBoundsMax() {
+	return boundsMax;
+}
+
+glm::vec3 Mesh::getBoundsCenter() {
+	return (boundsMin + boundsMax) * 0.5f;
+}
+
 int Mesh::getVertexCount() {
 	return vertexCount;
 }
@@ -48,74 +79,85 @@ VkBuffer Mesh::getVertexBuffer() {
 	return vertexBuffer;
 }
 
+VkBuffer Mesh::getPositionBuffer() {
+	return positionBuffer;
+}
+
 VkBuffer Mesh::getIndexBuffer() {
 	return indexBuffer;
 }
 
+void Mesh::setOccluderGeometry(std::vector<glm::vec3> positions, std::vector<uint32_t> indices) {
+	occluderPositions = std::move(positions);
+	occluderIndices = std::move(indices);
+}
+
+bool Mesh::isOccluder() {
+	return !occluderIndices.empty();
+}
+
+const std::vector<glm::vec3>& Mesh::getOccluderPositions() {
+	return occluderPositions;
+}
+
+const std::vector<uint32_t>& Mesh::getOccluderIndices() {
+	return occluderIndices;
+}
+
 void Mesh::destroyBuffers() {
 	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	GpuMemoryTracker::free(device, vertexBufferMemory);
+	vkDestroyBuffer(device, positionBuffer, nullptr);
+	GpuMemoryTracker::free(device, positionBufferMemory);
 	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	GpuMemoryTracker::free(device, indexBufferMemory);
+}
+
+void Mesh::retireBuffers(DeletionQueue& deletionQueue, uint64_t lastUseValue) {
+	deletionQueue.pushBuffer(vertexBuffer, vertexBufferMemory, lastUseValue);
+	deletionQueue.pushBuffer(positionBuffer, positionBufferMemory, lastUseValue);
+	deletionQueue.pushBuffer(indexBuffer, indexBufferMemory, lastUseValue);
 }
 
 Mesh::~Mesh() {
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices) {
+void Mesh::createVertexBuffer(UploadQueue& uploadQueue, std::vector<Vertex>&& vertices) {
 	// Still gets size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-	// Temporary buffer to "stage" vertex data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	// create staging buffer and allocate memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
-
-	// Map memory to Vertex Buffer
-	void* data;																// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);		// 2. Map the vertex buffer memory to that point
-	memcpy(data, vertices->data(), (size_t)bufferSize);						// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);								// 4. Unmap the vertex buffer memory
+	VkDeviceSize bufferSize = sizeof(Vertex) * vertices.size();
 
 	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also VERTEX_BUFFER)
 	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is only on the GPU
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-
-	// Copy staging buffer to vertex buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
+	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Geometry, &vertexBuffer, &vertexBufferMemory);
 
-	// Clean up Staging Buffer
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// Copy is queued in the open upload batch, the scheduler stages it (possibly over several frames) within its budget
+	uploadQueue.queueBuffer(vertexBuffer, makeUploadData(std::move(vertices)), bufferSize);
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices) {
-	// Still gets size of buffer needed for indices
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
+void Mesh::createPositionBuffer(UploadQueue& uploadQueue, const std::vector<Vertex>& vertices) {
+	// Depth pre-pass only reads positions, so it gets them without the color and UVs in between (12 bytes a vertex
+	// instead of 32)
+	std::vector<glm::vec3> positions;
+	positions.reserve(vertices.size());
+	for (const auto& vertex : vertices) {
+		positions.push_back(vertex.pos);
+	}
 
-	// Temporary buffer to "stage" index data before transferring to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	VkDeviceSize bufferSize = sizeof(glm::vec3) * positions.size();
 
-	// create staging buffer and allocate memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
+	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Geometry, &positionBuffer, &positionBufferMemory);
 
-	// Map memory to Index Buffer
-	void* data;																// 1. Create pointer to a point in normal memory
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);		// 2. Map the vertex buffer memory to that point
-	memcpy(data, indices->data(), (size_t)bufferSize);						// 3. Copy memory from vertices vector to the point
-	vkUnmapMemory(device, stagingBufferMemory);								// 4. Unmap the vertex buffer memory
+	uploadQueue.queueBuffer(positionBuffer, makeUploadData(std::move(positions)), bufferSize);
+}
+
+void Mesh::createIndexBuffer(UploadQueue& uploadQueue, std::vector<uint32_t>&& indices) {
+	// Still gets size of buffer needed for indices
+	VkDeviceSize bufferSize = sizeof(uint32_t) * indices.size();
 
 	// Create buffer with TRANSFER_DST_BIT to mark as recipient of transfer data (also INDEX_BUFFER)
 	// Buffer memory is to be DEVICE_LOCAL_BIT meaning memory is only on the GPU
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
-
-	// Copy staging buffer to index buffer on GPU
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
+	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Geometry, &indexBuffer, &indexBufferMemory);
 
-	// Clean up Staging Buffer
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// Copy is queued in the open upload batch, the scheduler stages it (possibly over several frames) within its budget
+	uploadQueue.queueBuffer(indexBuffer, makeUploadData(std::move(indices)), bufferSize);
 }
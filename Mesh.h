@@ -5,6 +5,8 @@
 
 #include <vector>
 #include "Utilities.h"
+#include "UploadQueue.h"
+#include "DeletionQueue.h"
 
 struct Model {
 	glm::mat4 model;
@@ -13,18 +15,37 @@ struct Model {
 class Mesh {
 public:
 	Mesh();
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, int newTexId);
+	// Takes the vertices and indices and queues their upload in uploadQueue's open batch, the mesh can't be drawn until
+	// that batch completes
+	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, UploadQueue& uploadQueue, std::vector<Vertex> vertices, std::vector<uint32_t> indices, int newTexId);
 
 	void setModel(glm::mat4 newModel);
 	Model getModel();
 	int getTexId();
+	void setTexId(int newTexId);
+
+	// Object space bounding box of the vertices
+	glm::vec3 getBoundsMin();
+	glm::vec3 getBoundsMax();
+	glm::vec3 getBoundsCenter();
 
 	int getVertexCount();
 	int getIndexCount();
 	VkBuffer getVertexBuffer();
+	// Positions only (tightly packed vec3s, same order as the vertex buffer), for passes that don't need the other attributes
+	VkBuffer getPositionBuffer();
 	VkBuffer getIndexBuffer();
 
+	// CPU copy of the triangles (object space positions, indices into them) for the software occlusion culler. Only kept
+	// for meshes picked as occluders
+	void setOccluderGeometry(std::vector<glm::vec3> positions, std::vector<uint32_t> indices);
+	bool isOccluder();
+	const std::vector<glm::vec3>& getOccluderPositions();
+	const std::vector<uint32_t>& getOccluderIndices();
+
 	void destroyBuffers();
+	// Buffers are destroyed once the GPU timeline passes lastUseValue
+	void retireBuffers(DeletionQueue& deletionQueue, uint64_t lastUseValue);
 
 	~Mesh();
 
@@ -33,18 +54,28 @@ private:
 
 	int texId;
 
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
 	int vertexCount;
 	VkBuffer vertexBuffer;
 	VkDeviceMemory vertexBufferMemory;
 
+	VkBuffer positionBuffer;
+	VkDeviceMemory positionBufferMemory;
+
 	int indexCount;
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
 
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<uint32_t> occluderIndices;
+
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
 
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices);
+	void createVertexBuffer(UploadQueue& uploadQueue, std::vector<Vertex>&& vertices);
+	void createPositionBuffer(UploadQueue& uploadQueue, const std::vector<Vertex>& vertices);
+	void createIndexBuffer(UploadQueue& uploadQueue, std::vector<uint32_t>&& indices);
 };
 
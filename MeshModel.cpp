@@ -1,12 +1,37 @@
 #include "MeshModel.h"
 
+#include <algorithm>
+
+// Occluder candidates need to be at least this large next to the model's largest mesh (bounding box diagonals)
+static const float MIN_OCCLUDER_SIZE_FRACTION = 0.25f;
+
 MeshModel::MeshModel() {
 	meshList = { };
+	model = glm::mat4(1.0f);
+	transforms = nullptr;
+	modelTransform = 0;
+	buildPlacements();
+}
+
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, TransformSystem* newTransforms)
+	: MeshModel(newMeshList, { RootNode(newMeshList.size()) }, newTransforms) {
 }
 
-MeshModel::MeshModel(std::vector<Mesh> newMeshList) {
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, std::vector<ModelNode> newNodes, TransformSystem* newTransforms) {
 	meshList = newMeshList;
 	model = glm::mat4(1.0f);
+	nodes = newNodes;
+
+	// Every model starts with a single instance sitting at the model transform
+	transforms = newTransforms;
+	modelTransform = transforms->add(model);
+	addInstance(glm::mat4(1.0f));
+
+	buildPlacements();
+}
+
+bool MeshModel::isLoaded() {
+	return transforms != nullptr;
 }
 
 size_t MeshModel::getMeshCount() {
@@ -27,6 +52,156 @@ glm::mat4 MeshModel::getModel() {
 
 void MeshModel::setModel(glm::mat4 newModel) {
 	model = newModel;
+	transforms->setLocal(modelTransform, model);
+}
+
+int MeshModel::addInstance(glm::mat4 newInstance) {
+	// The instance's own copy of the nodes goes after it, parents first as they are in the node list
+	uint32_t instanceTransform = transforms->add(newInstance, modelTransform);
+	instanceTransforms.push_back(instanceTransform);
+
+	size_t firstNode = nodeTransforms.size();
+	for (const auto& node : nodes) {
+		int parent = node.parent >= 0 ? (int)nodeTransforms[firstNode + node.parent] : (int)instanceTransform;
+		nodeTransforms.push_back(transforms->add(node.transform, parent));
+	}
+
+	buildObjectTransforms();
+
+	return (int)instanceTransforms.size() - 1;
+}
+
+void MeshModel::setInstance(size_t index, glm::mat4 newInstance) {
+	if (index >= instanceTransforms.size()) {
+		throw std::runtime_error("Attempted to access past Instance List bounds.");
+	}
+
+	transforms->setLocal(instanceTransforms[index], newInstance);
+}
+
+size_t MeshModel::getInstanceCount() {
+	return instanceTransforms.size();
+}
+
+size_t MeshModel::getNodeCount() {
+	return nodes.size();
+}
+
+int MeshModel::findNode(const std::string& name) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].name == name) {
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+glm::mat4 MeshModel::getNodeTransform(size_t index) {
+	if (index >= nodes.size()) {
+		throw std::runtime_error("Attempted to access past Node List bounds.");
+	}
+
+	return nodes[index].transform;
+}
+
+void MeshModel::setNodeTransform(size_t index, glm::mat4 newTransform) {
+	if (index >= nodes.size()) {
+		throw std::runtime_error("Attempted to access past Node List bounds.");
+	}
+
+	nodes[index].transform = newTransform;
+
+	// Decomposed once, then every instance's copy of the node gets the same local transform
+	glm::vec3 position, scale;
+	glm::quat rotation;
+	TransformSystem::decompose(newTransform, position, rotation, scale);
+	for (size_t i = 0; i < instanceTransforms.size(); i++) {
+		transforms->setLocal(nodeTransforms[i * nodes.size() + index], position, rotation, scale);
+	}
+}
+
+size_t MeshModel::getPlacementCount() {
+	return placementNodes.size();
+}
+
+uint32_t MeshModel::getPlacementNode(size_t placement) {
+	return placementNodes[placement];
+}
+
+uint32_t MeshModel::getMeshFirstPlacement(size_t meshIndex) {
+	return meshFirstPlacement[meshIndex];
+}
+
+uint32_t MeshModel::getMeshPlacementCount(size_t meshIndex) {
+	return meshFirstPlacement[meshIndex + 1] - meshFirstPlacement[meshIndex];
+}
+
+const std::vector<uint32_t>& MeshModel::getObjectTransforms() {
+	return objectTransforms;
+}
+
+std::vector<uint32_t> MeshModel::getTransformIds() {
+	std::vector<uint32_t> ids;
+	if (transforms == nullptr) {
+		return ids;
+	}
+
+	ids.push_back(modelTransform);
+	ids.insert(ids.end(), instanceTransforms.begin(), instanceTransforms.end());
+	ids.insert(ids.end(), nodeTransforms.begin(), nodeTransforms.end());
+
+	return ids;
+}
+
+void MeshModel::remapTransforms(const std::vector<uint32_t>& remap) {
+	if (transforms == nullptr) {
+		return;
+	}
+
+	modelTransform = remap[modelTransform];
+	for (auto& id : instanceTransforms) {
+		id = remap[id];
+	}
+	for (auto& id : nodeTransforms) {
+		id = remap[id];
+	}
+	for (auto& id : objectTransforms) {
+		id = remap[id];
+	}
+}
+
+void MeshModel::buildPlacements() {
+	// Count the nodes using each mesh, then list them grouped by mesh
+	meshFirstPlacement.assign(meshList.size() + 1, 0);
+	for (const auto& node : nodes) {
+		for (uint32_t mesh : node.meshes) {
+			meshFirstPlacement[mesh + 1]++;
+		}
+	}
+
+	for (size_t i = 1; i < meshFirstPlacement.size(); i++) {
+		meshFirstPlacement[i] += meshFirstPlacement[i - 1];
+	}
+
+	placementNodes.resize(meshFirstPlacement.back());
+	std::vector<uint32_t> nextPlacement(meshFirstPlacement.begin(), meshFirstPlacement.end() - 1);
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		for (uint32_t mesh : nodes[i].meshes) {
+			placementNodes[nextPlacement[mesh]++] = i;
+		}
+	}
+
+	buildObjectTransforms();
+}
+
+void MeshModel::buildObjectTransforms() {
+	objectTransforms.clear();
+	for (uint32_t node : placementNodes) {
+		for (size_t i = 0; i < instanceTransforms.size(); i++) {
+			objectTransforms.push_back(nodeTransforms[i * nodes.size() + node]);
+		}
+	}
 }
 
 void MeshModel::destroyMeshModel() {
@@ -35,6 +210,12 @@ void MeshModel::destroyMeshModel() {
 	}
 }
 
+void MeshModel::retireMeshModel(DeletionQueue& deletionQueue, uint64_t lastUseValue) {
+	for (auto& mesh : meshList) {
+		mesh.retireBuffers(deletionQueue, lastUseValue);
+	}
+}
+
 std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene) {
 	// Create 1:1 sized list of textures
 	std::vector<std::string> textureList(scene->mNumMaterials);
@@ -65,26 +246,70 @@ std::vector<std::string> MeshModel::LoadMaterials(const aiScene* scene) {
 	return textureList;
 }
 
-std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex) {
-	std::vector<Mesh> meshList;
+std::vector<MeshData> MeshModel::LoadMeshes(const aiScene* scene) {
+	// Same indices as the scene's meshes, which is what nodes refer to them by
+	std::vector<MeshData> meshList;
+	for (size_t i = 0; i < scene->mNumMeshes; i++) {
+		meshList.push_back(LoadMesh(scene->mMeshes[i]));
+	}
+
+	// Small meshes hide little however cheap they are, so only the large candidates are kept as occluders
+	float largestSize = 0.0f;
+	for (const auto& meshData : meshList) {
+		largestSize = std::max(largestSize, meshData.size);
+	}
+	for (auto& meshData : meshList) {
+		meshData.occluder = meshData.occluder && meshData.size >= largestSize * MIN_OCCLUDER_SIZE_FRACTION;
+	}
+
+	return meshList;
+}
+
+ModelNode MeshModel::RootNode(size_t meshCount) {
+	ModelNode root = { "", -1, glm::mat4(1.0f), { } };
+	for (uint32_t i = 0; i < meshCount; i++) {
+		root.meshes.push_back(i);
+	}
+
+	return root;
+}
+
+std::vector<ModelNode> MeshModel::LoadNodes(const aiScene* scene) {
+	std::vector<ModelNode> nodes;
+	LoadNode(scene->mRootNode, -1, nodes);
+
+	return nodes;
+}
+
+void MeshModel::LoadNode(aiNode* node, int parent, std::vector<ModelNode>& nodes) {
+	ModelNode newNode;
+	newNode.name = node->mName.C_Str();
+	newNode.parent = parent;
+
+	// Assimp matrices are row major, glm's are column major
+	for (int row = 0; row < 4; row++) {
+		for (int column = 0; column < 4; column++) {
+			newNode.transform[column][row] = node->mTransformation[row][column];
+		}
+	}
 
-	// Go through each mesh at this node and create it, then add it to meshList
 	for (size_t i = 0; i < node->mNumMeshes; i++) {
-		meshList.push_back(LoadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, scene->mMeshes[node->mMeshes[i]], scene, matToTex));
+		newNode.meshes.push_back(node->mMeshes[i]);
 	}
 
-	// Go through each node attached to this node and load it, then append their meshes to this node's mesh list
+	nodes.push_back(newNode);
+	int index = (int)nodes.size() - 1;
+
+	// Children go after their parent
 	for (size_t i = 0; i < node->mNumChildren; i++) {
-		std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
-		meshList.insert(meshList.end(), newList.begin(), newList.end());
+		LoadNode(node->mChildren[i], index, nodes);
 	}
-
-	return meshList;
 }
 
-Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex) {
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+MeshData MeshModel::LoadMesh(aiMesh* mesh) {
+	MeshData meshData;
+	std::vector<Vertex>& vertices = meshData.vertices;
+	std::vector<uint32_t>& indices = meshData.indices;
 
 	// Resize vertex list to hold all vertices for mesh
 	vertices.resize(mesh->mNumVertices);
@@ -116,10 +341,45 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
 		}
 	}
 
-	// Create new mesh with details and return it
-	Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+	meshData.materialIndex = mesh->mMaterialIndex;
+
+	// Occluders are picked by size. Any mesh with few enough triangles to rasterize every frame is a candidate, LoadMeshes
+	// keeps the ones large next to the rest of the model
+	glm::vec3 boundsMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0].pos;
+	glm::vec3 boundsMax = boundsMin;
+	for (const auto& vertex : vertices) {
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+	}
+	meshData.size = glm::length(boundsMax - boundsMin);
+	meshData.occluder = meshData.size > 0.0f && indices.size() / 3 <= MAX_OCCLUDER_TRIANGLES;
+
+	return meshData;
+}
+
+std::vector<Mesh> MeshModel::CreateMeshes(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, UploadQueue& uploadQueue, std::vector<MeshData>& meshData, const std::vector<int>& matToTex) {
+	std::vector<Mesh> meshList;
+
+	// Create new mesh with details for each loaded mesh (the data is handed to the upload queue)
+	for (auto& data : meshData) {
+		// Occluders keep their positions and indices, the rest of the data only goes to the GPU
+		std::vector<glm::vec3> occluderPositions;
+		std::vector<uint32_t> occluderIndices;
+		if (data.occluder) {
+			occluderPositions.reserve(data.vertices.size());
+			for (const auto& vertex : data.vertices) {
+				occluderPositions.push_back(vertex.pos);
+			}
+			occluderIndices = data.indices;
+		}
 
-	return newMesh;
+		meshList.push_back(Mesh(newPhysicalDevice, newDevice, uploadQueue, std::move(data.vertices), std::move(data.indices), matToTex[data.materialIndex]));
+		if (data.occluder) {
+			meshList.back().setOccluderGeometry(std::move(occluderPositions), std::move(occluderIndices));
+		}
+	}
+
+	return meshList;
 }
 
 MeshModel::~MeshModel() {
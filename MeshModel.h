@@ -1,16 +1,45 @@
 #pragma once
 
 #include <vector>
+#include <string>
 #include <glm/glm.hpp>
 
 #include <assimp/scene.h>
 
 #include "Mesh.h"
+#include "TransformSystem.h"
 
+// Meshes of at most this many triangles can be CPU occlusion culling occluders (they're kept on the CPU and rasterized
+// every frame)
+const uint32_t MAX_OCCLUDER_TRIANGLES = 2048;
+
+// Vertex and index data of one mesh, extracted from the imported scene on the worker thread
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	uint32_t materialIndex;
+	float size;							// Diagonal of the vertices' bounding box
+	bool occluder;						// Keeps a CPU copy of its triangles for the software occlusion culler
+};
+
+// Node of the model's scene hierarchy, placing some of the model's meshes relative to its parent node
+struct ModelNode {
+	std::string name;
+	int parent;							// Index of the parent node, -1 for the root (parents always come before their children)
+	glm::mat4 transform;				// Relative to the parent (position / rotation / scale only, any shear is lost)
+	std::vector<uint32_t> meshes;		// Indices into the model's mesh list
+};
+
+// Transforms of the model, its instances and every instance's copy of the node hierarchy live in a TransformSystem shared
+// by every model: the model transform is a root, instances are its children and each instance's nodes hang off it
 class MeshModel {
 public:
 	MeshModel();
-	MeshModel(std::vector<Mesh> newMeshList);
+	MeshModel(std::vector<Mesh> newMeshList, TransformSystem* newTransforms);
+	MeshModel(std::vector<Mesh> newMeshList, std::vector<ModelNode> newNodes, TransformSystem* newTransforms);
+
+	// Default constructed (and unloaded) models have no transforms and draw nothing
+	bool isLoaded();
 
 	size_t getMeshCount();
 	Mesh* getMesh(size_t index);
@@ -18,15 +47,66 @@ public:
 	glm::mat4 getModel();
 	void setModel(glm::mat4 newModel);
 
+	// Instances share this model's meshes, each placed by its own transform (relative to the model transform)
+	int addInstance(glm::mat4 newInstance);
+	void setInstance(size_t index, glm::mat4 newInstance);
+	size_t getInstanceCount();
+
+	// Nodes can be moved individually (in every instance at once), the transform system only recomputes the world
+	// transforms of what changed
+	size_t getNodeCount();
+	int findNode(const std::string& name);			// -1 if there's no node with that name
+	glm::mat4 getNodeTransform(size_t index);
+	void setNodeTransform(size_t index, glm::mat4 newTransform);
+
+	// Placement = one node drawing one mesh. Placements are grouped by mesh, so all of a mesh's placements can be drawn
+	// together with instancing however many nodes reuse it
+	size_t getPlacementCount();
+	uint32_t getPlacementNode(size_t placement);
+	uint32_t getMeshFirstPlacement(size_t meshIndex);
+	uint32_t getMeshPlacementCount(size_t meshIndex);
+
+	// Transform of every object the model draws (placement of an instance), ordered by placement then instance, so a
+	// mesh's objects are contiguous
+	const std::vector<uint32_t>& getObjectTransforms();
+	// Every transform the model added to the transform system
+	std::vector<uint32_t> getTransformIds();
+	// Follows the transform system closing the gaps left by removed transforms (remap from TransformSystem::remove)
+	void remapTransforms(const std::vector<uint32_t>& remap);
+
 	void destroyMeshModel();
+	// Mesh buffers are destroyed through the deletion queue once the GPU timeline passes lastUseValue
+	void retireMeshModel(DeletionQueue& deletionQueue, uint64_t lastUseValue);
 
 	static std::vector<std::string> LoadMaterials(const aiScene* scene);
-	static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiNode* node, const aiScene* scene, std::vector<int> matToTex);
-	static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex);
+	// CPU only, so these can run on the import thread. Every scene mesh is loaded once, however many nodes use it. Of the
+	// meshes LoadMesh finds small enough to be occluders, the ones large next to the rest of the model are picked
+	static std::vector<MeshData> LoadMeshes(const aiScene* scene);
+	static MeshData LoadMesh(aiMesh* mesh);
+	static std::vector<ModelNode> LoadNodes(const aiScene* scene);
+	// No hierarchy, a single node drawing every mesh
+	static ModelNode RootNode(size_t meshCount);
+	// Creates the meshes' buffers and queues their uploads in uploadQueue's open batch (takes the vertex / index data)
+	static std::vector<Mesh> CreateMeshes(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, UploadQueue& uploadQueue, std::vector<MeshData>& meshData, const std::vector<int>& matToTex);
 
 	~MeshModel();
 private:
 	std::vector<Mesh> meshList;
 	glm::mat4 model;
+
+	std::vector<ModelNode> nodes;
+
+	TransformSystem* transforms;
+	uint32_t modelTransform;
+	std::vector<uint32_t> instanceTransforms;
+	std::vector<uint32_t> nodeTransforms;			// Every node of the first instance, then of the second...
+
+	std::vector<uint32_t> placementNodes;			// Node of each placement
+	std::vector<uint32_t> meshFirstPlacement;		// First placement of each mesh, plus the total at the end
+	std::vector<uint32_t> objectTransforms;
+
+	void buildPlacements();
+	void buildObjectTransforms();
+	static void LoadNode(aiNode* node, int parent, std::vector<ModelNode>& nodes);
 };
 
@@ -0,0 +1,638 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+OcclusionCuller::OcclusionCuller() {
+	physicalDevice = nullptr;
+	device = nullptr;
+	frameCount = 0;
+	currentFrame = 0;
+	objectEnd = 0;
+
+	pyramidImage = VK_NULL_HANDLE;
+	pyramidMemory = VK_NULL_HANDLE;
+	pyramidView = VK_NULL_HANDLE;
+	pyramidSize = { };
+	pyramidLevels = 0;
+	pyramidInitialised = false;
+	pyramidValid = false;
+	pyramidSampler = VK_NULL_HANDLE;
+
+	cullSetLayout = VK_NULL_HANDLE;
+	cullPipelineLayout = VK_NULL_HANDLE;
+	cullPipeline = VK_NULL_HANDLE;
+	pyramidSetLayout = VK_NULL_HANDLE;
+	pyramidPipelineLayout = VK_NULL_HANDLE;
+	pyramidPipeline = VK_NULL_HANDLE;
+}
+
+void OcclusionCuller::init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newFrameCount) {
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+	frameCount = newFrameCount;
+
+	createPipelines();
+
+	// Depth and pyramid levels are only ever fetched, never filtered
+	VkSamplerCreateInfo samplerCreateInfo = { };
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	VkResult result = vkCreateSampler(device, &samplerCreateInfo, nullptr, &pyramidSampler);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the Hi-Z Sampler!");
+	}
+
+	// Sets are allocated fresh each frame: one culling set, and one per pyramid level
+	std::vector<DescriptorPoolRatio> poolRatios = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f }
+	};
+
+	frameBuffers.resize(frameCount);
+	for (auto& buffers : frameBuffers) {
+		buffers = { };
+		buffers.descriptorAllocator.init(device, 16, poolRatios);
+		growFrameBuffers(buffers, 64, 16, 128);
+	}
+}
+
+void OcclusionCuller::destroy() {
+	for (auto& buffers : frameBuffers) {
+		destroyFrameBuffers(buffers);
+		buffers.descriptorAllocator.destroyPools();
+	}
+	frameBuffers.clear();
+
+	for (VkImageView levelView : pyramidLevelViews) {
+		vkDestroyImageView(device, levelView, nullptr);
+	}
+	pyramidLevelViews.clear();
+	if (pyramidImage != VK_NULL_HANDLE) {
+		vkDestroyImageView(device, pyramidView, nullptr);
+		vkDestroyImage(device, pyramidImage, nullptr);
+		GpuMemoryTracker::free(device, pyramidMemory);
+		pyramidImage = VK_NULL_HANDLE;
+	}
+
+	vkDestroySampler(device, pyramidSampler, nullptr);
+	vkDestroyPipeline(device, pyramidPipeline, nullptr);
+	vkDestroyPipelineLayout(device, pyramidPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, pyramidSetLayout, nullptr);
+	vkDestroyPipeline(device, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, cullSetLayout, nullptr);
+}
+
+void OcclusionCuller::resize(uint32_t width, uint32_t height, DeletionQueue& deletionQueue, uint64_t lastUseValue) {
+	if (pyramidImage != VK_NULL_HANDLE) {
+		for (VkImageView levelView : pyramidLevelViews) {
+			deletionQueue.pushImage(VK_NULL_HANDLE, VK_NULL_HANDLE, levelView, lastUseValue);
+		}
+		pyramidLevelViews.clear();
+		deletionQueue.pushImage(pyramidImage, pyramidMemory, pyramidView, lastUseValue);
+		pyramidImage = VK_NULL_HANDLE;
+	}
+
+	createPyramid(width, height);
+}
+
+void OcclusionCuller::invalidatePyramid() {
+	pyramidValid = false;
+}
+
+void OcclusionCuller::beginFrame(uint32_t frameIndex, uint64_t frameNumber) {
+	currentFrame = frameIndex;
+	FrameBuffers& buffers = frameBuffers[currentFrame];
+
+	readBack(buffers);
+
+	buffers.descriptorAllocator.resetPools();
+	buffers.frameNumber = frameNumber;
+
+	objects.clear();
+	draws.clear();
+	commands.clear();
+	objectEnd = 0;
+}
+
+uint32_t OcclusionCuller::addDraw(glm::vec3 boundsMin, glm::vec3 boundsMax, uint32_t indexCount, uint32_t firstObject, uint32_t objectCount) {
+	uint32_t drawIndex = static_cast<uint32_t>(draws.size());
+
+	draws.push_back({ glm::vec4(boundsMin, 1.0f), glm::vec4(boundsMax, 1.0f) });
+
+	// Instances are compacted from firstObject up, so the drawn objects of each pass use the same indices as the source
+	VkDrawIndexedIndirectCommand command = { };
+	command.indexCount = indexCount;
+	command.instanceCount = 0;
+	command.firstIndex = 0;
+	command.vertexOffset = 0;
+	command.firstInstance = firstObject;
+	commands.push_back(command);
+
+	for (uint32_t i = 0; i < objectCount; i++) {
+		objects.push_back({ firstObject + i, drawIndex, 0 });
+	}
+	objectEnd = std::max(objectEnd, firstObject + objectCount);
+
+	return drawIndex;
+}
+
+void OcclusionCuller::recordFirstPass(VkCommandBuffer commandBuffer, VkBuffer sourceObjectBuffer, const glm::mat4& viewProjection) {
+	FrameBuffers& buffers = frameBuffers[currentFrame];
+
+	// Slot's previous submission has completed, so its buffers can be replaced straight away
+	growFrameBuffers(buffers, objects.size(), draws.size(), static_cast<size_t>(objectEnd) * 2);
+
+	if (!objects.empty()) {
+		memcpy(buffers.objectMapped, objects.data(), sizeof(CullObject) * objects.size());
+	}
+	if (!draws.empty()) {
+		memcpy(buffers.drawMapped, draws.data(), sizeof(CullDraw) * draws.size());
+
+		// Second pass' draws place their instances after every first pass object
+		VkDrawIndexedIndirectCommand* indirect = static_cast<VkDrawIndexedIndirectCommand*>(buffers.indirectMapped);
+		memcpy(indirect, commands.data(), sizeof(VkDrawIndexedIndirectCommand) * commands.size());
+		for (size_t i = 0; i < commands.size(); i++) {
+			indirect[commands.size() + i] = commands[i];
+			indirect[commands.size() + i].firstInstance += objectEnd;
+		}
+	}
+
+	// Counts to read back when the slot comes round again
+	buffers.recordedObjects = static_cast<uint32_t>(objects.size());
+	buffers.recordedTriangles.resize(commands.size());
+	buffers.recordedTrianglesSubmitted = 0;
+	for (size_t i = 0; i < commands.size(); i++) {
+		buffers.recordedTriangles[i] = commands[i].indexCount / 3;
+	}
+	for (const auto& object : objects) {
+		buffers.recordedTrianglesSubmitted += buffers.recordedTriangles[object.drawIndex];
+	}
+
+	// Both passes share one set, only the push constants differ
+	buffers.cullDescriptorSet = buffers.descriptorAllocator.allocate(cullSetLayout);
+
+	std::array<VkDescriptorBufferInfo, 5> bufferInfos = { };
+	bufferInfos[0] = { sourceObjectBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { buffers.objectBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { buffers.drawBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { buffers.indirectBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[4] = { buffers.drawnObjectBuffer, 0, VK_WHOLE_SIZE };
+
+	VkDescriptorImageInfo pyramidInfo = { };
+	pyramidInfo.sampler = pyramidSampler;
+	pyramidInfo.imageView = pyramidView;
+	pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	std::array<VkWriteDescriptorSet, 6> writes = { };
+	for (uint32_t i = 0; i < writes.size(); i++) {
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = buffers.cullDescriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		if (i < bufferInfos.size()) {
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[i].pBufferInfo = &bufferInfos[i];
+		} else {
+			writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[i].pImageInfo = &pyramidInfo;
+		}
+	}
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	// Pyramid is created UNDEFINED and stays in GENERAL from its first use on (written by the build, sampled by culling)
+	if (!pyramidInitialised) {
+		VkImageMemoryBarrier layoutBarrier = { };
+		layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		layoutBarrier.srcAccessMask = 0;
+		layoutBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		layoutBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		layoutBarrier.image = pyramidImage;
+		layoutBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0, 1 };
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &layoutBarrier);
+		pyramidInitialised = true;
+	}
+
+	// Previous frame's pyramid build (an earlier submission) must have finished writing before it's tested against
+	VkMemoryBarrier pyramidBarrier = { };
+	pyramidBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	pyramidBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	pyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &pyramidBarrier, 0, nullptr, 0, nullptr);
+
+	recordCullPass(commandBuffer, viewProjection, 0);
+}
+
+void OcclusionCuller::recordPyramid(VkCommandBuffer commandBuffer, VkImageView depthView, VkExtent2D renderExtent) {
+	FrameBuffers& buffers = frameBuffers[currentFrame];
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipeline);
+
+	// Level 0 reduces the rendered part of the depth target, each level after reduces the one above it by half
+	VkImageView sourceView = depthView;
+	VkImageLayout sourceLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	PyramidPushConstant sizes = { };
+	sizes.sourceSize = glm::ivec2(renderExtent.width, renderExtent.height);
+
+	for (uint32_t level = 0; level < pyramidLevels; level++) {
+		sizes.destinationSize = glm::ivec2(std::max(pyramidSize.width >> level, 1u), std::max(pyramidSize.height >> level, 1u));
+
+		VkDescriptorSet levelSet = buffers.descriptorAllocator.allocate(pyramidSetLayout);
+
+		VkDescriptorImageInfo sourceInfo = { pyramidSampler, sourceView, sourceLayout };
+		VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, pyramidLevelViews[level], VK_IMAGE_LAYOUT_GENERAL };
+
+		std::array<VkWriteDescriptorSet, 2> writes = { };
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = levelSet;
+		writes[0].dstBinding = 0;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &sourceInfo;
+
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = levelSet;
+		writes[1].dstBinding = 1;
+		writes[1].descriptorCount = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipelineLayout, 0, 1, &levelSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, pyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PyramidPushConstant), &sizes);
+		vkCmdDispatch(commandBuffer, (sizes.destinationSize.x + 7) / 8, (sizes.destinationSize.y + 7) / 8, 1);
+
+		// Level is read by the next one (and the last by the second culling pass)
+		VkMemoryBarrier levelBarrier = { };
+		levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+
+		sourceView = pyramidLevelViews[level];
+		sourceLayout = VK_IMAGE_LAYOUT_GENERAL;
+		sizes.sourceSize = sizes.destinationSize;
+	}
+
+	pyramidValid = true;
+}
+
+void OcclusionCuller::recordSecondPass(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection) {
+	recordCullPass(commandBuffer, viewProjection, 1);
+}
+
+VkBuffer OcclusionCuller::getIndirectBuffer() {
+	return frameBuffers[currentFrame].indirectBuffer;
+}
+
+VkDeviceSize OcclusionCuller::getIndirectOffset(uint32_t drawIndex, uint32_t pass) {
+	return sizeof(VkDrawIndexedIndirectCommand) * (pass * draws.size() + drawIndex);
+}
+
+VkBuffer OcclusionCuller::getDrawnObjectBuffer() {
+	return frameBuffers[currentFrame].drawnObjectBuffer;
+}
+
+const OcclusionCullStats& OcclusionCuller::getStats() {
+	return stats;
+}
+
+OcclusionCuller::~OcclusionCuller() {
+}
+
+void OcclusionCuller::createPipelines() {
+	// Culling Set: source objects, cull objects, draws, indirect commands, drawn objects, pyramid
+	std::array<VkDescriptorSetLayoutBinding, 6> cullBindings = { };
+	for (uint32_t i = 0; i < cullBindings.size(); i++) {
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorType = i < 5 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = { };
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+	layoutCreateInfo.pBindings = cullBindings.data();
+
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &cullSetLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+
+	// Pyramid Set: level above (or the depth target), level written
+	std::array<VkDescriptorSetLayoutBinding, 2> pyramidBindings = { };
+	pyramidBindings[0].binding = 0;
+	pyramidBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pyramidBindings[0].descriptorCount = 1;
+	pyramidBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pyramidBindings[1].binding = 1;
+	pyramidBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	pyramidBindings[1].descriptorCount = 1;
+	pyramidBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(pyramidBindings.size());
+	layoutCreateInfo.pBindings = pyramidBindings.data();
+
+	result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, nullptr, &pyramidSetLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
+	}
+
+	// Pipeline Layouts (everything else changes per dispatch, so goes in push constants)
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullPushConstant);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = { };
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &cullSetLayout;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &cullPipelineLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Pipeline Layout!");
+	}
+
+	pushConstantRange.size = sizeof(PyramidPushConstant);
+	pipelineLayoutCreateInfo.pSetLayouts = &pyramidSetLayout;
+
+	result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pyramidPipelineLayout);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Pipeline Layout!");
+	}
+
+	cullPipeline = createComputePipeline("Shaders/cull_comp.spv", cullPipelineLayout);
+	pyramidPipeline = createComputePipeline("Shaders/hiz_comp.spv", pyramidPipelineLayout);
+}
+
+VkPipeline OcclusionCuller::createComputePipeline(const std::string& shaderFile, VkPipelineLayout layout) {
+	std::vector<char> shaderCode = readFile(shaderFile);
+
+	VkShaderModuleCreateInfo shaderModuleCreateInfo = { };
+	shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleCreateInfo.codeSize = shaderCode.size();
+	shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+
+	VkShaderModule shaderModule;
+	VkResult result = vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a shader module!");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = { };
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineCreateInfo.stage.module = shaderModule;
+	pipelineCreateInfo.stage.pName = "main";
+	pipelineCreateInfo.layout = layout;
+
+	VkPipeline pipeline;
+	result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Compute Pipeline!");
+	}
+	return pipeline;
+}
+
+void OcclusionCuller::createPyramid(uint32_t width, uint32_t height) {
+	// Level 0 is the largest power of two that fits in the target (at most 2x2 source texels per texel at full
+	// resolution), so every level after it is an exact halving
+	pyramidSize.width = 1;
+	while (pyramidSize.width * 2 <= width) {
+		pyramidSize.width *= 2;
+	}
+	pyramidSize.height = 1;
+	while (pyramidSize.height * 2 <= height) {
+		pyramidSize.height *= 2;
+	}
+	pyramidSize.width = std::max(pyramidSize.width / 2, 1u);
+	pyramidSize.height = std::max(pyramidSize.height / 2, 1u);
+
+	pyramidLevels = 1;
+	while ((std::max(pyramidSize.width, pyramidSize.height) >> pyramidLevels) > 0) {
+		pyramidLevels++;
+	}
+
+	VkImageCreateInfo imageCreateInfo = { };
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent = { pyramidSize.width, pyramidSize.height, 1 };
+	imageCreateInfo.mipLevels = pyramidLevels;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkResult result = vkCreateImage(device, &imageCreateInfo, nullptr, &pyramidImage);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the Hi-Z Image!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, pyramidImage, &memoryRequirements);
+
+	VkMemoryAllocateInfo memoryAllocInfo = { };
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = memoryRequirements.size;
+	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	result = GpuMemoryTracker::allocate(device, &memoryAllocInfo, MemoryCategory::Attachment, &pyramidMemory);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate memory for the Hi-Z Image!");
+	}
+	vkBindImageMemory(device, pyramidImage, pyramidMemory, 0);
+
+	VkImageViewCreateInfo viewCreateInfo = { };
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = pyramidImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pyramidLevels, 0, 1 };
+
+	result = vkCreateImageView(device, &viewCreateInfo, nullptr, &pyramidView);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create an Image View!");
+	}
+
+	pyramidLevelViews.resize(pyramidLevels);
+	for (uint32_t level = 0; level < pyramidLevels; level++) {
+		viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		result = vkCreateImageView(device, &viewCreateInfo, nullptr, &pyramidLevelViews[level]);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create an Image View!");
+		}
+	}
+
+	pyramidInitialised = false;
+	pyramidValid = false;
+}
+
+void OcclusionCuller::destroyFrameBuffers(FrameBuffers& buffers) {
+	if (buffers.objectBuffer != VK_NULL_HANDLE) {
+		vkUnmapMemory(device, buffers.objectMemory);
+		vkDestroyBuffer(device, buffers.objectBuffer, nullptr);
+		GpuMemoryTracker::free(device, buffers.objectMemory);
+		buffers.objectBuffer = VK_NULL_HANDLE;
+	}
+	if (buffers.drawBuffer != VK_NULL_HANDLE) {
+		vkUnmapMemory(device, buffers.drawMemory);
+		vkDestroyBuffer(device, buffers.drawBuffer, nullptr);
+		GpuMemoryTracker::free(device, buffers.drawMemory);
+		buffers.drawBuffer = VK_NULL_HANDLE;
+
+		vkUnmapMemory(device, buffers.indirectMemory);
+		vkDestroyBuffer(device, buffers.indirectBuffer, nullptr);
+		GpuMemoryTracker::free(device, buffers.indirectMemory);
+		buffers.indirectBuffer = VK_NULL_HANDLE;
+	}
+	if (buffers.drawnObjectBuffer != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device, buffers.drawnObjectBuffer, nullptr);
+		GpuMemoryTracker::free(device, buffers.drawnObjectMemory);
+		buffers.drawnObjectBuffer = VK_NULL_HANDLE;
+	}
+}
+
+void OcclusionCuller::growFrameBuffers(FrameBuffers& buffers, size_t objectCount, size_t drawCount, size_t drawnObjectCount) {
+	VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	// Doubled until they fit, so a growing scene doesn't reallocate every frame
+	if (objectCount > buffers.objectCapacity || buffers.objectBuffer == VK_NULL_HANDLE) {
+		size_t capacity = std::max<size_t>(buffers.objectCapacity, 64);
+		while (capacity < objectCount) {
+			capacity *= 2;
+		}
+
+		if (buffers.objectBuffer != VK_NULL_HANDLE) {
+			vkUnmapMemory(device, buffers.objectMemory);
+			vkDestroyBuffer(device, buffers.objectBuffer, nullptr);
+			GpuMemoryTracker::free(device, buffers.objectMemory);
+		}
+
+		createBuffer(physicalDevice, device, sizeof(CullObject) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, MemoryCategory::Uniform, &buffers.objectBuffer, &buffers.objectMemory);
+		vkMapMemory(device, buffers.objectMemory, 0, VK_WHOLE_SIZE, 0, &buffers.objectMapped);
+		buffers.objectCapacity = capacity;
+	}
+
+	if (drawCount > buffers.drawCapacity || buffers.drawBuffer == VK_NULL_HANDLE) {
+		size_t capacity = std::max<size_t>(buffers.drawCapacity, 16);
+		while (capacity < drawCount) {
+			capacity *= 2;
+		}
+
+		if (buffers.drawBuffer != VK_NULL_HANDLE) {
+			vkUnmapMemory(device, buffers.drawMemory);
+			vkDestroyBuffer(device, buffers.drawBuffer, nullptr);
+			GpuMemoryTracker::free(device, buffers.drawMemory);
+			vkUnmapMemory(device, buffers.indirectMemory);
+			vkDestroyBuffer(device, buffers.indirectBuffer, nullptr);
+			GpuMemoryTracker::free(device, buffers.indirectMemory);
+		}
+
+		createBuffer(physicalDevice, device, sizeof(CullDraw) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, MemoryCategory::Uniform, &buffers.drawBuffer, &buffers.drawMemory);
+		vkMapMemory(device, buffers.drawMemory, 0, VK_WHOLE_SIZE, 0, &buffers.drawMapped);
+
+		// Host visible so the instance counts the GPU wrote can be read back for the statistics
+		createBuffer(physicalDevice, device, sizeof(VkDrawIndexedIndirectCommand) * capacity * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, hostVisible, MemoryCategory::Uniform, &buffers.indirectBuffer, &buffers.indirectMemory);
+		vkMapMemory(device, buffers.indirectMemory, 0, VK_WHOLE_SIZE, 0, &buffers.indirectMapped);
+
+		buffers.drawCapacity = capacity;
+	}
+
+	if (drawnObjectCount > buffers.drawnObjectCapacity || buffers.drawnObjectBuffer == VK_NULL_HANDLE) {
+		size_t capacity = std::max<size_t>(buffers.drawnObjectCapacity, 128);
+		while (capacity < drawnObjectCount) {
+			capacity *= 2;
+		}
+
+		if (buffers.drawnObjectBuffer != VK_NULL_HANDLE) {
+			vkDestroyBuffer(device, buffers.drawnObjectBuffer, nullptr);
+			GpuMemoryTracker::free(device, buffers.drawnObjectMemory);
+		}
+
+		createBuffer(physicalDevice, device, sizeof(ObjectTransform) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Uniform, &buffers.drawnObjectBuffer, &buffers.drawnObjectMemory);
+		buffers.drawnObjectCapacity = capacity;
+	}
+}
+
+void OcclusionCuller::readBack(FrameBuffers& buffers) {
+	// Nothing recorded into the slot since its counts were last read (culling was off, or it's the first use)
+	if (buffers.recordedTriangles.empty() && buffers.recordedObjects == 0) {
+		return;
+	}
+
+	const VkDrawIndexedIndirectCommand* indirect = static_cast<const VkDrawIndexedIndirectCommand*>(buffers.indirectMapped);
+	size_t drawCount = buffers.recordedTriangles.size();
+
+	OcclusionCullStats frameStats;
+	frameStats.frame = buffers.frameNumber;
+	frameStats.objects = buffers.recordedObjects;
+	frameStats.trianglesSubmitted = buffers.recordedTrianglesSubmitted;
+	for (size_t i = 0; i < drawCount; i++) {
+		uint32_t firstPass = indirect[i].instanceCount;
+		uint32_t secondPass = indirect[drawCount + i].instanceCount;
+		frameStats.drawnFirstPass += firstPass;
+		frameStats.drawnSecondPass += secondPass;
+		frameStats.trianglesDrawn += static_cast<uint64_t>(buffers.recordedTriangles[i]) * (firstPass + secondPass);
+	}
+
+	stats = frameStats;
+
+	buffers.recordedObjects = 0;
+	buffers.recordedTriangles.clear();
+}
+
+void OcclusionCuller::recordCullPass(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection, uint32_t pass) {
+	FrameBuffers& buffers = frameBuffers[currentFrame];
+
+	if (!objects.empty()) {
+		CullPushConstant parameters = { };
+		parameters.viewProjection = viewProjection;
+		parameters.pyramidSize = glm::vec2(pyramidSize.width, pyramidSize.height);
+		parameters.pyramidLevels = pyramidValid ? pyramidLevels : 0;
+		parameters.objectCount = static_cast<uint32_t>(objects.size());
+		parameters.drawCount = static_cast<uint32_t>(draws.size());
+		parameters.pass = pass;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &buffers.cullDescriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstant), &parameters);
+		vkCmdDispatch(commandBuffer, (parameters.objectCount + 63) / 64, 1, 1);
+	}
+
+	// Commands and drawn objects are read by the draws. Compute also waits, so the pyramid isn't rebuilt while culling
+	// still reads it, and the host once the submission completes (instance counts for the statistics)
+	VkMemoryBarrier cullBarrier = { };
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
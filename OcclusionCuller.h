@@ -0,0 +1,170 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+#include <glm/glm.hpp>
+
+#include "Utilities.h"
+#include "DescriptorAllocator.h"
+#include "DeletionQueue.h"
+
+// What culling did in one frame, read back once the frame's submission has completed
+struct OcclusionCullStats {
+	uint64_t frame = 0;					// Frame number the counts are from
+	uint32_t objects = 0;				// Objects (mesh instances) tested
+	uint32_t drawnFirstPass = 0;		// Visible against the previous frame's pyramid
+	uint32_t drawnSecondPass = 0;		// Culled by that but visible against this frame's (newly disoccluded)
+	uint64_t trianglesSubmitted = 0;	// Triangles of every object, what would be drawn without culling
+	uint64_t trianglesDrawn = 0;
+};
+
+// Two pass occlusion culling against a Hi-Z pyramid (farthest depth per texel, halving in size each level) built from
+// the scene's depth with a compute pass.
+//
+// Each frame: the first pass tests every object against the pyramid of the previous frame and draws what passes. The
+// pyramid is then rebuilt from that depth, and the second pass re-tests what the first culled against it, drawing the
+// objects that have come into view. Visible objects are appended to their draw's indirect command by the GPU, with their
+// transforms copied to a compacted object buffer the command's instances index, so the vertex shaders don't change.
+//
+// Everything per frame is owned by frame slot and only reused once that slot's previous submission has completed. The
+// pyramid is shared, queue order keeps one frame's build ahead of the next frame's first pass
+class OcclusionCuller {
+public:
+	OcclusionCuller();
+
+	void init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newFrameCount);
+	void destroy();
+
+	// Pyramid covering scene targets of this size. The old one may still be in use by frames in flight, so it goes to the
+	// deletion queue, the first frame after this one only culls against the frustum
+	void resize(uint32_t width, uint32_t height, DeletionQueue& deletionQueue, uint64_t lastUseValue);
+	// Next frame's first pass doesn't use the pyramid (it's stale, e.g. culling was off for a while)
+	void invalidatePyramid();
+
+	// Call once the frame slot's last submission has completed: reads back its counts and starts laying out a new frame
+	void beginFrame(uint32_t frameIndex, uint64_t frameNumber);
+	// Objects firstObject .. firstObject + objectCount - 1 of the source object buffer, all instances of one mesh. Returns
+	// the draw's index for getIndirectOffset
+	uint32_t addDraw(glm::vec3 boundsMin, glm::vec3 boundsMax, uint32_t indexCount, uint32_t firstObject, uint32_t objectCount);
+
+	// Compute passes, recorded outside render passes. The first pass' commands and objects are ready for the draws after
+	// recordFirstPass, the second's after recordSecondPass. recordPyramid reads depthView in SHADER_READ_ONLY_OPTIMAL
+	void recordFirstPass(VkCommandBuffer commandBuffer, VkBuffer sourceObjectBuffer, const glm::mat4& viewProjection);
+	void recordPyramid(VkCommandBuffer commandBuffer, VkImageView depthView, VkExtent2D renderExtent);
+	void recordSecondPass(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection);
+
+	// One VkDrawIndexedIndirectCommand per draw and pass (0 = first, 1 = second)
+	VkBuffer getIndirectBuffer();
+	VkDeviceSize getIndirectOffset(uint32_t drawIndex, uint32_t pass);
+	// Transforms of the drawn objects, bound in place of the source object buffer for the indirect draws
+	VkBuffer getDrawnObjectBuffer();
+
+	// Latest frame read back
+	const OcclusionCullStats& getStats();
+
+	~OcclusionCuller();
+
+private:
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	uint32_t frameCount;
+	uint32_t currentFrame;
+
+	// Must match the structs in cull.comp
+	struct CullObject {
+		uint32_t objectIndex;
+		uint32_t drawIndex;
+		uint32_t firstPassVisible;
+	};
+
+	struct CullDraw {
+		glm::vec4 boundsMin;
+		glm::vec4 boundsMax;
+	};
+
+	struct CullPushConstant {
+		glm::mat4 viewProjection;
+		glm::vec2 pyramidSize;
+		uint32_t pyramidLevels;
+		uint32_t objectCount;
+		uint32_t drawCount;
+		uint32_t pass;
+	};
+
+	struct PyramidPushConstant {
+		glm::ivec2 sourceSize;
+		glm::ivec2 destinationSize;
+	};
+
+	// Host visible buffers are written by the CPU before recording (and the counts read back), the drawn object buffer
+	// only by the GPU. Grown when a frame needs more, once the slot is idle
+	struct FrameBuffers {
+		VkBuffer objectBuffer;				// CullObject per object
+		VkDeviceMemory objectMemory;
+		void* objectMapped;
+		size_t objectCapacity;
+
+		VkBuffer drawBuffer;				// CullDraw per draw
+		VkDeviceMemory drawMemory;
+		void* drawMapped;
+		VkBuffer indirectBuffer;			// Command per draw for the first pass, then the same for the second
+		VkDeviceMemory indirectMemory;
+		void* indirectMapped;
+		size_t drawCapacity;
+
+		VkBuffer drawnObjectBuffer;			// ObjectTransform, room for every object in each pass
+		VkDeviceMemory drawnObjectMemory;
+		size_t drawnObjectCapacity;
+
+		DescriptorAllocator descriptorAllocator;	// Reset each time the slot comes round
+		VkDescriptorSet cullDescriptorSet;
+
+		// Layout of the frame last recorded into the slot, to read its counts back
+		uint64_t frameNumber;
+		uint32_t recordedObjects;
+		std::vector<uint32_t> recordedTriangles;	// Triangles per instance of each draw
+		uint64_t recordedTrianglesSubmitted;
+	};
+	std::vector<FrameBuffers> frameBuffers;
+
+	// CPU side of the frame being laid out
+	std::vector<CullObject> objects;
+	std::vector<CullDraw> draws;
+	std::vector<VkDrawIndexedIndirectCommand> commands;		// First pass' only, the second pass' are copies with instances moved past every object
+	uint32_t objectEnd;										// One past the highest source object index used
+
+	// Hi-Z Pyramid (R32_SFLOAT, kept in GENERAL)
+	VkImage pyramidImage;
+	VkDeviceMemory pyramidMemory;
+	VkImageView pyramidView;								// Every level, sampled by the culling passes
+	std::vector<VkImageView> pyramidLevelViews;				// One level each, written by the build and read by the next level
+	VkExtent2D pyramidSize;
+	uint32_t pyramidLevels;
+	bool pyramidInitialised;								// Moved out of UNDEFINED
+	bool pyramidValid;										// Holds a previous frame's depth
+
+	VkSampler pyramidSampler;								// Nearest, only used with texelFetch
+
+	VkDescriptorSetLayout cullSetLayout;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+
+	VkDescriptorSetLayout pyramidSetLayout;
+	VkPipelineLayout pyramidPipelineLayout;
+	VkPipeline pyramidPipeline;
+
+	OcclusionCullStats stats;
+
+	void createPipelines();
+	VkPipeline createComputePipeline(const std::string& shaderFile, VkPipelineLayout layout);
+	void createPyramid(uint32_t width, uint32_t height);
+	void destroyFrameBuffers(FrameBuffers& buffers);
+	void growFrameBuffers(FrameBuffers& buffers, size_t objectCount, size_t drawCount, size_t drawnObjectCount);
+	void readBack(FrameBuffers& buffers);
+	void recordCullPass(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection, uint32_t pass);
+};
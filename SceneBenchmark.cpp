@@ -0,0 +1,456 @@
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "SceneBenchmark.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "VulkanRenderer.h"
+#include "Statistics.h"
+#include "Tracer.h"
+
+// Peak resident memory of the process so far, in bytes
+static size_t getPeakProcessMemory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = { };
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	rusage usage = { };
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;		// Kilobytes on Linux
+#endif
+}
+
+static void writeJsonStatistics(std::ostream& out, const char* name, double avg, double p50, double p95, double p99, double max) {
+	out << "\t\"" << name << "\": { \"avg\": " << avg << ", \"p50\": " << p50 << ", \"p95\": " << p95 << ", \"p99\": " << p99 << ", \"max\": " << max << " }";
+}
+
+BenchmarkScript loadBenchmarkScript(const std::string& fileName) {
+	std::ifstream file(fileName);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open benchmark script " + fileName + "!");
+	}
+
+	BenchmarkScript script;
+	script.fileName = fileName;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		// Strip comments
+		size_t commentStart = line.find('#');
+		if (commentStart != std::string::npos) {
+			line.erase(commentStart);
+		}
+
+		std::istringstream words(line);
+		std::string command;
+		if (!(words >> command)) {
+			continue;
+		}
+
+		bool valid = true;
+		if (command == "resolution") {
+			valid = static_cast<bool>(words >> script.width >> script.height);
+		} else if (command == "frames-in-flight") {
+			valid = static_cast<bool>(words >> script.framesInFlight);
+		} else if (command == "warmup") {
+			valid = static_cast<bool>(words >> script.warmupFrames);
+		} else if (command == "frames") {
+			valid = static_cast<bool>(words >> script.measuredFrames) && script.measuredFrames > 0;
+		} else if (command == "timestep") {
+			valid = static_cast<bool>(words >> script.timestep) && script.timestep > 0.0;
+		} else if (command == "model") {
+			BenchmarkModel model;
+			valid = static_cast<bool>(words >> model.fileName);
+
+			// Position and scale are optional
+			glm::vec3 position;
+			if (words >> position.x >> position.y >> position.z) {
+				model.position = position;
+				float scale;
+				if (words >> scale) {
+					model.scale = scale;
+				}
+			}
+			script.models.push_back(model);
+		} else if (command == "spin") {
+			valid = static_cast<bool>(words >> script.spinDegreesPerSecond);
+		} else if (command == "camera") {
+			script.orbitCamera = false;
+			valid = static_cast<bool>(words >> script.cameraPosition.x >> script.cameraPosition.y >> script.cameraPosition.z
+				>> script.cameraTarget.x >> script.cameraTarget.y >> script.cameraTarget.z);
+		} else if (command == "camera-orbit") {
+			script.orbitCamera = true;
+			valid = static_cast<bool>(words >> script.orbitRadius >> script.orbitHeight >> script.orbitDegreesPerSecond);
+		} else if (command == "async-load") {
+			script.asyncLoad = true;
+		} else if (command == "upload-budget") {
+			valid = static_cast<bool>(words >> script.uploadBudgetMiB) && script.uploadBudgetMiB >= 0.0;
+
+			// Time budget is optional
+			uint32_t microseconds;
+			script.uploadBudgetMicroseconds = (words >> microseconds) ? microseconds : DEFAULT_UPLOAD_BUDGET_MICROSECONDS;
+		} else if (command == "texture-budget") {
+			valid = static_cast<bool>(words >> script.textureBudgetMiB) && script.textureBudgetMiB >= 0.0;
+		} else if (command == "dynamic-resolution") {
+			valid = static_cast<bool>(words >> script.dynamicResolutionMs) && script.dynamicResolutionMs > 0.0;
+
+			// Smallest scale is optional
+			float minScale;
+			if (words >> minScale) {
+				script.minResolutionScale = minScale;
+			}
+		} else if (command == "depth-prepass") {
+			script.depthPrepass = true;
+		} else if (command == "occlusion-culling") {
+			script.occlusionCulling = true;
+		} else if (command == "cpu-occlusion-culling") {
+			script.cpuOcclusionCulling = true;
+		} else if (command == "output") {
+			valid = static_cast<bool>(words >> script.outputFile);
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			throw std::runtime_error("Failed to parse benchmark script " + fileName + " (line " + std::to_string(lineNumber) + ": " + line + ")!");
+		}
+	}
+
+	if (script.models.empty()) {
+		throw std::runtime_error("Benchmark script " + fileName + " has no models!");
+	}
+
+	return script;
+}
+
+int runSceneBenchmark(VulkanRenderer& renderer, const std::string& scriptFile) {
+	BenchmarkScript script;
+	try {
+		script = loadBenchmarkScript(scriptFile);
+	} catch (const std::runtime_error& e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (script.framesInFlight > 0) {
+		renderer.setFramesInFlight(script.framesInFlight);
+	}
+
+	if (script.uploadBudgetMiB >= 0.0) {
+		renderer.setUploadBudget(static_cast<VkDeviceSize>(script.uploadBudgetMiB * 1024 * 1024), script.uploadBudgetMicroseconds);
+	}
+
+	if (script.textureBudgetMiB >= 0.0) {
+		renderer.setTextureBudget(static_cast<VkDeviceSize>(script.textureBudgetMiB * 1024 * 1024));
+	}
+
+	renderer.setDynamicResolution(script.dynamicResolutionMs, script.minResolutionScale);
+	renderer.setDepthPrepass(script.depthPrepass);
+	renderer.setOcclusionCulling(script.occlusionCulling);
+	renderer.setCpuOcclusionCulling(script.cpuOcclusionCulling);
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	// Imports run on worker threads alongside init
+	for (const auto& model : script.models) {
+		renderer.prefetchMeshModel(model.fileName);
+	}
+
+	if (renderer.initHeadless(script.width, script.height) == EXIT_FAILURE) {
+		return EXIT_FAILURE;
+	}
+
+	// Asynchronous loads get their model id once resident (-1 until then)
+	std::vector<int> modelIds;
+	std::vector<int> modelLoads;
+	try {
+		for (const auto& model : script.models) {
+			if (script.asyncLoad) {
+				modelLoads.push_back(renderer.createMeshModelAsync(model.fileName));
+				modelIds.push_back(-1);
+			} else {
+				modelIds.push_back(renderer.createMeshModel(model.fileName));
+			}
+		}
+	} catch (const std::runtime_error& e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		renderer.cleanup();
+		return EXIT_FAILURE;
+	}
+
+	double firstFrameMs = 0.0;
+	int residentFrame = script.asyncLoad ? -1 : 0;		// First frame with every model drawn
+	RollingStatistics cpuFrameTimes(script.measuredFrames);
+	double drawTotal = 0.0;
+	double triangleTotal = 0.0;
+	double cullObjectTotal = 0.0;
+	double cullFirstPassTotal = 0.0;
+	double cullSecondPassTotal = 0.0;
+	double cullSubmittedTotal = 0.0;
+	double cpuCullTestedTotal = 0.0;
+	double cpuCullCulledTotal = 0.0;
+	double cpuCullRasterMsTotal = 0.0;
+	double cpuCullTestMsTotal = 0.0;
+
+	// Upload work of every frame (streaming can finish during warm up, so it isn't limited to measured frames)
+	VkDeviceSize uploadBytesTotal = 0;
+	VkDeviceSize uploadBytesMax = 0;
+	uint32_t uploadFrames = 0;				// Frames that uploaded anything
+	uint32_t uploadDeferredFrames = 0;		// Frames that left uploads for later ones
+
+	// Resolution scale of every measured frame, and its average over each second of scene time to show how it moved
+	RollingStatistics resolutionScales(script.measuredFrames);
+	std::vector<double> resolutionScaleSeconds;
+	uint32_t framesPerSecond = std::max(1u, static_cast<uint32_t>(std::round(1.0 / script.timestep)));
+	double resolutionScaleSum = 0.0;
+	size_t resolutionChangesAtStart = 0;
+
+	uint32_t totalFrames = script.warmupFrames + script.measuredFrames;
+	for (uint32_t frame = 0; frame < totalFrames; frame++) {
+		// Measurement starts clean once warm up is done (pipelines, caches and allocations have settled)
+		if (frame == script.warmupFrames) {
+			renderer.resetStatistics(script.measuredFrames);
+			resolutionChangesAtStart = renderer.getResolutionChangeCount();
+		}
+
+		auto frameStart = std::chrono::steady_clock::now();
+
+		// Scene time only depends on the frame number, never the wall clock
+		double time = frame * script.timestep;
+
+		{
+			TRACE_SCOPE("Update scene");
+
+			if (residentFrame < 0) {
+				bool allResident = true;
+				for (size_t i = 0; i < modelLoads.size(); i++) {
+					modelIds[i] = renderer.getAsyncModelId(modelLoads[i]);
+					allResident = allResident && modelIds[i] >= 0;
+				}
+				if (allResident) {
+					residentFrame = static_cast<int>(frame);
+				}
+			}
+
+			for (size_t i = 0; i < modelIds.size(); i++) {
+				const BenchmarkModel& model = script.models[i];
+				if (modelIds[i] < 0) {
+					continue;
+				}
+
+				glm::mat4 transform(1.0f);
+				transform = glm::translate(transform, model.position);
+				transform = glm::rotate(transform, glm::radians(static_cast<float>(script.spinDegreesPerSecond * time)), glm::vec3(0.0f, 1.0f, 0.0f));
+				transform = glm::scale(transform, glm::vec3(model.scale));
+				renderer.updateModel(modelIds[i], transform);
+			}
+
+			if (script.orbitCamera) {
+				float orbitAngle = glm::radians(static_cast<float>(script.orbitDegreesPerSecond * time));
+				glm::vec3 eye(script.orbitRadius * cos(orbitAngle), script.orbitHeight, script.orbitRadius * sin(orbitAngle));
+				renderer.setCamera(eye, glm::vec3(0.0f));
+			} else {
+				renderer.setCamera(script.cameraPosition, script.cameraTarget);
+			}
+		}
+
+		renderer.draw();
+
+		TRACE_FRAME_END();
+
+		const UploadStats& uploadStats = renderer.getUploadStats();
+		uploadBytesTotal += uploadStats.bytes;
+		uploadBytesMax = std::max(uploadBytesMax, uploadStats.bytes);
+		uploadFrames += uploadStats.bytes > 0 ? 1 : 0;
+		uploadDeferredFrames += uploadStats.uploadsDeferred > 0 ? 1 : 0;
+
+		if (frame == 0) {
+			firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+		}
+
+		if (frame >= script.warmupFrames) {
+			cpuFrameTimes.addSample(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+
+			CommandRecorderStats stats = renderer.getRecordingStats();
+			drawTotal += stats.draws;
+			triangleTotal += static_cast<double>(stats.triangles);
+
+			// Culled draws are indirect, so the triangles come from the culler's read back counts (of a frame in flight
+			// earlier, like the GPU timings)
+			if (script.occlusionCulling) {
+				const OcclusionCullStats& culling = renderer.getOcclusionStats();
+				triangleTotal += static_cast<double>(culling.trianglesDrawn);
+				cullObjectTotal += culling.objects;
+				cullFirstPassTotal += culling.drawnFirstPass;
+				cullSecondPassTotal += culling.drawnSecondPass;
+				cullSubmittedTotal += static_cast<double>(culling.trianglesSubmitted);
+			} else if (script.cpuOcclusionCulling) {
+				const SoftwareOcclusionStats& culling = renderer.getCpuOcclusionStats();
+				cpuCullTestedTotal += culling.objectsTested;
+				cpuCullCulledTotal += culling.objectsCulled;
+				cpuCullRasterMsTotal += culling.rasterMs;
+				cpuCullTestMsTotal += culling.testMs;
+			}
+
+			float resolutionScale = renderer.getResolutionScale();
+			resolutionScales.addSample(resolutionScale);
+			resolutionScaleSum += resolutionScale;
+			if ((frame - script.warmupFrames + 1) % framesPerSecond == 0) {
+				resolutionScaleSeconds.push_back(resolutionScaleSum / framesPerSecond);
+				resolutionScaleSum = 0.0;
+			}
+		}
+	}
+
+	// GPU frame time is the "Frame" scope (command buffer start to end). Results lag by the frames in flight, so the
+	// last few measured frames aren't included and the first few come from the end of warm up
+	bool gpuTimed = false;
+	GpuScopeTiming gpuFrame = { };
+	bool sceneTimed = false;
+	GpuScopeTiming gpuScene = { };
+	bool prepassTimed = false;
+	GpuScopeTiming gpuPrepass = { };
+	for (const auto& timing : renderer.getGpuTimings()) {
+		if (timing.name == "Frame") {
+			gpuFrame = timing;
+			gpuTimed = true;
+		}
+		if (timing.name == "Scene pass") {
+			gpuScene = timing;
+			sceneTimed = true;
+		}
+		if (timing.name == "Depth pre-pass") {
+			gpuPrepass = timing;
+			prepassTimed = true;
+		}
+	}
+
+	// Forward slashes keep Windows paths valid JSON
+	std::string scriptName = script.fileName;
+	std::replace(scriptName.begin(), scriptName.end(), '\\', '/');
+
+	std::ostringstream report;
+	report << "{\n";
+	report << "\t\"script\": \"" << scriptName << "\",\n";
+	report << "\t\"resolution\": [" << script.width << ", " << script.height << "],\n";
+	report << "\t\"frames_in_flight\": " << renderer.getFramesInFlight() << ",\n";
+	report << "\t\"warmup_frames\": " << script.warmupFrames << ",\n";
+	report << "\t\"measured_frames\": " << script.measuredFrames << ",\n";
+	report << "\t\"time_to_first_frame_ms\": " << firstFrameMs << ",\n";
+	report << "\t\"async_load\": " << (script.asyncLoad ? "true" : "false") << ",\n";
+	report << "\t\"models_resident_frame\": " << residentFrame << ",\n";
+	writeJsonStatistics(report, "cpu_frame_ms", cpuFrameTimes.getAverage(), cpuFrameTimes.getPercentile(50.0), cpuFrameTimes.getPercentile(95.0), cpuFrameTimes.getPercentile(99.0), cpuFrameTimes.getMax());
+	report << ",\n";
+	if (gpuTimed) {
+		writeJsonStatistics(report, "gpu_frame_ms", gpuFrame.avgMs, gpuFrame.p50Ms, gpuFrame.p95Ms, gpuFrame.p99Ms, gpuFrame.maxMs);
+	} else {
+		report << "\t\"gpu_frame_ms\": null";
+	}
+	report << ",\n";
+	if (sceneTimed) {
+		writeJsonStatistics(report, "gpu_scene_ms", gpuScene.avgMs, gpuScene.p50Ms, gpuScene.p95Ms, gpuScene.p99Ms, gpuScene.maxMs);
+	} else {
+		report << "\t\"gpu_scene_ms\": null";
+	}
+	report << ",\n";
+	// Part of the scene pass spent in the depth pre-pass (null when it's off)
+	report << "\t\"depth_prepass\": " << (script.depthPrepass ? "true" : "false") << ",\n";
+	if (prepassTimed) {
+		writeJsonStatistics(report, "gpu_depth_prepass_ms", gpuPrepass.avgMs, gpuPrepass.p50Ms, gpuPrepass.p95Ms, gpuPrepass.p99Ms, gpuPrepass.maxMs);
+	} else {
+		report << "\t\"gpu_depth_prepass_ms\": null";
+	}
+	report << ",\n";
+
+	// What the dynamic resolution controller did over the measured frames (a scale of 1 throughout when it's off)
+	report << "\t\"dynamic_resolution\": { \"target_ms\": " << script.dynamicResolutionMs << ", \"min_scale\": " << resolutionScales.getMin()
+		<< ", \"avg_scale\": " << resolutionScales.getAverage() << ", \"max_scale\": " << resolutionScales.getMax()
+		<< ", \"changes\": " << renderer.getResolutionChangeCount() - resolutionChangesAtStart << ", \"scale_per_second\": [";
+	for (size_t i = 0; i < resolutionScaleSeconds.size(); i++) {
+		report << (i == 0 ? "" : ", ") << resolutionScaleSeconds[i];
+	}
+	report << "] },\n";
+	report << "\t\"draws_per_frame\": " << drawTotal / script.measuredFrames << ",\n";
+	report << "\t\"triangles_per_frame\": " << static_cast<uint64_t>(triangleTotal / script.measuredFrames) << ",\n";
+	// Per frame averages, objects are mesh instances (null when culling is off)
+	if (script.occlusionCulling) {
+		report << "\t\"occlusion_culling\": { \"objects\": " << cullObjectTotal / script.measuredFrames
+			<< ", \"drawn_first_pass\": " << cullFirstPassTotal / script.measuredFrames
+			<< ", \"drawn_second_pass\": " << cullSecondPassTotal / script.measuredFrames
+			<< ", \"triangles_submitted\": " << static_cast<uint64_t>(cullSubmittedTotal / script.measuredFrames)
+			<< ", \"triangles_drawn\": " << static_cast<uint64_t>(triangleTotal / script.measuredFrames) << " },\n";
+	} else {
+		report << "\t\"occlusion_culling\": null,\n";
+	}
+	// Only used when GPU culling is off
+	if (script.cpuOcclusionCulling && !script.occlusionCulling) {
+		report << "\t\"cpu_occlusion_culling\": { \"objects\": " << cpuCullTestedTotal / script.measuredFrames
+			<< ", \"culled\": " << cpuCullCulledTotal / script.measuredFrames
+			<< ", \"raster_ms\": " << cpuCullRasterMsTotal / script.measuredFrames
+			<< ", \"test_ms\": " << cpuCullTestMsTotal / script.measuredFrames << " },\n";
+	} else {
+		report << "\t\"cpu_occlusion_culling\": null,\n";
+	}
+	report << "\t\"peak_memory_bytes\": " << getPeakProcessMemory() << ",\n";
+	report << "\t\"upload_bytes_total\": " << uploadBytesTotal << ",\n";
+	report << "\t\"upload_bytes_max_frame\": " << uploadBytesMax << ",\n";
+	report << "\t\"upload_frames\": " << uploadFrames << ",\n";
+	report << "\t\"upload_deferred_frames\": " << uploadDeferredFrames << ",\n";
+	report << "\t\"texture_resident_bytes\": " << renderer.getTextureResidentBytes() << ",\n";
+
+	// Live device memory at the end of the run, by category and against the device local budget
+	report << "\t\"gpu_memory_bytes\": {";
+	for (size_t i = 0; i < static_cast<size_t>(MemoryCategory::Count); i++) {
+		MemoryCategory category = static_cast<MemoryCategory>(i);
+		report << (i == 0 ? " " : ", ") << "\"" << getMemoryCategoryName(category) << "\": " << GpuMemoryTracker::getCategoryUsage(category);
+	}
+	report << " },\n";
+
+	VkDeviceSize deviceLocalUsage = 0;
+	VkDeviceSize deviceLocalBudget = 0;
+	for (const auto& heap : GpuMemoryTracker::getHeapUsage()) {
+		if (heap.deviceLocal) {
+			deviceLocalUsage += heap.usage;
+			deviceLocalBudget += heap.budget;
+		}
+	}
+	report << "\t\"gpu_device_local_usage_bytes\": " << deviceLocalUsage << ",\n";
+	report << "\t\"gpu_device_local_budget_bytes\": " << deviceLocalBudget << "\n";
+	report << "}\n";
+
+	std::cout << report.str();
+
+	std::ofstream output(script.outputFile);
+	if (output.is_open()) {
+		output << report.str();
+	} else {
+		std::cout << "Failed to write benchmark report to " << script.outputFile << "\n";
+	}
+
+	Tracer::endCapture();
+	renderer.cleanup();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "DynamicResolution.h"
+
+class VulkanRenderer;
+
+// Windowless scene benchmark driven by a script, so runs of different builds render exactly the same frames.
+//
+// Script is one command per line, '#' starts a comment:
+//	resolution <width> <height>
+//	frames-in-flight <count>
+//	warmup <frames>							frames rendered before measuring
+//	frames <frames>							frames measured
+//	timestep <seconds>						fixed time between frames
+//	model <file> [x y z] [scale]			model to load and where to place it
+//	spin <degrees per second>				every model turns about Y at this rate
+//	camera <x y z> <target x y z>			fixed camera
+//	camera-orbit <radius> <height> <degrees per second>		camera circling the origin
+//	async-load								stream the models in while rendering instead of loading them before the first frame
+//	upload-budget <MiB> [microseconds]		most upload work per frame while streaming (0 = unlimited)
+//	texture-budget <MiB>					most device memory streamed texture levels may take (0 = unlimited)
+//	dynamic-resolution <ms> [min scale]		scale the scene's resolution to hold its GPU time at ms
+//	depth-prepass							lay down depth with a position only pass before the main pass
+//	occlusion-culling						cull meshes hidden behind others against a Hi-Z pyramid on the GPU
+//	cpu-occlusion-culling					cull them on the CPU against a software depth buffer of the largest meshes instead
+//	output <file>							JSON report (default benchmark.json)
+struct BenchmarkModel {
+	std::string fileName;
+	glm::vec3 position = glm::vec3(0.0f);
+	float scale = 1.0f;
+};
+
+struct BenchmarkScript {
+	std::string fileName;
+
+	uint32_t width = 1280;
+	uint32_t height = 960;
+	uint32_t framesInFlight = 0;			// 0 = renderer default
+
+	uint32_t warmupFrames = 60;
+	uint32_t measuredFrames = 600;
+	double timestep = 1.0 / 60.0;
+
+	std::vector<BenchmarkModel> models;
+	bool asyncLoad = false;
+	double uploadBudgetMiB = -1.0;			// < 0 = renderer default
+	uint32_t uploadBudgetMicroseconds = 0;
+	double textureBudgetMiB = -1.0;			// < 0 = renderer default
+	double dynamicResolutionMs = 0.0;		// 0 = always full resolution
+	float minResolutionScale = DEFAULT_MIN_RESOLUTION_SCALE;
+	bool depthPrepass = false;
+	bool occlusionCulling = false;
+	bool cpuOcclusionCulling = false;
+	float spinDegreesPerSecond = 0.0f;
+
+	bool orbitCamera = false;
+	glm::vec3 cameraPosition = glm::vec3(200.0f, 0.0f, 200.0f);
+	glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, -1.0f);
+	float orbitRadius = 200.0f;
+	float orbitHeight = 0.0f;
+	float orbitDegreesPerSecond = 0.0f;
+
+	std::string outputFile = "benchmark.json";
+};
+
+BenchmarkScript loadBenchmarkScript(const std::string& fileName);
+
+// Inits the renderer headless, plays the script and writes the JSON report. Returns EXIT_SUCCESS / EXIT_FAILURE
+int runSceneBenchmark(VulkanRenderer& renderer, const std::string& scriptFile);
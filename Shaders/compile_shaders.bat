@@ -1,7 +1,11 @@
 C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -V shader.vert
 C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -V shader.frag
+C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -o depth_vert.spv -V depth.vert
 
 C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -o second_vert.spv -V second.vert
 C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -o second_frag.spv -V second.frag
 
+C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -o hiz_comp.spv -V hiz.comp
+C:\VulkanSDK\1.3.250.1\Bin\glslangValidator.exe -o cull_comp.spv -V cull.comp
+
 pause
\ No newline at end of file
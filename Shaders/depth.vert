@@ -0,0 +1,31 @@
+#version 450		// Use GLSL 4.5
+
+// Position only stream (Mesh::getPositionBuffer), nothing else is needed to write depth
+layout (location = 0) in vec3 pos;
+
+layout (set = 0, binding = 0) uniform UboViewProjection {
+	mat4 projection;
+	mat4 view;
+} uboViewProjection;
+
+// Must match ObjectTransform in Utilities.h
+struct ObjectTransform {
+	vec4 model[3];		// Rows of the 3x4 affine model matrix
+	vec4 normal[3];		// Rows of the normal matrix (w unused)
+};
+
+layout (std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+	ObjectTransform objects[];
+} objectBuffer;
+
+// Must be computed exactly as in shader.vert, the main pass tests against this depth with EQUAL
+invariant gl_Position;
+
+void main(void) {
+	ObjectTransform object = objectBuffer.objects[gl_InstanceIndex];
+
+	vec4 localPos = vec4(pos, 1.0);
+	vec4 worldPos = vec4(dot(object.model[0], localPos), dot(object.model[1], localPos), dot(object.model[2], localPos), 1.0);
+
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * worldPos;
+}
@@ -2,22 +2,32 @@
 
 #extension GL_KHR_vulkan_glsl : enable
 
-layout (input_attachment_index = 0, binding = 0) uniform subpassInput inputColor; // Color output from Subpass 1
-layout (input_attachment_index = 1, binding = 1) uniform subpassInput inputDepth; // Depth output from Subpass 1
+layout (binding = 0) uniform sampler2D inputColor; // Color output from the scene pass
+layout (binding = 1) uniform sampler2D inputDepth; // Depth output from the scene pass
+
+// Scene only covers the top left part of its targets when the resolution is scaled down
+layout (push_constant) uniform Composite {
+	vec2 uvScale;		// Rendered size / target size
+	vec2 uvMax;			// Last texel centre inside the rendered part
+} composite;
+
+layout (location = 0) in vec2 fragUV;
 
 layout (location = 0) out vec4 color;
 
 void main(void) {
-	int xHalf = 1280 / 2;
-	if (gl_FragCoord.x > xHalf) {
+	vec2 uv = min(fragUV * composite.uvScale, composite.uvMax);
+
+	if (fragUV.x > 0.5) {
 		float lowerBound = 0.998;
 		float upperBound = 1.;
 
-		float depth = subpassLoad(inputDepth).r;
+		// Depth isn't filtered, read the nearest texel
+		float depth = texelFetch(inputDepth, ivec2(uv * textureSize(inputDepth, 0)), 0).r;
 
 		float depthColorScaled = 1.0f - ((depth - lowerBound) / (upperBound - lowerBound));
-		color = vec4(subpassLoad(inputColor).rgb * depthColorScaled, 1.0f);
+		color = vec4(texture(inputColor, uv).rgb * depthColorScaled, 1.0f);
 	} else {
-		color = subpassLoad(inputColor);
+		color = texture(inputColor, uv);
 	}
 }
\ No newline at end of file
@@ -9,6 +9,9 @@ vec2 positions[3] = vec2[] (
 	vec2(-1.0, 3.0)
 );
 
+layout (location = 0) out vec2 fragUV;	// 0 - 1 across the screen
+
 void main(void) {
 	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+	fragUV = positions[gl_VertexIndex] * 0.5 + 0.5;
 }
\ No newline at end of file
@@ -9,21 +9,31 @@ layout (set = 0, binding = 0) uniform UboViewProjection {
 	mat4 view;
 } uboViewProjection;
 
-// Not in use, left for reference
-layout (set = 0, binding = 1) uniform UboModel {
-	mat4 model;
-} uboModel;
+// Must match ObjectTransform in Utilities.h
+struct ObjectTransform {
+	vec4 model[3];		// Rows of the 3x4 affine model matrix
+	vec4 normal[3];		// Rows of the normal matrix (w unused)
+};
 
-layout(push_constant) uniform PushModel {
-	mat4 model;
-} pushModel;
+layout (std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+	ObjectTransform objects[];
+} objectBuffer;
+
+// Depth pre-pass (depth.vert) computes the same position, the main pass' EQUAL depth test needs it bit for bit identical
+invariant gl_Position;
 
 layout (location = 0) out vec3 fragCol;
 layout (location = 1) out vec2 fragTex;
 
 void main(void) {
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
+	// gl_InstanceIndex already includes the draw's firstInstance, so it indexes straight into the object buffer
+	ObjectTransform object = objectBuffer.objects[gl_InstanceIndex];
+
+	vec4 localPos = vec4(pos, 1.0);
+	vec4 worldPos = vec4(dot(object.model[0], localPos), dot(object.model[1], localPos), dot(object.model[2], localPos), 1.0);
+
+	gl_Position = uboViewProjection.projection * uboViewProjection.view * worldPos;
 
 	fragCol = col;
 	fragTex = tex;
-}
\ No newline at end of file
+}
@@ -0,0 +1,414 @@
+#include "SoftwareOcclusionCuller.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <future>
+#include <thread>
+
+// Fewer boxes than this aren't worth handing to other threads
+static const size_t MIN_BOXES_PER_THREAD = 256;
+
+// Triangles smaller than this (twice the area, in pixels) are skipped
+static const float MIN_TRIANGLE_AREA = 1e-4f;
+
+static uint32_t leftShiftMask(int32_t shift) {
+	// Shifting a 32 bit value by 32 is undefined, AVX2's variable shifts give 0
+	return shift >= 32 ? 0u : (~0u << shift);
+}
+
+// Coverage of a triangle on the 8 rows of a row of tiles. Ends of each row's span are pixel centre positions, minus the
+// half pixel so the first / last covered pixel is a ceil / floor away
+struct RowSpans {
+	float start[SOFTWARE_OCCLUSION_TILE_HEIGHT];
+	float end[SOFTWARE_OCCLUSION_TILE_HEIGHT];
+};
+
+SoftwareOcclusionCuller::SoftwareOcclusionCuller() {
+	width = 0;
+	height = 0;
+	tileColumns = 0;
+	tileRows = 0;
+	threadCount = 0;
+	viewProjection = glm::mat4(1.0f);
+	nearPlane = 0.1f;
+
+	setResolution(DEFAULT_SOFTWARE_OCCLUSION_WIDTH, DEFAULT_SOFTWARE_OCCLUSION_WIDTH * 3 / 4);
+}
+
+void SoftwareOcclusionCuller::setResolution(uint32_t newWidth, uint32_t newHeight) {
+	tileColumns = std::max((newWidth + SOFTWARE_OCCLUSION_TILE_WIDTH - 1) / SOFTWARE_OCCLUSION_TILE_WIDTH, 1u);
+	tileRows = std::max((newHeight + SOFTWARE_OCCLUSION_TILE_HEIGHT - 1) / SOFTWARE_OCCLUSION_TILE_HEIGHT, 1u);
+	width = tileColumns * SOFTWARE_OCCLUSION_TILE_WIDTH;
+	height = tileRows * SOFTWARE_OCCLUSION_TILE_HEIGHT;
+
+	tiles.resize(static_cast<size_t>(tileColumns) * tileRows);
+}
+
+uint32_t SoftwareOcclusionCuller::getWidth() {
+	return width;
+}
+
+uint32_t SoftwareOcclusionCuller::getHeight() {
+	return height;
+}
+
+void SoftwareOcclusionCuller::setThreadCount(uint32_t count) {
+	threadCount = count;
+}
+
+void SoftwareOcclusionCuller::beginFrame(const glm::mat4& newViewProjection, float newNearPlane) {
+	viewProjection = newViewProjection;
+	nearPlane = newNearPlane;
+
+	// Nothing drawn: the whole tile is as far as it goes, and there's no working layer
+	Tile emptyTile = { };
+	emptyTile.zMax0 = FLT_MAX;
+	emptyTile.zMax1 = 0.0f;
+	std::fill(tiles.begin(), tiles.end(), emptyTile);
+
+	triangles.clear();
+	stats = SoftwareOcclusionStats();
+}
+
+void SoftwareOcclusionCuller::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const glm::vec4* worldRows) {
+	stats.occluders++;
+	stats.occluderTriangles += static_cast<uint32_t>(indices.size() / 3);
+
+	// World matrix is stored as rows, glm wants columns
+	glm::mat4 world = glm::transpose(glm::mat4(worldRows[0], worldRows[1], worldRows[2], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+	glm::mat4 worldViewProjection = viewProjection * world;
+
+	clipPositions.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		clipPositions[i] = worldViewProjection * glm::vec4(positions[i], 1.0f);
+	}
+
+	glm::vec2 screenScale(width * 0.5f, height * 0.5f);
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		const glm::vec4& clip0 = clipPositions[indices[i]];
+		const glm::vec4& clip1 = clipPositions[indices[i + 1]];
+		const glm::vec4& clip2 = clipPositions[indices[i + 2]];
+
+		// Not clipped, dropping the triangle only leaves more visible
+		if (clip0.w < nearPlane || clip1.w < nearPlane || clip2.w < nearPlane) {
+			continue;
+		}
+
+		glm::vec2 screen[3];
+		float invW[3] = { 1.0f / clip0.w, 1.0f / clip1.w, 1.0f / clip2.w };
+		screen[0] = (glm::vec2(clip0) * invW[0] + 1.0f) * screenScale;
+		screen[1] = (glm::vec2(clip1) * invW[1] + 1.0f) * screenScale;
+		screen[2] = (glm::vec2(clip2) * invW[2] + 1.0f) * screenScale;
+
+		Triangle triangle;
+		triangle.boundsMin = glm::max(glm::min(glm::min(screen[0], screen[1]), screen[2]), glm::vec2(0.0f));
+		triangle.boundsMax = glm::min(glm::max(glm::max(screen[0], screen[1]), screen[2]), glm::vec2(width, height));
+		if (triangle.boundsMin.x >= triangle.boundsMax.x || triangle.boundsMin.y >= triangle.boundsMax.y) {
+			continue;
+		}
+
+		// Twice the signed area, the edge functions are flipped for clockwise triangles so inside is always >= 0
+		glm::vec2 edge1 = screen[1] - screen[0];
+		glm::vec2 edge2 = screen[2] - screen[0];
+		float area = edge1.x * edge2.y - edge2.x * edge1.y;
+		if (std::abs(area) < MIN_TRIANGLE_AREA) {
+			continue;
+		}
+		float orientation = area > 0.0f ? 1.0f : -1.0f;
+
+		for (int e = 0; e < 3; e++) {
+			const glm::vec2& from = screen[e];
+			const glm::vec2& to = screen[(e + 1) % 3];
+
+			// Inside when a * x + b * y + c >= 0
+			float a = (from.y - to.y) * orientation;
+			float b = (to.x - from.x) * orientation;
+			float c = (from.x * to.y - from.y * to.x) * orientation;
+
+			if (a == 0.0f) {
+				triangle.edgeKind[e] = EDGE_HORIZONTAL;
+				triangle.edgeSlope[e] = b;
+				triangle.edgeOffset[e] = c;
+			} else {
+				triangle.edgeKind[e] = a > 0.0f ? EDGE_LEFT : EDGE_RIGHT;
+				triangle.edgeSlope[e] = -b / a;
+				triangle.edgeOffset[e] = -c / a;
+			}
+		}
+
+		// Plane of 1 / w through the three vertices
+		float invWDelta1 = invW[1] - invW[0];
+		float invWDelta2 = invW[2] - invW[0];
+		triangle.invWPlane.x = (invWDelta1 * edge2.y - invWDelta2 * edge1.y) / area;
+		triangle.invWPlane.y = (invWDelta2 * edge1.x - invWDelta1 * edge2.x) / area;
+		triangle.invWPlane.z = invW[0] - triangle.invWPlane.x * screen[0].x - triangle.invWPlane.y * screen[0].y;
+		triangle.invWMin = std::min(std::min(invW[0], invW[1]), invW[2]);
+
+		triangle.firstTileColumn = static_cast<uint32_t>(triangle.boundsMin.x) / SOFTWARE_OCCLUSION_TILE_WIDTH;
+		triangle.lastTileColumn = std::min(static_cast<uint32_t>(triangle.boundsMax.x) / SOFTWARE_OCCLUSION_TILE_WIDTH, tileColumns - 1);
+		triangle.firstTileRow = static_cast<uint32_t>(triangle.boundsMin.y) / SOFTWARE_OCCLUSION_TILE_HEIGHT;
+		triangle.lastTileRow = std::min(static_cast<uint32_t>(triangle.boundsMax.y) / SOFTWARE_OCCLUSION_TILE_HEIGHT, tileRows - 1);
+
+		triangles.push_back(triangle);
+	}
+}
+
+void SoftwareOcclusionCuller::rasterize() {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stats.trianglesRasterized = static_cast<uint32_t>(triangles.size());
+
+	// Each worker owns a band of tile rows and goes through every triangle, keeping the order triangles reach a tile in
+	uint32_t workerCount = getWorkerCount(tileRows);
+	uint32_t rowsPerWorker = (tileRows + workerCount - 1) / workerCount;
+
+	std::vector<std::future<void>> workers;
+	for (uint32_t i = 1; i < workerCount; i++) {
+		uint32_t firstRow = i * rowsPerWorker;
+		uint32_t lastRow = std::min(firstRow + rowsPerWorker, tileRows) - 1;
+		if (firstRow < tileRows) {
+			workers.push_back(std::async(std::launch::async, &SoftwareOcclusionCuller::rasterizeTileRows, this, firstRow, lastRow));
+		}
+	}
+	rasterizeTileRows(0, std::min(rowsPerWorker, tileRows) - 1);
+
+	for (auto& worker : workers) {
+		worker.get();
+	}
+
+	stats.rasterMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SoftwareOcclusionCuller::testBoxes(const OcclusionBox* boxes, size_t count, uint8_t* visible) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t workerCount = getWorkerCount(count / MIN_BOXES_PER_THREAD);
+	size_t boxesPerWorker = (count + workerCount - 1) / std::max(workerCount, 1u);
+
+	std::vector<std::future<size_t>> workers;
+	for (uint32_t i = 1; i < workerCount; i++) {
+		size_t first = i * boxesPerWorker;
+		size_t last = std::min(first + boxesPerWorker, count);
+		if (first < last) {
+			workers.push_back(std::async(std::launch::async, &SoftwareOcclusionCuller::testBoxRange, this, boxes, first, last, visible));
+		}
+	}
+	size_t culled = testBoxRange(boxes, 0, std::min(boxesPerWorker, count), visible);
+
+	for (auto& worker : workers) {
+		culled += worker.get();
+	}
+
+	stats.objectsTested += static_cast<uint32_t>(count);
+	stats.objectsCulled += static_cast<uint32_t>(culled);
+	stats.testMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool SoftwareOcclusionCuller::testBox(const OcclusionBox& box) {
+	glm::mat4 world = glm::transpose(glm::mat4(box.worldRows[0], box.worldRows[1], box.worldRows[2], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+	glm::mat4 worldViewProjection = viewProjection * world;
+
+	// Culled if every corner is outside the same side of the screen
+	bool outsideLeft = true;
+	bool outsideRight = true;
+	bool outsideTop = true;
+	bool outsideBottom = true;
+	bool crossesNear = false;
+	glm::vec2 ndcMin(FLT_MAX);
+	glm::vec2 ndcMax(-FLT_MAX);
+	float nearest = FLT_MAX;
+
+	for (int i = 0; i < 8; i++) {
+		glm::vec4 corner(
+			(i & 1) == 0 ? box.boundsMin.x : box.boundsMax.x,
+			(i & 2) == 0 ? box.boundsMin.y : box.boundsMax.y,
+			(i & 4) == 0 ? box.boundsMin.z : box.boundsMax.z,
+			1.0f);
+		glm::vec4 clip = worldViewProjection * corner;
+
+		outsideLeft = outsideLeft && clip.x < -clip.w;
+		outsideRight = outsideRight && clip.x > clip.w;
+		outsideTop = outsideTop && clip.y < -clip.w;
+		outsideBottom = outsideBottom && clip.y > clip.w;
+
+		if (clip.w < nearPlane) {
+			crossesNear = true;
+		} else {
+			glm::vec2 ndc = glm::vec2(clip) / clip.w;
+			ndcMin = glm::min(ndcMin, ndc);
+			ndcMax = glm::max(ndcMax, ndc);
+			nearest = std::min(nearest, clip.w);
+		}
+	}
+
+	if (outsideLeft || outsideRight || outsideTop || outsideBottom) {
+		return false;
+	}
+
+	// Part of the box is too close to project, so where it lands on screen isn't known
+	if (crossesNear) {
+		return true;
+	}
+
+	// Every pixel the box's screen rectangle touches
+	glm::vec2 screenMin = (ndcMin + 1.0f) * glm::vec2(width * 0.5f, height * 0.5f);
+	glm::vec2 screenMax = (ndcMax + 1.0f) * glm::vec2(width * 0.5f, height * 0.5f);
+	int32_t minX = std::max(static_cast<int32_t>(std::floor(screenMin.x)), 0);
+	int32_t minY = std::max(static_cast<int32_t>(std::floor(screenMin.y)), 0);
+	int32_t maxX = std::min(static_cast<int32_t>(std::floor(screenMax.x)), static_cast<int32_t>(width) - 1);
+	int32_t maxY = std::min(static_cast<int32_t>(std::floor(screenMax.y)), static_cast<int32_t>(height) - 1);
+	if (minX > maxX || minY > maxY) {
+		return false;
+	}
+
+	for (int32_t tileRow = minY / SOFTWARE_OCCLUSION_TILE_HEIGHT; tileRow <= maxY / static_cast<int32_t>(SOFTWARE_OCCLUSION_TILE_HEIGHT); tileRow++) {
+		int32_t tileY = tileRow * SOFTWARE_OCCLUSION_TILE_HEIGHT;
+		int32_t firstRow = std::max(minY - tileY, 0);
+		int32_t lastRow = std::min(maxY - tileY, static_cast<int32_t>(SOFTWARE_OCCLUSION_TILE_HEIGHT) - 1);
+
+		for (int32_t tileColumn = minX / SOFTWARE_OCCLUSION_TILE_WIDTH; tileColumn <= maxX / static_cast<int32_t>(SOFTWARE_OCCLUSION_TILE_WIDTH); tileColumn++) {
+			const Tile& tile = tiles[tileRow * tileColumns + tileColumn];
+
+			// Behind the farthest depth of the whole tile, hidden here whatever the masks say
+			if (nearest > tile.zMax0) {
+				continue;
+			}
+
+			int32_t tileX = tileColumn * SOFTWARE_OCCLUSION_TILE_WIDTH;
+			uint32_t columns = leftShiftMask(std::max(minX - tileX, 0)) & ~leftShiftMask(std::min(maxX - tileX, 31) + 1);
+
+			// In front of the tile's far depth: visible on any pixel the working layer doesn't cover, or on one it
+			// does if it's in front of that too
+			bool inFrontOfWorkingLayer = nearest <= tile.zMax1;
+			for (int32_t row = firstRow; row <= lastRow; row++) {
+				uint32_t rectangle = columns;
+				if ((rectangle & ~tile.mask[row]) != 0 || (inFrontOfWorkingLayer && (rectangle & tile.mask[row]) != 0)) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+const SoftwareOcclusionStats& SoftwareOcclusionCuller::getStats() {
+	return stats;
+}
+
+SoftwareOcclusionCuller::~SoftwareOcclusionCuller() {
+}
+
+uint32_t SoftwareOcclusionCuller::getWorkerCount(size_t workItems) {
+	uint32_t workers = threadCount > 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	return static_cast<uint32_t>(std::max<size_t>(std::min<size_t>(workers, workItems), 1));
+}
+
+void SoftwareOcclusionCuller::rasterizeTileRows(uint32_t firstTileRow, uint32_t lastTileRow) {
+	// Rest of the project is built without AVX2, so it still runs on CPUs that don't have it
+	if (cpuSupportsAvx2()) {
+		rasterizeTileRowsAvx2(firstTileRow, lastTileRow);
+		return;
+	}
+
+	for (const Triangle& triangle : triangles) {
+		uint32_t firstRow = std::max(triangle.firstTileRow, firstTileRow);
+		uint32_t lastRow = std::min(triangle.lastTileRow, lastTileRow);
+
+		for (uint32_t tileRow = firstRow; tileRow <= lastRow; tileRow++) {
+			float tileY = static_cast<float>(tileRow * SOFTWARE_OCCLUSION_TILE_HEIGHT);
+
+			// Span of each of the 8 rows (at pixel centres), the edges bounding it on the left take the largest start
+			// and those on the right the smallest end
+			RowSpans spans;
+			for (uint32_t row = 0; row < SOFTWARE_OCCLUSION_TILE_HEIGHT; row++) {
+				float rowY = tileY + row + 0.5f;
+				float start = -FLT_MAX;
+				float end = FLT_MAX;
+				for (int e = 0; e < 3; e++) {
+					float x = triangle.edgeSlope[e] * rowY + triangle.edgeOffset[e];
+					if (triangle.edgeKind[e] == EDGE_LEFT) {
+						start = std::max(start, x);
+					} else if (triangle.edgeKind[e] == EDGE_RIGHT) {
+						end = std::min(end, x);
+					} else if (x < 0.0f) {
+						start = FLT_MAX;
+					}
+				}
+				spans.start[row] = start - 0.5f;
+				spans.end[row] = end - 0.5f;
+			}
+
+			for (uint32_t tileColumn = triangle.firstTileColumn; tileColumn <= triangle.lastTileColumn; tileColumn++) {
+				float tileX = static_cast<float>(tileColumn * SOFTWARE_OCCLUSION_TILE_WIDTH);
+
+				// Pixels x with start <= x + 0.5 <= end, as bits of the tile's rows. Clamped to the tile first, so the
+				// float to int conversion stays in range
+				uint32_t coverage[SOFTWARE_OCCLUSION_TILE_HEIGHT];
+				uint32_t anyCoverage = 0;
+				for (uint32_t row = 0; row < SOFTWARE_OCCLUSION_TILE_HEIGHT; row++) {
+					float firstPixel = std::min(std::max(std::ceil(spans.start[row] - tileX), 0.0f), static_cast<float>(SOFTWARE_OCCLUSION_TILE_WIDTH));
+					float endPixel = std::min(std::max(std::floor(spans.end[row] - tileX) + 1.0f, 0.0f), static_cast<float>(SOFTWARE_OCCLUSION_TILE_WIDTH));
+					coverage[row] = leftShiftMask(static_cast<int32_t>(firstPixel)) & ~leftShiftMask(static_cast<int32_t>(endPixel));
+					anyCoverage |= coverage[row];
+				}
+				if (anyCoverage == 0) {
+					continue;
+				}
+
+				addTileCoverage(tiles[tileRow * tileColumns + tileColumn], getTileDepth(triangle, tileX, tileY), coverage);
+			}
+		}
+	}
+}
+
+float SoftwareOcclusionCuller::getTileDepth(const Triangle& triangle, float tileX, float tileY) {
+	// Farthest the triangle gets over the part of its bounds in this tile: the plane's smallest 1 / w is at a corner of
+	// that rectangle, and never below the vertices' (where the plane leaves the triangle)
+	float depthMinX = std::max(triangle.boundsMin.x, tileX);
+	float depthMaxX = std::min(triangle.boundsMax.x, tileX + SOFTWARE_OCCLUSION_TILE_WIDTH);
+	float depthMinY = std::max(triangle.boundsMin.y, tileY);
+	float depthMaxY = std::min(triangle.boundsMax.y, tileY + SOFTWARE_OCCLUSION_TILE_HEIGHT);
+	float invWRowMin = triangle.invWPlane.z + std::min(triangle.invWPlane.y * depthMinY, triangle.invWPlane.y * depthMaxY);
+	float invWMin = invWRowMin + std::min(triangle.invWPlane.x * depthMinX, triangle.invWPlane.x * depthMaxX);
+
+	return 1.0f / std::max(invWMin, triangle.invWMin);
+}
+
+void SoftwareOcclusionCuller::addTileCoverage(Tile& tile, float triangleDepth, const uint32_t* coverage) {
+	// Working layer is dropped when the triangle is much nearer than it, compared to how far the working layer is in
+	// front of the tile's far depth. Either way the triangle starts or joins the working layer
+	float workingToTriangle = tile.zMax1 - triangleDepth;
+	float farToWorking = tile.zMax0 - tile.zMax1;
+	if (workingToTriangle > farToWorking) {
+		tile.zMax1 = 0.0f;
+		std::fill(tile.mask, tile.mask + SOFTWARE_OCCLUSION_TILE_HEIGHT, 0u);
+	}
+	tile.zMax1 = std::max(tile.zMax1, triangleDepth);
+
+	// Once the working layer covers the whole tile, its depth is the tile's far depth
+	uint32_t coveredBits = ~0u;
+	for (uint32_t row = 0; row < SOFTWARE_OCCLUSION_TILE_HEIGHT; row++) {
+		tile.mask[row] |= coverage[row];
+		coveredBits &= tile.mask[row];
+	}
+	if (coveredBits == ~0u) {
+		std::fill(tile.mask, tile.mask + SOFTWARE_OCCLUSION_TILE_HEIGHT, 0u);
+		tile.zMax0 = std::min(tile.zMax0, tile.zMax1);
+		tile.zMax1 = 0.0f;
+	}
+}
+
+size_t SoftwareOcclusionCuller::testBoxRange(const OcclusionBox* boxes, size_t first, size_t last, uint8_t* visible) {
+	size_t culled = 0;
+	for (size_t i = first; i < last; i++) {
+		visible[i] = testBox(boxes[i]) ? 1 : 0;
+		culled += visible[i] == 0 ? 1 : 0;
+	}
+
+	return culled;
+}
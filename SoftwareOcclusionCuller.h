@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// Depth buffer tiles: one 32 bit coverage mask per row, so a tile's 8 rows fill one 256 bit (AVX2) register
+const uint32_t SOFTWARE_OCCLUSION_TILE_WIDTH = 32;
+const uint32_t SOFTWARE_OCCLUSION_TILE_HEIGHT = 8;
+
+// Default resolution of the depth buffer (the height follows the view's aspect ratio)
+const uint32_t DEFAULT_SOFTWARE_OCCLUSION_WIDTH = 320;
+// Most occluder triangles rasterized a frame, the nearest occluders are added first
+const uint32_t MAX_SOFTWARE_OCCLUSION_TRIANGLES = 32768;
+
+// Mesh instance to test: object space bounding box and the rows of its 3x4 world matrix (as TransformSystem keeps them)
+struct OcclusionBox {
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	const glm::vec4* worldRows;
+};
+
+// Work done by the last frame
+struct SoftwareOcclusionStats {
+	uint32_t occluders = 0;					// Occluder instances added
+	uint32_t occluderTriangles = 0;			// Their triangles
+	uint32_t trianglesRasterized = 0;		// Of those, the ones in front of the near plane and on screen
+	uint32_t objectsTested = 0;
+	uint32_t objectsCulled = 0;
+	double rasterMs = 0.0;					// Wall time of rasterize()
+	double testMs = 0.0;					// Wall time of every testBoxes() call
+};
+
+// Occlusion culling on the CPU, for when GPU culling isn't available. A few large occluder meshes are rasterized at low
+// resolution into a masked depth buffer (as in Masked Software Occlusion Culling): each 32x8 tile keeps a farthest depth
+// for the whole tile, plus a coverage mask of the pixels a working layer of triangles covers and that layer's farthest
+// depth. Coverage is computed per pixel (8 rows at a time with AVX2 when the CPU has it), depth only per tile, so the
+// buffer is conservative: a box is only culled if everything it covers is certainly behind an occluder.
+//
+// Depth is view distance (clip space w). Occluder triangles with a vertex closer than the near plane are skipped rather
+// than clipped, which can only let more through. Rasterization is split across threads by rows of tiles, so threads
+// never write the same tile, and boxes are tested across threads in chunks
+class SoftwareOcclusionCuller {
+public:
+	SoftwareOcclusionCuller();
+
+	// Rounded up to whole tiles
+	void setResolution(uint32_t newWidth, uint32_t newHeight);
+	uint32_t getWidth();
+	uint32_t getHeight();
+	// Threads rasterize() and testBoxes() use, 0 = one per hardware thread
+	void setThreadCount(uint32_t count);
+
+	// Clears the depth buffer and the occluders
+	void beginFrame(const glm::mat4& newViewProjection, float newNearPlane);
+	// Triangles (indices into positions, object space) placed by the rows of a 3x4 world matrix
+	void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const glm::vec4* worldRows);
+	// Rasterizes every occluder added since beginFrame
+	void rasterize();
+
+	// visible[i] = 1 if boxes[i] may be visible, 0 if it's off screen or hidden behind the occluders
+	void testBoxes(const OcclusionBox* boxes, size_t count, uint8_t* visible);
+	bool testBox(const OcclusionBox& box);
+
+	const SoftwareOcclusionStats& getStats();
+
+	~SoftwareOcclusionCuller();
+
+private:
+	// 32x8 pixels, bit x of mask[y] is pixel x of the tile's row y
+	struct Tile {
+		uint32_t mask[SOFTWARE_OCCLUSION_TILE_HEIGHT];	// Pixels covered by the working layer
+		float zMax0;									// Farthest depth of anything over the whole tile
+		float zMax1;									// Farthest depth of the working layer
+	};
+
+	enum EdgeKind : uint32_t {
+		EDGE_LEFT = 0,
+		EDGE_RIGHT = 1,
+		EDGE_HORIZONTAL = 2
+	};
+
+	// Triangle set up in pixel space (pixel centres at + 0.5)
+	struct Triangle {
+		// Each edge bounds the row's coverage: x = slope * y + offset is the left or right end, a horizontal edge covers
+		// the whole row when slope * y + offset >= 0, and nothing otherwise
+		float edgeSlope[3];
+		float edgeOffset[3];
+		uint32_t edgeKind[3];
+		// 1 / w is linear in screen space: invW = invWPlane.x * x + invWPlane.y * y + invWPlane.z
+		glm::vec3 invWPlane;
+		float invWMin;									// Of the vertices (the farthest point)
+		glm::vec2 boundsMin;
+		glm::vec2 boundsMax;
+		uint32_t firstTileRow, lastTileRow;
+		uint32_t firstTileColumn, lastTileColumn;
+	};
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileColumns;
+	uint32_t tileRows;
+	uint32_t threadCount;
+
+	glm::mat4 viewProjection;
+	float nearPlane;
+
+	std::vector<Tile> tiles;
+	std::vector<Triangle> triangles;
+	std::vector<glm::vec4> clipPositions;				// Scratch space for addOccluder
+
+	SoftwareOcclusionStats stats;
+
+	uint32_t getWorkerCount(size_t workItems);
+	void rasterizeTileRows(uint32_t firstTileRow, uint32_t lastTileRow);
+	// Same as rasterizeTileRows, in SoftwareOcclusionCullerAvx2.cpp (built with AVX2), only called if the CPU supports it
+	void rasterizeTileRowsAvx2(uint32_t firstTileRow, uint32_t lastTileRow);
+	// Farthest depth of the triangle over the tile at (tileX, tileY)
+	float getTileDepth(const Triangle& triangle, float tileX, float tileY);
+	// Merges a triangle's coverage of the tile (a mask per row) into its working layer
+	void addTileCoverage(Tile& tile, float triangleDepth, const uint32_t* coverage);
+	size_t testBoxRange(const OcclusionBox* boxes, size_t first, size_t last, uint8_t* visible);
+};
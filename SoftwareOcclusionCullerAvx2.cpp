@@ -0,0 +1,65 @@
+#include "SoftwareOcclusionCuller.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include <immintrin.h>
+
+// The project builds this file alone with AVX2 (/arch:AVX2), GCC and Clang are told per function instead
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+AVX2_FUNCTION void SoftwareOcclusionCuller::rasterizeTileRowsAvx2(uint32_t firstTileRow, uint32_t lastTileRow) {
+	for (const Triangle& triangle : triangles) {
+		uint32_t firstRow = std::max(triangle.firstTileRow, firstTileRow);
+		uint32_t lastRow = std::min(triangle.lastTileRow, lastTileRow);
+
+		for (uint32_t tileRow = firstRow; tileRow <= lastRow; tileRow++) {
+			float tileY = static_cast<float>(tileRow * SOFTWARE_OCCLUSION_TILE_HEIGHT);
+
+			// Span of each of the 8 rows (at pixel centres), the edges bounding it on the left take the largest start
+			// and those on the right the smallest end. Less the half pixel, so the first / last covered pixel is a
+			// ceil / floor away
+			__m256 rowY = _mm256_add_ps(_mm256_set1_ps(tileY + 0.5f), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+			__m256 start = _mm256_set1_ps(-FLT_MAX);
+			__m256 end = _mm256_set1_ps(FLT_MAX);
+			for (int e = 0; e < 3; e++) {
+				__m256 x = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.edgeSlope[e]), rowY), _mm256_set1_ps(triangle.edgeOffset[e]));
+				if (triangle.edgeKind[e] == EDGE_LEFT) {
+					start = _mm256_max_ps(start, x);
+				} else if (triangle.edgeKind[e] == EDGE_RIGHT) {
+					end = _mm256_min_ps(end, x);
+				} else {
+					start = _mm256_blendv_ps(start, _mm256_set1_ps(FLT_MAX), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+			}
+			__m256 spanStart = _mm256_sub_ps(start, _mm256_set1_ps(0.5f));
+			__m256 spanEnd = _mm256_sub_ps(end, _mm256_set1_ps(0.5f));
+
+			for (uint32_t tileColumn = triangle.firstTileColumn; tileColumn <= triangle.lastTileColumn; tileColumn++) {
+				float tileX = static_cast<float>(tileColumn * SOFTWARE_OCCLUSION_TILE_WIDTH);
+
+				// Pixels x with start <= x + 0.5 <= end, as bits of the tile's rows. Clamped to the tile first, so the
+				// float to int conversion stays in range
+				__m256 tileLeft = _mm256_set1_ps(tileX);
+				__m256 zero = _mm256_setzero_ps();
+				__m256 tileWidth = _mm256_set1_ps(static_cast<float>(SOFTWARE_OCCLUSION_TILE_WIDTH));
+				__m256i firstPixel = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_ceil_ps(_mm256_sub_ps(spanStart, tileLeft)), zero), tileWidth));
+				__m256i endPixel = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_floor_ps(_mm256_sub_ps(spanEnd, tileLeft)), _mm256_set1_ps(1.0f)), zero), tileWidth));
+
+				__m256i allBits = _mm256_set1_epi32(-1);
+				__m256i rowMasks = _mm256_andnot_si256(_mm256_sllv_epi32(allBits, endPixel), _mm256_sllv_epi32(allBits, firstPixel));
+				if (_mm256_testz_si256(rowMasks, rowMasks)) {
+					continue;
+				}
+
+				uint32_t coverage[SOFTWARE_OCCLUSION_TILE_HEIGHT];
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(coverage), rowMasks);
+				addTileCoverage(tiles[tileRow * tileColumns + tileColumn], getTileDepth(triangle, tileX, tileY), coverage);
+			}
+		}
+	}
+}
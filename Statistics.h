@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+
+// Keeps the last windowSize samples of a value (frame time, GPU pass time...) and reports min / average / max / percentiles over them
+class RollingStatistics {
+public:
+	RollingStatistics(size_t newWindowSize = 512) : windowSize(newWindowSize), nextSample(0) {
+		samples.reserve(windowSize);
+	}
+
+	void addSample(double value) {
+		// Fill the window, then overwrite the oldest sample
+		if (samples.size() < windowSize) {
+			samples.push_back(value);
+		} else {
+			samples[nextSample] = value;
+		}
+		nextSample = (nextSample + 1) % windowSize;
+	}
+
+	void reset() {
+		samples.clear();
+		nextSample = 0;
+	}
+
+	size_t getSampleCount() const {
+		return samples.size();
+	}
+
+	double getMin() const {
+		return samples.empty() ? 0.0 : *std::min_element(samples.begin(), samples.end());
+	}
+
+	double getMax() const {
+		return samples.empty() ? 0.0 : *std::max_element(samples.begin(), samples.end());
+	}
+
+	double getAverage() const {
+		if (samples.empty()) {
+			return 0.0;
+		}
+
+		double total = 0.0;
+		for (double sample : samples) {
+			total += sample;
+		}
+		return total / samples.size();
+	}
+
+	// percentile in [0, 100], nearest-rank on a sorted copy of the window
+	double getPercentile(double percentile) const {
+		if (samples.empty()) {
+			return 0.0;
+		}
+
+		std::vector<double> sorted = samples;
+		size_t rank = static_cast<size_t>((percentile / 100.0) * (sorted.size() - 1) + 0.5);
+		rank = std::min(rank, sorted.size() - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+
+		return sorted[rank];
+	}
+
+private:
+	size_t windowSize;
+	size_t nextSample;
+	std::vector<double> samples;
+};
+
+// Wall time of named steps run one after another (start up phases). Work done on other threads at the same time can be
+// added with its own duration, it's reported but not counted in the total
+class PhaseTimer {
+public:
+	// Ends the running phase (if any) and starts timing the next one
+	void begin(const std::string& name) {
+		end();
+		currentName = name;
+		currentStart = std::chrono::steady_clock::now();
+		running = true;
+	}
+
+	void end() {
+		if (running) {
+			add(currentName, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - currentStart).count(), false);
+			running = false;
+		}
+	}
+
+	void add(const std::string& name, double milliseconds, bool overlapped) {
+		Phase phase = { name, milliseconds, overlapped };
+		phases.push_back(phase);
+	}
+
+	double getTotal() const {
+		double total = 0.0;
+		for (const auto& phase : phases) {
+			total += phase.overlapped ? 0.0 : phase.milliseconds;
+		}
+		return total;
+	}
+
+	void print(std::ostream& out) const {
+		for (const auto& phase : phases) {
+			out << "\t" << phase.name << ": " << phase.milliseconds << " ms" << (phase.overlapped ? " (worker thread, overlapped)" : "") << "\n";
+		}
+		out << "\ttotal: " << getTotal() << " ms\n";
+	}
+
+private:
+	struct Phase {
+		std::string name;
+		double milliseconds;
+		bool overlapped;
+	};
+	std::vector<Phase> phases;
+
+	bool running = false;
+	std::string currentName;
+	std::chrono::steady_clock::time_point currentStart;
+};
@@ -0,0 +1,249 @@
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <cstring>
+
+TextureResidency::TextureResidency() {
+	budget = 0;
+	committedBytes = 0;
+}
+
+void TextureResidency::setBudget(uint64_t bytes) {
+	budget = bytes;
+}
+
+uint64_t TextureResidency::getBudget() {
+	return budget;
+}
+
+uint32_t TextureResidency::addTexture(uint32_t width, uint32_t height, uint32_t mipLevels) {
+	TextureState texture = { };
+	texture.width = width;
+	texture.height = height;
+	texture.mipLevels = std::max(mipLevels, 1u);
+
+	// Finest level that's no bigger than the tail size (or the last level if the chain stops short of it)
+	texture.tailMip = 0;
+	while (texture.tailMip + 1 < texture.mipLevels && std::max(width >> texture.tailMip, height >> texture.tailMip) > TEXTURE_STREAMING_TAIL_SIZE) {
+		texture.tailMip++;
+	}
+
+	texture.residentMip = texture.tailMip;
+	texture.targetMip = texture.tailMip;
+	texture.requestedMip = texture.tailMip;
+	texture.lastUsedFrame = 0;
+	texture.used = false;
+	texture.removed = false;
+
+	committedBytes += getTargetSize(texture, texture.tailMip);
+
+	for (uint32_t i = 0; i < textures.size(); i++) {
+		if (textures[i].removed) {
+			textures[i] = texture;
+			return i;
+		}
+	}
+
+	textures.push_back(texture);
+
+	return static_cast<uint32_t>(textures.size() - 1);
+}
+
+void TextureResidency::removeTexture(uint32_t texture) {
+	TextureState& state = textures[texture];
+	if (state.removed) {
+		return;
+	}
+
+	committedBytes -= getTargetSize(state, state.targetMip);
+	state.used = false;
+	state.removed = true;
+}
+
+void TextureResidency::requestMip(uint32_t texture, uint32_t mip, uint64_t frame) {
+	TextureState& state = textures[texture];
+	if (state.removed) {
+		return;
+	}
+	mip = std::min(mip, state.mipLevels - 1);
+
+	if (!state.used || state.lastUsedFrame != frame) {
+		state.requestedMip = mip;
+	} else {
+		state.requestedMip = std::min(state.requestedMip, mip);
+	}
+
+	state.lastUsedFrame = frame;
+	state.used = true;
+}
+
+std::vector<TextureResidency::Change> TextureResidency::update(uint64_t frame, size_t maxChanges) {
+	std::vector<Change> changes;
+
+	// Budget may have been lowered, get back under it before streaming anything in
+	if (budget > 0 && committedBytes > budget) {
+		makeRoom(0, frame, UINT32_MAX, changes, maxChanges);
+	}
+
+	// Textures drawn this frame that need finer levels than they have, the furthest from what they need first
+	std::vector<uint32_t> upgrades;
+	for (uint32_t i = 0; i < textures.size(); i++) {
+		const TextureState& texture = textures[i];
+		if (texture.used && texture.lastUsedFrame == frame && texture.targetMip == texture.residentMip && texture.requestedMip < texture.residentMip) {
+			upgrades.push_back(i);
+		}
+	}
+
+	std::stable_sort(upgrades.begin(), upgrades.end(), [this](uint32_t a, uint32_t b) {
+		return textures[a].residentMip - textures[a].requestedMip > textures[b].residentMip - textures[b].requestedMip;
+	});
+
+	for (uint32_t index : upgrades) {
+		if (changes.size() >= maxChanges) {
+			break;
+		}
+
+		TextureState& texture = textures[index];
+		uint32_t mip = texture.requestedMip;
+		uint64_t residentSize = getTargetSize(texture, texture.residentMip);
+
+		if (budget > 0 && committedBytes + getTargetSize(texture, mip) - residentSize > budget) {
+			// Make room by evicting others, failing that stream in as much as fits
+			if (!makeRoom(getTargetSize(texture, mip) - residentSize, frame, index, changes, maxChanges)) {
+				while (mip < texture.residentMip && committedBytes + getTargetSize(texture, mip) - residentSize > budget) {
+					mip++;
+				}
+			}
+		}
+
+		if (mip == texture.residentMip || changes.size() >= maxChanges) {
+			continue;
+		}
+
+		committedBytes += getTargetSize(texture, mip) - residentSize;
+		texture.targetMip = mip;
+		changes.push_back({ index, mip });
+	}
+
+	return changes;
+}
+
+void TextureResidency::setResident(uint32_t texture, uint32_t mip) {
+	textures[texture].residentMip = mip;
+}
+
+uint32_t TextureResidency::getResidentMip(uint32_t texture) {
+	return textures[texture].residentMip;
+}
+
+uint32_t TextureResidency::getTailMip(uint32_t texture) {
+	return textures[texture].tailMip;
+}
+
+uint64_t TextureResidency::getResidentBytes() {
+	return committedBytes;
+}
+
+uint32_t TextureResidency::getMipLevelCount(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+uint64_t TextureResidency::getMipOffset(uint32_t width, uint32_t height, uint32_t mip) {
+	return getMipChainSize(width, height, 0, mip);
+}
+
+uint64_t TextureResidency::getMipChainSize(uint32_t width, uint32_t height, uint32_t firstMip, uint32_t mipLevels) {
+	uint64_t size = 0;
+	for (uint32_t level = firstMip; level < mipLevels; level++) {
+		size += static_cast<uint64_t>(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 4;
+	}
+	return size;
+}
+
+uint32_t TextureResidency::getMipForScreenSize(uint32_t width, uint32_t height, float screenPixels) {
+	uint32_t mipLevels = getMipLevelCount(width, height);
+	uint32_t size = std::max(width, height);
+
+	uint32_t mip = 0;
+	while (mip + 1 < mipLevels && static_cast<float>(size >> (mip + 1)) >= screenPixels) {
+		mip++;
+	}
+	return mip;
+}
+
+std::vector<unsigned char> TextureResidency::generateMipChain(const unsigned char* pixels, uint32_t width, uint32_t height) {
+	uint32_t mipLevels = getMipLevelCount(width, height);
+	std::vector<unsigned char> chain(static_cast<size_t>(getMipChainSize(width, height, 0, mipLevels)));
+
+	memcpy(chain.data(), pixels, static_cast<size_t>(width) * height * 4);
+
+	for (uint32_t level = 1; level < mipLevels; level++) {
+		uint32_t srcWidth = std::max(width >> (level - 1), 1u);
+		uint32_t srcHeight = std::max(height >> (level - 1), 1u);
+		uint32_t dstWidth = std::max(width >> level, 1u);
+		uint32_t dstHeight = std::max(height >> level, 1u);
+
+		const unsigned char* src = chain.data() + getMipOffset(width, height, level - 1);
+		unsigned char* dst = chain.data() + getMipOffset(width, height, level);
+
+		for (uint32_t y = 0; y < dstHeight; y++) {
+			// Odd sizes (and 1 pixel wide / tall levels) reuse the last row / column
+			uint32_t y0 = std::min(y * 2, srcHeight - 1);
+			uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+			for (uint32_t x = 0; x < dstWidth; x++) {
+				uint32_t x0 = std::min(x * 2, srcWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+
+				for (uint32_t c = 0; c < 4; c++) {
+					uint32_t sum = src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c]
+						+ src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+					dst[(y * dstWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	return chain;
+}
+
+uint64_t TextureResidency::getTargetSize(const TextureState& texture, uint32_t mip) {
+	return getMipChainSize(texture.width, texture.height, mip, texture.mipLevels);
+}
+
+bool TextureResidency::makeRoom(uint64_t bytes, uint64_t frame, uint32_t keepTexture, std::vector<Change>& changes, size_t maxChanges) {
+	// Textures holding finer levels than they need: not drawn this frame, or drawn smaller than what they have
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < textures.size(); i++) {
+		const TextureState& texture = textures[i];
+		bool holdsUnneededLevels = !texture.used || texture.lastUsedFrame < frame || texture.requestedMip > texture.residentMip;
+		if (i != keepTexture && !texture.removed && texture.targetMip == texture.residentMip && texture.residentMip < texture.tailMip && holdsUnneededLevels) {
+			candidates.push_back(i);
+		}
+	}
+
+	// Least recently used first
+	std::stable_sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) {
+		return textures[a].lastUsedFrame < textures[b].lastUsedFrame;
+	});
+
+	// One level per texture per frame (a texture only has one change in flight), so big deficits take a few frames
+	for (uint32_t index : candidates) {
+		if (committedBytes + bytes <= budget || changes.size() >= maxChanges) {
+			break;
+		}
+
+		TextureState& texture = textures[index];
+		uint32_t mip = texture.residentMip + 1;
+
+		committedBytes -= getTargetSize(texture, texture.residentMip) - getTargetSize(texture, mip);
+		texture.targetMip = mip;
+		changes.push_back({ index, mip });
+	}
+
+	return committedBytes + bytes <= budget;
+}
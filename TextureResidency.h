@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Textures start with only their mip tail (levels no bigger than this) on the GPU, finer levels are streamed in
+const uint32_t TEXTURE_STREAMING_TAIL_SIZE = 64;
+// Residency changes (new images to upload) started per frame
+const size_t MAX_TEXTURE_CHANGES_PER_FRAME = 4;
+
+// Decides which mip levels of each texture should be on the GPU. Textures ask for the finest level their draws need each
+// frame; update() hands back the changes to make (stream finer levels in, or evict the least recently used ones when the
+// budget is exceeded). Bookkeeping only, the renderer creates the images and reports back once a change is resident
+class TextureResidency {
+public:
+	struct Change {
+		uint32_t texture;
+		uint32_t mip;						// New finest resident level
+	};
+
+	TextureResidency();
+
+	// Most bytes textures may take on the GPU (0 = unlimited)
+	void setBudget(uint64_t bytes);
+	uint64_t getBudget();
+
+	// Returns the texture's id (the lowest removed texture's id, otherwise the next in order). Resident from its mip tail to
+	// start with
+	uint32_t addTexture(uint32_t width, uint32_t height, uint32_t mipLevels);
+	// Texture's levels no longer count against the budget and its id is free to be handed out again
+	void removeTexture(uint32_t texture);
+	// Finest level needed by a draw this frame, the finest of a frame's requests is kept
+	void requestMip(uint32_t texture, uint32_t mip, uint64_t frame);
+
+	// Changes to start this frame, at most maxChanges and none for textures with a change still in flight
+	std::vector<Change> update(uint64_t frame, size_t maxChanges);
+	// Change has completed, texture now has levels mip and coarser on the GPU
+	void setResident(uint32_t texture, uint32_t mip);
+
+	uint32_t getResidentMip(uint32_t texture);
+	uint32_t getTailMip(uint32_t texture);
+	uint64_t getResidentBytes();			// Levels on the GPU (in flight changes count at their target size)
+
+	// Level sizes for RGBA8 textures, each level half the size of the one above (rounded down, at least 1)
+	static uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+	static uint64_t getMipOffset(uint32_t width, uint32_t height, uint32_t mip);			// Bytes before level mip in a full chain
+	static uint64_t getMipChainSize(uint32_t width, uint32_t height, uint32_t firstMip, uint32_t mipLevels);
+
+	// Coarsest level with at least screenPixels texels across (a draw covering that many pixels wouldn't gain from finer ones)
+	static uint32_t getMipForScreenSize(uint32_t width, uint32_t height, float screenPixels);
+
+	// Full chain (level 0 first) of an RGBA8 image, each level a 2x2 box filter of the one above
+	static std::vector<unsigned char> generateMipChain(const unsigned char* pixels, uint32_t width, uint32_t height);
+
+private:
+	struct TextureState {
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t tailMip;
+		uint32_t residentMip;
+		uint32_t targetMip;					// Differs from residentMip while a change is in flight
+		uint32_t requestedMip;				// Finest level requested in lastUsedFrame
+		uint64_t lastUsedFrame;
+		bool used;							// Requested at least once
+		bool removed;
+	};
+
+	std::vector<TextureState> textures;
+	uint64_t budget;
+	uint64_t committedBytes;				// Every texture at its target level
+
+	uint64_t getTargetSize(const TextureState& texture, uint32_t mip);
+	// Evicts the top level of the least recently used textures until bytes more fit in the budget. False if they can't
+	bool makeRoom(uint64_t bytes, uint64_t frame, uint32_t keepTexture, std::vector<Change>& changes, size_t maxChanges);
+};
@@ -0,0 +1,189 @@
+#include "Tracer.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+// Events a thread can record in one capture, anything past this is dropped (and counted)
+static const size_t TRACE_EVENTS_PER_THREAD = 1 << 18;
+
+struct TraceEvent {
+	const char* name;
+	char phase;				// 'X' = complete scope, 'C' = counter
+	double timestampUs;
+	double value;			// Duration (us) of a scope, value of a counter
+};
+
+// Only ever written by the thread that owns it. count is published with release so the writer of the capture file
+// sees every event it counts
+struct TraceThreadBuffer {
+	uint32_t threadId;
+	std::vector<TraceEvent> events;
+	std::atomic<size_t> count;
+	std::atomic<size_t> dropped;
+};
+
+static std::mutex traceRegistryMutex;									// Only taken the first time a thread records
+static std::vector<std::unique_ptr<TraceThreadBuffer>> traceThreadBuffers;
+
+static std::atomic<bool> traceCapturing(false);
+static std::atomic<uint32_t> traceFramesLeft(0);
+static std::string traceFileName;
+
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+static TraceThreadBuffer* getThreadBuffer() {
+	thread_local TraceThreadBuffer* threadBuffer = nullptr;
+
+	if (threadBuffer == nullptr) {
+		std::unique_ptr<TraceThreadBuffer> newBuffer(new TraceThreadBuffer());
+		newBuffer->events.resize(TRACE_EVENTS_PER_THREAD);
+		newBuffer->count = 0;
+		newBuffer->dropped = 0;
+
+		std::lock_guard<std::mutex> lock(traceRegistryMutex);
+		newBuffer->threadId = static_cast<uint32_t>(traceThreadBuffers.size());
+		threadBuffer = newBuffer.get();
+		traceThreadBuffers.push_back(std::move(newBuffer));
+	}
+
+	return threadBuffer;
+}
+
+static void pushEvent(const TraceEvent& event) {
+	TraceThreadBuffer* threadBuffer = getThreadBuffer();
+
+	size_t index = threadBuffer->count.load(std::memory_order_relaxed);
+	if (index >= threadBuffer->events.size()) {
+		threadBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	threadBuffer->events[index] = event;
+	threadBuffer->count.store(index + 1, std::memory_order_release);
+}
+
+// Names are code literals, but escape anything that would break the JSON anyway
+static void writeJsonString(std::ofstream& file, const char* text) {
+	file << '"';
+	for (const char* c = text; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			file << '\\';
+		}
+		file << *c;
+	}
+	file << '"';
+}
+
+void Tracer::beginCapture(uint32_t frameCount, const std::string& fileName) {
+#if ENABLE_TRACING
+	{
+		std::lock_guard<std::mutex> lock(traceRegistryMutex);
+		for (auto& threadBuffer : traceThreadBuffers) {
+			threadBuffer->count = 0;
+			threadBuffer->dropped = 0;
+		}
+	}
+
+	traceFileName = fileName;
+	traceFramesLeft = frameCount;
+	traceCapturing = true;
+#else
+	std::cout << "Tracing was compiled out (ENABLE_TRACING is 0), " << fileName << " will not be written\n";
+#endif
+}
+
+void Tracer::endCapture() {
+	if (!traceCapturing.exchange(false)) {
+		return;
+	}
+
+	std::ofstream file(traceFileName);
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to open " + traceFileName + " for writing!");
+	}
+
+	// Timestamps are microseconds since start, keep them out of scientific notation
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	std::lock_guard<std::mutex> lock(traceRegistryMutex);
+
+	size_t eventCount = 0;
+	size_t droppedCount = 0;
+	bool first = true;
+	for (auto& threadBuffer : traceThreadBuffers) {
+		size_t count = threadBuffer->count.load(std::memory_order_acquire);
+		droppedCount += threadBuffer->dropped.load(std::memory_order_relaxed);
+
+		// Name the thread rows, the first thread to record is the main thread
+		std::string threadName = threadBuffer->threadId == 0 ? "Main" : "Worker " + std::to_string(threadBuffer->threadId);
+		file << (first ? "" : ",\n");
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadBuffer->threadId << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+		first = false;
+
+		for (size_t i = 0; i < count; i++) {
+			const TraceEvent& event = threadBuffer->events[i];
+
+			file << ",\n{\"name\":";
+			writeJsonString(file, event.name);
+			file << ",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << threadBuffer->threadId << ",\"ts\":" << event.timestampUs;
+			if (event.phase == 'X') {
+				file << ",\"dur\":" << event.value << "}";
+			} else {
+				file << ",\"args\":{\"value\":" << event.value << "}}";
+			}
+		}
+		eventCount += count;
+	}
+
+	file << "\n]}\n";
+
+	std::cout << "Wrote " << eventCount << " trace events to " << traceFileName;
+	if (droppedCount > 0) {
+		std::cout << " (" << droppedCount << " dropped, thread buffers full)";
+	}
+	std::cout << "\n";
+}
+
+bool Tracer::isCapturing() {
+	return traceCapturing.load(std::memory_order_relaxed);
+}
+
+void Tracer::endFrame() {
+	if (!isCapturing()) {
+		return;
+	}
+
+	if (traceFramesLeft.fetch_sub(1) <= 1) {
+		endCapture();
+	}
+}
+
+double Tracer::now() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+void Tracer::recordScope(const char* name, double startUs, double endUs) {
+	if (!isCapturing()) {
+		return;
+	}
+
+	TraceEvent event = { name, 'X', startUs, endUs - startUs };
+	pushEvent(event);
+}
+
+void Tracer::recordCounter(const char* name, double value) {
+	if (!isCapturing()) {
+		return;
+	}
+
+	TraceEvent event = { name, 'C', now(), value };
+	pushEvent(event);
+}
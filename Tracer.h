@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Define ENABLE_TRACING as 0 to compile every TRACE_* marker out
+#ifndef ENABLE_TRACING
+#define ENABLE_TRACING 1
+#endif
+
+// CPU tracer. Markers are only recorded while a capture is running, each thread appends to its own buffer so recording
+// never takes a lock. The capture is written as Chrome trace JSON (open in chrome://tracing or ui.perfetto.dev)
+class Tracer {
+public:
+	// Start recording, the capture is written to fileName once frameCount frames have ended (or on endCapture).
+	// Call while no other thread is recording
+	static void beginCapture(uint32_t frameCount, const std::string& fileName);
+	// Write the capture now (if one is running)
+	static void endCapture();
+	static bool isCapturing();
+
+	// Mark the end of a frame, counts down the frames left in the capture
+	static void endFrame();
+
+	// Microseconds since the tracer started
+	static double now();
+
+	static void recordScope(const char* name, double startUs, double endUs);
+	static void recordCounter(const char* name, double value);
+};
+
+// Records the time between its construction and destruction as a named scope. Name must be a string literal
+// (or otherwise outlive the capture), only the pointer is stored
+class TraceScope {
+public:
+	TraceScope(const char* newName) : name(newName), startUs(Tracer::isCapturing() ? Tracer::now() : -1.0) {
+	}
+
+	~TraceScope() {
+		if (startUs >= 0.0) {
+			Tracer::recordScope(name, startUs, Tracer::now());
+		}
+	}
+
+private:
+	const char* name;
+	double startUs;			// Negative if no capture was running when the scope started
+};
+
+#if ENABLE_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) Tracer::recordCounter(name, static_cast<double>(value))
+#define TRACE_FRAME_END() Tracer::endFrame()
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_COUNTER(name, value)
+#define TRACE_FRAME_END()
+#endif
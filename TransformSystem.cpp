@@ -0,0 +1,398 @@
+#include "TransformSystem.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// How far apart the per-axis scales can be, relative to the x scale, and still count as one scale
+static const float UNIFORM_SCALE_TOLERANCE = 1e-5f;
+
+TransformSystem::TransformSystem() {
+	count = 0;
+	anyDirty = false;
+}
+
+uint32_t TransformSystem::add(glm::vec3 position, glm::quat rotation, glm::vec3 scale, int parent) {
+	if (parent >= static_cast<int>(count)) {
+		throw std::runtime_error("Attempted to add a transform with a parent that doesn't exist yet.");
+	}
+
+	// Grow a whole block at a time, the spare slots hold identity transforms with no parent
+	if (count % 4 == 0) {
+		size_t paddedCount = count + 4;
+		positionX.resize(paddedCount, 0.0f);
+		positionY.resize(paddedCount, 0.0f);
+		positionZ.resize(paddedCount, 0.0f);
+		rotationX.resize(paddedCount, 0.0f);
+		rotationY.resize(paddedCount, 0.0f);
+		rotationZ.resize(paddedCount, 0.0f);
+		rotationW.resize(paddedCount, 1.0f);
+		scaleX.resize(paddedCount, 1.0f);
+		scaleY.resize(paddedCount, 1.0f);
+		scaleZ.resize(paddedCount, 1.0f);
+		parents.resize(paddedCount, -1);
+		worldRows.resize(paddedCount * 3);
+		uniformScale.resize(paddedCount, 1);
+		dirty.resize((paddedCount + 63) / 64, 0);
+	}
+
+	uint32_t id = static_cast<uint32_t>(count++);
+	parents[id] = parent;
+	setLocal(id, position, rotation, scale);
+
+	return id;
+}
+
+uint32_t TransformSystem::add(const glm::mat4& local, int parent) {
+	glm::vec3 position, scale;
+	glm::quat rotation;
+	decompose(local, position, rotation, scale);
+
+	return add(position, rotation, scale, parent);
+}
+
+size_t TransformSystem::getCount() {
+	return count;
+}
+
+std::vector<uint32_t> TransformSystem::remove(const std::vector<uint32_t>& ids) {
+	std::vector<uint32_t> remap(count, 0);
+	for (uint32_t id : ids) {
+		remap[id] = UINT32_MAX;
+	}
+
+	// Objects only move down, so each can be copied over an earlier slot in one pass in order (parents before children
+	// is kept)
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (remap[i] == UINT32_MAX) {
+			continue;
+		}
+		if (parents[i] >= 0 && remap[parents[i]] == UINT32_MAX) {
+			throw std::runtime_error("Attempted to remove a transform without its children.");
+		}
+
+		remap[i] = kept;
+		positionX[kept] = positionX[i];
+		positionY[kept] = positionY[i];
+		positionZ[kept] = positionZ[i];
+		rotationX[kept] = rotationX[i];
+		rotationY[kept] = rotationY[i];
+		rotationZ[kept] = rotationZ[i];
+		rotationW[kept] = rotationW[i];
+		scaleX[kept] = scaleX[i];
+		scaleY[kept] = scaleY[i];
+		scaleZ[kept] = scaleZ[i];
+		parents[kept] = parents[i] >= 0 ? static_cast<int32_t>(remap[parents[i]]) : -1;
+		for (int row = 0; row < 3; row++) {
+			worldRows[kept * 3 + row] = worldRows[i * 3 + row];
+		}
+		uniformScale[kept] = uniformScale[i];
+
+		// Dirty bits move with their objects
+		bool wasDirty = isDirty(i);
+		dirty[kept / 64] &= ~(1ull << (kept % 64));
+		if (wasDirty) {
+			dirty[kept / 64] |= 1ull << (kept % 64);
+		}
+		kept++;
+	}
+
+	count = kept;
+	size_t paddedCount = (count + 3) / 4 * 4;
+	positionX.resize(paddedCount);
+	positionY.resize(paddedCount);
+	positionZ.resize(paddedCount);
+	rotationX.resize(paddedCount);
+	rotationY.resize(paddedCount);
+	rotationZ.resize(paddedCount);
+	rotationW.resize(paddedCount);
+	scaleX.resize(paddedCount);
+	scaleY.resize(paddedCount);
+	scaleZ.resize(paddedCount);
+	parents.resize(paddedCount);
+	worldRows.resize(paddedCount * 3);
+	uniformScale.resize(paddedCount);
+	dirty.resize((paddedCount + 63) / 64);
+	resetPadding();
+
+	return remap;
+}
+
+void TransformSystem::setPosition(uint32_t id, glm::vec3 position) {
+	positionX[id] = position.x;
+	positionY[id] = position.y;
+	positionZ[id] = position.z;
+	markDirty(id);
+}
+
+void TransformSystem::setRotation(uint32_t id, glm::quat rotation) {
+	rotationX[id] = rotation.x;
+	rotationY[id] = rotation.y;
+	rotationZ[id] = rotation.z;
+	rotationW[id] = rotation.w;
+	markDirty(id);
+}
+
+void TransformSystem::setScale(uint32_t id, glm::vec3 scale) {
+	scaleX[id] = scale.x;
+	scaleY[id] = scale.y;
+	scaleZ[id] = scale.z;
+	markDirty(id);
+}
+
+void TransformSystem::setLocal(uint32_t id, glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+	setPosition(id, position);
+	setRotation(id, rotation);
+	setScale(id, scale);
+}
+
+void TransformSystem::setLocal(uint32_t id, const glm::mat4& local) {
+	glm::vec3 position, scale;
+	glm::quat rotation;
+	decompose(local, position, rotation, scale);
+
+	setLocal(id, position, rotation, scale);
+}
+
+glm::vec3 TransformSystem::getPosition(uint32_t id) {
+	return glm::vec3(positionX[id], positionY[id], positionZ[id]);
+}
+
+glm::quat TransformSystem::getRotation(uint32_t id) {
+	return glm::quat(rotationW[id], rotationX[id], rotationY[id], rotationZ[id]);
+}
+
+glm::vec3 TransformSystem::getScale(uint32_t id) {
+	return glm::vec3(scaleX[id], scaleY[id], scaleZ[id]);
+}
+
+int TransformSystem::getParent(uint32_t id) {
+	return parents[id];
+}
+
+void TransformSystem::update() {
+	if (!anyDirty) {
+		return;
+	}
+
+	// Children of changed objects have to be rebuilt too. Parents come first, so one pass passes changes all the way down
+	for (uint32_t i = 0; i < count; i++) {
+		if (parents[i] >= 0 && isDirty(parents[i])) {
+			markDirty(i);
+		}
+	}
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 maskW = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 uniformTolerance = _mm_set1_ps(UNIFORM_SCALE_TOLERANCE);
+
+	for (size_t first = 0; first < count; first += 4) {
+		// Skip blocks with nothing to rebuild (blocks never straddle a 64 bit word)
+		if (((dirty[first / 64] >> (first % 64)) & 0xF) == 0) {
+			continue;
+		}
+
+		// Local matrices of four objects at once, one per lane: rotation (from the quaternion) scaled per column, then
+		// translation in the last column. mRC is row R column C
+		__m128 qx = _mm_loadu_ps(&rotationX[first]);
+		__m128 qy = _mm_loadu_ps(&rotationY[first]);
+		__m128 qz = _mm_loadu_ps(&rotationZ[first]);
+		__m128 qw = _mm_loadu_ps(&rotationW[first]);
+		__m128 sx = _mm_loadu_ps(&scaleX[first]);
+		__m128 sy = _mm_loadu_ps(&scaleY[first]);
+		__m128 sz = _mm_loadu_ps(&scaleZ[first]);
+
+		// Lanes whose scale is the same on every axis (a negative one only mirrors)
+		__m128 absX = _mm_and_ps(sx, absMask);
+		__m128 maxDifference = _mm_mul_ps(absX, uniformTolerance);
+		__m128 uniformX = _mm_and_ps(_mm_cmple_ps(_mm_and_ps(_mm_sub_ps(_mm_and_ps(sy, absMask), absX), absMask), maxDifference),
+			_mm_cmple_ps(_mm_and_ps(_mm_sub_ps(_mm_and_ps(sz, absMask), absX), absMask), maxDifference));
+		int uniformLanes = _mm_movemask_ps(uniformX);
+
+		__m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+		__m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+		__m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+		__m128 m00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		__m128 m01 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		__m128 m02 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		__m128 m03 = _mm_loadu_ps(&positionX[first]);
+
+		__m128 m10 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		__m128 m11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		__m128 m12 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		__m128 m13 = _mm_loadu_ps(&positionY[first]);
+
+		__m128 m20 = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		__m128 m21 = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		__m128 m22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		__m128 m23 = _mm_loadu_ps(&positionZ[first]);
+
+		// Lanes to rows: after the transposes mRX holds row R of object X
+		_MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+		_MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+		_MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+		__m128 localRows[4][3] = {
+			{ m00, m10, m20 },
+			{ m01, m11, m21 },
+			{ m02, m12, m22 },
+			{ m03, m13, m23 }
+		};
+
+		// Objects in order, so a parent earlier in the same block is already done when its child gets here
+		size_t blockCount = std::min<size_t>(4, count - first);
+		for (size_t lane = 0; lane < blockCount; lane++) {
+			size_t id = first + lane;
+			__m128* world = reinterpret_cast<__m128*>(&worldRows[id * 3]);
+
+			// A rotation and one scale stay that way under a parent that is too, otherwise the product can shear
+			bool uniformLocal = ((uniformLanes >> lane) & 1) != 0;
+			uniformScale[id] = uniformLocal && (parents[id] < 0 || uniformScale[parents[id]] != 0) ? 1 : 0;
+
+			if (parents[id] < 0) {
+				for (int row = 0; row < 3; row++) {
+					_mm_storeu_ps(reinterpret_cast<float*>(&world[row]), localRows[lane][row]);
+				}
+				continue;
+			}
+
+			// world = parent world * local. Each row is the local rows weighted by the parent row, plus the parent's
+			// translation (the local matrix's implicit last row is 0, 0, 0, 1)
+			const float* parentWorld = &worldRows[parents[id] * 3].x;
+			for (int row = 0; row < 3; row++) {
+				__m128 parentRow = _mm_loadu_ps(parentWorld + row * 4);
+				__m128 result = _mm_mul_ps(_mm_shuffle_ps(parentRow, parentRow, _MM_SHUFFLE(0, 0, 0, 0)), localRows[lane][0]);
+				result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(parentRow, parentRow, _MM_SHUFFLE(1, 1, 1, 1)), localRows[lane][1]));
+				result = _mm_add_ps(result, _mm_mul_ps(_mm_shuffle_ps(parentRow, parentRow, _MM_SHUFFLE(2, 2, 2, 2)), localRows[lane][2]));
+				_mm_storeu_ps(reinterpret_cast<float*>(&world[row]), _mm_add_ps(result, _mm_and_ps(parentRow, maskW)));
+			}
+		}
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+	anyDirty = false;
+}
+
+const glm::vec4* TransformSystem::getWorldRows(uint32_t id) {
+	return &worldRows[id * 3];
+}
+
+void TransformSystem::write(const uint32_t* ids, size_t idCount, ObjectTransform* dst) {
+	// Rest of the project is built without AVX2, so it still runs on CPUs that don't have it
+	if (cpuSupportsAvx2()) {
+		writeAvx2(ids, idCount, dst);
+		return;
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (size_t first = 0; first < idCount; first += 4) {
+		// Short last group repeats its final object, only the real ones are stored
+		size_t groupCount = std::min<size_t>(4, idCount - first);
+		const float* worlds[4];
+		bool allUniform = true;
+		for (size_t lane = 0; lane < 4; lane++) {
+			uint32_t id = ids[first + std::min(lane, groupCount - 1)];
+			worlds[lane] = &worldRows[id * 3].x;
+			allUniform = allUniform && uniformScale[id] != 0;
+		}
+
+		// Rows straight out, then transposed to one object per lane for the normal matrices
+		__m128 w[3][4];
+		for (int row = 0; row < 3; row++) {
+			for (size_t lane = 0; lane < 4; lane++) {
+				w[row][lane] = _mm_loadu_ps(worlds[lane] + row * 4);
+				if (lane < groupCount) {
+					_mm_storeu_ps(&dst[first + lane].model[row].x, w[row][lane]);
+				}
+			}
+			_MM_TRANSPOSE4_PS(w[row][0], w[row][1], w[row][2], w[row][3]);
+		}
+
+		// Normal matrix = inverse transpose of the upper 3x3. For rows a, b, c its rows are b x c, c x a and a x b over
+		// the determinant. A rotation times scale s is its own inverse transpose times s squared, so those just divide
+		__m128 n[3][4];
+		__m128 scaleDivisor;
+		if (allUniform) {
+			for (int row = 0; row < 3; row++) {
+				for (int column = 0; column < 3; column++) {
+					n[row][column] = w[row][column];
+				}
+				n[row][3] = zero;
+			}
+			scaleDivisor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w[0][0], w[0][0]), _mm_mul_ps(w[0][1], w[0][1])), _mm_mul_ps(w[0][2], w[0][2]));
+		} else {
+			for (int row = 0; row < 3; row++) {
+				const __m128* u = w[(row + 1) % 3];
+				const __m128* v = w[(row + 2) % 3];
+				n[row][0] = _mm_sub_ps(_mm_mul_ps(u[1], v[2]), _mm_mul_ps(u[2], v[1]));
+				n[row][1] = _mm_sub_ps(_mm_mul_ps(u[2], v[0]), _mm_mul_ps(u[0], v[2]));
+				n[row][2] = _mm_sub_ps(_mm_mul_ps(u[0], v[1]), _mm_mul_ps(u[1], v[0]));
+				n[row][3] = zero;
+			}
+			scaleDivisor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w[0][0], n[0][0]), _mm_mul_ps(w[0][1], n[0][1])), _mm_mul_ps(w[0][2], n[0][2]));
+		}
+		__m128 inverseDivisor = _mm_and_ps(_mm_div_ps(one, scaleDivisor), _mm_cmpneq_ps(scaleDivisor, zero));
+
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++) {
+				n[row][column] = _mm_mul_ps(n[row][column], inverseDivisor);
+			}
+			_MM_TRANSPOSE4_PS(n[row][0], n[row][1], n[row][2], n[row][3]);
+			for (size_t lane = 0; lane < groupCount; lane++) {
+				_mm_storeu_ps(&dst[first + lane].normal[row].x, n[row][lane]);
+			}
+		}
+	}
+}
+
+void TransformSystem::decompose(const glm::mat4& matrix, glm::vec3& position, glm::quat& rotation, glm::vec3& scale) {
+	position = glm::vec3(matrix[3]);
+
+	glm::mat3 basis(matrix);
+	scale = glm::vec3(glm::length(basis[0]), glm::length(basis[1]), glm::length(basis[2]));
+	if (glm::determinant(basis) < 0.0f) {
+		scale.x = -scale.x;
+	}
+
+	// Rotation is what's left once the scale is divided out of each column
+	for (int column = 0; column < 3; column++) {
+		if (scale[column] != 0.0f) {
+			basis[column] /= scale[column];
+		}
+	}
+	rotation = glm::normalize(glm::quat_cast(basis));
+}
+
+void TransformSystem::resetPadding() {
+	for (size_t i = count; i < positionX.size(); i++) {
+		positionX[i] = 0.0f;
+		positionY[i] = 0.0f;
+		positionZ[i] = 0.0f;
+		rotationX[i] = 0.0f;
+		rotationY[i] = 0.0f;
+		rotationZ[i] = 0.0f;
+		rotationW[i] = 1.0f;
+		scaleX[i] = 1.0f;
+		scaleY[i] = 1.0f;
+		scaleZ[i] = 1.0f;
+		parents[i] = -1;
+		uniformScale[i] = 1;
+		dirty[i / 64] &= ~(1ull << (i % 64));
+	}
+}
+
+void TransformSystem::markDirty(uint32_t id) {
+	dirty[id / 64] |= 1ull << (id % 64);
+	anyDirty = true;
+}
+
+bool TransformSystem::isDirty(uint32_t id) {
+	return (dirty[id / 64] >> (id % 64)) & 1;
+}
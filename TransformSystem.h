@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "Utilities.h"
+
+// Position / rotation / scale of every object relative to its parent, kept in separate contiguous arrays (structure of
+// arrays) so world transforms can be rebuilt four objects at a time with SSE. Objects are stored in topological order (a
+// parent is always added before its children), so a single pass in order has every parent's world transform ready before
+// its children need it. Only objects changed since the last update, and their descendants, are recomputed. Normal
+// matrices are only worked out when transforms are written out for drawing (eight at a time with AVX2 when the CPU has
+// it), and objects whose world matrix is a rotation times one scale skip the inverse: theirs is the same rows over the
+// scale squared
+class TransformSystem {
+public:
+	TransformSystem();
+
+	// Returns the new object's id (ids are handed out in order). parent is an existing object, or -1 for a root
+	uint32_t add(glm::vec3 position, glm::quat rotation, glm::vec3 scale, int parent = -1);
+	uint32_t add(const glm::mat4& local, int parent = -1);
+	size_t getCount();
+	// Removes the objects (which must include all of their descendants) and closes the gaps, keeping the rest in order.
+	// Returns each old id's new id, UINT32_MAX for removed ones
+	std::vector<uint32_t> remove(const std::vector<uint32_t>& ids);
+
+	void setPosition(uint32_t id, glm::vec3 position);
+	void setRotation(uint32_t id, glm::quat rotation);
+	void setScale(uint32_t id, glm::vec3 scale);
+	void setLocal(uint32_t id, glm::vec3 position, glm::quat rotation, glm::vec3 scale);
+	// Decomposed into position / rotation / scale, so any shear is lost
+	void setLocal(uint32_t id, const glm::mat4& local);
+
+	glm::vec3 getPosition(uint32_t id);
+	glm::quat getRotation(uint32_t id);
+	glm::vec3 getScale(uint32_t id);
+	int getParent(uint32_t id);
+
+	// Recomputes the world matrix of every changed object and its descendants
+	void update();
+	// Rows of the 3x4 world matrix as of the last update (the last row is always 0, 0, 0, 1)
+	const glm::vec4* getWorldRows(uint32_t id);
+	// Writes the world transforms of ids, in that order, as the shader reads them (with the normal matrix) to dst. Write
+	// only, so dst can be a mapped upload buffer
+	void write(const uint32_t* ids, size_t idCount, ObjectTransform* dst);
+
+	// Position / rotation / scale of an affine matrix (a negative determinant flips the sign of scale.x)
+	static void decompose(const glm::mat4& matrix, glm::vec3& position, glm::quat& rotation, glm::vec3& scale);
+
+private:
+	size_t count;
+
+	// Padded to a multiple of 4 with identity transforms, so the kernel always reads whole blocks
+	std::vector<float> positionX;
+	std::vector<float> positionY;
+	std::vector<float> positionZ;
+	std::vector<float> rotationX;
+	std::vector<float> rotationY;
+	std::vector<float> rotationZ;
+	std::vector<float> rotationW;
+	std::vector<float> scaleX;
+	std::vector<float> scaleY;
+	std::vector<float> scaleZ;
+	std::vector<int32_t> parents;
+
+	std::vector<uint64_t> dirty;			// One bit per object
+	bool anyDirty;
+
+	std::vector<glm::vec4> worldRows;		// 3 per object
+	std::vector<uint8_t> uniformScale;		// 1 if the world matrix is a rotation (or mirror) times one scale
+
+	// Same as write, in TransformSystemAvx2.cpp (built with AVX2), only called if the CPU supports it
+	void writeAvx2(const uint32_t* ids, size_t idCount, ObjectTransform* dst);
+	// Puts the spare slots past count back to identity transforms with no parent
+	void resetPadding();
+	void markDirty(uint32_t id);
+	bool isDirty(uint32_t id);
+};
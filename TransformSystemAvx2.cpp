@@ -0,0 +1,103 @@
+#include "TransformSystem.h"
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+// The project builds this file alone with AVX2 (/arch:AVX2), GCC and Clang are told per function instead
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+// Rows of 8 objects (a0..a7, one __m128 each) to components: out[c] lane i is component c of object i
+AVX2_FUNCTION static inline void transposeRows(const __m128* rows, __m256* out) {
+	__m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(rows[0]), rows[4], 1);
+	__m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(rows[1]), rows[5], 1);
+	__m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(rows[2]), rows[6], 1);
+	__m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(rows[3]), rows[7], 1);
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	out[0] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	out[1] = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	out[2] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	out[3] = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+AVX2_FUNCTION void TransformSystem::writeAvx2(const uint32_t* ids, size_t idCount, ObjectTransform* dst) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	for (size_t first = 0; first < idCount; first += 8) {
+		// Short last group repeats its final object, only the real ones are stored
+		size_t groupCount = std::min<size_t>(8, idCount - first);
+		const float* worlds[8];
+		bool allUniform = true;
+		for (size_t lane = 0; lane < 8; lane++) {
+			uint32_t id = ids[first + std::min(lane, groupCount - 1)];
+			worlds[lane] = &worldRows[id * 3].x;
+			allUniform = allUniform && uniformScale[id] != 0;
+		}
+
+		// Rows straight out, then transposed to one object per lane for the normal matrices
+		__m256 w[3][4];
+		for (int row = 0; row < 3; row++) {
+			__m128 rows[8];
+			for (size_t lane = 0; lane < 8; lane++) {
+				rows[lane] = _mm_loadu_ps(worlds[lane] + row * 4);
+				if (lane < groupCount) {
+					_mm_storeu_ps(&dst[first + lane].model[row].x, rows[lane]);
+				}
+			}
+			transposeRows(rows, w[row]);
+		}
+
+		// Same normal matrix as write: cofactors over the determinant, or for a rotation times one scale the rows over
+		// the scale squared
+		__m256 n[3][3];
+		__m256 scaleDivisor;
+		if (allUniform) {
+			for (int row = 0; row < 3; row++) {
+				for (int column = 0; column < 3; column++) {
+					n[row][column] = w[row][column];
+				}
+			}
+			scaleDivisor = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w[0][0], w[0][0]), _mm256_mul_ps(w[0][1], w[0][1])), _mm256_mul_ps(w[0][2], w[0][2]));
+		} else {
+			for (int row = 0; row < 3; row++) {
+				const __m256* u = w[(row + 1) % 3];
+				const __m256* v = w[(row + 2) % 3];
+				n[row][0] = _mm256_sub_ps(_mm256_mul_ps(u[1], v[2]), _mm256_mul_ps(u[2], v[1]));
+				n[row][1] = _mm256_sub_ps(_mm256_mul_ps(u[2], v[0]), _mm256_mul_ps(u[0], v[2]));
+				n[row][2] = _mm256_sub_ps(_mm256_mul_ps(u[0], v[1]), _mm256_mul_ps(u[1], v[0]));
+			}
+			scaleDivisor = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w[0][0], n[0][0]), _mm256_mul_ps(w[0][1], n[0][1])), _mm256_mul_ps(w[0][2], n[0][2]));
+		}
+		__m256 inverseDivisor = _mm256_and_ps(_mm256_div_ps(one, scaleDivisor), _mm256_cmp_ps(scaleDivisor, zero, _CMP_NEQ_UQ));
+
+		for (int row = 0; row < 3; row++) {
+			__m256 x = _mm256_mul_ps(n[row][0], inverseDivisor);
+			__m256 y = _mm256_mul_ps(n[row][1], inverseDivisor);
+			__m256 z = _mm256_mul_ps(n[row][2], inverseDivisor);
+			// Back to one object per 128 bit lane
+			__m256 t0 = _mm256_unpacklo_ps(x, y);
+			__m256 t1 = _mm256_unpackhi_ps(x, y);
+			__m256 t2 = _mm256_unpacklo_ps(z, zero);
+			__m256 t3 = _mm256_unpackhi_ps(z, zero);
+			__m256 o0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 o1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+			__m256 o2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			__m256 o3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+			__m128 out[8] = {
+				_mm256_castps256_ps128(o0), _mm256_castps256_ps128(o1), _mm256_castps256_ps128(o2), _mm256_castps256_ps128(o3),
+				_mm256_extractf128_ps(o0, 1), _mm256_extractf128_ps(o1, 1), _mm256_extractf128_ps(o2, 1), _mm256_extractf128_ps(o3, 1)
+			};
+			for (size_t lane = 0; lane < groupCount; lane++) {
+				_mm_storeu_ps(&dst[first + lane].normal[row].x, out[lane]);
+			}
+		}
+	}
+}
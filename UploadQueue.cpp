@@ -0,0 +1,506 @@
+#include "UploadQueue.h"
+
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#include "Tracer.h"
+
+// Chunks are placed in the staging buffer at this alignment (buffer to image copies need a multiple of the texel size)
+static const VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static VkDeviceSize alignStaging(VkDeviceSize size) {
+	return (size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+}
+
+// Bytes of one RGBA8 mip level
+static VkDeviceSize getImageLevelSize(uint32_t width, uint32_t height, uint32_t mipLevel) {
+	return static_cast<VkDeviceSize>(std::max(width >> mipLevel, 1u)) * std::max(height >> mipLevel, 1u) * 4;
+}
+
+UploadQueue::UploadQueue() {
+	physicalDevice = nullptr;
+	device = nullptr;
+	timeline = nullptr;
+	commandPool = VK_NULL_HANDLE;
+	profiler = nullptr;
+	budgetBytes = DEFAULT_UPLOAD_BUDGET_BYTES;
+	budgetMicroseconds = DEFAULT_UPLOAD_BUDGET_MICROSECONDS;
+	openBatchId = 0;
+	openBatchPriority = 0;
+	nextBatchId = 1;
+	stagingBuffer = VK_NULL_HANDLE;
+	stagingBufferMemory = VK_NULL_HANDLE;
+	stagingData = nullptr;
+	stagingCapacity = 0;
+	stagingHead = 0;
+	stagingUsed = 0;
+	profiledSubmissionInFlight = false;
+}
+
+void UploadQueue::init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, GpuTimeline* newTimeline, uint32_t queueFamilyIndex, GpuProfiler* newProfiler) {
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+	timeline = newTimeline;
+	profiler = newProfiler;
+
+	// Upload command buffers are short lived and freed one by one
+	VkCommandPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create an Upload Command Pool!");
+	}
+}
+
+void UploadQueue::destroy() {
+	if (!submissions.empty()) {
+		timeline->wait(submissions.back().timelineValue);
+	}
+	while (!submissions.empty()) {
+		retireOldestSubmission();
+	}
+
+	pendingUploads.clear();
+	batches.clear();
+	openBatchId = 0;
+
+	if (stagingBuffer != VK_NULL_HANDLE) {
+		vkUnmapMemory(device, stagingBufferMemory);
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		GpuMemoryTracker::free(device, stagingBufferMemory);
+		stagingBuffer = VK_NULL_HANDLE;
+		stagingData = nullptr;
+		stagingCapacity = 0;
+	}
+
+	if (commandPool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(device, commandPool, nullptr);
+		commandPool = VK_NULL_HANDLE;
+	}
+}
+
+void UploadQueue::setBudget(VkDeviceSize bytesPerFrame, uint32_t microsecondsPerFrame) {
+	budgetBytes = bytesPerFrame;
+	budgetMicroseconds = microsecondsPerFrame;
+}
+
+void UploadQueue::beginBatch(int priority) {
+	if (openBatchId != 0) {
+		throw std::runtime_error("Failed to begin an upload batch, one is already open!");
+	}
+
+	openBatchId = nextBatchId++;
+	openBatchPriority = priority;
+
+	BatchState batch = { };
+	batches[openBatchId] = batch;
+}
+
+void UploadQueue::queueBuffer(VkBuffer dstBuffer, UploadData data, VkDeviceSize size) {
+	PendingUpload upload = { };
+	upload.dstBuffer = dstBuffer;
+	upload.data = data;
+	upload.size = size;
+
+	queueUpload(upload);
+}
+
+void UploadQueue::queueImage(VkImage dstImage, UploadData pixels, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	PendingUpload upload = { };
+	upload.dstImage = dstImage;
+	upload.width = width;
+	upload.height = height;
+	upload.mipLevels = mipLevels;
+	upload.data = pixels;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		upload.size += getImageLevelSize(width, height, level);
+	}
+
+	queueUpload(upload);
+}
+
+uint64_t UploadQueue::submitBatch() {
+	if (openBatchId == 0) {
+		throw std::runtime_error("Failed to submit an upload batch, none is open!");
+	}
+
+	uint64_t batchId = openBatchId;
+	openBatchId = 0;
+
+	// Nothing was queued, so it's already complete
+	BatchState& batch = batches[batchId];
+	batch.submitted = true;
+	if (batch.unfinishedUploads == 0) {
+		batches.erase(batchId);
+	}
+
+	return batchId;
+}
+
+void UploadQueue::update() {
+	// Timeline values only grow, so submissions complete (and free their staging ranges) in the order they were made
+	while (!submissions.empty() && timeline->isComplete(submissions.front().timelineValue)) {
+		retireOldestSubmission();
+	}
+
+	frameStats = UploadStats();
+	recordUploads(true);
+
+	TRACE_COUNTER("Upload bytes", static_cast<double>(frameStats.bytes));
+	TRACE_COUNTER("Upload bytes deferred", static_cast<double>(frameStats.bytesDeferred));
+}
+
+bool UploadQueue::isComplete(uint64_t batchId) {
+	return batchId < nextBatchId && batches.find(batchId) == batches.end();
+}
+
+void UploadQueue::waitForBatch(uint64_t batchId) {
+	if (batchId == openBatchId) {
+		throw std::runtime_error("Failed to wait for an upload batch, it hasn't been submitted!");
+	}
+
+	if (isComplete(batchId)) {
+		return;
+	}
+
+	// Everything still queued goes now, then wait for all of it (the batch's uploads may be spread over several submissions,
+	// more than one here if they don't fit in the staging ring at once)
+	while (!pendingUploads.empty()) {
+		recordUploads(false);
+	}
+
+	if (!submissions.empty()) {
+		timeline->wait(submissions.back().timelineValue);
+	}
+	while (!submissions.empty()) {
+		retireOldestSubmission();
+	}
+}
+
+const UploadStats& UploadQueue::getFrameStats() {
+	return frameStats;
+}
+
+size_t UploadQueue::getPendingUploadCount() {
+	return pendingUploads.size();
+}
+
+UploadQueue::~UploadQueue() {
+}
+
+void UploadQueue::queueUpload(PendingUpload upload) {
+	if (openBatchId == 0) {
+		throw std::runtime_error("Failed to queue an upload, no upload batch is open!");
+	}
+
+	if (upload.size == 0) {
+		return;
+	}
+
+	upload.batchId = openBatchId;
+	upload.priority = openBatchPriority;
+	upload.recorded = 0;
+	batches[openBatchId].unfinishedUploads++;
+
+	// After everything of the same or higher priority, so uploads of equal priority keep their order
+	auto position = std::find_if(pendingUploads.begin(), pendingUploads.end(), [&upload](const PendingUpload& pending) {
+		return pending.priority < upload.priority;
+	});
+	pendingUploads.insert(position, upload);
+}
+
+void UploadQueue::recordUploads(bool limited) {
+	if (pendingUploads.empty()) {
+		return;
+	}
+
+	TRACE_SCOPE("Record uploads");
+	auto start = std::chrono::steady_clock::now();
+
+	bool limitBytes = limited && budgetBytes > 0;
+	bool limitTime = limited && budgetMicroseconds > 0;
+
+	// One range of the staging ring for the whole submission, sized for what's queued up to the budget. Always big enough
+	// for the first upload's smallest chunk (one row of an image), so the queue can't stall on an image wider than the budget
+	VkDeviceSize stagingSize = 0;
+	for (const auto& upload : pendingUploads) {
+		stagingSize += alignStaging(upload.size - upload.recorded);
+		if (limitBytes && stagingSize >= budgetBytes) {
+			stagingSize = alignStaging(budgetBytes);
+			break;
+		}
+	}
+
+	VkDeviceSize minimumSize = STAGING_ALIGNMENT;
+	const PendingUpload& first = pendingUploads.front();
+	if (first.dstImage != VK_NULL_HANDLE) {
+		minimumSize = alignStaging(static_cast<VkDeviceSize>(first.width) * 4);
+		stagingSize = std::max(stagingSize, minimumSize);
+	}
+
+	ensureStagingRing(minimumSize);
+
+	// Budgeted frames skip uploading rather than stall on the GPU when earlier frames' copies still fill the ring
+	VkDeviceSize stagingRangeOffset = 0;
+	VkDeviceSize stagingSkipped = 0;
+	stagingSize = findStagingSpace(stagingSize, minimumSize, !limited, &stagingRangeOffset, &stagingSkipped);
+	if (stagingSize == 0) {
+		for (const auto& upload : pendingUploads) {
+			frameStats.bytesDeferred += upload.size - upload.recorded;
+		}
+		frameStats.uploadsDeferred = static_cast<uint32_t>(pendingUploads.size());
+		return;
+	}
+
+	Submission submission = { };
+	submission.profilerScope = -1;
+	submission.stagingOffset = stagingRangeOffset;
+
+	unsigned char* staging = stagingData + stagingRangeOffset;
+
+	VkCommandBufferAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &submission.commandBuffer);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate an Upload Command Buffer!");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(submission.commandBuffer, &beginInfo);
+
+	// Timestamp queries for uploads only have room for one submission, later ones go untimed until it's read back
+	if (profiler != nullptr && profiler->isEnabled() && !profiledSubmissionInFlight) {
+		profiler->beginImmediate(submission.commandBuffer);
+		submission.profilerScope = profiler->beginScope(submission.commandBuffer, "Uploads");
+	}
+
+	VkDeviceSize stagingOffset = 0;
+	while (!pendingUploads.empty() && stagingOffset < stagingSize) {
+		// The first chunk always goes, so uploads keep moving however small the time budget
+		if (limitTime && frameStats.chunks > 0) {
+			auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			if (elapsed >= static_cast<long long>(budgetMicroseconds)) {
+				break;
+			}
+		}
+
+		PendingUpload& upload = pendingUploads.front();
+		VkDeviceSize chunkSize = std::min(upload.size - upload.recorded, stagingSize - stagingOffset);
+
+		if (upload.dstImage != VK_NULL_HANDLE) {
+			// Find the mip level the next rows belong to. A chunk never crosses levels, it's split on whole rows of one
+			uint32_t mipLevel = 0;
+			VkDeviceSize levelOffset = 0;
+			while (levelOffset + getImageLevelSize(upload.width, upload.height, mipLevel) <= upload.recorded) {
+				levelOffset += getImageLevelSize(upload.width, upload.height, mipLevel);
+				mipLevel++;
+			}
+
+			uint32_t levelWidth = std::max(upload.width >> mipLevel, 1u);
+			VkDeviceSize rowSize = static_cast<VkDeviceSize>(levelWidth) * 4;
+			VkDeviceSize levelRemaining = levelOffset + getImageLevelSize(upload.width, upload.height, mipLevel) - upload.recorded;
+
+			uint32_t firstRow = static_cast<uint32_t>((upload.recorded - levelOffset) / rowSize);
+			uint32_t rowCount = static_cast<uint32_t>(std::min(chunkSize, levelRemaining) / rowSize);
+			if (rowCount == 0) {
+				break;
+			}
+			chunkSize = rowCount * rowSize;
+
+			if (upload.recorded == 0) {
+				recordTransitionImageLayout(submission.commandBuffer, upload.dstImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.mipLevels);
+			}
+
+			memcpy(staging + stagingOffset, static_cast<const unsigned char*>(upload.data.get()) + upload.recorded, static_cast<size_t>(chunkSize));
+			recordCopyImageBuffer(submission.commandBuffer, stagingBuffer, upload.dstImage, levelWidth, rowCount, stagingRangeOffset + stagingOffset, firstRow, mipLevel);
+
+			// Image stays a transfer destination between chunks, it isn't sampled until its batch is complete
+			if (upload.recorded + chunkSize == upload.size) {
+				recordTransitionImageLayout(submission.commandBuffer, upload.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, upload.mipLevels);
+			}
+		} else {
+			memcpy(staging + stagingOffset, static_cast<const unsigned char*>(upload.data.get()) + upload.recorded, static_cast<size_t>(chunkSize));
+
+			VkBufferCopy bufferCopyRegion = { };
+			bufferCopyRegion.srcOffset = stagingRangeOffset + stagingOffset;
+			bufferCopyRegion.dstOffset = upload.recorded;
+			bufferCopyRegion.size = chunkSize;
+
+			vkCmdCopyBuffer(submission.commandBuffer, stagingBuffer, upload.dstBuffer, 1, &bufferCopyRegion);
+		}
+
+		upload.recorded += chunkSize;
+		stagingOffset = alignStaging(stagingOffset + chunkSize);
+		frameStats.bytes += chunkSize;
+		frameStats.chunks++;
+
+		// Rest of a part done upload goes in the next chunk (the next mip level), or next frame if it's out of room
+		if (upload.recorded < upload.size) {
+			continue;
+		}
+
+		submission.finishedUploads.push_back(upload.batchId);
+		frameStats.uploadsFinished++;
+		pendingUploads.pop_front();
+	}
+
+	// Only what was written stays held, the rest of the range is free for the next submission
+	submission.stagingReserved = stagingSkipped + stagingOffset;
+	stagingHead = (stagingRangeOffset + stagingOffset) % stagingCapacity;
+	stagingUsed += submission.stagingReserved;
+
+	// Buffer copies have to be visible to the vertex input / shaders of frames submitted after this one
+	// (images are already covered by their layout transition)
+	VkMemoryBarrier memoryBarrier = { };
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(submission.commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+	if (submission.profilerScope >= 0) {
+		profiler->endScope(submission.commandBuffer, submission.profilerScope);
+		profiler->endImmediate();
+		profiledSubmissionInFlight = true;
+	}
+
+	result = vkEndCommandBuffer(submission.commandBuffer);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to stop recording an Upload Command Buffer!");
+	}
+
+	VkSubmitInfo submitInfo = { };
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &submission.commandBuffer;
+
+	result = timeline->submit(submitInfo, &submission.timelineValue);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit an Upload Command Buffer!");
+	}
+
+	submissions.push_back(submission);
+
+	for (const auto& upload : pendingUploads) {
+		frameStats.bytesDeferred += upload.size - upload.recorded;
+	}
+	frameStats.uploadsDeferred = static_cast<uint32_t>(pendingUploads.size());
+	frameStats.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void UploadQueue::ensureStagingRing(VkDeviceSize minimumSize) {
+	// Unlimited budgets still get a bounded ring, bigger uploads just take several submissions
+	VkDeviceSize frameBytes = budgetBytes > 0 ? budgetBytes : DEFAULT_UPLOAD_BUDGET_BYTES;
+	VkDeviceSize capacity = std::max(alignStaging(frameBytes) * UPLOAD_STAGING_FRAMES, minimumSize);
+	if (stagingBuffer != VK_NULL_HANDLE && stagingCapacity >= capacity) {
+		return;
+	}
+
+	// Only grows (a bigger budget or a wider image), so this is rare enough to wait for the copies using the old ring
+	if (!submissions.empty()) {
+		timeline->wait(submissions.back().timelineValue);
+	}
+	while (!submissions.empty()) {
+		retireOldestSubmission();
+	}
+
+	if (stagingBuffer != VK_NULL_HANDLE) {
+		vkUnmapMemory(device, stagingBufferMemory);
+		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		GpuMemoryTracker::free(device, stagingBufferMemory);
+	}
+
+	createBuffer(physicalDevice, device, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging, &stagingBuffer, &stagingBufferMemory);
+	vkMapMemory(device, stagingBufferMemory, 0, capacity, 0, reinterpret_cast<void**>(&stagingData));
+
+	stagingCapacity = capacity;
+	stagingHead = 0;
+	stagingUsed = 0;
+}
+
+VkDeviceSize UploadQueue::findStagingSpace(VkDeviceSize size, VkDeviceSize minimumSize, bool wait, VkDeviceSize* offset, VkDeviceSize* skipped) {
+	size = std::min(size, stagingCapacity);
+
+	while (true) {
+		if (stagingUsed == 0) {
+			stagingHead = 0;
+		}
+
+		// Held ranges run from the tail up to the head, possibly wrapping past the end of the ring
+		VkDeviceSize tail = (stagingHead + stagingCapacity - stagingUsed) % stagingCapacity;
+		VkDeviceSize atHead = 0;
+		VkDeviceSize atStart = 0;
+		if (stagingUsed == stagingCapacity) {
+			atHead = 0;
+		} else if (tail <= stagingHead) {
+			atHead = stagingCapacity - stagingHead;
+			atStart = tail;
+		} else {
+			atHead = tail - stagingHead;
+		}
+
+		// A range never wraps, so a submission that doesn't fit before the end skips it and starts over at 0
+		if (atHead >= size || (atHead >= minimumSize && atHead >= atStart)) {
+			*offset = stagingHead;
+			*skipped = 0;
+			return std::min(size, atHead);
+		}
+		if (atStart >= minimumSize) {
+			*offset = 0;
+			*skipped = atHead;
+			return std::min(size, atStart);
+		}
+
+		if (!wait || submissions.empty()) {
+			return 0;
+		}
+		timeline->wait(submissions.front().timelineValue);
+		retireOldestSubmission();
+	}
+}
+
+void UploadQueue::retireOldestSubmission() {
+	Submission& submission = submissions.front();
+	stagingUsed -= submission.stagingReserved;
+	retireSubmission(submission);
+	submissions.erase(submissions.begin());
+}
+
+void UploadQueue::retireSubmission(Submission& submission) {
+	// Timeline has passed the submission, so its timestamps can be read without waiting
+	if (submission.profilerScope >= 0) {
+		profiler->resolveImmediate();
+		profiledSubmissionInFlight = false;
+	}
+
+	for (uint64_t batchId : submission.finishedUploads) {
+		finishUpload(batchId);
+	}
+	submission.finishedUploads.clear();
+
+	vkFreeCommandBuffers(device, commandPool, 1, &submission.commandBuffer);
+}
+
+void UploadQueue::finishUpload(uint64_t batchId) {
+	auto batch = batches.find(batchId);
+	if (batch == batches.end()) {
+		return;
+	}
+
+	batch->second.unfinishedUploads--;
+	if (batch->second.submitted && batch->second.unfinishedUploads == 0) {
+		batches.erase(batch);
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+#include "Utilities.h"
+#include "GpuProfiler.h"
+#include "GpuTimeline.h"
+
+// Copy work allowed per frame unless the renderer is told otherwise
+const VkDeviceSize DEFAULT_UPLOAD_BUDGET_BYTES = 16 * 1024 * 1024;
+const uint32_t DEFAULT_UPLOAD_BUDGET_MICROSECONDS = 2000;
+// Frames of uploads at the byte budget the staging ring holds, so a frame's copies don't wait for the previous ones
+const uint32_t UPLOAD_STAGING_FRAMES = 3;
+
+// Data an upload reads from. Shared so its owner (a vertex vector, decoded pixels) is only released once it has been staged
+typedef std::shared_ptr<void> UploadData;
+
+// Takes over a vector's storage for an upload, without copying it
+template <typename T>
+UploadData makeUploadData(std::vector<T>&& data) {
+	std::shared_ptr<std::vector<T>> owner = std::make_shared<std::vector<T>>(std::move(data));
+	return UploadData(owner, owner->data());
+}
+
+// Upload work done in one frame
+struct UploadStats {
+	VkDeviceSize bytes = 0;				// Staged and recorded
+	uint32_t chunks = 0;				// Copy commands recorded (large uploads are split over frames)
+	uint32_t uploadsFinished = 0;		// Uploads whose last chunk was recorded
+	uint32_t uploadsDeferred = 0;		// Uploads left waiting (or part done) for later frames
+	VkDeviceSize bytesDeferred = 0;
+	double cpuMs = 0.0;					// Staging copies and recording
+};
+
+// Schedules buffer / image uploads in priority order under a per-frame budget of bytes and CPU time. Uploads bigger
+// than what's left of the budget are split (buffers by range, images by mip level and rows) and carried on next frame,
+// so a burst of new assets can't cause a spike. A frame's uploads share one command buffer and a contiguous range of a
+// persistently mapped staging ring, submitted through the queue's timeline and recycled once it reaches the
+// submission's value instead of waiting for the queue. Uploads are grouped into batches to tell when a set of resources
+// (a model) is resident. Everything runs on the thread that owns the queue
+class UploadQueue {
+public:
+	UploadQueue();
+
+	// Submits to the timeline's queue
+	void init(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, GpuTimeline* newTimeline, uint32_t queueFamilyIndex, GpuProfiler* newProfiler = nullptr);
+	// Waits for every submitted upload, then frees everything (uploads still queued are dropped)
+	void destroy();
+
+	// Limits for each update(), 0 = unlimited
+	void setBudget(VkDeviceSize bytesPerFrame, uint32_t microsecondsPerFrame);
+
+	// Uploads queued between beginBatch and submitBatch form a batch. Higher priority batches are uploaded first
+	void beginBatch(int priority = 0);
+	void queueBuffer(VkBuffer dstBuffer, UploadData data, VkDeviceSize size);
+	// RGBA8 pixels of the first mipLevels levels (level 0 first, each level half the size of the one above). The image is
+	// left in SHADER_READ_ONLY_OPTIMAL once its last rows are copied
+	void queueImage(VkImage dstImage, UploadData pixels, uint32_t width, uint32_t height, uint32_t mipLevels = 1);
+	// Closes the batch and returns its id
+	uint64_t submitBatch();
+
+	// Once a frame: retires submissions the timeline has passed, then records and submits this frame's share of the queue
+	void update();
+	bool isComplete(uint64_t batchId);
+	// Uploads everything queued, ignoring the budget, and waits for it (init, synchronous loads)
+	void waitForBatch(uint64_t batchId);
+
+	// Work done by the last update()
+	const UploadStats& getFrameStats();
+	size_t getPendingUploadCount();
+
+	~UploadQueue();
+
+private:
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	GpuTimeline* timeline;
+	VkCommandPool commandPool;
+	GpuProfiler* profiler;
+
+	VkDeviceSize budgetBytes;
+	uint32_t budgetMicroseconds;
+
+	struct PendingUpload {
+		uint64_t batchId;
+		int priority;
+		VkBuffer dstBuffer;					// Buffer upload, or
+		VkImage dstImage;					// image upload (width / height set)
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		UploadData data;
+		VkDeviceSize size;
+		VkDeviceSize recorded;				// Bytes already recorded (images split on whole rows of a level)
+	};
+
+	// One frame's recorded uploads
+	struct Submission {
+		VkCommandBuffer commandBuffer;
+		uint64_t timelineValue;				// Staging range and command buffer are free once the timeline reaches it
+		VkDeviceSize stagingOffset;
+		VkDeviceSize stagingReserved;		// Ring bytes held until then (includes the end of the ring skipped to wrap)
+		std::vector<uint64_t> finishedUploads;		// Batch of each upload that finished in this submission
+		int profilerScope;							// -1 if untimed (the profiler times one submission at a time)
+	};
+
+	struct BatchState {
+		bool submitted;						// submitBatch has been called
+		uint32_t unfinishedUploads;			// Queued, or recorded into a submission that hasn't completed
+	};
+
+	std::deque<PendingUpload> pendingUploads;		// Highest priority first, queue order within a priority
+	std::vector<Submission> submissions;
+	std::map<uint64_t, BatchState> batches;			// Batches that aren't complete yet
+	uint64_t openBatchId;							// 0 = none open
+	int openBatchPriority;
+	uint64_t nextBatchId;
+
+	// Staging ring, allocated in submission order and freed in the same order as the timeline passes them
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	unsigned char* stagingData;						// Mapped for the queue's lifetime
+	VkDeviceSize stagingCapacity;
+	VkDeviceSize stagingHead;						// Where the next submission's range starts
+	VkDeviceSize stagingUsed;						// Held by submissions that haven't completed
+
+	UploadStats frameStats;
+	bool profiledSubmissionInFlight;
+
+	void queueUpload(PendingUpload upload);
+	// Records queued uploads into one submission, within the budget if limited
+	void recordUploads(bool limited);
+	// (Re)creates the ring if it's missing or smaller than the budget needs, after the GPU is done with the old one
+	void ensureStagingRing(VkDeviceSize minimumSize);
+	// Finds up to size bytes (at least minimumSize) of contiguous free ring space, waiting for submissions to free it if
+	// allowed. Returns the bytes found, 0 if there isn't enough free yet
+	VkDeviceSize findStagingSpace(VkDeviceSize size, VkDeviceSize minimumSize, bool wait, VkDeviceSize* offset, VkDeviceSize* skipped);
+	void retireOldestSubmission();
+	void retireSubmission(Submission& submission);
+	void finishUpload(uint64_t batchId);
+};
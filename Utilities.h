@@ -1,8 +1,5 @@
 #pragma once
 
-const int MAX_FRAMES_DRAWS = 2;
-const int MAX_OBJECTS = 20;
-
 #include <fstream>
 
 #define GLFW_INCLUDE_VULKAN
@@ -10,6 +7,12 @@ const int MAX_OBJECTS = 20;
 
 #include <glm/glm.hpp>
 
+#include "GpuMemory.h"
+
+// Number of frames the CPU can record ahead of the GPU (chosen at runtime, between 1 and MAX_FRAMES_IN_FLIGHT)
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
@@ -21,6 +24,22 @@ struct Vertex {
 	glm::vec2 tex; // Texture UV Coords (U, V)
 };
 
+// Per-object transform as read by shader.vert (std430 layout, 96 bytes)
+struct ObjectTransform {
+	glm::vec4 model[3];		// Rows of the 3x4 affine model matrix (last row is always 0, 0, 0, 1 so is not stored)
+	glm::vec4 normal[3];	// Rows of the normal matrix (inverse transpose of the upper 3x3), padded to vec4
+};
+
+static void packObjectTransform(const glm::mat4& model, ObjectTransform* objectTransform) {
+	// glm is column major (model[column][row]), the shader wants rows so each component is a single dot product
+	glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+
+	for (int row = 0; row < 3; row++) {
+		objectTransform->model[row] = glm::vec4(model[0][row], model[1][row], model[2][row], model[3][row]);
+		objectTransform->normal[row] = glm::vec4(normal[0][row], normal[1][row], normal[2][row], 0.0f);
+	}
+}
+
 // Indices (locations) of Queue Families (if they exist at all)
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;		// Location of Graphics Queue Family
@@ -88,8 +107,23 @@ static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t al
 	return 0;	// bad code (0 is a possible return)
 }
 
+// Same search as findMemoryTypeIndex, but for optional properties (e.g. lazily allocated) so returns false instead of throwing
+static bool tryFindMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties, uint32_t* memoryTypeIndex) {
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+		if ((allowedTypes & (1 << i)) && ((memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)) {
+			*memoryTypeIndex = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 
-static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags bufferProperties, VkBuffer* buffer, VkDeviceMemory* bufferMemory) {
+static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkMemoryPropertyFlags bufferProperties, MemoryCategory category, VkBuffer* buffer, VkDeviceMemory* bufferMemory) {
 	// INformation to create a buffer (doesnt include assigning memory)
 	VkBufferCreateInfo bufferInfo = { };
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -112,8 +146,8 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
 	memoryAllocInfo.allocationSize = memRequirements.size;
 	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, bufferProperties);
 
-	// Allocate memory to VkDeviceMemory
-	result = vkAllocateMemory(device, &memoryAllocInfo, nullptr, bufferMemory);
+	// Allocate memory to VkDeviceMemory (accounted under the given category)
+	result = GpuMemoryTracker::allocate(device, &memoryAllocInfo, category, bufferMemory);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate Vertex Buffer Memory!");
 	}
@@ -122,102 +156,26 @@ static void createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDev
 	vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
 }
 
-static VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool) {
-	// Command Buffer to hold transfer commands
-	VkCommandBuffer commandBuffer;
-
-	// Command Buffer Details
-	VkCommandBufferAllocateInfo allocInfo = { };
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool;
-	allocInfo.commandBufferCount = 1;
-
-	// Allocate command buffer from pool
-	vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-	// Information to begin the command buffer record
-	VkCommandBufferBeginInfo beginInfo = { };
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;	// We are ony using the command buffer once, so set it up accordingly
-
-	VkResult result;
-
-	// Begin recording transfer commands
-	result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to begin Tranfer Command Buffer");
-	}
-
-	return commandBuffer;
-}
-
-static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool, VkQueue queue, VkCommandBuffer commandBuffer) {
-	// End recording transfer commands
-	VkResult result;
-	result = vkEndCommandBuffer(commandBuffer);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to end Tranfer Command Buffer");
-	}
-
-	// Queue Submission Information
-	VkSubmitInfo submitInfo = { };
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	// Submit transfer command to transfer queue and wait until it finishes
-	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-
-	// Wait for it to finish
-	vkQueueWaitIdle(queue);
-
-
-	// Free temporary command buffer back to pool
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize) {
-		// Create Buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
-	// Region of Data to copy from and to
-	VkBufferCopy bufferCopyRegion = { };
-	bufferCopyRegion.srcOffset = 0;			// from the beginning
-	bufferCopyRegion.dstOffset = 0;			// also from the beginning
-	bufferCopyRegion.size = bufferSize;
-
-	// Command to copy src buffer to dst buffer
-	vkCmdCopyBuffer(transferCommandBuffer, srcBuffer, dstBuffer, 1, &bufferCopyRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
-}
-
-static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool, VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height) {
-	// Create Buffer
-	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
-
+// Record a buffer to image copy into an already recording command buffer (image must be in TRANSFER_DST_OPTIMAL)
+// Copies height rows starting at firstRow (the whole image by default) of one mip level from srcBuffer at bufferOffset
+static void recordCopyImageBuffer(VkCommandBuffer transferCommandBuffer, VkBuffer srcBuffer, VkImage dstImage, uint32_t width, uint32_t height, VkDeviceSize bufferOffset = 0, uint32_t firstRow = 0, uint32_t mipLevel = 0) {
 	VkBufferImageCopy imageRegion = { };
-	imageRegion.bufferOffset = 0;											// Offset into data
+	imageRegion.bufferOffset = bufferOffset;								// Offset into data
 	imageRegion.bufferRowLength = 0;										// Row length of data to calculate data spacing
 	imageRegion.bufferImageHeight = 0;										// Image height to calculate data spacing
 	imageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	imageRegion.imageSubresource.mipLevel = 0;								// Mipmap level to copy
+	imageRegion.imageSubresource.mipLevel = mipLevel;						// Mipmap level to copy
 	imageRegion.imageSubresource.baseArrayLayer = 0;						// Starting array layer (if array)
 	imageRegion.imageSubresource.layerCount = 1;							// Number of layers to copy starting at baseArrayLayer
-	imageRegion.imageOffset = { 0, 0, 0 };									// Offset into image (as opposed to raw data in buffer offset)
+	imageRegion.imageOffset = { 0, static_cast<int32_t>(firstRow), 0 };	// Offset into image (as opposed to raw data in buffer offset)
 	imageRegion.imageExtent = { width, height, 1 };							// Size of region to copy as (x, y, z) values
 
 	// Copy buffer to given image
 	vkCmdCopyBufferToImage(transferCommandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageRegion);
-
-	endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
 }
 
-static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
-	VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
-
+// Record a layout transition barrier (of the first mipLevels levels) into an already recording command buffer
+static void recordTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels = 1) {
 	VkImageMemoryBarrier imageMemoryBarrier = { };
 	imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 	imageMemoryBarrier.oldLayout = oldLayout;									// Layout to transition from
@@ -227,7 +185,7 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 	imageMemoryBarrier.image = image;											// Image being accessed and modified as part of barrier
 	imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// aspect of image being altered
 	imageMemoryBarrier.subresourceRange.baseMipLevel = 0;						// first mip level to start alterations on
-	imageMemoryBarrier.subresourceRange.levelCount = 1;							// number of mip levels to alter starting from baseMipLevel
+	imageMemoryBarrier.subresourceRange.levelCount = mipLevels;					// number of mip levels to alter starting from baseMipLevel
 	imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;						// first layer to start alterations on
 	imageMemoryBarrier.subresourceRange.layerCount = 1;							// Number of layers to alter starting from baseArrayLayer
 
@@ -258,6 +216,4 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 		0, nullptr,				// Buffer Memory Barrier + data
 		1, &imageMemoryBarrier	// Image Memory Barrier count + data
 	);
-
-	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
-}
\ No newline at end of file
+}
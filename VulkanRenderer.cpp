@@ -10,22 +10,28 @@ VulkanRenderer::VulkanRenderer() {
 	swapChainExtent = { };
 	swapChainImageFormat = { };
 	pipelineLayout = nullptr;
-	renderPass = nullptr;
+	sceneRenderPass = nullptr;
+	sceneLoadRenderPass = nullptr;
+	compositeRenderPass = nullptr;
 	graphicsPipeline = nullptr;
+	depthPrepassPipeline = nullptr;
+	depthEqualPipeline = nullptr;
 	graphicsCommandPool = nullptr;
-	descriptorPool = nullptr;
 	descriptorSetLayout = nullptr;
 	uboViewProjection = { };
-	pushConstantRange = { };
-	depthBufferImage = { };
-	depthBufferImageMemory = { };
-	depthBufferImageView = { };
-	samplerDescriptorPool = nullptr;
+	colorBufferFormat = VK_FORMAT_UNDEFINED;
+	depthBufferFormat = VK_FORMAT_UNDEFINED;
 	samplerSetLayout = nullptr;
+	uniformDescriptorTemplate = nullptr;
+	textureDescriptorTemplate = nullptr;
+	inputDescriptorTemplate = nullptr;
 	textureSampler = nullptr;
-	//minUniformBufferOffset = 0;
-	//modelUniformAlignment = 0;
-	//modelTransferSpace = nullptr;
+	attachmentSampler = nullptr;
+	renderExtent = { };
+	uniformBuffer = nullptr;
+	uniformBufferMemory = nullptr;
+	uniformBufferMapped = nullptr;
+	uniformSliceSize = 0;
 
 	mainDevice = { };
 }
@@ -34,39 +40,123 @@ VulkanRenderer::~VulkanRenderer() {
 
 }
 
+void VulkanRenderer::setFramesInFlight(uint32_t count) {
+	framesInFlight = std::min(std::max(count, 1u), MAX_FRAMES_IN_FLIGHT);
+}
+
+uint32_t VulkanRenderer::getFramesInFlight() {
+	return framesInFlight;
+}
+
 int VulkanRenderer::init(GLFWwindow* newWindow) {
 	window = newWindow;
-	
+	headless = false;
+
+	return initVulkan();
+}
+
+int VulkanRenderer::initHeadless(uint32_t width, uint32_t height, uint32_t targetCount) {
+	window = nullptr;
+	headless = true;
+
+	// Offscreen targets stand in for the swapchain images
+	swapChainExtent = { width, height };
+	offscreenImageMemory.resize(std::max(targetCount, 1u));
+
+	return initVulkan();
+}
+
+bool VulkanRenderer::isHeadless() {
+	return headless;
+}
+
+int VulkanRenderer::initVulkan() {
+	TRACE_SCOPE("initVulkan");
+
+	// One set of per-frame resources for each frame that can be in flight
+	frames.resize(framesInFlight);
+
+	// Default texture needs nothing from Vulkan to decode, start it straight away
+	std::future<TextureData> defaultTextureDecode = std::async(std::launch::async, decodeTextureFile, std::string("plain.png"));
+
 	try {
+		startupPhases.begin("Instance and device");
 		createInstance();
-		createSurface();
+		if (!headless) {
+			createSurface();
+		}
 		getPhysicalDevice();
 		createLogicalDevice();
-		createSwapChain();
-		createRenderPass();
+
+		startupPhases.begin(headless ? "Offscreen targets" : "Swapchain");
+		if (headless) {
+			createOffscreenTargets(swapChainExtent.width, swapChainExtent.height, static_cast<uint32_t>(offscreenImageMemory.size()));
+		} else {
+			createSwapChain();
+		}
+
+		startupPhases.begin("Render pass and layouts");
+		chooseAttachmentFormats();
+		createRenderPasses();
 		createDescriptorSetLayout();
-		createPushConstantRange();
-		createGraphicsPipeline();
+		createDescriptorUpdateTemplates();
+
+		// Pipelines only need the render pass and set layouts (pipeline creation is thread safe), build them on a worker
+		// while the rest of init carries on. Nothing below touches the pipelines or their layouts
+		double pipelineMs = 0.0;
+		std::future<void> pipelineCreation = std::async(std::launch::async, [this, &pipelineMs]() {
+			auto start = std::chrono::steady_clock::now();
+			createGraphicsPipeline();
+			pipelineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		});
+
+		startupPhases.begin("Attachments and framebuffers");
 		createColorBufferImage();
 		createDepthBufferImage();
 		createFramebuffers();
+		reportAttachmentMemory();
+
+		startupPhases.begin("Commands, buffers and descriptors");
 		createCommandPool();
 		createCommandBuffers();
-		createTextureSampler();
-		//allocateDynamicBufferTransferSpace();
+		createSamplers();
 		createUniformBuffers();
-		createDescriptorPool();
+		createObjectBuffers();
+		createDescriptorAllocators();
 		createDescriptorSets();
 		createInputDescriptorSets();
 		createSynchronization();
+		gpuProfiler.init(mainDevice.physicalDevice, mainDevice.logicalDevice, getQueueFamilies(mainDevice.physicalDevice).graphicsFamily, framesInFlight);
+		uploadQueue.init(mainDevice.physicalDevice, mainDevice.logicalDevice, &graphicsTimeline, getQueueFamilies(mainDevice.physicalDevice).graphicsFamily, &gpuProfiler);
+		deletionQueue.init(mainDevice.logicalDevice);
+		occlusionCuller.init(mainDevice.physicalDevice, mainDevice.logicalDevice, framesInFlight);
+		occlusionCuller.resize(swapChainExtent.width, swapChainExtent.height, deletionQueue, 0);
+
+		// Textures get half of what the device local heaps can take unless told otherwise, leaving the rest for geometry,
+		// attachments and other applications
+		if (!textureBudgetSet) {
+			VkDeviceSize deviceLocalBudget = 0;
+			for (const auto& heap : GpuMemoryTracker::getHeapUsage()) {
+				if (heap.deviceLocal) {
+					deviceLocalBudget += heap.budget;
+				}
+			}
+			textureResidency.setBudget(deviceLocalBudget / 2);
+		}
 
-		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / swapChainExtent.height, 0.1f, 1000.0f);
-		uboViewProjection.view = glm::lookAt(glm::vec3(200.0f, 0.0f, 200.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		startupPhases.begin("Wait for graphics pipelines");
+		pipelineCreation.get();
+		startupPhases.add("Graphics pipelines", pipelineMs, true);
 
-		uboViewProjection.projection[1][1] *= -1;		// Vulkan Coordinate System wierd. Y points down, but GLM is designed for OpenGL where Y goes up.
+		updateProjection();
+		uboViewProjection.view = glm::lookAt(glm::vec3(200.0f, 0.0f, 200.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
 		// Create our default "no texture" texture
-		createTexture("plain.png");
+		startupPhases.begin("Default texture");
+		uploadQueue.beginBatch();
+		createTexture(defaultTextureDecode.get());
+		uploadQueue.waitForBatch(uploadQueue.submitBatch());
+		startupPhases.end();
 		
 		// DebugInformation();
 	} catch (const std::runtime_error& e) {
@@ -78,64 +168,386 @@ int VulkanRenderer::init(GLFWwindow* newWindow) {
 }
 
 void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel) {
-	if (modelId >= modelList.size() || modelId < 0) {
+	if (!isModelLoaded(modelId)) {
 		return;
 	}
 	modelList[modelId].setModel(newModel);
 }
 
+int VulkanRenderer::findModelNode(int modelId, std::string nodeName) {
+	if (!isModelLoaded(modelId)) {
+		return -1;
+	}
+
+	return modelList[modelId].findNode(nodeName);
+}
+
+void VulkanRenderer::updateModelNode(int modelId, int nodeId, glm::mat4 newTransform) {
+	if (!isModelLoaded(modelId)) {
+		return;
+	}
+	if (nodeId >= modelList[modelId].getNodeCount() || nodeId < 0) {
+		return;
+	}
+	modelList[modelId].setNodeTransform(nodeId, newTransform);
+}
+
+int VulkanRenderer::createModelInstance(int modelId, glm::mat4 newInstance) {
+	if (!isModelLoaded(modelId)) {
+		return -1;
+	}
+
+	// Instance reuses the model's vertex/index buffers and textures, only its transform is new
+	return modelList[modelId].addInstance(newInstance);
+}
+
+void VulkanRenderer::updateModelInstance(int modelId, int instanceId, glm::mat4 newInstance) {
+	if (!isModelLoaded(modelId)) {
+		return;
+	}
+	if (instanceId >= modelList[modelId].getInstanceCount() || instanceId < 0) {
+		return;
+	}
+	modelList[modelId].setInstance(instanceId, newInstance);
+}
+
+void VulkanRenderer::updateModelInstances(int modelId, int firstInstanceId, const std::vector<glm::mat4>& newInstances) {
+	if (!isModelLoaded(modelId) || firstInstanceId < 0) {
+		return;
+	}
+
+	// Only update instances that exist, anything past the end is ignored
+	size_t instanceCount = modelList[modelId].getInstanceCount();
+	for (size_t i = 0; i < newInstances.size() && firstInstanceId + i < instanceCount; i++) {
+		modelList[modelId].setInstance(firstInstanceId + i, newInstances[i]);
+	}
+}
+
+void VulkanRenderer::unloadMeshModel(int modelId) {
+	if (!isModelLoaded(modelId)) {
+		return;
+	}
+	MeshModel& model = modelList[modelId];
+
+	// Every model creates its own textures (texture 0 is the shared default)
+	std::set<int> modelTextures;
+	for (size_t i = 0; i < model.getMeshCount(); i++) {
+		if (model.getMesh(i)->getTexId() != 0) {
+			modelTextures.insert(model.getMesh(i)->getTexId());
+		}
+	}
+	for (int texId : modelTextures) {
+		releaseTexture(texId);
+	}
+
+	// Frames up to the last one recorded may still draw it
+	model.retireMeshModel(deletionQueue, graphicsTimeline.getLastSubmittedValue());
+
+	// Its transforms go, and every other model follows the ones that moved down to fill the gap
+	std::vector<uint32_t> remap = transforms.remove(model.getTransformIds());
+	modelList[modelId] = MeshModel();
+	for (auto& otherModel : modelList) {
+		otherModel.remapTransforms(remap);
+	}
+}
+
+void VulkanRenderer::releaseTexture(int textureId) {
+	// Default texture stays, meshes fall back to it
+	if (textureId <= 0 || textureId >= textures.size() || textures[textureId].released) {
+		return;
+	}
+	Texture& texture = textures[textureId];
+
+	deletionQueue.pushImage(texture.image, texture.imageMemory, texture.imageView, graphicsTimeline.getLastSubmittedValue());
+	deletionQueue.pushDescriptorSet(samplerDescriptorSets[textureId], &freeTextureDescriptorSets, graphicsTimeline.getLastSubmittedValue());
+	if (texture.changing) {
+		abandonedTextureLevels.push_back({ texture.pendingImage, texture.pendingImageMemory, texture.pendingImageView, texture.pendingBatch });
+	}
+
+	texture.pixels.reset();
+	texture.changing = false;
+	texture.released = true;
+	samplerDescriptorSets[textureId] = samplerDescriptorSets[0];
+	textureResidency.removeTexture(textureId);
+
+	// The id is handed out again to the next texture created, so nothing may keep drawing with it
+	for (auto& model : modelList) {
+		for (size_t i = 0; i < model.getMeshCount(); i++) {
+			if (model.getMesh(i)->getTexId() == textureId) {
+				model.getMesh(i)->setTexId(0);
+			}
+		}
+	}
+	for (auto& load : modelLoads) {
+		for (auto& mesh : load.meshes) {
+			if (mesh.getTexId() == textureId) {
+				mesh.setTexId(0);
+			}
+		}
+	}
+}
+
+void VulkanRenderer::setCamera(glm::vec3 eye, glm::vec3 target) {
+	uboViewProjection.view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
 void VulkanRenderer::draw() {
+	TRACE_SCOPE("draw");
+
+	// Rebuild the size dependent resources first. Nothing to draw to while the window is minimised
+	if (!headless && swapChainOutOfDate && !recreateSwapChain()) {
+		return;
+	}
+
+	FrameContext& frame = frames[currentFrame];
+
 	// 1. Get the next available image to draw to and set something to signal when we're finished with the image (a semaphore)
 
-	// wait for given fence to signal open from last draw call
-	vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	// manually reset fence
-	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
-	
+	// wait for the timeline to reach this frame's last submission, the GPU has then finished with everything the frame owns
+	auto waitStart = std::chrono::high_resolution_clock::now();
+	{
+		TRACE_SCOPE("Wait for frame");
+		graphicsTimeline.wait(frame.timelineValue);
+	}
+	auto waitEnd = std::chrono::high_resolution_clock::now();
+
+	// Frame time is measured wait to wait, so it includes any time the CPU was held back by the GPU
+	fenceWaitStats.addSample(std::chrono::duration<double, std::milli>(waitEnd - waitStart).count());
+	if (!firstFrame) {
+		frameTimeStats.addSample(std::chrono::duration<double, std::milli>(waitEnd - lastFrameTime).count());
+	}
+	lastFrameTime = waitEnd;
+	firstFrame = false;
+
+	// GPU is done with this frame's commands and transient descriptor sets, so hand them all back at once
+	vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+	frame.descriptorAllocator.resetPools();
+
+	// Culling counts of the slot's last frame are readable now, and it starts laying out this frame's draws
+	if (occlusionCulling) {
+		occlusionCuller.beginFrame(currentFrame, frameNumber);
+	}
+
+	// Anything whose last use the GPU has passed, including uploads and frames finished since
+	deletionQueue.flush(graphicsTimeline.getCompletedValue());
+
+	// Free finished uploads, upload this frame's share of the queue and move asynchronous model loads along. None of it
+	// waits on the GPU or the import threads
+	{
+		TRACE_SCOPE("Process model loads");
+		uploadQueue.update();
+		processModelLoads();
+	}
+
+	// Offscreen targets are simply used in turn, there's nothing to acquire them from
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	if (headless) {
+		imageIndex = nextOffscreenImage;
+		nextOffscreenImage = (nextOffscreenImage + 1) % swapChainImages.size();
+	} else {
+		TRACE_SCOPE("Acquire swapchain image");
+		VkResult result = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+
+		// Out of date: no image was acquired (and the semaphore won't be signalled), skip the frame and rebuild. A
+		// suboptimal swapchain can still be presented to, it's rebuilt after this frame
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			swapChainOutOfDate = true;
+			return;
+		}
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			throw std::runtime_error("Failed to acquire a Swapchain Image!");
+		}
+		if (result == VK_SUBOPTIMAL_KHR) {
+			swapChainOutOfDate = true;
+		}
+	}
+
+	// Another frame may still be rendering to this image (images can be acquired out of order)
+	if (!graphicsTimeline.isComplete(imagesInFlight[imageIndex])) {
+		TRACE_SCOPE("Wait for image");
+		graphicsTimeline.wait(imagesInFlight[imageIndex]);
+	}
 
-	recordCommands(imageIndex);
+	// Scene resolution for this frame, from the scene pass timings read back so far. Texture streaming sizes its requests
+	// by it too, so a scaled down scene asks for coarser levels
+	float resolutionScale = dynamicResolution.getScale();
+	renderExtent.width = std::max(1u, static_cast<uint32_t>(swapChainExtent.width * resolutionScale + 0.5f));
+	renderExtent.height = std::max(1u, static_cast<uint32_t>(swapChainExtent.height * resolutionScale + 0.5f));
 
-	updateUniformBuffers(imageIndex);
+	// Object offsets must be known before recording the draws that use them
+	{
+		TRACE_SCOPE("updateObjectBuffer");
+		updateObjectBuffer(frame);
+	}
+
+	// Sort draws by state then depth so binds aren't repeated and near objects are drawn first
+	{
+		TRACE_SCOPE("buildDrawList");
+		buildDrawList();
+	}
+
+	// GPU culling does its own (and better) job, the CPU culler is the fallback
+	if (cpuOcclusionCulling && !occlusionCulling) {
+		TRACE_SCOPE("cullDrawListOnCpu");
+		cullDrawListOnCpu(frame);
+	}
+
+	// Draws have asked for the mip levels they need, swap in finished texture changes before recording uses the sets
+	{
+		TRACE_SCOPE("updateTextureStreaming");
+		updateTextureStreaming();
+	}
+
+	{
+		TRACE_SCOPE("recordCommands");
+		recordCommands(frame, imageIndex);
+	}
+
+	{
+		TRACE_SCOPE("updateUniformBuffers");
+		updateUniformBuffers(frame);
+	}
+
+	TRACE_COUNTER("Draws", recordingStats.draws);
+	TRACE_COUNTER("Binds issued", recordingStats.issued);
+	TRACE_COUNTER("Binds elided", recordingStats.elided);
+	if (occlusionCulling) {
+		TRACE_COUNTER("Triangles drawn", occlusionCuller.getStats().trianglesDrawn);
+	} else if (cpuOcclusionCulling) {
+		TRACE_COUNTER("Objects culled", softwareOcclusion.getStats().objectsCulled);
+	}
 
 	// 2. Submit our command buffer to the queue for execution, making sure it waits for the image to be signaled as available before drawing
 	//	  and signals when it has finished rendering
 	 
 	VkSubmitInfo submitInfo = { };
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;								// Number of semaphores to wait on
-	submitInfo.pWaitSemaphores = &imageAvailable[currentFrame];		// list of semaphores to wait on
+	submitInfo.waitSemaphoreCount = headless ? 0 : 1;				// Number of semaphores to wait on (nothing to wait for or present when headless)
+	submitInfo.pWaitSemaphores = &frame.imageAvailable;				// list of semaphores to wait on
 	VkPipelineStageFlags waitStages[] = {
 		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
 	};
 	submitInfo.pWaitDstStageMask = waitStages;						// stages to check semaphores at
 	submitInfo.commandBufferCount = 1;								// number of command buffers to submit
-	submitInfo.pCommandBuffers = &commandBuffers.at(imageIndex);	// command buffer to submit
-	submitInfo.signalSemaphoreCount = 1;							// semaphores to signal when command buffer has finished
-	submitInfo.pSignalSemaphores = &renderFinished[currentFrame];	// semaphores to signal when command buffer finished
+	submitInfo.pCommandBuffers = &frame.commandBuffer;				// command buffer to submit
+	submitInfo.signalSemaphoreCount = headless ? 0 : 1;				// semaphores to signal when command buffer has finished
+	submitInfo.pSignalSemaphores = &frame.renderFinished;			// semaphores to signal when command buffer finished
 
 	// Submit command buffer to queue
-	VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame]);
+	VkResult result;
+	{
+		TRACE_SCOPE("Submit");
+		result = graphicsTimeline.submit(submitInfo, &frame.timelineValue);
+	}
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to submit Command Buffer to Queue!");
 	}
+	imagesInFlight[imageIndex] = frame.timelineValue;
+	frameNumber++;
+
+	if (headless) {
+		currentFrame = (currentFrame + 1) % framesInFlight;
+		return;
+	}
 	
 	// 3. Present image to screen when it has signaled finished rendering
 	VkPresentInfoKHR presentInfo = { };
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &renderFinished[currentFrame];
+	presentInfo.pWaitSemaphores = &frame.renderFinished;
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = &swapchain;
 	presentInfo.pImageIndices = &imageIndex;
 
-	result = vkQueuePresentKHR(presentationQueue, &presentInfo);
-	if (result != VK_SUCCESS) {
+	{
+		TRACE_SCOPE("Present");
+		result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+	}
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+		swapChainOutOfDate = true;
+	} else if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to present Image!");
 	}
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_DRAWS;
+	currentFrame = (currentFrame + 1) % framesInFlight;
+}
+
+void VulkanRenderer::setDynamicResolution(double targetMs, float minScale) {
+	dynamicResolution.setTarget(targetMs, minScale);
+}
+
+float VulkanRenderer::getResolutionScale() {
+	return static_cast<float>(renderExtent.width) / std::max(swapChainExtent.width, 1u);
+}
+
+size_t VulkanRenderer::getResolutionChangeCount() {
+	return dynamicResolution.getChangeCount();
+}
+
+void VulkanRenderer::setDepthPrepass(bool enabled) {
+	// Built the first time it's turned on after init (init builds it if it's on by then)
+	if (enabled && depthPrepassPipeline == nullptr && pipelineLayout != nullptr) {
+		createDepthPrepassPipeline();
+	}
+	depthPrepass = enabled;
+}
+
+bool VulkanRenderer::isDepthPrepassEnabled() {
+	return depthPrepass;
+}
+
+void VulkanRenderer::setOcclusionCulling(bool enabled) {
+	// Pyramid is of whatever was last drawn with culling on, which may be long gone
+	if (enabled && !occlusionCulling) {
+		occlusionCuller.invalidatePyramid();
+	}
+	occlusionCulling = enabled;
+}
+
+bool VulkanRenderer::isOcclusionCullingEnabled() {
+	return occlusionCulling;
+}
+
+const OcclusionCullStats& VulkanRenderer::getOcclusionStats() {
+	return occlusionCuller.getStats();
+}
+
+void VulkanRenderer::setCpuOcclusionCulling(bool enabled) {
+	cpuOcclusionCulling = enabled;
+}
+
+bool VulkanRenderer::isCpuOcclusionCullingEnabled() {
+	return cpuOcclusionCulling;
+}
+
+const SoftwareOcclusionStats& VulkanRenderer::getCpuOcclusionStats() {
+	return softwareOcclusion.getStats();
+}
+
+void VulkanRenderer::notifyFramebufferResized() {
+	swapChainOutOfDate = true;
+}
+
+CommandRecorderStats VulkanRenderer::getRecordingStats() {
+	return recordingStats;
+}
+
+const RollingStatistics& VulkanRenderer::getFrameTimeStats() {
+	return frameTimeStats;
+}
+
+const RollingStatistics& VulkanRenderer::getFenceWaitStats() {
+	return fenceWaitStats;
+}
+
+std::vector<GpuScopeTiming> VulkanRenderer::getGpuTimings() {
+	return gpuProfiler.getTimings();
+}
+
+void VulkanRenderer::resetStatistics(size_t windowSize) {
+	frameTimeStats = RollingStatistics(windowSize);
+	fenceWaitStats = RollingStatistics(windowSize);
+	gpuProfiler.resetStatistics(windowSize);
 }
 
 void VulkanRenderer::cleanup() {
@@ -144,74 +556,124 @@ void VulkanRenderer::cleanup() {
 	//vkQueueWaitIdle(graphicsQueue);
 	//vkQueueWaitIdle(presentationQueue);
 
-	//_aligned_free(modelTransferSpace);
+	// Keep the GPU timings of the run
+	gpuProfiler.writeCsv("gpu_timings.csv");
+
+	// Frees the staging memory of uploads still in flight, the profiler reads back the last upload's timestamps
+	uploadQueue.destroy();
+	gpuProfiler.destroy();
 
 	for (size_t i = 0; i < modelList.size(); i++) {
 		modelList[i].destroyMeshModel();
 	}
 
-	vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool, nullptr);
+	// Meshes of loads that never became resident (their textures are in the texture lists, destroyed below)
+	for (auto& load : modelLoads) {
+		if (load.state == ModelLoadState::Uploading) {
+			for (auto& mesh : load.meshes) {
+				mesh.destroyBuffers();
+			}
+		}
+	}
 
-	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, inputSetLayout, nullptr);
+	for (auto& frame : frames) {
+		frame.descriptorAllocator.destroyPools();
+	}
+	descriptorAllocator.destroyPools();
+
+	vkDestroyDescriptorUpdateTemplate(mainDevice.logicalDevice, inputDescriptorTemplate, nullptr);
+	vkDestroyDescriptorUpdateTemplate(mainDevice.logicalDevice, textureDescriptorTemplate, nullptr);
+	vkDestroyDescriptorUpdateTemplate(mainDevice.logicalDevice, uniformDescriptorTemplate, nullptr);
 
-	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, inputSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
 
+	vkDestroySampler(mainDevice.logicalDevice, attachmentSampler, nullptr);
 	vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
 
-	for (size_t i = 0; i < textureImages.size(); i++) {
-		vkDestroyImageView(mainDevice.logicalDevice, textureImageViews.at(i), nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, textureImages.at(i), nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, textureImageMemory.at(i), nullptr);
-	}
+	deletionQueue.flushAll();
+	occlusionCuller.destroy();
+	for (auto& texture : textures) {
+		if (texture.released) {
+			continue;
+		}
 
-	for (size_t i = 0; i < colorBufferImage.size(); i++) {
-		vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, colorBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, colorBufferImageMemory[i], nullptr);
-	}
+		vkDestroyImageView(mainDevice.logicalDevice, texture.imageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, texture.image, nullptr);
+		GpuMemoryTracker::free(mainDevice.logicalDevice, texture.imageMemory);
 
-	for (size_t i = 0; i < depthBufferImage.size(); i++) {
-		vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
+		// Upload queue has been destroyed by now, so a pending image is idle too
+		if (texture.changing) {
+			vkDestroyImageView(mainDevice.logicalDevice, texture.pendingImageView, nullptr);
+			vkDestroyImage(mainDevice.logicalDevice, texture.pendingImage, nullptr);
+			GpuMemoryTracker::free(mainDevice.logicalDevice, texture.pendingImageMemory);
+		}
 	}
+	for (auto& abandoned : abandonedTextureLevels) {
+		vkDestroyImageView(mainDevice.logicalDevice, abandoned.imageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, abandoned.image, nullptr);
+		GpuMemoryTracker::free(mainDevice.logicalDevice, abandoned.imageMemory);
+	}
+
+	for (auto& frame : frames) {
+		vkDestroyImageView(mainDevice.logicalDevice, frame.colorBufferImageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, frame.colorBufferImage, nullptr);
+		GpuMemoryTracker::free(mainDevice.logicalDevice, frame.colorBufferImageMemory);
 
-	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, frame.depthBufferImageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, frame.depthBufferImage, nullptr);
+		GpuMemoryTracker::free(mainDevice.logicalDevice, frame.depthBufferImageMemory);
+	}
 
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		vkDestroyBuffer(mainDevice.logicalDevice, uniformBuffer.at(i), nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, uniformBufferMemory.at(i), nullptr);
-		//vkDestroyBuffer(mainDevice.logicalDevice, dynamicUniformBuffer.at(i), nullptr);
-		//vkFreeMemory(mainDevice.logicalDevice, dynamicUniformBufferMemory.at(i), nullptr);
-	}
+	vkUnmapMemory(mainDevice.logicalDevice, uniformBufferMemory);
+	vkDestroyBuffer(mainDevice.logicalDevice, uniformBuffer, nullptr);
+	GpuMemoryTracker::free(mainDevice.logicalDevice, uniformBufferMemory);
+
+	for (auto& frame : frames) {
+		destroyObjectBuffer(frame);
 
-	for (size_t i = 0; i < MAX_FRAMES_DRAWS; i++) {
-		vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
-		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
-		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, frame.renderFinished, nullptr);
+		vkDestroySemaphore(mainDevice.logicalDevice, frame.imageAvailable, nullptr);
+		vkDestroyCommandPool(mainDevice.logicalDevice, frame.commandPool, nullptr);
+
+		vkDestroyFramebuffer(mainDevice.logicalDevice, frame.sceneFramebuffer, nullptr);
 	}
-	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 	for (auto& frameBuffer : swapChainFramebuffers) {
 		vkDestroyFramebuffer(mainDevice.logicalDevice, frameBuffer, nullptr);
 	}
+	graphicsTimeline.destroy();
+	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipleineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, depthEqualPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, depthPrepassPipeline, nullptr);
 	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, compositeRenderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, sceneLoadRenderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, sceneRenderPass, nullptr);
 	for (auto& image : swapChainImages) {
 		vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
 	}
-	vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (headless) {
+		// Offscreen targets are owned by us rather than a swapchain
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			vkDestroyImage(mainDevice.logicalDevice, swapChainImages[i].image, nullptr);
+			GpuMemoryTracker::free(mainDevice.logicalDevice, offscreenImageMemory[i]);
+		}
+	} else {
+		vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 	vkDestroyDevice(mainDevice.logicalDevice, nullptr);
 	vkDestroyInstance(instance, nullptr);
 }
 
 void VulkanRenderer::createInstance() {
+	TRACE_SCOPE("createInstance");
+
 	// Validation Layer Check
 	if (enableValidationLayers && !checkValidationLayerSupport()) {
 		throw std::runtime_error("Validation Layers Requested, but not available!");
@@ -242,12 +704,14 @@ void VulkanRenderer::createInstance() {
 	uint32_t glfwExtensionCount = 0;	// GLFW may require multiple extensions
 	const char** glfwExtensions;		// Extensions passed as array of cstrings, so need pointer to pointer
 
-	// Get GLFW extensions
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	// Get GLFW extensions (surface extensions, not needed when there's no window)
+	if (!headless) {
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-	// Add GLFW extensions to list of extensions
-	for (size_t i = 0; i < glfwExtensionCount; i++) {
-		instanceExtensions.push_back(glfwExtensions[i]);
+		// Add GLFW extensions to list of extensions
+		for (size_t i = 0; i < glfwExtensionCount; i++) {
+			instanceExtensions.push_back(glfwExtensions[i]);
+		}
 	}
 
 	// Check Instance Extensions supported...
@@ -276,6 +740,8 @@ void VulkanRenderer::createInstance() {
 }
 
 void VulkanRenderer::createLogicalDevice() {
+	TRACE_SCOPE("createLogicalDevice");
+
 	// Get the queue family indices for the chosen Physical Device
 	QueueFamilyIndices indices = getQueueFamilies(mainDevice.physicalDevice);
 
@@ -303,12 +769,58 @@ void VulkanRenderer::createLogicalDevice() {
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());		// Number of queue create infos
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();								// list of queue create infos so device can create required queues
-	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());	// number of enabled logical device extensions
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();							// list of enabled logical device extensions
+
+	// Required extensions (no swapchain when headless), plus the memory budget and timeline semaphore extensions when the
+	// device has them
+	std::vector<const char*> enabledExtensions;
+	if (!headless) {
+		enabledExtensions = deviceExtensions;
+	}
+
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+	bool memoryBudgetSupported = false;
+	bool timelineSemaphoreExtension = false;
+	for (const auto& extension : availableExtensions) {
+		if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+			memoryBudgetSupported = true;
+			enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+		if (strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+			timelineSemaphoreExtension = true;
+		}
+	}
+
+	// The extension alone isn't enough, the feature has to be there too (the GpuTimeline falls back to fences without it)
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = { };
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	if (timelineSemaphoreExtension) {
+		VkPhysicalDeviceFeatures2 features2 = { };
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features2.pNext = &timelineFeatures;
+		vkGetPhysicalDeviceFeatures2(mainDevice.physicalDevice, &features2);
+	}
+
+	timelineSemaphoresEnabled = timelineFeatures.timelineSemaphore == VK_TRUE;
+	if (timelineSemaphoresEnabled) {
+		enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		deviceCreateInfo.pNext = &timelineFeatures;
+	}
+
+	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());		// number of enabled logical device extensions
+	deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();							// list of enabled logical device extensions
+
+	// Anisotropy is required with a window, but software drivers used headless may not have it
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &supportedFeatures);
+	samplerAnisotropyEnabled = supportedFeatures.samplerAnisotropy == VK_TRUE;
 
 	// Physical Device Features the Logical Device will be using
 	VkPhysicalDeviceFeatures deviceFeatures = {};
-	deviceFeatures.samplerAnisotropy = VK_TRUE;								// Enabling Anisotropy
+	deviceFeatures.samplerAnisotropy = samplerAnisotropyEnabled ? VK_TRUE : VK_FALSE;		// Enabling Anisotropy
 
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;					// Physical Device features Logical Device will use
 
@@ -323,6 +835,9 @@ void VulkanRenderer::createLogicalDevice() {
 	// From given logical device, of given Queue Family, of given Queue Index (0 since only one queue), place reference in given VkQueue
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+
+	// Every allocation from here on is accounted for
+	GpuMemoryTracker::init(mainDevice.physicalDevice, memoryBudgetSupported);
 }
 
 void VulkanRenderer::createSurface() {
@@ -334,7 +849,9 @@ void VulkanRenderer::createSurface() {
 	}
 }
 
-void VulkanRenderer::createSwapChain() {
+void VulkanRenderer::createSwapChain(VkSwapchainKHR oldSwapchain) {
+	TRACE_SCOPE("createSwapChain");
+
 	// Get Swap Chain details so we can pick best settings
 	SwapChainDetails swapChainDetails = getSwapChainDetails(mainDevice.physicalDevice);
 
@@ -388,8 +905,9 @@ void VulkanRenderer::createSwapChain() {
 		swapChainCreateInfo.pQueueFamilyIndices = nullptr;
 	}
 
-	// if old swap chain been destroyed and this one replaces it, then link old one to quickly hand over responsibilities
-	swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+	// if this one replaces an old swap chain, link the old one to quickly hand over responsibilities (it's retired, but
+	// images already acquired from it can still be presented)
+	swapChainCreateInfo.oldSwapchain = oldSwapchain;
 
 	// Create Swapchain
 	VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapChainCreateInfo, nullptr, &swapchain);
@@ -422,67 +940,211 @@ void VulkanRenderer::createSwapChain() {
 	}
 }
 
-void VulkanRenderer::createRenderPass() {
-	// Array of our subpasses
-	std::array<VkSubpassDescription, 2> subpasses { };
+bool VulkanRenderer::recreateSwapChain() {
+	TRACE_SCOPE("recreateSwapChain");
+
+	// Minimised windows have no size, wait for one before building anything
+	int width = 0;
+	int height = 0;
+	glfwGetFramebufferSize(window, &width, &height);
+	if (width == 0 || height == 0) {
+		return false;
+	}
+
+	// Only what depends on the size is rebuilt. Pipelines set viewport and scissor when recording, and the render pass
+	// only depends on the formats. Frames in flight may still use the old objects, so they go to the deletion queue
+	// rather than waiting for the device to go idle
+	uint64_t lastUseValue = graphicsTimeline.getLastSubmittedValue();
+
+	for (VkFramebuffer framebuffer : swapChainFramebuffers) {
+		deletionQueue.pushFramebuffer(framebuffer, lastUseValue);
+	}
+	swapChainFramebuffers.clear();
+
+	for (auto& frame : frames) {
+		deletionQueue.pushFramebuffer(frame.sceneFramebuffer, lastUseValue);
+		deletionQueue.pushImage(frame.colorBufferImage, frame.colorBufferImageMemory, frame.colorBufferImageView, lastUseValue);
+		deletionQueue.pushImage(frame.depthBufferImage, frame.depthBufferImageMemory, frame.depthBufferImageView, lastUseValue);
+		deletionQueue.pushDescriptorSet(frame.inputDescriptorSet, &freeInputDescriptorSets, lastUseValue);
+	}
+
+	// Swapchain images belong to the swapchain, only the views are ours
+	for (auto& image : swapChainImages) {
+		deletionQueue.pushImage(VK_NULL_HANDLE, VK_NULL_HANDLE, image.imageView, lastUseValue);
+	}
+	swapChainImages.clear();
+
+	VkFormat previousFormat = swapChainImageFormat;
+	VkSwapchainKHR oldSwapchain = swapchain;
+	createSwapChain(oldSwapchain);
+	deletionQueue.pushSwapchain(oldSwapchain, lastUseValue);
+
+	if (swapChainImageFormat != previousFormat) {
+		throw std::runtime_error("Failed to recreate the Swapchain, the surface format changed!");
+	}
+
+	createColorBufferImage();
+	createDepthBufferImage();
+	createFramebuffers();
+	createInputDescriptorSets();
+	occlusionCuller.resize(swapChainExtent.width, swapChainExtent.height, deletionQueue, lastUseValue);
+
+	// No frame has rendered to the new images yet
+	imagesInFlight.assign(swapChainImages.size(), 0);
+
+	updateProjection();
+
+	swapChainOutOfDate = false;
+	return true;
+}
+
+void VulkanRenderer::createOffscreenTargets(uint32_t width, uint32_t height, uint32_t targetCount) {
+	TRACE_SCOPE("createOffscreenTargets");
+
+	// Plain images take the place of the swapchain images. Usable as a transfer source so frames can be read back
+	swapChainImageFormat = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	swapChainExtent = { width, height };
 
-	// Attachments
-	// Subpass 1 attachments + References (input attachments)
+	for (uint32_t i = 0; i < targetCount; i++) {
+		SwapchainImage offscreenImage = { };
+		offscreenImage.image = createImage(width, height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachment, &offscreenImageMemory[i]);
+		offscreenImage.imageView = createImageView(offscreenImage.image, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
 
-	// Color Attachment (Input)
+		swapChainImages.push_back(offscreenImage);
+	}
+}
+
+void VulkanRenderer::chooseAttachmentFormats() {
+	// Color attachment needs to be renderable (the old check passed an image layout in as the feature flags), and filtered
+	// when the composite upscales it
+	colorBufferFormat = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+
+	// Nothing uses stencil, so prefer depth only formats (D32_SFLOAT_S8_UINT is 8 bytes per pixel on most hardware). The
+	// composite reads it too (fetched, not filtered)
+	depthBufferFormat = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+}
+
+void VulkanRenderer::createRenderPasses() {
+	TRACE_SCOPE("createRenderPasses");
+
+	// Scene Render Pass: draws into the frame's color and depth targets, which the composite pass then samples. Split
+	// from the composite (rather than being its first subpass) so the scene can render to less of the target than the
+	// composite writes to the swapchain image
+
+	// Color Attachment
 	VkAttachmentDescription colorAttachment = { };
-	colorAttachment.format = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	colorAttachment.format = colorBufferFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Depth Attachment (Input)
+	// Depth Attachment
 	VkAttachmentDescription depthAttachment = { };
-	depthAttachment.format = chooseSupportedFormat({ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+	depthAttachment.format = depthBufferFormat;
 	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
 	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Color Attachment (Input) Reference
+	// Color Attachment Reference
 	VkAttachmentReference colorAttachmentReference = { };
-	colorAttachmentReference.attachment = 1;
+	colorAttachmentReference.attachment = 0;
 	colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// Depth Attachment (Input) Reference
+	// Depth Attachment Reference
 	VkAttachmentReference depthAttachmentReference = { };
-	depthAttachmentReference.attachment = 2;
+	depthAttachmentReference.attachment = 1;
 	depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Set up Subpass 1
-	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpasses[0].colorAttachmentCount = 1;
-	subpasses[0].pColorAttachments = &colorAttachmentReference;
-	subpasses[0].pDepthStencilAttachment = &depthAttachmentReference;
+	VkSubpassDescription sceneSubpass = { };
+	sceneSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	sceneSubpass.colorAttachmentCount = 1;
+	sceneSubpass.pColorAttachments = &colorAttachmentReference;
+	sceneSubpass.pDepthStencilAttachment = &depthAttachmentReference;
+
+	std::array<VkSubpassDependency, 2> sceneDependencies = { };
+
+	// The last composite pass (and Hi-Z pyramid build) to sample these targets (same frame slot, an earlier submission)
+	// must be done reading before they're cleared and written again
+	sceneDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	sceneDependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	sceneDependencies[0].srcAccessMask = 0;
+	sceneDependencies[0].dstSubpass = 0;
+	sceneDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	sceneDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	sceneDependencies[0].dependencyFlags = 0;
+
+	// Written color and depth made visible to the composite pass' fragment shader (and the Hi-Z pyramid build)
+	sceneDependencies[1].srcSubpass = 0;
+	sceneDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	sceneDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	sceneDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	sceneDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	sceneDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	sceneDependencies[1].dependencyFlags = 0;
+
+	std::array<VkAttachmentDescription, 2> sceneAttachments = { colorAttachment, depthAttachment };		// the ordering needs to be consistent
+
+	// Create info for renderpass
+	VkRenderPassCreateInfo renderPassCreateInfo = { };
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(sceneAttachments.size());
+	renderPassCreateInfo.pAttachments = sceneAttachments.data();
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &sceneSubpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(sceneDependencies.size());
+	renderPassCreateInfo.pDependencies = sceneDependencies.data();
+
+	VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &sceneRenderPass);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Render Pass!");
+	}
+
+	// Scene Load Render Pass: the second occlusion culling pass draws over what the first drew, once the pyramid build has
+	// read the depth. Compatible with sceneRenderPass, so it uses the same framebuffers and pipelines
+	sceneAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	sceneAttachments[0].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sceneAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	sceneAttachments[1].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Subpass 2 Attachments + References
+	// Pyramid build must be done reading the depth before it's written again, and the first pass' writes before they're loaded
+	sceneDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	sceneDependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	sceneDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	sceneDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &sceneLoadRenderPass);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Render Pass!");
+	}
+
+	// Composite Render Pass: a full screen triangle sampling the scene targets into the swapchain image
 
 	// Swapchain Color Attachment
 	VkAttachmentDescription swapChainColorAttachment = { };
 	swapChainColorAttachment.format = swapChainImageFormat;											// Format to use for attachment
 	swapChainColorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;										// Number of samples to write for multisampling
-	swapChainColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;									// Describes what to do with attachment before rendering
+	swapChainColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;								// Every pixel is written by the composite, nothing to clear
 	swapChainColorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;								// Describes what to do with attachement after rendering
 	swapChainColorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;						// Describes what to do with stencil before rendering
 	swapChainColorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;						// Describes what to do with stencil after rendering
-	
+
 	// Framebuffer data will be stored as an image, but images can be given different data layouts
 	// to give optimal use for certain operations
 	swapChainColorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;								// Image Data Layout before render pass starts
-	swapChainColorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;							// Image Data Layout after render pass (to change to)
+	swapChainColorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;							// Image Data Layout after render pass (to change to)
 
 	// References
 	// Attachment Reference uses an attachment index that refers to index in the attachment list passed to renderPassCreateInfo
@@ -490,73 +1152,46 @@ void VulkanRenderer::createRenderPass() {
 	swapChainColorAttachmentReference.attachment = 0;
 	swapChainColorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// References to attachments that subpass will take input from
-	std::array<VkAttachmentReference, 2> inputReferences = { };
-	inputReferences[0].attachment = 1;
-	inputReferences[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	inputReferences[1].attachment = 2;
-	inputReferences[1].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-	// Set up Subpass 2
-	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpasses[1].colorAttachmentCount = 1;
-	subpasses[1].pColorAttachments = &swapChainColorAttachmentReference;
-	subpasses[1].inputAttachmentCount = static_cast<uint32_t>(inputReferences.size());
-	subpasses[1].pInputAttachments = inputReferences.data();
-
-	// Subpass Dependencies
+	VkSubpassDescription compositeSubpass = { };
+	compositeSubpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	compositeSubpass.colorAttachmentCount = 1;
+	compositeSubpass.pColorAttachments = &swapChainColorAttachmentReference;
 
 	// Need to determine when layout transitions occur using subpass dependencies
-	std::array<VkSubpassDependency, 3> subpassDependencies = { };
+	std::array<VkSubpassDependency, 2> compositeDependencies = { };
 
 	// Conversion from VK_IMAGE_LAYOUT_UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
 	// Transition must happen after...
-	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;										// Subpass index (VK_SUBPASS_EXTERNAL = special value meaning outside of renderpass)
-	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;						// Pipeline Stage
-	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;								// Stage access mask (memory access)
+	compositeDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;										// Subpass index (VK_SUBPASS_EXTERNAL = special value meaning outside of renderpass)
+	compositeDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;			// Pipeline Stage (the acquire semaphore is waited on here)
+	compositeDependencies[0].srcAccessMask = 0;														// Stage access mask (memory access)
 
 	// But must happen before...
-	subpassDependencies[0].dstSubpass = 0;
-	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-	subpassDependencies[0].dependencyFlags = 0;
-
-	// Subpass 1 layout (color / depth) to Subpass 2 layout
-
-	subpassDependencies[1].srcSubpass = 0;
-	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	subpassDependencies[1].dstSubpass = 1;
-	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	subpassDependencies[1].dependencyFlags = 0;
+	compositeDependencies[0].dstSubpass = 0;
+	compositeDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	compositeDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	compositeDependencies[0].dependencyFlags = 0;
 
 	// Conversion from VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL to VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
 	// Transition must happen after...
-	subpassDependencies[2].srcSubpass = 0;
-	subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	compositeDependencies[1].srcSubpass = 0;
+	compositeDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	compositeDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
 	// But must happen before...
-	subpassDependencies[2].dstSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	subpassDependencies[2].dependencyFlags = 0;
-
-	std::array<VkAttachmentDescription, 3> renderPassAttachments = { swapChainColorAttachment, colorAttachment, depthAttachment };		// the ordering needs to be consistent
-
-	// Create info for renderpass
-	VkRenderPassCreateInfo renderPassCreateInfo = { };
-	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(renderPassAttachments.size());
-	renderPassCreateInfo.pAttachments = renderPassAttachments.data();
-	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
-	renderPassCreateInfo.pSubpasses = subpasses.data();
-	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
-	renderPassCreateInfo.pDependencies = subpassDependencies.data();
-
-	VkResult result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &renderPass);
+	compositeDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	compositeDependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	compositeDependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	compositeDependencies[1].dependencyFlags = 0;
+
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &swapChainColorAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &compositeSubpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(compositeDependencies.size());
+	renderPassCreateInfo.pDependencies = compositeDependencies.data();
+
+	result = vkCreateRenderPass(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &compositeRenderPass);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create a Render Pass!");
 	}
@@ -572,14 +1207,15 @@ void VulkanRenderer::createDescriptorSetLayout() {
 	uboViewProjectionLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;							// Shader stage to bind to
 	uboViewProjectionLayoutBinding.pImmutableSamplers = nullptr;										// For Texture: Can make Sampler immutable by specifying in layout.
 
-	/*VkDescriptorSetLayoutBinding uboModelLayoutBinding = { };
-	uboModelLayoutBinding.binding = 1;
-	uboModelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	uboModelLayoutBinding.descriptorCount = 1;
-	uboModelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	uboModelLayoutBinding.pImmutableSamplers = nullptr;*/
+	// Object Transform Storage Buffer Binding Info
+	VkDescriptorSetLayoutBinding objectLayoutBinding = { };
+	objectLayoutBinding.binding = 1;
+	objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	objectLayoutBinding.descriptorCount = 1;
+	objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	objectLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { uboViewProjectionLayoutBinding };
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { uboViewProjectionLayoutBinding, objectLayoutBinding };
 
 	// Create Descriptor Set Layout with given bindings
 	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = { };
@@ -615,25 +1251,25 @@ void VulkanRenderer::createDescriptorSetLayout() {
 		throw std::runtime_error("Failed to create a Descriptor Set Layout!");
 	}
 
-	// Create Input Attachment Image Descriptor Set Layout
+	// Create Composite Input Descriptor Set Layout (the scene pass' targets, sampled)
 	// Color Input Binding
 	VkDescriptorSetLayoutBinding colorInputLayoutBinding = { };
 	colorInputLayoutBinding.binding = 0;
-	colorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	colorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	colorInputLayoutBinding.descriptorCount = 1;
 	colorInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
 	// Depth Input Binding
 	VkDescriptorSetLayoutBinding depthInputLayoutBinding = { };
 	depthInputLayoutBinding.binding = 1;
-	depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	depthInputLayoutBinding.descriptorCount = 1;
 	depthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	// Array of input attachment bindings
+	// Array of composite input bindings
 	std::vector<VkDescriptorSetLayoutBinding> inputBindings = { colorInputLayoutBinding, depthInputLayoutBinding };
 
-	// Create a Descriptor Set Layout for input attachments
+	// Create a Descriptor Set Layout for composite inputs
 	VkDescriptorSetLayoutCreateInfo inputLayoutCreateInfo = { };
 	inputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	inputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(inputBindings.size());
@@ -645,13 +1281,9 @@ void VulkanRenderer::createDescriptorSetLayout() {
 	}
 }
 
-void VulkanRenderer::createPushConstantRange() {
-	pushConstantRange.offset = 0;									// offset into given data to pash to push constant
-	pushConstantRange.size = sizeof(Model);							// size of data being passed
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;		// Shader stage push constant will go to
-}
-
 void VulkanRenderer::createGraphicsPipeline() {
+	TRACE_SCOPE("createGraphicsPipeline");
+
 	// Read in SPIR-V code for shaders
 	auto vertexShaderCode = readFile("Shaders/vert.spv");
 	auto fragmentShaderCode = readFile("Shaders/frag.spv");
@@ -726,7 +1358,7 @@ void VulkanRenderer::createGraphicsPipeline() {
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;			// Primitive type to assemble vertices as
 	inputAssembly.primitiveRestartEnable = VK_FALSE;						// Allow overriding of "strip" topology to start new primitives
 
-	// Viewport and Scissor
+	// Viewport and Scissor (dynamic state, these only give the count)
 	VkViewport viewport = { };
 	viewport.x = 0.0f;														// x start coordinate
 	viewport.y = 0.0f;														// y start coordinate
@@ -746,9 +1378,7 @@ void VulkanRenderer::createGraphicsPipeline() {
 	viewportStateCreateInfo.scissorCount = 1;
 	viewportStateCreateInfo.pScissors = &scissor;
 
-	/*
-	
-	// Dynamic State
+	// Dynamic State (set when recording, so a resize doesn't need new pipelines)
 	std::vector<VkDynamicState> dynamicStateEnables;
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);				// Dynamic Viewport : Can resize in command buffer with vkCmdSetViewport(commandbuffer, 0, 1, &viewport);
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);				// Dyanmic Scissor  : Can resize in command buffer with vkCmdSetScissor(commandbuffer, 0, 1, &scissor);
@@ -758,10 +1388,6 @@ void VulkanRenderer::createGraphicsPipeline() {
 	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
 	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
 
-	// Can't forget to remake swapchain and any depth / image buffers you are using
-	
-	*/
-
 	// Rasterizer
 	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = { };
 	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -808,8 +1434,8 @@ void VulkanRenderer::createGraphicsPipeline() {
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;						// Transforms come from the object storage buffer, not push constants
+	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
 
 	// Create Pipeline Layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
@@ -835,13 +1461,13 @@ void VulkanRenderer::createGraphicsPipeline() {
 	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
 	pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-	pipelineCreateInfo.pDynamicState = nullptr;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
 	pipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
 	pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
 	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
 	pipelineCreateInfo.layout = pipelineLayout;							// Pipeline layout pipeline should use
-	pipelineCreateInfo.renderPass = renderPass;							// renderpass description the pipeline is compatible with
+	pipelineCreateInfo.renderPass = sceneRenderPass;					// renderpass description the pipeline is compatible with
 	pipelineCreateInfo.subpass = 0;										// subpass of render pass to use with pipeline
 
 	// Pipeline Derivatives : Can create multiple pipelines that derive from one another for optimization
@@ -853,6 +1479,25 @@ void VulkanRenderer::createGraphicsPipeline() {
 		throw std::runtime_error("Failed to create Graphics Pipeline!");
 	}
 
+	// Main pass after a depth pre-pass: depth already holds the nearest surface, so only fragments exactly on it (the
+	// same position computed by depth.vert) are shaded and depth is left as it is
+	VkPipelineDepthStencilStateCreateInfo depthEqualCreateInfo = depthStencilCreateInfo;
+	depthEqualCreateInfo.depthWriteEnable = VK_FALSE;
+	depthEqualCreateInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+	VkGraphicsPipelineCreateInfo depthEqualPipelineCreateInfo = pipelineCreateInfo;
+	depthEqualPipelineCreateInfo.pDepthStencilState = &depthEqualCreateInfo;
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &depthEqualPipelineCreateInfo, nullptr, &depthEqualPipeline);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the Depth Equal Pipeline!");
+	}
+
+	// Depth pre-pass pipeline only exists once the pre-pass is turned on
+	if (depthPrepass) {
+		createDepthPrepassPipeline();
+	}
+
 	// Destroy Shader Modules, no longer needed after Pipeline created
 	// destroyed in reverse order
 	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
@@ -887,8 +1532,14 @@ void VulkanRenderer::createGraphicsPipeline() {
 	secondPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	secondPipelineLayoutCreateInfo.setLayoutCount = 1;
 	secondPipelineLayoutCreateInfo.pSetLayouts = &inputSetLayout;
-	secondPipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	secondPipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+	// Where in the scene targets to read from changes with the resolution scale each frame
+	VkPushConstantRange compositePushConstantRange = { };
+	compositePushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	compositePushConstantRange.offset = 0;
+	compositePushConstantRange.size = sizeof(CompositePushConstant);
+
+	secondPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	secondPipelineLayoutCreateInfo.pPushConstantRanges = &compositePushConstantRange;
 
 	result = vkCreatePipelineLayout(mainDevice.logicalDevice, &secondPipelineLayoutCreateInfo, nullptr, &secondPipleineLayout);
 	if (result != VK_SUCCESS) {
@@ -896,8 +1547,9 @@ void VulkanRenderer::createGraphicsPipeline() {
 	}
 
 	pipelineCreateInfo.pStages = secondShaderStages;			// Update second shader stage list
-	pipelineCreateInfo.layout = secondPipleineLayout;			// Change pipeline layout for input attachment descriptor sets
-	pipelineCreateInfo.subpass = 1;								// Use second subpass
+	pipelineCreateInfo.layout = secondPipleineLayout;			// Change pipeline layout for composite input descriptor sets
+	pipelineCreateInfo.renderPass = compositeRenderPass;		// Use the composite pass' only subpass
+	pipelineCreateInfo.subpass = 0;
 
 	// Create second pipeline
 	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &secondPipeline);
@@ -910,467 +1562,868 @@ void VulkanRenderer::createGraphicsPipeline() {
 	vkDestroyShaderModule(mainDevice.logicalDevice, secondVertexShaderModule, nullptr);
 }
 
-void VulkanRenderer::createColorBufferImage() {
-	// Resize supported format for color attachment
-	colorBufferImage.resize(swapChainImages.size());
-	colorBufferImageMemory.resize(swapChainImages.size());
-	colorBufferImageView.resize(swapChainImages.size());
-	
-	// Get supported format for color attachment
-	VkFormat colorFormat = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+void VulkanRenderer::createDepthPrepassPipeline() {
+	TRACE_SCOPE("createDepthPrepassPipeline");
+
+	// Vertex stage only (depth is written without a fragment shader), reading the tightly packed position stream
+	auto depthShaderCode = readFile("Shaders/depth_vert.spv");
+	VkShaderModule depthShaderModule = createShaderModule(depthShaderCode);
+
+	VkPipelineShaderStageCreateInfo depthShaderCreateInfo = { };
+	depthShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	depthShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	depthShaderCreateInfo.module = depthShaderModule;
+	depthShaderCreateInfo.pName = "main";
+
+	VkVertexInputBindingDescription positionBindingDescription = { };
+	positionBindingDescription.binding = 0;
+	positionBindingDescription.stride = sizeof(glm::vec3);
+	positionBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	VkVertexInputAttributeDescription positionAttributeDescription = { };
+	positionAttributeDescription.binding = 0;
+	positionAttributeDescription.location = 0;
+	positionAttributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+	positionAttributeDescription.offset = 0;
+
+	VkPipelineVertexInputStateCreateInfo positionInputCreateInfo = { };
+	positionInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	positionInputCreateInfo.vertexBindingDescriptionCount = 1;
+	positionInputCreateInfo.pVertexBindingDescriptions = &positionBindingDescription;
+	positionInputCreateInfo.vertexAttributeDescriptionCount = 1;
+	positionInputCreateInfo.pVertexAttributeDescriptions = &positionAttributeDescription;
+
+	// Fixed function state has to match the scene pipeline (createGraphicsPipeline), so the main pass' EQUAL depth test
+	// sees the same depth for the same triangles
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = { };
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		// Create the color buffer image
-		colorBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBufferImageMemory[i]);
+	// Viewport and Scissor are dynamic, these only give the count
+	VkPipelineViewportStateCreateInfo viewportStateCreateInfo = { };
+	viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportStateCreateInfo.viewportCount = 1;
+	viewportStateCreateInfo.scissorCount = 1;
 
-		// Creat the Color Buffer Image View
-		colorBufferImageView[i] = createImageView(colorBufferImage[i], colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+	std::array<VkDynamicState, 2> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = { };
+	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
+	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
+
+	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = { };
+	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerCreateInfo.depthClampEnable = VK_FALSE;
+	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerCreateInfo.lineWidth = 1.0f;
+	rasterizerCreateInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
+
+	VkPipelineMultisampleStateCreateInfo multiSamplingCreateInfo = { };
+	multiSamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multiSamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+	multiSamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = { };
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = VK_TRUE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+	// Scene pass' color attachment is left untouched
+	VkPipelineColorBlendAttachmentState depthOnlyColorState = { };
+	depthOnlyColorState.colorWriteMask = 0;
+	depthOnlyColorState.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo depthOnlyBlendCreateInfo = { };
+	depthOnlyBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	depthOnlyBlendCreateInfo.logicOpEnable = VK_FALSE;
+	depthOnlyBlendCreateInfo.attachmentCount = 1;
+	depthOnlyBlendCreateInfo.pAttachments = &depthOnlyColorState;
+
+	// Same layout as the scene pipeline, so the object and sampler sets bound for the main pass stay bound
+	VkGraphicsPipelineCreateInfo depthPrepassPipelineCreateInfo = { };
+	depthPrepassPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	depthPrepassPipelineCreateInfo.stageCount = 1;
+	depthPrepassPipelineCreateInfo.pStages = &depthShaderCreateInfo;
+	depthPrepassPipelineCreateInfo.pVertexInputState = &positionInputCreateInfo;
+	depthPrepassPipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	depthPrepassPipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
+	depthPrepassPipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+	depthPrepassPipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+	depthPrepassPipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
+	depthPrepassPipelineCreateInfo.pColorBlendState = &depthOnlyBlendCreateInfo;
+	depthPrepassPipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	depthPrepassPipelineCreateInfo.layout = pipelineLayout;
+	depthPrepassPipelineCreateInfo.renderPass = sceneRenderPass;
+	depthPrepassPipelineCreateInfo.subpass = 0;
+	depthPrepassPipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	depthPrepassPipelineCreateInfo.basePipelineIndex = -1;
+
+	VkResult result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &depthPrepassPipelineCreateInfo, nullptr, &depthPrepassPipeline);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create the Depth Pre-pass Pipeline!");
 	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, depthShaderModule, nullptr);
 }
 
-void VulkanRenderer::createDepthBufferImage() {
-	depthBufferImage.resize(swapChainImages.size());
-	depthBufferImageMemory.resize(swapChainImages.size());
-	depthBufferImageView.resize(swapChainImages.size());
+void VulkanRenderer::createColorBufferImage() {
+	for (auto& frame : frames) {
+		// Create the color buffer image. Sized for the full swapchain so scaling the resolution never reallocates, and
+		// sampled by the composite pass
+		frame.colorBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, colorBufferFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachment, &frame.colorBufferImageMemory);
 
-	// Get supported format for depth buffer
-	VkFormat depthFormat = chooseSupportedFormat(
-		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+		// Creat the Color Buffer Image View
+		frame.colorBufferImageView = createImageView(frame.colorBufferImage, colorBufferFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+}
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		// Create depth buffer image
-		depthBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
+void VulkanRenderer::createDepthBufferImage() {
+	for (auto& frame : frames) {
+		// Create depth buffer image (full size and sampled, same as the color buffer)
+		frame.depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, depthBufferFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachment, &frame.depthBufferImageMemory);
 
 		// Create Depth Buffer Image View
-		depthBufferImageView[i] = createImageView(depthBufferImage[i], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+		frame.depthBufferImageView = createImageView(frame.depthBufferImage, depthBufferFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
 	}
 }
 
 void VulkanRenderer::createFramebuffers() {
-	// Resize framebuffer count to equal swapchain image count
-	swapChainFramebuffers.resize(swapChainImages.size());
+	TRACE_SCOPE("createFramebuffers");
+
+	VkFramebufferCreateInfo framebufferCreateInfo = { };
+	framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferCreateInfo.width = swapChainExtent.width;									// framebuffer width
+	framebufferCreateInfo.height = swapChainExtent.height;									// framebuffer height
+	framebufferCreateInfo.layers = 1;														// framebuffer layers
+
+	// Scene framebuffer per frame, over its own targets
+	for (auto& frame : frames) {
+		std::array<VkImageView, 2> attachments = {
+			frame.colorBufferImageView,
+			frame.depthBufferImageView
+		};
+
+		framebufferCreateInfo.renderPass = sceneRenderPass;										// render pass layout the Framebuffer will be used with
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());		//
+		framebufferCreateInfo.pAttachments = attachments.data();								// list of attachments (1:1 with render pass)
 
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &frame.sceneFramebuffer);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create Framebuffer!");
+		}
+	}
+
+	// Composite framebuffer per swapchain image, any frame can be given any image
+	swapChainFramebuffers.resize(swapChainImages.size());
 	for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-		std::array<VkImageView, 3> attachments = {
-			swapChainImages[i].imageView,
-			colorBufferImageView[i],
-			depthBufferImageView[i]
-		};
+		framebufferCreateInfo.renderPass = compositeRenderPass;
+		framebufferCreateInfo.attachmentCount = 1;
+		framebufferCreateInfo.pAttachments = &swapChainImages[i].imageView;
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &swapChainFramebuffers[i]);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create Framebuffer!");
+		}
+	}
+}
+
+void VulkanRenderer::reportAttachmentMemory() {
+	VkImageUsageFlags colorUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	// Previous setup for comparison: a device local color + depth/stencil pair for every swapchain image
+	VkFormat legacyDepthFormat = chooseSupportedFormat({ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+
+	struct Resolution {
+		const char* name;
+		uint32_t width;
+		uint32_t height;
+	};
+	std::array<Resolution, 2> resolutions = { {
+		{ "current", swapChainExtent.width, swapChainExtent.height },
+		{ "4K", 3840, 2160 }
+	} };
+
+	const double bytesPerMiB = 1024.0 * 1024.0;
+
+	std::cout << "Scene target memory (" << frames.size() << " frames in flight, " << swapChainImages.size() << " swapchain images):\n";
+
+	for (const auto& resolution : resolutions) {
+		VkDeviceSize legacySize = swapChainImages.size() * (getImageMemorySize(resolution.width, resolution.height, colorBufferFormat, colorUsage)
+			+ getImageMemorySize(resolution.width, resolution.height, legacyDepthFormat, depthUsage));
+
+		VkDeviceSize frameSize = frames.size() * (getImageMemorySize(resolution.width, resolution.height, colorBufferFormat, colorUsage)
+			+ getImageMemorySize(resolution.width, resolution.height, depthBufferFormat, depthUsage));
+
+		std::cout << "\t" << resolution.name << " (" << resolution.width << "x" << resolution.height << "): "
+			<< legacySize / bytesPerMiB << " MiB -> " << frameSize / bytesPerMiB << " MiB, saved "
+			<< (legacySize > frameSize ? (legacySize - frameSize) / bytesPerMiB : 0.0) << " MiB\n";
+	}
+}
+
+void VulkanRenderer::createCommandPool() {
+	VkCommandPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;							// Allows the created Command Buffers to be re-recorded. (Can be done with a reset command or implictly)
+	poolInfo.queueFamilyIndex = getQueueFamilies(mainDevice.physicalDevice).graphicsFamily;		// Queue Family type that buffers from this command pool will use
+
+	// Create a graphics queue family command pool
+	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
+
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Command Pool!");
+	}
+}
+
+void VulkanRenderer::createCommandBuffers() {
+	TRACE_SCOPE("createCommandBuffers");
+
+	// Each frame gets its own pool, so the whole pool can be reset in one go once the frame's last submission has completed
+	VkCommandPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;										// Buffers are re-recorded every frame
+	poolInfo.queueFamilyIndex = getQueueFamilies(mainDevice.physicalDevice).graphicsFamily;		// Queue Family type that buffers from this command pool will use
+
+	for (auto& frame : frames) {
+		VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &frame.commandPool);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a Command Pool!");
+		}
+
+		VkCommandBufferAllocateInfo cbAllocInfo = { };
+		cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cbAllocInfo.commandPool = frame.commandPool;
+		cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;					// VK_COMMAND_BUFFER_PRIMARY : Buffer you submit directly to queue. Can't be called by other buffers
+																				// VK_COMMAND_BUFFER_SECONDARY : Buffer can't be called directly. Can be called from other buffers via "vkCmdExecuteCommands"
+		cbAllocInfo.commandBufferCount = 1;
+
+		result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &frame.commandBuffer);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate Command Buffers!");
+		}
+	}
+}
+
+void VulkanRenderer::createSynchronization() {
+	TRACE_SCOPE("createSynchronization");
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = { };
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	// Acquire / present need binary semaphores, GPU progress (frames finishing, uploads) is tracked on the timeline
+	graphicsTimeline.init(mainDevice.logicalDevice, graphicsQueue, timelineSemaphoresEnabled);
+
+	for (auto& frame : frames) {
+		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &frame.imageAvailable) != VK_SUCCESS
+			|| vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &frame.renderFinished) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create a Semaphore!");
+		}
+
+		// Value 0 is always complete, so the first wait for each frame returns straight away
+		frame.timelineValue = 0;
+		frame.resolutionScale = 1.0f;
+	}
+
+	// No frame has used any image yet
+	imagesInFlight.assign(swapChainImages.size(), 0);
+}
+
+void VulkanRenderer::createSamplers() {
+	// Sampler Creation Info
+	VkSamplerCreateInfo samplerCreateInfo = { };
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;						//	How to render when image is magnified on screen
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;						// How to render when image is minified on screen
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in U (x) direction
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in V (y) direction
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in W (z) direction
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;	// Border beyond texture (only works for border clamp)
+	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;				// Whether coords should be normalized between zero and one
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;		// Mipmap interpolation mode
+	samplerCreateInfo.mipLodBias = 0.0f;								// Level of Details bias for mip level
+	samplerCreateInfo.minLod = 0.0f;									// Minimum Level of Detail to pick mip level
+	samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;					// Maximum level of detail to pick mip level
+	samplerCreateInfo.anisotropyEnable = samplerAnisotropyEnabled;		// Enable Anisotropy (if the device has it)
+	samplerCreateInfo.maxAnisotropy = 16;								// Anisotropy sample level
+
+	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Texture Sampler!");
+	}
+
+	// Composite reads of the scene targets: no mips, and clamped so filtering at the edges doesn't wrap round
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.maxLod = 0.0f;
+	samplerCreateInfo.anisotropyEnable = VK_FALSE;
+	samplerCreateInfo.maxAnisotropy = 1;
+
+	result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &attachmentSampler);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create an Attachment Sampler!");
+	}
+}
+
+void VulkanRenderer::createUniformBuffers() {
+	// Each frame's slice has to start on an offset the device allows uniform buffers to be bound at
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+
+	VkDeviceSize alignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+	uniformSliceSize = sizeof(UboViewProjection);
+	if (alignment > 0) {
+		uniformSliceSize = (uniformSliceSize + alignment - 1) & ~(alignment - 1);
+	}
+
+	// One uniform buffer shared by every frame in flight
+	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, uniformSliceSize * frames.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform, &uniformBuffer, &uniformBufferMemory);
+
+	// Written every frame, so keep it mapped for its whole lifetime
+	vkMapMemory(mainDevice.logicalDevice, uniformBufferMemory, 0, VK_WHOLE_SIZE, 0, &uniformBufferMapped);
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		frames[i].uniformOffset = uniformSliceSize * i;
+	}
+}
+
+void VulkanRenderer::createObjectBuffers() {
+	// Start small, buffers grow to fit the scene in updateObjectBuffer
+	for (auto& frame : frames) {
+		createObjectBuffer(frame, 64);
+	}
+}
+
+void VulkanRenderer::createObjectBuffer(FrameContext& frame, size_t capacity) {
+	frame.objectBufferCapacity = capacity;
+
+	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(ObjectTransform) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform, &frame.objectBuffer, &frame.objectBufferMemory);
+
+	// Written every frame, so keep it mapped for its whole lifetime
+	vkMapMemory(mainDevice.logicalDevice, frame.objectBufferMemory, 0, VK_WHOLE_SIZE, 0, &frame.objectBufferMapped);
+}
+
+void VulkanRenderer::destroyObjectBuffer(FrameContext& frame) {
+	vkUnmapMemory(mainDevice.logicalDevice, frame.objectBufferMemory);
+	vkDestroyBuffer(mainDevice.logicalDevice, frame.objectBuffer, nullptr);
+	GpuMemoryTracker::free(mainDevice.logicalDevice, frame.objectBufferMemory);
+
+	frame.objectBuffer = nullptr;
+	frame.objectBufferMemory = nullptr;
+	frame.objectBufferMapped = nullptr;
+	frame.objectBufferCapacity = 0;
+}
+
+void VulkanRenderer::createDescriptorAllocators() {
+	// Long-lived sets: one uniform set per frame, one sampler set per texture and one composite input set per frame.
+	// Pools are chained as they fill up, so there is no fixed limit on how many textures can be created
+	std::vector<DescriptorPoolRatio> poolRatios = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f }
+	};
+	descriptorAllocator.init(mainDevice.logicalDevice, 32, poolRatios);
+
+	// Transient sets: allocated freely during a frame and all released with a single vkResetDescriptorPool
+	std::vector<DescriptorPoolRatio> framePoolRatios = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.0f }
+	};
+	for (auto& frame : frames) {
+		frame.descriptorAllocator.init(mainDevice.logicalDevice, 64, framePoolRatios);
+	}
+}
+
+void VulkanRenderer::createDescriptorUpdateTemplates() {
+	// Uniform Set Template (set 0): both bindings are read out of one UniformDescriptors struct
+	std::array<VkDescriptorUpdateTemplateEntry, 2> uniformEntries = { };
+	uniformEntries[0].dstBinding = 0;													// Binding to update
+	uniformEntries[0].dstArrayElement = 0;												// Index in array to update
+	uniformEntries[0].descriptorCount = 1;												// Amount to update
+	uniformEntries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;				// Type of descriptor
+	uniformEntries[0].offset = offsetof(UniformDescriptors, viewProjection);			// Where the info struct sits in the data passed to the update
+	uniformEntries[0].stride = sizeof(VkDescriptorBufferInfo);							// Distance between info structs (for arrays)
+
+	uniformEntries[1].dstBinding = 1;
+	uniformEntries[1].dstArrayElement = 0;
+	uniformEntries[1].descriptorCount = 1;
+	uniformEntries[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	uniformEntries[1].offset = offsetof(UniformDescriptors, objects);
+	uniformEntries[1].stride = sizeof(VkDescriptorBufferInfo);
+
+	VkDescriptorUpdateTemplateCreateInfo templateCreateInfo = { };
+	templateCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+	templateCreateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	templateCreateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(uniformEntries.size());
+	templateCreateInfo.pDescriptorUpdateEntries = uniformEntries.data();
+	templateCreateInfo.descriptorSetLayout = descriptorSetLayout;
+
+	VkResult result = vkCreateDescriptorUpdateTemplate(mainDevice.logicalDevice, &templateCreateInfo, nullptr, &uniformDescriptorTemplate);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Update Template!");
+	}
 
-		VkFramebufferCreateInfo framebufferCreateInfo = { };
-		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferCreateInfo.renderPass = renderPass;											// render pass layout the Framebuffer will be used with
-		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());		//
-		framebufferCreateInfo.pAttachments = attachments.data();								// list of attachments (1:1 with render pass)
-		framebufferCreateInfo.width = swapChainExtent.width;									// framebuffer width
-		framebufferCreateInfo.height = swapChainExtent.height;									// framebuffer height
-		framebufferCreateInfo.layers = 1;														// framebuffer layers
+	// Texture Set Template (set 1): a single combined image sampler
+	VkDescriptorUpdateTemplateEntry textureEntry = { };
+	textureEntry.dstBinding = 0;
+	textureEntry.dstArrayElement = 0;
+	textureEntry.descriptorCount = 1;
+	textureEntry.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	textureEntry.offset = 0;
+	textureEntry.stride = sizeof(VkDescriptorImageInfo);
 
-		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &swapChainFramebuffers.at(i));
+	templateCreateInfo.descriptorUpdateEntryCount = 1;
+	templateCreateInfo.pDescriptorUpdateEntries = &textureEntry;
+	templateCreateInfo.descriptorSetLayout = samplerSetLayout;
 
-		if (result != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create Framebuffer!");
-		}
+	result = vkCreateDescriptorUpdateTemplate(mainDevice.logicalDevice, &templateCreateInfo, nullptr, &textureDescriptorTemplate);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Update Template!");
+	}
+
+	// Composite Input Set Template: color and depth both come from one CompositeInputDescriptors struct
+	std::array<VkDescriptorUpdateTemplateEntry, 2> inputEntries = { };
+	inputEntries[0].dstBinding = 0;
+	inputEntries[0].dstArrayElement = 0;
+	inputEntries[0].descriptorCount = 1;
+	inputEntries[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	inputEntries[0].offset = offsetof(CompositeInputDescriptors, color);
+	inputEntries[0].stride = sizeof(VkDescriptorImageInfo);
+
+	inputEntries[1].dstBinding = 1;
+	inputEntries[1].dstArrayElement = 0;
+	inputEntries[1].descriptorCount = 1;
+	inputEntries[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	inputEntries[1].offset = offsetof(CompositeInputDescriptors, depth);
+	inputEntries[1].stride = sizeof(VkDescriptorImageInfo);
+
+	templateCreateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(inputEntries.size());
+	templateCreateInfo.pDescriptorUpdateEntries = inputEntries.data();
+	templateCreateInfo.descriptorSetLayout = inputSetLayout;
+
+	result = vkCreateDescriptorUpdateTemplate(mainDevice.logicalDevice, &templateCreateInfo, nullptr, &inputDescriptorTemplate);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create a Descriptor Update Template!");
 	}
 }
 
-void VulkanRenderer::createCommandPool() {
-	VkCommandPoolCreateInfo poolInfo = { };
-	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;							// Allows the created Command Buffers to be re-recorded. (Can be done with a reset command or implictly)
-	poolInfo.queueFamilyIndex = getQueueFamilies(mainDevice.physicalDevice).graphicsFamily;		// Queue Family type that buffers from this command pool will use
+void VulkanRenderer::createDescriptorSets() {
+	TRACE_SCOPE("createDescriptorSets");
 
-	// Create a graphics queue family command pool
-	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
+	// One set for every frame in flight
+	for (auto& frame : frames) {
+		frame.descriptorSet = descriptorAllocator.allocate(descriptorSetLayout);
 
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create a Command Pool!");
+		writeUniformDescriptorSet(frame);
 	}
 }
 
-void VulkanRenderer::createCommandBuffers() {
-	// Resize command buffer count to have one for each frame buffer
-	commandBuffers.resize(swapChainFramebuffers.size());
+void VulkanRenderer::writeUniformDescriptorSet(FrameContext& frame) {
+	UniformDescriptors uniformDescriptors = { };
 
-	VkCommandBufferAllocateInfo cbAllocInfo = { };
-	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cbAllocInfo.commandPool = graphicsCommandPool;
-	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;					// VK_COMMAND_BUFFER_PRIMARY : Buffer you submit directly to queue. Can't be called by other buffers
-																			// VK_COMMAND_BUFFER_SECONDARY : Buffer can't be called directly. Can be called from other buffers via "vkCmdExecuteCommands"
-	cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	// View Projection Descriptor
+	// Buffer info and data offset info
+	uniformDescriptors.viewProjection.buffer = uniformBuffer;					// Buffer to get data from
+	uniformDescriptors.viewProjection.offset = frame.uniformOffset;				// Position of start of this frame's slice
+	uniformDescriptors.viewProjection.range = sizeof(UboViewProjection);		// Size of data
 
-	VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
+	// Object Transform Descriptor (whole buffer, shader indexes into it)
+	uniformDescriptors.objects.buffer = frame.objectBuffer;
+	uniformDescriptors.objects.offset = 0;
+	uniformDescriptors.objects.range = VK_WHOLE_SIZE;
 
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate Command Buffers!");
-	}
+	// Update the descriptor set from the template (Connects Descriptor set to Uniform and Storage Buffers)
+	vkUpdateDescriptorSetWithTemplate(mainDevice.logicalDevice, frame.descriptorSet, uniformDescriptorTemplate, &uniformDescriptors);
 }
 
-void VulkanRenderer::createSynchronization() {
-	imageAvailable.resize(MAX_FRAMES_DRAWS);
-	renderFinished.resize(MAX_FRAMES_DRAWS);
-	drawFences.resize(MAX_FRAMES_DRAWS);
+void VulkanRenderer::createInputDescriptorSets() {
+	// Update Each Descriptor Set with the frame's scene targets
+	for (auto& frame : frames) {
+		// Sets of attachments replaced by a resize are reused once the GPU is done with them
+		if (!freeInputDescriptorSets.empty()) {
+			frame.inputDescriptorSet = freeInputDescriptorSets.back();
+			freeInputDescriptorSets.pop_back();
+		} else {
+			frame.inputDescriptorSet = descriptorAllocator.allocate(inputSetLayout);
+		}
 
-	VkSemaphoreCreateInfo semaphoreCreateInfo = { };
-	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		CompositeInputDescriptors inputDescriptors = { };
 
-	VkFenceCreateInfo fenceInfo = { };
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		// Color Target Descriptor
+		inputDescriptors.color.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		inputDescriptors.color.imageView = frame.colorBufferImageView;
+		inputDescriptors.color.sampler = attachmentSampler;
 
+		// Depth Target Descriptor
+		inputDescriptors.depth.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		inputDescriptors.depth.imageView = frame.depthBufferImageView;
+		inputDescriptors.depth.sampler = attachmentSampler;
 
-	for (size_t i = 0; i < MAX_FRAMES_DRAWS; i++) {
-		if (vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS
-			|| vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS
-			|| vkCreateFence(mainDevice.logicalDevice, &fenceInfo, nullptr, &drawFences[i]) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create a Semaphore and/or Fence!");
-		}
+		// Update Descriptor Set (both bindings in one call)
+		vkUpdateDescriptorSetWithTemplate(mainDevice.logicalDevice, frame.inputDescriptorSet, inputDescriptorTemplate, &inputDescriptors);
 	}
 }
 
-void VulkanRenderer::createTextureSampler() {
-	// Sampler Creation Info
-	VkSamplerCreateInfo samplerCreateInfo = { };
-	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;						//	How to render when image is magnified on screen
-	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;						// How to render when image is minified on screen
-	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in U (x) direction
-	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in V (y) direction
-	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;	// How to handle texture wrap in W (z) direction
-	samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;	// Border beyond texture (only works for border clamp)
-	samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;				// Whether coords should be normalized between zero and one
-	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;		// Mipmap interpolation mode
-	samplerCreateInfo.mipLodBias = 0.0f;								// Level of Details bias for mip level
-	samplerCreateInfo.minLod = 0.0f;									// Minimum Level of Detail to pick mip level
-	samplerCreateInfo.maxLod = 0.0f;									// Maximum level of detail to pick mip level
-	samplerCreateInfo.anisotropyEnable = VK_TRUE;						// Enable Anisotropy
-	samplerCreateInfo.maxAnisotropy = 16;								// Anisotropy sample level
+void VulkanRenderer::updateProjection() {
+	uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / swapChainExtent.height, nearPlane, farPlane);
+	uboViewProjection.projection[1][1] *= -1;		// Vulkan Coordinate System wierd. Y points down, but GLM is designed for OpenGL where Y goes up.
 
-	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create a Texture Sampler!");
-	}
+	// Software occlusion depth buffer stays at a fixed low width, with the view's aspect ratio
+	softwareOcclusion.setResolution(DEFAULT_SOFTWARE_OCCLUSION_WIDTH, std::max(1u, DEFAULT_SOFTWARE_OCCLUSION_WIDTH * swapChainExtent.height / std::max(swapChainExtent.width, 1u)));
 }
 
-void VulkanRenderer::createUniformBuffers() {
-	// ViewProjection Buffer size
-	VkDeviceSize uniformBufferSize = sizeof(UboViewProjection);
+void VulkanRenderer::updateUniformBuffers(FrameContext& frame) {
+	// Copy Uniform Buffer Data into this frame's slice
+	memcpy(static_cast<char*>(uniformBufferMapped) + frame.uniformOffset, &uboViewProjection, sizeof(UboViewProjection));
+}
+
+void VulkanRenderer::updateObjectBuffer(FrameContext& frame) {
+	// The final transform of every placement (node drawing a mesh) of every instance of every model goes into one
+	// contiguous array, remembering where each model starts. A model's objects are ordered by placement then instance, so
+	// each mesh's objects are contiguous and it can be drawn once however many nodes and instances use it
+	size_t objectCount = 0;
+	modelFirstObject.resize(modelList.size());
+	for (size_t i = 0; i < modelList.size(); i++) {
+		modelFirstObject[i] = static_cast<uint32_t>(objectCount);
+		objectCount += modelList[i].getPlacementCount() * modelList[i].getInstanceCount();
+	}
 
-	// Model Buffer size
-	//VkDeviceSize dynamicUniformBufferSize = modelUniformAlignment * MAX_OBJECTS;
+	// Only transforms moved since last frame (and their children) have their world matrices recomputed
+	transforms.update();
 
-	// One uniform buffer for each image (and by extension, command buffer)
-	uniformBuffer.resize(swapChainImages.size());
-	uniformBufferMemory.resize(swapChainImages.size());
+	// Grow this frame's buffer if it can't hold every object. The frame's last submission has already completed, so the GPU
+	// is no longer using it and it can be replaced straight away (other frames grow when their turn comes)
+	if (objectCount > frame.objectBufferCapacity) {
+		size_t newCapacity = frame.objectBufferCapacity;
+		while (newCapacity < objectCount) {
+			newCapacity *= 2;
+		}
 
-	//dynamicUniformBuffer.resize(swapChainImages.size());
-	//dynamicUniformBufferMemory.resize(swapChainImages.size());
+		destroyObjectBuffer(frame);
+		createObjectBuffer(frame, newCapacity);
 
-	// Create uniform buffers
-	for (size_t i = 0; i < uniformBuffer.size(); i++) {
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, uniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffer.at(i), &uniformBufferMemory.at(i));
+		// Descriptor set still points at the old buffer
+		writeUniformDescriptorSet(frame);
+	}
 
-		//createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, dynamicUniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &dynamicUniformBuffer.at(i), &dynamicUniformBufferMemory.at(i));
+	// Written straight into this frame's mapped buffer, no CPU side copy
+	ObjectTransform* objects = static_cast<ObjectTransform*>(frame.objectBufferMapped);
+	for (size_t i = 0; i < modelList.size(); i++) {
+		const std::vector<uint32_t>& objectTransforms = modelList[i].getObjectTransforms();
+		transforms.write(objectTransforms.data(), objectTransforms.size(), objects + modelFirstObject[i]);
 	}
 }
 
-void VulkanRenderer::createDescriptorPool() {
-	// Create Uniform Descriptor Pool
-
-	// Type of descriptors + how many DESCRIPTORS, not descriptor sets (combined makes the pool size)
-	// View Projection Pool Size
-	VkDescriptorPoolSize uniformPoolSize = { };
-	uniformPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uniformPoolSize.descriptorCount = static_cast<uint32_t>(uniformBuffer.size());
+void VulkanRenderer::buildDrawList() {
+	drawItems.clear();
+	drawKeys.clear();
+	drawOrder.clear();
 
-	//// Model Pool Size (DYNAMIC)
-	//VkDescriptorPoolSize dynamicUniformPoolSize = { };
-	//dynamicUniformPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	//dynamicUniformPoolSize.descriptorCount = static_cast<uint32_t>(dynamicUniformBuffer.size());
-
-	std::vector<VkDescriptorPoolSize> poolSizes = { uniformPoolSize };
+	uint32_t geometryId = 0;
+	for (size_t i = 0; i < modelList.size(); i++) {
+		MeshModel& thisModel = modelList[i];
 
-	VkDescriptorPoolCreateInfo poolCreateInfo = { };
-	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());					// Maximum number of Descriptor Sets that can be created from pool
-	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());					// Amount of Pool Sizes being passed
-	poolCreateInfo.pPoolSizes = poolSizes.data();											// Pool Sizes to create Pool with
+		uint32_t modelInstanceCount = static_cast<uint32_t>(thisModel.getInstanceCount());
+		const std::vector<uint32_t>& objectTransforms = thisModel.getObjectTransforms();
 
-	// Create Descriptor Pool
-	VkResult result = vkCreateDescriptorPool(mainDevice.logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
+		for (size_t j = 0; j < thisModel.getMeshCount(); j++, geometryId++) {
+			// Every node using the mesh, for every instance of the model, in one instanced draw
+			uint32_t firstInstance = modelFirstObject[i] + thisModel.getMeshFirstPlacement(j) * modelInstanceCount;
+			uint32_t instanceCount = thisModel.getMeshPlacementCount(j) * modelInstanceCount;
+			if (instanceCount == 0) {
+				continue;
+			}
 
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create a Descriptor Pool!");
-	}
+			Mesh* mesh = thisModel.getMesh(j);
+			glm::vec4 center = glm::vec4(mesh->getBoundsCenter(), 1.0f);
 
-	// Create Sampler Descriptor Pool
-	// Texture Sampler Pool
-	VkDescriptorPoolSize samplerPoolSize = { };
-	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;
+			float boundsRadius = glm::length(mesh->getBoundsMax() - mesh->getBoundsMin()) * 0.5f;
 
-	VkDescriptorPoolCreateInfo samplerPoolCreateInfo = { };
-	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
-	samplerPoolCreateInfo.poolSizeCount = 1;
-	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
+			// Depth of the draw is the nearest of its instances
+			float nearestDepth = farPlane;
+			float largestScreenSize = 0.0f;
+			for (uint32_t k = 0; k < instanceCount; k++) {
+				const glm::vec4* world = transforms.getWorldRows(objectTransforms[firstInstance - modelFirstObject[i] + k]);
+				glm::vec4 worldCenter = glm::vec4(glm::dot(world[0], center), glm::dot(world[1], center), glm::dot(world[2], center), 1.0f);
 
-	result = vkCreateDescriptorPool(mainDevice.logicalDevice, &samplerPoolCreateInfo, nullptr, &samplerDescriptorPool);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create a Descriptor Pool!");
-	}
+				float viewDepth = -(uboViewProjection.view * worldCenter).z;
+				nearestDepth = std::min(nearestDepth, viewDepth);
 
-	// Create Input Attachment Descriptor Pool
-	// Color Attachment Pool Size
-	VkDescriptorPoolSize colorInputPoolSize = { };
-	colorInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	colorInputPoolSize.descriptorCount = static_cast<uint32_t>(colorBufferImageView.size());
+				// Height in pixels of the instance's bounding sphere, for picking the texture level it needs. Instances behind
+				// the camera don't need any
+				if (viewDepth > -boundsRadius) {
+					float scale = std::max(glm::length(glm::vec3(world[0].x, world[1].x, world[2].x)),
+						std::max(glm::length(glm::vec3(world[0].y, world[1].y, world[2].y)), glm::length(glm::vec3(world[0].z, world[1].z, world[2].z))));
+					float screenSize = boundsRadius * scale * std::abs(uboViewProjection.projection[1][1]) * renderExtent.height / std::max(viewDepth, nearPlane);
+					largestScreenSize = std::max(largestScreenSize, screenSize);
+				}
+			}
 
-	// Depth Attachment Pool Size
-	VkDescriptorPoolSize depthInputPoolSize = { };
-	depthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	depthInputPoolSize.descriptorCount = static_cast<uint32_t>(depthBufferImageView.size());
+			if (largestScreenSize > 0.0f) {
+				uint32_t texId = static_cast<uint32_t>(mesh->getTexId());
+				textureResidency.requestMip(texId, TextureResidency::getMipForScreenSize(textures[texId].width, textures[texId].height, largestScreenSize), frameNumber);
+			}
 
-	std::vector<VkDescriptorPoolSize> inputPoolSizes = { colorInputPoolSize, depthInputPoolSize };
+			float normalizedDepth = (nearestDepth - nearPlane) / (farPlane - nearPlane);
 
-	// Create Input Attachment Pool
-	VkDescriptorPoolCreateInfo inputPoolCreateInfo = { };
-	inputPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	inputPoolCreateInfo.maxSets = (int)swapChainImages.size();
-	inputPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(inputPoolSizes.size());
-	inputPoolCreateInfo.pPoolSizes = inputPoolSizes.data();
+			// Only one scene pipeline for now
+			drawKeys.push_back(makeDrawKey(0, static_cast<uint32_t>(mesh->getTexId()), geometryId, normalizedDepth));
+			drawOrder.push_back(static_cast<uint32_t>(drawItems.size()));
+			drawItems.push_back({ mesh, static_cast<uint32_t>(i), firstInstance, instanceCount });
 
-	result = vkCreateDescriptorPool(mainDevice.logicalDevice, &inputPoolCreateInfo, nullptr, &inputDescriptorPool);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create a Descriptor Pool!");
+			// Culler's draws are added in the same order, so they share the draw item's index
+			if (occlusionCulling) {
+				occlusionCuller.addDraw(mesh->getBoundsMin(), mesh->getBoundsMax(), mesh->getIndexCount(), firstInstance, instanceCount);
+			}
+		}
 	}
+
+	radixSortDrawKeys(drawKeys, drawOrder, drawKeysTemp, drawOrderTemp);
 }
 
-void VulkanRenderer::createDescriptorSets() {
-	// Resize Descriptor Set List so one for every buffer
-	descriptorSets.resize(swapChainImages.size());
+void VulkanRenderer::cullDrawListOnCpu(FrameContext& frame) {
+	softwareOcclusion.beginFrame(uboViewProjection.projection * uboViewProjection.view, nearPlane);
+
+	// Every instance of an occluder mesh is a candidate, the nearest hide the most so they go in first until the triangle
+	// budget runs out
+	occluderInstances.clear();
+	for (const DrawItem& drawItem : drawItems) {
+		if (!drawItem.mesh->isOccluder()) {
+			continue;
+		}
 
-	std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), descriptorSetLayout);
+		const uint32_t* objectIds = modelList[drawItem.model].getObjectTransforms().data() + (drawItem.firstInstance - modelFirstObject[drawItem.model]);
+		glm::vec4 center = glm::vec4(drawItem.mesh->getBoundsCenter(), 1.0f);
+		for (uint32_t k = 0; k < drawItem.instanceCount; k++) {
+			const glm::vec4* world = transforms.getWorldRows(objectIds[k]);
+			glm::vec4 worldCenter = glm::vec4(glm::dot(world[0], center), glm::dot(world[1], center), glm::dot(world[2], center), 1.0f);
+			occluderInstances.push_back({ glm::length(glm::vec3(uboViewProjection.view * worldCenter)), drawItem.mesh, world });
+		}
+	}
+	std::sort(occluderInstances.begin(), occluderInstances.end(), [](const OccluderInstance& a, const OccluderInstance& b) {
+		return a.distance < b.distance;
+	});
 
-	// Descriptor Set Allocation Info
-	VkDescriptorSetAllocateInfo setAllocInfo = { };
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = descriptorPool;											// Pool to allocate Descriptor Set from
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());		// Number of sets to allocate
-	setAllocInfo.pSetLayouts = setLayouts.data();											// Layouts to use to allocate sets (1:1 relationship)
+	uint32_t occluderTriangles = 0;
+	for (const auto& occluder : occluderInstances) {
+		uint32_t triangleCount = static_cast<uint32_t>(occluder.mesh->getOccluderIndices().size() / 3);
+		if (occluderTriangles + triangleCount > MAX_SOFTWARE_OCCLUSION_TRIANGLES) {
+			continue;
+		}
 
-	// Allocate Descriptor Sets (multiple)
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, descriptorSets.data());
+		softwareOcclusion.addOccluder(occluder.mesh->getOccluderPositions(), occluder.mesh->getOccluderIndices(), occluder.worldRows);
+		occluderTriangles += triangleCount;
+	}
+	softwareOcclusion.rasterize();
 
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate Descriptor Sets!");
-	}
-
-	// Update all of descriptor set bindings
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		// View Projection Descriptor
-		// Buffer info and data offset info
-		VkDescriptorBufferInfo uboViewProjectionBufferInfo = { };
-		uboViewProjectionBufferInfo.buffer = uniformBuffer[i];		// Buffer to get data from
-		uboViewProjectionBufferInfo.offset = 0;						// Position of start of data1
-		uboViewProjectionBufferInfo.range = sizeof(UboViewProjection);				// Size of data
-
-		// Data about connection between binding and buffer
-		VkWriteDescriptorSet uboViewProjectionSetWrite = { };
-		uboViewProjectionSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		uboViewProjectionSetWrite.dstSet = descriptorSets.at(i);						// Descriptor Set to update
-		uboViewProjectionSetWrite.dstBinding = 0;										// Binding to update (matches with binding on layout/shader)
-		uboViewProjectionSetWrite.dstArrayElement = 0;									// Index in array to update
-		uboViewProjectionSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;	// Type of descriptor
-		uboViewProjectionSetWrite.descriptorCount = 1;									// Amount to update
-		uboViewProjectionSetWrite.pBufferInfo = &uboViewProjectionBufferInfo;			// Information about buffer data to bind
-
-		// Model Descriptor
-		// Model Buffer Binding Info
-		/*VkDescriptorBufferInfo uboModelProjectionBufferInfo = { };
-		uboModelProjectionBufferInfo.buffer = dynamicUniformBuffer.at(i);
-		uboModelProjectionBufferInfo.offset = 0;
-		uboModelProjectionBufferInfo.range = modelUniformAlignment;
-
-		VkWriteDescriptorSet uboModelSetWrite = { };
-		uboModelSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		uboModelSetWrite.dstSet = descriptorSets.at(i);
-		uboModelSetWrite.dstBinding = 1;
-		uboModelSetWrite.dstArrayElement = 0;
-		uboModelSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-		uboModelSetWrite.descriptorCount = 1;
-		uboModelSetWrite.pBufferInfo = &uboModelProjectionBufferInfo;*/
-
-		std::vector<VkWriteDescriptorSet> setWrites = { uboViewProjectionSetWrite };
-
-		// Update the descriptor sets with new buffer/binding info (Connects Descriptor sets to Uniform Buffer)
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+	// Then every instance of every draw item (occluders too, they can be hidden by nearer ones) is tested at once
+	occlusionBoxes.clear();
+	for (const DrawItem& drawItem : drawItems) {
+		const uint32_t* objectIds = modelList[drawItem.model].getObjectTransforms().data() + (drawItem.firstInstance - modelFirstObject[drawItem.model]);
+		for (uint32_t k = 0; k < drawItem.instanceCount; k++) {
+			occlusionBoxes.push_back({ drawItem.mesh->getBoundsMin(), drawItem.mesh->getBoundsMax(), transforms.getWorldRows(objectIds[k]) });
+		}
 	}
-}
+	occlusionVisible.resize(occlusionBoxes.size());
+	softwareOcclusion.testBoxes(occlusionBoxes.data(), occlusionBoxes.size(), occlusionVisible.data());
 
-void VulkanRenderer::createInputDescriptorSets() {
-	// Resize array to hold descriptor set for each swap chain image
-	inputDescriptorSets.resize(swapChainImages.size());
+	// Visible instances are rewritten from the transform system (not read back from the mapped buffer, which may be write
+	// combined) to the start of the draw item's objects, so the draw just has a smaller instance count
+	ObjectTransform* objects = static_cast<ObjectTransform*>(frame.objectBufferMapped);
+	size_t box = 0;
+	for (DrawItem& drawItem : drawItems) {
+		const uint32_t* objectIds = modelList[drawItem.model].getObjectTransforms().data() + (drawItem.firstInstance - modelFirstObject[drawItem.model]);
+
+		visibleObjectIds.clear();
+		for (uint32_t k = 0; k < drawItem.instanceCount; k++, box++) {
+			if (occlusionVisible[box]) {
+				visibleObjectIds.push_back(objectIds[k]);
+			}
+		}
 
-	// Fill array of layouts ready for set creation
-	std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), inputSetLayout);
+		if (visibleObjectIds.size() < drawItem.instanceCount) {
+			transforms.write(visibleObjectIds.data(), visibleObjectIds.size(), objects + drawItem.firstInstance);
+			drawItem.instanceCount = static_cast<uint32_t>(visibleObjectIds.size());
+		}
+	}
 
-	// Input Attachment Desciptor Set Allocation Info
-	VkDescriptorSetAllocateInfo setAllocInfo = { };
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = inputDescriptorPool;
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-	setAllocInfo.pSetLayouts = setLayouts.data();
+	// Draw items with nothing left aren't recorded at all
+	drawOrder.erase(std::remove_if(drawOrder.begin(), drawOrder.end(), [this](uint32_t drawIndex) {
+		return drawItems[drawIndex].instanceCount == 0;
+	}), drawOrder.end());
+}
 
-	// Allocate Descriptor Sets
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, inputDescriptorSets.data());
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate input attachment descriptor sets!");
-	}
-
-	// Update Each Descriptor Set with input attachment
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		// Color Attachment Descriptor
-		VkDescriptorImageInfo colorAttachmentDescriptor = { };
-		colorAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		colorAttachmentDescriptor.imageView = colorBufferImageView[i];
-		colorAttachmentDescriptor.sampler = VK_NULL_HANDLE;
-
-		// Color Attachment Descriptor Write
-		VkWriteDescriptorSet colorWrite = { };
-		colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		colorWrite.dstSet = inputDescriptorSets[i];
-		colorWrite.dstBinding = 0;
-		colorWrite.dstArrayElement = 0;
-		colorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		colorWrite.descriptorCount = 1;
-		colorWrite.pImageInfo = &colorAttachmentDescriptor;
-
-
-		// Depth Attachment Descriptor
-		VkDescriptorImageInfo depthAttachmentDescriptor = { };
-		depthAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		depthAttachmentDescriptor.imageView = depthBufferImageView[i];
-		depthAttachmentDescriptor.sampler = VK_NULL_HANDLE;
-
-		// Depth Attachment Descriptor Write
-		VkWriteDescriptorSet depthWrite = { };
-		depthWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		depthWrite.dstSet = inputDescriptorSets[i];
-		depthWrite.dstBinding = 1;
-		depthWrite.dstArrayElement = 0;
-		depthWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		depthWrite.descriptorCount = 1;
-		depthWrite.pImageInfo = &depthAttachmentDescriptor;
-
-		// List of Input Descriptor Set Writes
-		std::vector<VkWriteDescriptorSet> setWrites = { colorWrite, depthWrite };
-
-		// Update Descriptor Sets
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
-	}
-}
-
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex) {
-	// Copy Uniform Buffer Data
-
-	void* data;
-	vkMapMemory(mainDevice.logicalDevice, uniformBufferMemory.at(imageIndex), 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, uniformBufferMemory.at(imageIndex));
-
-	// Copy Dynamic Uniform Buffer Data
-	//for (size_t i = 0; i < meshList.size(); i++) {
-	//	Model* thisModel = (Model*)((uint64_t)modelTransferSpace + (i * modelUniformAlignment));
-	//	*thisModel = meshList.at(i).getModel();
-	//}
-	//// Map the list of model data
-	//vkMapMemory(mainDevice.logicalDevice, dynamicUniformBufferMemory.at(imageIndex), 0, modelUniformAlignment * meshList.size(), 0, &data);
-	//memcpy(data, modelTransferSpace, modelUniformAlignment * meshList.size());
-	//vkUnmapMemory(mainDevice.logicalDevice, dynamicUniformBufferMemory.at(imageIndex));
-}
-
-void VulkanRenderer::recordCommands(uint32_t currentImage) {
+void VulkanRenderer::recordCommands(FrameContext& frame, uint32_t currentImage) {
 	VkCommandBufferBeginInfo beginInfo { };
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
 	// Information about how to begin a render pass (only needed for a graphical application)
+	// Scene only renders to (and clears) the scaled down part of its targets
 	VkRenderPassBeginInfo renderPassBeginInfo = { };
 	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = renderPass;								// Render pass to begin
+	renderPassBeginInfo.renderPass = sceneRenderPass;							// Render pass to begin
 	renderPassBeginInfo.renderArea.offset = { 0, 0 };							// start point of render pass in pixels
-	renderPassBeginInfo.renderArea.extent = swapChainExtent;					// size of region to run render pass on (starting at offset
+	renderPassBeginInfo.renderArea.extent = renderExtent;						// size of region to run render pass on (starting at offset
 
-	std::array<VkClearValue, 3> clearValues = {	};
-	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-	clearValues[1].color = { 36 / 255.0f, 47 / 255.0f, 87 / 255.0f, 1.0f };
-	clearValues[2].depthStencil.depth = 1.0f;
+	std::array<VkClearValue, 2> clearValues = {	};
+	clearValues[0].color = { 36 / 255.0f, 47 / 255.0f, 87 / 255.0f, 1.0f };
+	clearValues[1].depthStencil.depth = 1.0f;
 
 	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassBeginInfo.pClearValues = clearValues.data();
 
-	renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
+	renderPassBeginInfo.framebuffer = frame.sceneFramebuffer;
+
+	// Composite covers the whole swapchain image, every pixel is written so nothing is cleared
+	VkRenderPassBeginInfo compositePassBeginInfo = { };
+	compositePassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	compositePassBeginInfo.renderPass = compositeRenderPass;
+	compositePassBeginInfo.renderArea.offset = { 0, 0 };
+	compositePassBeginInfo.renderArea.extent = swapChainExtent;
+	compositePassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
 
 	// Start recording commands to command buffer!
 	VkResult result;
-	result = vkBeginCommandBuffer(commandBuffers.at(currentImage), &beginInfo);
+	result = vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to start recording a command buffer!");
 	}
 
-		vkCmdBeginRenderPass(commandBuffers.at(currentImage), &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			// Bind Pipeline to be used in render pass
-			vkCmdBindPipeline(commandBuffers.at(currentImage), VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-			// Can add mutliple bind pipeline cmd calls. Useful for doing deferred shading.
+	commandRecorder.begin(frame.commandBuffer);
+	commandRecorder.resetStats();
 
-			for (size_t j = 0; j < modelList.size(); j++) {
+	// Picks up this frame slot's timings from its last use and resets its queries (must be outside the render pass)
+	gpuProfiler.beginFrame(frame.commandBuffer, currentFrame);
+	int frameScope = gpuProfiler.beginScope(frame.commandBuffer, "Frame");
 
-				MeshModel thisModel = modelList[j];
-				glm::mat4 thisModelModel = modelList[j].getModel();
-				vkCmdPushConstants(commandBuffers[currentImage], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Model), &thisModelModel);
+	// Timings just read back are of this slot's previous frame, rendered at the scale it used then. They decide the next
+	// frame's scale. Only the scene's render passes count: with occlusion culling there are two, and the culling and
+	// pyramid dispatches between them don't change with the resolution scale the way drawing does
+	double sceneMs = 0.0;
+	if (gpuProfiler.takeLatestMs("Scene pass", &sceneMs)) {
+		double secondPassMs = 0.0;
+		if (gpuProfiler.takeLatestMs("Scene second pass", &secondPassMs)) {
+			sceneMs += secondPassMs;
+		}
+		dynamicResolution.addSample(sceneMs, frame.resolutionScale);
+	}
+	frame.resolutionScale = static_cast<float>(renderExtent.width) / swapChainExtent.width;
+
+	// Both pipelines take viewport and scissor as dynamic state, so the scene's size can change every frame
+	VkViewport viewport = { 0.0f, 0.0f, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
+	VkRect2D scissor = { { 0, 0 }, renderExtent };
+
+	if (occlusionCulling) {
+		glm::mat4 viewProjection = uboViewProjection.projection * uboViewProjection.view;
+
+		// Indirect draws read the transforms of the objects that passed from the culler's buffer, with the same
+		// uniforms as the frame's set
+		UniformDescriptors cullDescriptors = { };
+		cullDescriptors.viewProjection.buffer = uniformBuffer;
+		cullDescriptors.viewProjection.offset = frame.uniformOffset;
+		cullDescriptors.viewProjection.range = sizeof(UboViewProjection);
+		cullDescriptors.objects.buffer = occlusionCuller.getDrawnObjectBuffer();
+		cullDescriptors.objects.offset = 0;
+		cullDescriptors.objects.range = VK_WHOLE_SIZE;
+
+		VkDescriptorSet cullObjectSet = allocateFrameDescriptorSet(descriptorSetLayout);
+		vkUpdateDescriptorSetWithTemplate(mainDevice.logicalDevice, cullObjectSet, uniformDescriptorTemplate, &cullDescriptors);
+
+		// First pass: objects visible against last frame's pyramid. Compute binds and pushes go around the recorder,
+		// so its shadow state is dropped after each culling pass
+		occlusionCuller.recordFirstPass(frame.commandBuffer, frame.objectBuffer, viewProjection);
+		commandRecorder.invalidate();
+
+		int sceneScope = gpuProfiler.beginScope(frame.commandBuffer, "Scene pass");
+		vkCmdBeginRenderPass(frame.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetViewport(frame.commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(frame.commandBuffer, 0, 1, &scissor);
+			recordSceneDraws(frame, cullObjectSet, 0);
+		vkCmdEndRenderPass(frame.commandBuffer);
+		gpuProfiler.endScope(frame.commandBuffer, sceneScope);
+
+		// Pyramid of that depth, used by the second pass and next frame's first
+		int pyramidScope = gpuProfiler.beginScope(frame.commandBuffer, "Hi-Z pyramid");
+		occlusionCuller.recordPyramid(frame.commandBuffer, frame.depthBufferImageView, renderExtent);
+		gpuProfiler.endScope(frame.commandBuffer, pyramidScope);
+
+		// Second pass: what the first culled but this frame's depth shows, drawn over the first pass' results
+		occlusionCuller.recordSecondPass(frame.commandBuffer, viewProjection);
+		commandRecorder.invalidate();
+
+		renderPassBeginInfo.renderPass = sceneLoadRenderPass;
+		int secondSceneScope = gpuProfiler.beginScope(frame.commandBuffer, "Scene second pass");
+		vkCmdBeginRenderPass(frame.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetViewport(frame.commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(frame.commandBuffer, 0, 1, &scissor);
+			recordSceneDraws(frame, cullObjectSet, 1);
+		vkCmdEndRenderPass(frame.commandBuffer);
+		gpuProfiler.endScope(frame.commandBuffer, secondSceneScope);
+	} else {
+		int sceneScope = gpuProfiler.beginScope(frame.commandBuffer, "Scene pass");
+		vkCmdBeginRenderPass(frame.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetViewport(frame.commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(frame.commandBuffer, 0, 1, &scissor);
+			recordSceneDraws(frame, frame.descriptorSet, -1);
+		vkCmdEndRenderPass(frame.commandBuffer);
+		gpuProfiler.endScope(frame.commandBuffer, sceneScope);
+	}
 
-				for (size_t k = 0; k < thisModel.getMeshCount(); k++) {
-					VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer() };														// Buffers to bind
-					VkDeviceSize offsets[] = { 0 };																								// offsets into buffers being bound
-					vkCmdBindVertexBuffers(commandBuffers.at(currentImage), 0, 1, vertexBuffers, offsets);										// Command to bind vertex buffer before drawing with them
+	int compositeScope = gpuProfiler.beginScope(frame.commandBuffer, "Composite pass");
 
-					vkCmdBindIndexBuffer(commandBuffers.at(currentImage), thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);		// Command to bind Mesh Index Buffer with 0 offset
+		// Upscale the scene to the swapchain image
+		vkCmdBeginRenderPass(frame.commandBuffer, &compositePassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-					// Dynamic Offset Amount
-					//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAlignment * j);
+			viewport.width = (float)swapChainExtent.width;
+			viewport.height = (float)swapChainExtent.height;
+			scissor.extent = swapChainExtent;
+			vkCmdSetViewport(frame.commandBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(frame.commandBuffer, 0, 1, &scissor);
 
-					std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[thisModel.getMesh(k)->getTexId()] };
+			commandRecorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
 
-					// Bind Descriptor Sets
-					vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+			commandRecorder.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipleineLayout, 0, 1, &frame.inputDescriptorSet);
 
-					// vkCmdDraw(commandBuffers.at(i), static_cast<uint32_t>(firstMesh.getVertexCount()), 1, 0, 0);
-					vkCmdDrawIndexed(commandBuffers.at(currentImage), thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);						// Use Indexed Draw Call instead
-				}
-			}
+			// Bilinear reads stop half a texel inside the rendered part, so nothing left over outside it bleeds in
+			CompositePushConstant composite = { };
+			composite.uvScale = glm::vec2((float)renderExtent.width / swapChainExtent.width, (float)renderExtent.height / swapChainExtent.height);
+			composite.uvMax = glm::vec2((renderExtent.width - 0.5f) / swapChainExtent.width, (renderExtent.height - 0.5f) / swapChainExtent.height);
+			commandRecorder.pushConstants(secondPipleineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(CompositePushConstant), &composite);
 
-		// Start Second Subpass
-		vkCmdNextSubpass(commandBuffers[currentImage], VK_SUBPASS_CONTENTS_INLINE);
+			commandRecorder.draw(3, 1, 0, 0);
 
-			vkCmdBindPipeline(commandBuffers.at(currentImage), VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
+		vkCmdEndRenderPass(frame.commandBuffer);
 
-			vkCmdBindDescriptorSets(commandBuffers.at(currentImage), VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipleineLayout, 0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
+	gpuProfiler.endScope(frame.commandBuffer, compositeScope);
 
-			vkCmdDraw(commandBuffers.at(currentImage), 3, 1, 0, 0);
+	gpuProfiler.endScope(frame.commandBuffer, frameScope);
 
-		vkCmdEndRenderPass(commandBuffers.at(currentImage));
+	recordingStats = commandRecorder.getStats();
 
 	// Stop recording to command buffer
-	result = vkEndCommandBuffer(commandBuffers[currentImage]);
+	result = vkEndCommandBuffer(frame.commandBuffer);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to stop recording a command buffer!");
 	}
 }
 
 void VulkanRenderer::getPhysicalDevice() {
+	TRACE_SCOPE("getPhysicalDevice");
+
 	// Enumerate Physical devices the vkInstance can access
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -1392,17 +2445,9 @@ void VulkanRenderer::getPhysicalDevice() {
 		}
 	}
 
-	VkPhysicalDeviceProperties deviceProperties;
-	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
-
-	//minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
-}
-
-void VulkanRenderer::allocateDynamicBufferTransferSpace() {
-	//modelUniformAlignment = (sizeof(Model) + minUniformBufferOffset - 1) & ~(minUniformBufferOffset - 1);		// Wierd Bit Shifting Magic happening here. Used to calculate alignment of model data
-
-	//// Create space in memory to hold dynamic buffer that is aligned to our required alignment and holds MAX_OBJECTS
-	//modelTransferSpace = (Model*)_aligned_malloc(modelUniformAlignment * MAX_OBJECTS, modelUniformAlignment);
+	if (mainDevice.physicalDevice == nullptr) {
+		throw std::runtime_error("Can't find a suitable GPU!");
+	}
 }
 
 bool VulkanRenderer::checkInstanceExtensionSupport(std::vector<const char*>* checkExtensions) {
@@ -1442,6 +2487,11 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device) {
 
 	QueueFamilyIndices indices = getQueueFamilies(device);
 
+	// Headless only needs a graphics queue (software drivers such as lavapipe are fine)
+	if (headless) {
+		return indices.isValid();
+	}
+
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
 
 	bool swapChainValid = false;
@@ -1530,9 +2580,13 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device) {
 			indices.graphicsFamily = i; // if queue family is valid, then get index
 		}
 
-		// Check if queue family supports presentation
+		// Check if queue family supports presentation (nothing is presented when headless, so the graphics queue will do)
 		VkBool32 presentationSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		if (headless) {
+			presentationSupport = indices.graphicsFamily == i;
+		} else {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+		}
 		// Check if queue is presentation type (can be both graphics and presentation)
 		if (queueFamily.queueCount > 0 && presentationSupport) {
 			indices.presentationFamily = i;
@@ -1654,7 +2708,7 @@ VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat>& form
 	throw std::runtime_error("Failed to find a matching format!");
 }
 
-VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory) {
+VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryCategory category, VkDeviceMemory* imageMemory, VkMemoryPropertyFlags preferredPropFlags, uint32_t mipLevels) {
 	// Create Image
 	VkImageCreateInfo imageCreateInfo = { };
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1662,7 +2716,7 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	imageCreateInfo.extent.width = width;								
 	imageCreateInfo.extent.height = height;
 	imageCreateInfo.extent.depth = 1;
-	imageCreateInfo.mipLevels = 1;										// Number of mipmap levels
+	imageCreateInfo.mipLevels = mipLevels;								// Number of mipmap levels
 	imageCreateInfo.arrayLayers = 1;									// number of levels in image array
 	imageCreateInfo.format = format;									// Format type of image
 	imageCreateInfo.tiling = tiling;									// how image data should be aranged for optimal reading
@@ -1687,9 +2741,16 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	VkMemoryAllocateInfo memoryAllocInfo = { };
 	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	memoryAllocInfo.allocationSize = memoryRequirements.size;
-	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
 
-	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, imageMemory);
+	// Use the preferred properties as well if there is a memory type with them, otherwise only the required ones
+	uint32_t memoryTypeIndex;
+	if (preferredPropFlags != 0 && tryFindMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags | preferredPropFlags, &memoryTypeIndex)) {
+		memoryAllocInfo.memoryTypeIndex = memoryTypeIndex;
+	} else {
+		memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
+	}
+
+	result = GpuMemoryTracker::allocate(mainDevice.logicalDevice, &memoryAllocInfo, category, imageMemory);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate memory for image!");
 	}
@@ -1700,7 +2761,38 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	return image;
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+VkDeviceSize VulkanRenderer::getImageMemorySize(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags useFlags) {
+	// Image is only created to ask the driver how much memory it would need, it never gets memory bound
+	VkImageCreateInfo imageCreateInfo = { };
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = width;
+	imageCreateInfo.extent.height = height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = format;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = useFlags;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkImage image;
+	VkResult result = vkCreateImage(mainDevice.logicalDevice, &imageCreateInfo, nullptr, &image);
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create an Image!");
+	}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
+
+	vkDestroyImage(mainDevice.logicalDevice, image, nullptr);
+
+	return memoryRequirements.size;
+}
+
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
 	VkImageViewCreateInfo viewCreateInfo = { };
 	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	viewCreateInfo.image = image;										// Image to create view for
@@ -1715,7 +2807,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	// Subresources allow the view to view only a part of the image
 	viewCreateInfo.subresourceRange.aspectMask = aspectFlags;			// Which aspect of image to view (e.g. COLOR_BIT for viewing color)
 	viewCreateInfo.subresourceRange.baseMipLevel = 0;					// Start mipmap level to view from
-	viewCreateInfo.subresourceRange.levelCount = 1;						// Number of mipmap levels to view
+	viewCreateInfo.subresourceRange.levelCount = mipLevels;				// Number of mipmap levels to view
 	viewCreateInfo.subresourceRange.baseArrayLayer = 0;					// Start array level to view from
 	viewCreateInfo.subresourceRange.layerCount = 1;						// Number of array levels to view
 
@@ -1747,158 +2839,425 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string fileName) {
-	// Load image file
-	int width, height;
-	VkDeviceSize imageSize;
-	stbi_uc* imageData = loadTextureFile(fileName, &width, &height, &imageSize);
+int VulkanRenderer::createTexture(TextureData texture) {
+	TRACE_SCOPE("createTexture");
+
+	Texture newTexture = { };
+	newTexture.pixels = texture.pixels;
+	newTexture.width = static_cast<uint32_t>(texture.width);
+	newTexture.height = static_cast<uint32_t>(texture.height);
+	newTexture.mipLevels = texture.mipLevels;
 
-	// Create Staging Buffer to hold loaded data, ready to copy to device
-	VkBuffer imageStagingBuffer;
-	VkDeviceMemory imageStagingBufferMemory;
-	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &imageStagingBuffer, &imageStagingBufferMemory);
+	// Only the mip tail is uploaded to start with, finer levels are streamed in once draws need them. The residency manager
+	// picks the id, reusing a released texture's
+	uint32_t textureId = textureResidency.addTexture(newTexture.width, newTexture.height, newTexture.mipLevels);
+	createTextureLevels(newTexture, textureResidency.getTailMip(textureId), &newTexture.image, &newTexture.imageMemory, &newTexture.imageView);
+
+	// Create Texture Descriptor
+	VkDescriptorSet descriptorSet = writeTextureDescriptorSet(newTexture.imageView);
+	if (textureId == textures.size()) {
+		textures.push_back(newTexture);
+		samplerDescriptorSets.push_back(descriptorSet);
+	} else {
+		textures[textureId] = newTexture;
+		samplerDescriptorSets[textureId] = descriptorSet;
+	}
 
-	// Copy Image Data to Staging Buffer
-	void* data;
-	vkMapMemory(mainDevice.logicalDevice, imageStagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, imageData, static_cast<size_t>(imageSize));
-	vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
+	// Return location of set with texture
+	return (int)textureId;
+}
 
-	// Free original image data
-	stbi_image_free(imageData);
+void VulkanRenderer::createTextureLevels(const Texture& texture, uint32_t firstMip, VkImage* image, VkDeviceMemory* imageMemory, VkImageView* imageView) {
+	uint32_t width = std::max(texture.width >> firstMip, 1u);
+	uint32_t height = std::max(texture.height >> firstMip, 1u);
+	uint32_t mipLevels = texture.mipLevels - firstMip;
 
-	// Create Image to hold Final Texture
-	VkImage texImage;
-	VkDeviceMemory texImageMemory;
-	texImage = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory);
+	// Create Image to hold the levels, level 0 of the image is level firstMip of the texture
+	*image = createImage(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Texture, imageMemory, 0, mipLevels);
 
 	// COPY DATA TO IMAGE
-	// Transition image to be DST for copy operation
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	// Copy image data
-	copyImageBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, imageStagingBuffer, texImage, width, height);
+	// Points into the texture's chain and shares its ownership, so the pixels stay alive until they've been staged
+	unsigned char* chain = static_cast<unsigned char*>(texture.pixels.get());
+	UploadData levels(texture.pixels, chain + TextureResidency::getMipOffset(texture.width, texture.height, firstMip));
+	uploadQueue.queueImage(*image, levels, width, height, mipLevels);
 
-	// Transition image to be shader readable for shader usage
-	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	*imageView = createImageView(*image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+}
+
+VkDescriptorSet VulkanRenderer::writeTextureDescriptorSet(VkImageView textureImage) {
+	// Reuse a retired texture's set if there is one, otherwise allocate (allocator chains a new pool if the current one is full)
+	VkDescriptorSet descriptorSet;
+	if (!freeTextureDescriptorSets.empty()) {
+		descriptorSet = freeTextureDescriptorSets.back();
+		freeTextureDescriptorSets.pop_back();
+	} else {
+		descriptorSet = descriptorAllocator.allocate(samplerSetLayout);
+	}
 
-	// Add Texture data to vector for reference
-	textureImages.push_back(texImage);
-	textureImageMemory.push_back(texImageMemory);
+	// Texture Image Info
+	VkDescriptorImageInfo imageInfo = { };
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;				// Image Layout when in use
+	imageInfo.imageView = textureImage;												// Image to bind to set
+	imageInfo.sampler = textureSampler;												// Sampler to use for set
 
-	// Destroy Staging Buffers
-	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+	// Update new descriptor set
+	vkUpdateDescriptorSetWithTemplate(mainDevice.logicalDevice, descriptorSet, textureDescriptorTemplate, &imageInfo);
 
-	// Return index of new texture image in vector
-	return (int)textureImages.size() - 1;
+	return descriptorSet;
 }
 
-int VulkanRenderer::createTexture(std::string fileName) {
-	// Create texture image and get its location in array
-	int textureImageLoc = createTextureImage(fileName);
+void VulkanRenderer::updateTextureStreaming() {
+	// Swap in changes whose upload has completed. Frames in flight may still be sampling the old image through the old set,
+	// so both are retired rather than destroyed (and the set isn't rewritten in place)
+	for (uint32_t i = 0; i < textures.size(); i++) {
+		Texture& texture = textures[i];
+		if (!texture.changing || !uploadQueue.isComplete(texture.pendingBatch)) {
+			continue;
+		}
+
+		deletionQueue.pushImage(texture.image, texture.imageMemory, texture.imageView, graphicsTimeline.getLastSubmittedValue());
+		deletionQueue.pushDescriptorSet(samplerDescriptorSets[i], &freeTextureDescriptorSets, graphicsTimeline.getLastSubmittedValue());
 
-	// Create Image View and add to list
-	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
-	textureImageViews.push_back(imageView);
+		texture.image = texture.pendingImage;
+		texture.imageMemory = texture.pendingImageMemory;
+		texture.imageView = texture.pendingImageView;
+		texture.changing = false;
+		samplerDescriptorSets[i] = writeTextureDescriptorSet(texture.imageView);
 
-	// Create Texture Descriptor
-	int descriptorLoc = createTextureDescriptor(imageView);
+		textureResidency.setResident(i, texture.pendingMip);
+	}
 
-	// Return location of set with texture
-	return descriptorLoc;
+	// Released textures' unfinished changes, no frame ever used them
+	size_t keptAbandoned = 0;
+	for (auto& abandoned : abandonedTextureLevels) {
+		if (uploadQueue.isComplete(abandoned.batch)) {
+			deletionQueue.pushImage(abandoned.image, abandoned.imageMemory, abandoned.imageView, graphicsTimeline.getLastSubmittedValue());
+		} else {
+			abandonedTextureLevels[keptAbandoned++] = abandoned;
+		}
+	}
+	abandonedTextureLevels.resize(keptAbandoned);
+
+	// Start the changes asked for by this frame's requests. Evictions are small and free memory, so go ahead of
+	// model loads, streaming in finer levels goes behind them
+	for (const auto& change : textureResidency.update(frameNumber, MAX_TEXTURE_CHANGES_PER_FRAME)) {
+		Texture& texture = textures[change.texture];
+		bool evicting = change.mip > textureResidency.getResidentMip(change.texture);
+
+		uploadQueue.beginBatch(evicting ? 1 : -1);
+		createTextureLevels(texture, change.mip, &texture.pendingImage, &texture.pendingImageMemory, &texture.pendingImageView);
+		texture.pendingBatch = uploadQueue.submitBatch();
+		texture.pendingMip = change.mip;
+		texture.changing = true;
+	}
+
+	TRACE_COUNTER("Texture bytes resident", textureResidency.getResidentBytes());
+	TRACE_COUNTER("Pending deletions", deletionQueue.getPendingCount());
 }
 
-int VulkanRenderer::createTextureDescriptor(VkImageView textureImage) {
-	VkDescriptorSet descriptorSet;
+void VulkanRenderer::recordSceneDraws(FrameContext& frame, VkDescriptorSet objectSet, int cullPass) {
+	VkBuffer indirectBuffer = cullPass >= 0 ? occlusionCuller.getIndirectBuffer() : VK_NULL_HANDLE;
 
-	// Descriptor Set Allocation Info
-	VkDescriptorSetAllocateInfo setAllocInfo = { };
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &samplerSetLayout;
+	// Depth only pass over the same draws first. Depth and stencil tests happen in primitive order within the subpass, so
+	// the main draws see the finished depth without a barrier
+	if (depthPrepass) {
+		int prepassScope = gpuProfiler.beginScope(frame.commandBuffer, "Depth pre-pass");
 
-	// Allocate Descriptor Sets
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
-	if (result != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate Texture Descriptor Sets!");
+		commandRecorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
+
+		for (uint32_t drawIndex : drawOrder) {
+			const DrawItem& drawItem = drawItems[drawIndex];
+
+			VkBuffer positionBuffers[] = { drawItem.mesh->getPositionBuffer() };
+			VkDeviceSize offsets[] = { 0 };
+			commandRecorder.bindVertexBuffers(0, 1, positionBuffers, offsets);
+			commandRecorder.bindIndexBuffer(drawItem.mesh->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+			// Only set 0 (uniforms and transforms) is used, the layout is the main pipeline's so it stays bound
+			commandRecorder.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &objectSet);
+
+			if (cullPass >= 0) {
+				commandRecorder.drawIndexedIndirect(indirectBuffer, occlusionCuller.getIndirectOffset(drawIndex, cullPass), 1, sizeof(VkDrawIndexedIndirectCommand));
+			} else {
+				commandRecorder.drawIndexed(drawItem.mesh->getIndexCount(), drawItem.instanceCount, 0, 0, drawItem.firstInstance);
+			}
+		}
+
+		gpuProfiler.endScope(frame.commandBuffer, prepassScope);
 	}
 
-	// Texture Image Info
-	VkDescriptorImageInfo imageInfo = { };
-	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;				// Image Layout when in use
-	imageInfo.imageView = textureImage;												// Image to bind to set
-	imageInfo.sampler = textureSampler;												// Sampler to use for set
+	// Bind Pipeline to be used in render pass
+	commandRecorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepass ? depthEqualPipeline : graphicsPipeline);
+	// Can add mutliple bind pipeline cmd calls. Useful for doing deferred shading.
 
-	// Descriptor Write Info
-	VkWriteDescriptorSet descriptorWrite = { };
-	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.dstSet = descriptorSet;
-	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
-	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrite.descriptorCount = 1;
-	descriptorWrite.pImageInfo = &imageInfo;
+	// Draws are sorted by texture then front to back, the recorder drops any bind that matches the previous draw's
+	for (uint32_t drawIndex : drawOrder) {
+		const DrawItem& drawItem = drawItems[drawIndex];
 
-	// Update new descriptor set
-	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
+		VkBuffer vertexBuffers[] = { drawItem.mesh->getVertexBuffer() };											// Buffers to bind
+		VkDeviceSize offsets[] = { 0 };																				// offsets into buffers being bound
+		commandRecorder.bindVertexBuffers(0, 1, vertexBuffers, offsets);											// Command to bind vertex buffer before drawing with them
+
+		commandRecorder.bindIndexBuffer(drawItem.mesh->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);					// Command to bind Mesh Index Buffer with 0 offset
+
+		std::array<VkDescriptorSet, 2> descriptorSetGroup = { objectSet, samplerDescriptorSets[drawItem.mesh->getTexId()] };
+
+		// Bind Descriptor Sets
+		commandRecorder.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data());
+
+		// Every instance of the model is drawn by the same call. firstInstance is the model's offset into the object
+		// buffer, so gl_InstanceIndex in the shader is the object index. Culled draws have the GPU fill in the instance
+		// count, and their firstInstance indexes the culler's buffer of the objects that passed
+		if (cullPass >= 0) {
+			commandRecorder.drawIndexedIndirect(indirectBuffer, occlusionCuller.getIndirectOffset(drawIndex, cullPass), 1, sizeof(VkDrawIndexedIndirectCommand));
+		} else {
+			commandRecorder.drawIndexed(drawItem.mesh->getIndexCount(), drawItem.instanceCount, 0, 0, drawItem.firstInstance);
+		}
+	}
+}
+
+bool VulkanRenderer::isModelLoaded(int modelId) {
+	return modelId >= 0 && modelId < modelList.size() && modelList[modelId].isLoaded();
+}
 
-	// Add Descriptor Set to list
-	samplerDescriptorSets.push_back(descriptorSet);
+VkDescriptorSet VulkanRenderer::allocateFrameDescriptorSet(VkDescriptorSetLayout layout) {
+	// Only valid until this frame slot comes round again, so never keep hold of the returned set
+	return frames[currentFrame].descriptorAllocator.allocate(layout);
+}
 
-	// Return Descriptor Set Location
-	return (int)samplerDescriptorSets.size() - 1;
+void VulkanRenderer::prefetchMeshModel(std::string modelFile) {
+	if (modelImports.find(modelFile) == modelImports.end()) {
+		modelImports[modelFile] = std::async(std::launch::async, importModelFile, modelFile);
+	}
 }
 
 int VulkanRenderer::createMeshModel(std::string modelFile) {
-	// Import model "scene"
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices);
-	if (!scene) {
-		throw std::runtime_error("Failed to load model! (" + modelFile + ")");
+	TRACE_SCOPE("createMeshModel");
+
+	// Use the import prefetchMeshModel started if there is one, otherwise import now
+	ImportedModel model;
+	auto prefetched = modelImports.find(modelFile);
+	if (prefetched != modelImports.end()) {
+		startupPhases.begin("Wait for model import (" + modelFile + ")");
+		std::future<ImportedModel> import = std::move(prefetched->second);
+		modelImports.erase(prefetched);
+		model = import.get();
+		startupPhases.add("Model import (" + modelFile + ")", model.importMs, true);
+	} else {
+		startupPhases.begin("Model import (" + modelFile + ")");
+		model = importModelFile(modelFile);
 	}
 
-	// Get vector of all materials with 1:1 ID placement
-	std::vector<std::string> textureNames = MeshModel::LoadMaterials(scene);
+	startupPhases.begin("Model upload (" + modelFile + ")");
+
+	// Everything goes in one upload batch, flushed and waited on here since the model is used straight away
+	uploadQueue.beginBatch();
+	std::vector<Mesh> modelMeshes = createModelResources(model);
+	uploadQueue.waitForBatch(uploadQueue.submitBatch());
+
+	// Create mesh model and add to list
+	MeshModel meshModel = MeshModel(modelMeshes, model.nodes, &transforms);
+	modelList.push_back(meshModel);
 
+	startupPhases.end();
+
+	return (int)modelList.size() - 1;
+}
+
+int VulkanRenderer::createMeshModelAsync(std::string modelFile, int priority) {
+	ModelLoad load;
+	load.fileName = modelFile;
+	load.priority = priority;
+	load.state = ModelLoadState::Importing;
+	load.uploadBatch = 0;
+	load.modelId = -1;
+
+	// Carry on from a prefetch of the same file if there is one
+	auto prefetched = modelImports.find(modelFile);
+	if (prefetched != modelImports.end()) {
+		load.import = std::move(prefetched->second);
+		modelImports.erase(prefetched);
+	} else {
+		load.import = std::async(std::launch::async, importModelFile, modelFile);
+	}
+
+	modelLoads.push_back(std::move(load));
+
+	return (int)modelLoads.size() - 1;
+}
+
+void VulkanRenderer::setUploadBudget(VkDeviceSize bytesPerFrame, uint32_t microsecondsPerFrame) {
+	uploadQueue.setBudget(bytesPerFrame, microsecondsPerFrame);
+}
+
+const UploadStats& VulkanRenderer::getUploadStats() {
+	return uploadQueue.getFrameStats();
+}
+
+void VulkanRenderer::setTextureBudget(VkDeviceSize bytes) {
+	textureResidency.setBudget(bytes);
+	textureBudgetSet = true;
+}
+
+VkDeviceSize VulkanRenderer::getTextureResidentBytes() {
+	return textureResidency.getResidentBytes();
+}
+
+ModelLoadState VulkanRenderer::getModelLoadState(int loadHandle) {
+	return modelLoads.at(loadHandle).state;
+}
+
+int VulkanRenderer::getAsyncModelId(int loadHandle) {
+	return modelLoads.at(loadHandle).modelId;
+}
+
+std::vector<Mesh> VulkanRenderer::createModelResources(ImportedModel& model) {
 	// Conversion from the materials list IDs to our Descriptor Array IDs
-	std::vector<int> matToTex(textureNames.size());
+	std::vector<int> matToTex(model.textureNames.size());
 
 	// Loop over textureNames and create textures for them
-	for (size_t i = 0; i < textureNames.size(); i++) {
+	for (size_t i = 0; i < model.textureNames.size(); i++) {
 		// if material has no texture, set 0 to indicate no texture (0 = default)
-		if (textureNames[i].empty()) {
+		if (model.textureNames[i].empty()) {
 			matToTex[i] = 0;
 		} else {
 			// otherwise, create texture and set value to index of new texture
-			matToTex[i] = createTexture(textureNames[i]);
+			matToTex[i] = createTexture(model.textures[i]);
 		}
 	}
 
-	// Load in all our meshes
-	std::vector<Mesh> modelMeshes = MeshModel::LoadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, scene->mRootNode, scene, matToTex);
+	// Create all our meshes
+	TRACE_SCOPE("Create mesh buffers");
+	return MeshModel::CreateMeshes(mainDevice.physicalDevice, mainDevice.logicalDevice, uploadQueue, model.meshes, matToTex);
+}
 
-	// Create mesh model and add to list
-	MeshModel meshModel = MeshModel(modelMeshes);
-	modelList.push_back(meshModel);
+void VulkanRenderer::processModelLoads() {
+	for (auto& load : modelLoads) {
+		if (load.state == ModelLoadState::Importing) {
+			// Never wait for an import, check again next frame
+			if (load.import.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				continue;
+			}
 
-	return (int)modelList.size() - 1;
+			TRACE_SCOPE("Start model upload");
+
+			ImportedModel model;
+			try {
+				model = load.import.get();
+			} catch (const std::runtime_error& e) {
+				std::cout << "Error: " << e.what() << std::endl;
+				load.state = ModelLoadState::Failed;
+				continue;
+			}
+
+			uploadQueue.beginBatch(load.priority);
+			load.meshes = createModelResources(model);
+			load.nodes = std::move(model.nodes);
+			load.uploadBatch = uploadQueue.submitBatch();
+			load.state = ModelLoadState::Uploading;
+		} else if (load.state == ModelLoadState::Uploading && uploadQueue.isComplete(load.uploadBatch)) {
+			// Resources are resident, so the model can join the draw list
+			modelList.push_back(MeshModel(load.meshes, load.nodes, &transforms));
+			load.meshes.clear();
+			load.nodes.clear();
+			load.modelId = (int)modelList.size() - 1;
+			load.state = ModelLoadState::Resident;
+		}
+	}
 }
 
-stbi_uc* VulkanRenderer::loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize) {
+const PhaseTimer& VulkanRenderer::getStartupPhases() {
+	return startupPhases;
+}
+
+TextureData VulkanRenderer::decodeTextureFile(std::string fileName) {
+	TRACE_SCOPE("Decode texture file");
+
+	TextureData texture;
+	texture.fileName = fileName;
+
 	// Number of Channels image uses
 	int channels;
 
 	// Load Pixel Data for image
 	std::string fileLoc = "Textures/" + fileName;
-	stbi_uc* image = stbi_load(fileLoc.c_str(), width, height, &channels, STBI_rgb_alpha);
+	stbi_uc* image = stbi_load(fileLoc.c_str(), &texture.width, &texture.height, &channels, STBI_rgb_alpha);
 
 	if (!image) {
 		throw std::runtime_error("Failed to load texture file! (" + fileName + ")");
 	}
 
-	// Calculate image size using given and known data
-	*imageSize = *width * *height * 4;
+	// Whole chain is built here on the loading thread, so streaming a level in later is only a copy
+	std::vector<unsigned char> chain = TextureResidency::generateMipChain(image, texture.width, texture.height);
+	stbi_image_free(image);
 
-	return image;
+	texture.mipLevels = TextureResidency::getMipLevelCount(texture.width, texture.height);
+	texture.size = chain.size();
+	texture.pixels = makeUploadData(std::move(chain));
+
+	return texture;
+}
+
+ImportedModel VulkanRenderer::importModelFile(std::string modelFile) {
+	TRACE_SCOPE("importModelFile");
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Import model "scene"
+	ImportedModel model;
+	Assimp::Importer importer;
+	const aiScene* scene;
+	{
+		// Node transforms aren't baked into the vertices, so a mesh used by several nodes is only loaded (and uploaded) once
+		TRACE_SCOPE("Import model file");
+		scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
+	}
+	if (!scene) {
+		throw std::runtime_error("Failed to load model! (" + modelFile + ")");
+	}
+
+	// Get vector of all materials with 1:1 ID placement
+	model.textureNames = MeshModel::LoadMaterials(scene);
+	model.textures.resize(model.textureNames.size());
+
+	// Decoding is most of the load time, spread the textures over a few workers (each writes only the slots it claims)
+	std::atomic<size_t> nextTexture(0);
+	auto decodeTextures = [&model, &nextTexture]() {
+		for (size_t i = nextTexture++; i < model.textureNames.size(); i = nextTexture++) {
+			if (!model.textureNames[i].empty()) {
+				model.textures[i] = decodeTextureFile(model.textureNames[i]);
+			}
+		}
+	};
+
+	size_t workerCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), model.textureNames.size());
+	std::vector<std::future<void>> workers;
+	for (size_t i = 0; i < workerCount; i++) {
+		workers.push_back(std::async(std::launch::async, decodeTextures));
+	}
+
+	// Vertex and index data and the node hierarchy are pulled out of the scene while the workers decode
+	{
+		TRACE_SCOPE("Load meshes");
+		model.meshes = MeshModel::LoadMeshes(scene);
+		model.nodes = MeshModel::LoadNodes(scene);
+	}
+
+	// Wait for every worker before giving up on a failed decode, they all reference model
+	std::string error;
+	for (auto& worker : workers) {
+		try {
+			worker.get();
+		} catch (const std::runtime_error& e) {
+			error = e.what();
+		}
+	}
+
+	if (!error.empty()) {
+		throw std::runtime_error(error);
+	}
+
+	model.importMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	return model;
 }
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <map>
 
 #include "stb_image.h"
 
@@ -20,6 +26,19 @@
 #include "Utilities.h"
 #include "Mesh.h"
 #include "MeshModel.h"
+#include "DescriptorAllocator.h"
+#include "DrawSort.h"
+#include "CommandRecorder.h"
+#include "Statistics.h"
+#include "GpuProfiler.h"
+#include "UploadQueue.h"
+#include "DeletionQueue.h"
+#include "GpuTimeline.h"
+#include "TextureResidency.h"
+#include "DynamicResolution.h"
+#include "OcclusionCuller.h"
+#include "SoftwareOcclusionCuller.h"
+#include "Tracer.h"
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
@@ -30,26 +49,180 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif
 
+// Texture file decoded on the CPU with its full mip chain built, ready to upload
+struct TextureData {
+	std::string fileName;
+	UploadData pixels;								// RGBA8 levels, level 0 first
+	int width = 0;
+	int height = 0;
+	uint32_t mipLevels = 0;
+	VkDeviceSize size = 0;							// Whole chain
+};
+
+// Model file read by Assimp with its meshes extracted and textures decoded. Everything short of touching the device, so
+// it can be done on a worker thread
+struct ImportedModel {
+	std::vector<MeshData> meshes;
+	std::vector<ModelNode> nodes;
+	std::vector<std::string> textureNames;			// Texture of each material (empty = no texture)
+	std::vector<TextureData> textures;				// Decoded textureNames, same indices
+	double importMs = 0.0;
+};
+
+enum class ModelLoadState {
+	Importing,			// File read / texture decode on a worker thread
+	Uploading,			// Buffers and images created, upload batch submitted but not complete
+	Resident,			// In the model list and drawn
+	Failed
+};
+
 class VulkanRenderer {
 public:
 	VulkanRenderer();
 	~VulkanRenderer();
 
+	// Must be called before init. Clamped to [1, MAX_FRAMES_IN_FLIGHT]
+	void setFramesInFlight(uint32_t count);
+	uint32_t getFramesInFlight();
+
 	int init(GLFWwindow* newWindow);
+	// Offscreen mode, no window / surface / swapchain. Renders into targetCount images of the given size instead
+	int initHeadless(uint32_t width, uint32_t height, uint32_t targetCount = 3);
+	bool isHeadless();
 
+	// Start importing a model (file read + texture decode) on worker threads, so a later createMeshModel of the same file
+	// only has to upload it. Can be called before init
+	void prefetchMeshModel(std::string modelFile);
 	int createMeshModel(std::string modelFile);
 
+	// Imports on worker threads and uploads through the upload queue over the following frames, without the render loop
+	// waiting on either. Returns a load handle straight away, the model is only added (and drawn) once it's resident.
+	// Higher priority loads are uploaded first
+	int createMeshModelAsync(std::string modelFile, int priority = 0);
+	ModelLoadState getModelLoadState(int loadHandle);
+	// Model id of a finished asynchronous load, -1 until then
+	int getAsyncModelId(int loadHandle);
+
+	// Most upload work (bytes staged, CPU time) done per frame, the rest waits for later frames. 0 = unlimited
+	void setUploadBudget(VkDeviceSize bytesPerFrame, uint32_t microsecondsPerFrame);
+	// Uploads done by the last frame and what was left for later ones
+	const UploadStats& getUploadStats();
+
+	// Most device memory streamed texture levels may take, the least recently used levels are evicted to stay under it.
+	// Defaults to half the device local heap budget, 0 = unlimited
+	void setTextureBudget(VkDeviceSize bytes);
+	// Texture levels on the GPU (or being streamed in)
+	VkDeviceSize getTextureResidentBytes();
+
+	// Scales the scene's resolution (width and height, down to minScale) each frame so its GPU time stays near targetMs,
+	// the composite pass upscales it to the window. targetMs <= 0 always renders at full resolution
+	void setDynamicResolution(double targetMs, float minScale = DEFAULT_MIN_RESOLUTION_SCALE);
+	// Scale the last frame was rendered at
+	float getResolutionScale();
+	size_t getResolutionChangeCount();
+
+	// Lays down the scene's depth with a position only pass first, so the main pass (depth test EQUAL, no depth writes)
+	// shades each pixel once instead of once per overlapping surface. Can be switched between frames
+	void setDepthPrepass(bool enabled);
+	bool isDepthPrepassEnabled();
+
+	// Culls meshes hidden behind what was drawn last frame (and then this frame) against a Hi-Z pyramid of the scene's
+	// depth, on the GPU, drawing the rest with indirect draws. Can be switched between frames
+	void setOcclusionCulling(bool enabled);
+	bool isOcclusionCullingEnabled();
+	// Counts of the latest frame the GPU has finished (frames late), only updated while culling is on
+	const OcclusionCullStats& getOcclusionStats();
+
+	// Culls mesh instances hidden behind the nearest occluder meshes (picked when models load) on the CPU instead, with a
+	// low resolution software depth buffer, before the frame is recorded. For when GPU culling isn't available, it's
+	// ignored while that's on
+	void setCpuOcclusionCulling(bool enabled);
+	bool isCpuOcclusionCullingEnabled();
+	// Work done for the last frame culled on the CPU
+	const SoftwareOcclusionStats& getCpuOcclusionStats();
+
+	// Frees the model's mesh buffers and textures once the frames in flight are done with them, without waiting for the
+	// GPU. The id isn't reused, the model's calls just do nothing from then on
+	void unloadMeshModel(int modelId);
+	// Frees the texture once the frames in flight are done with it. Meshes still using it switch to the default texture,
+	// so its id can be handed out again to a later texture
+	void releaseTexture(int textureId);
+
+	// Wall time of each init / model loading phase
+	const PhaseTimer& getStartupPhases();
+
 	void updateModel(int modelId, glm::mat4 newModel);
 
+	// Nodes of the model file's hierarchy can be moved on their own (transform relative to the parent node), without
+	// touching the mesh data. Nodes are found by name, -1 if there's no such model or node
+	int findModelNode(int modelId, std::string nodeName);
+	void updateModelNode(int modelId, int nodeId, glm::mat4 newTransform);
+
+	int createModelInstance(int modelId, glm::mat4 newInstance);
+	void updateModelInstance(int modelId, int instanceId, glm::mat4 newInstance);
+	void updateModelInstances(int modelId, int firstInstanceId, const std::vector<glm::mat4>& newInstances);
+
+	void setCamera(glm::vec3 eye, glm::vec3 target);
+
 	void draw();
 	void cleanup();
+
+	// Window's framebuffer changed size, the swapchain is rebuilt before the next frame (out of date / suboptimal
+	// swapchains are picked up by draw() anyway, but not every platform reports them)
+	void notifyFramebufferResized();
+
+	// Bind calls issued vs skipped as redundant while recording the last frame
+	CommandRecorderStats getRecordingStats();
+
+	// CPU time between draw() calls, and how much of it was spent waiting for the frame's previous use to finish on the GPU
+	// (milliseconds)
+	const RollingStatistics& getFrameTimeStats();
+	const RollingStatistics& getFenceWaitStats();
+
+	// GPU time of each profiled scope (render subpasses, uploads), read back from timestamp queries a few frames late
+	std::vector<GpuScopeTiming> getGpuTimings();
+
+	// Start frame time / frame wait / GPU timing statistics over, keeping up to windowSize frames (e.g. after warm up)
+	void resetStatistics(size_t windowSize);
 private:
 	GLFWwindow* window;
 
-	int currentFrame = 0;
+	// Headless (offscreen) rendering
+	bool headless = false;
+	std::vector<VkDeviceMemory> offscreenImageMemory;		// Memory of the offscreen targets standing in for swapchain images
+	uint32_t nextOffscreenImage = 0;
+	bool samplerAnisotropyEnabled = false;
+	bool timelineSemaphoresEnabled = false;				// Device has timeline semaphores (the graphics timeline uses fences otherwise)
+
+	// Frame Pacing
+	uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+	uint32_t currentFrame = 0;
+	uint64_t frameNumber = 0;								// Frames drawn so far
+
+	RollingStatistics frameTimeStats;
+	RollingStatistics fenceWaitStats;
+	std::chrono::high_resolution_clock::time_point lastFrameTime;
+	bool firstFrame = true;
 
 	// Scene Objects
 	std::vector<MeshModel> modelList;
+	TransformSystem transforms;					// Every model's, instance's and node's transform
+	std::map<std::string, std::future<ImportedModel>> modelImports;		// Started by prefetchMeshModel, not yet created
+
+	// Asynchronous model loads, indexed by load handle. Advanced once a frame by processModelLoads
+	struct ModelLoad {
+		std::string fileName;
+		std::future<ImportedModel> import;
+		int priority;
+		ModelLoadState state;
+		uint64_t uploadBatch;
+		std::vector<Mesh> meshes;							// Not drawn until the upload batch completes
+		std::vector<ModelNode> nodes;
+		int modelId;
+	};
+	std::vector<ModelLoad> modelLoads;
+
+	PhaseTimer startupPhases;
 
 	// Scene Settings
 	struct UboViewProjection {
@@ -57,6 +230,29 @@ private:
 		glm::mat4 view;
 	} uboViewProjection;
 
+	float nearPlane = 0.1f;
+	float farPlane = 1000.0f;
+
+	// Draw List (one entry per mesh, every instance of it drawn by the same call). Sorted by key each frame
+	struct DrawItem {
+		Mesh* mesh;
+		uint32_t model;										// Index into modelList
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+	};
+	std::vector<DrawItem> drawItems;
+	std::vector<uint64_t> drawKeys;
+	std::vector<uint32_t> drawOrder;						// Index into drawItems, in the order draws are recorded
+	std::vector<uint64_t> drawKeysTemp;						// Radix sort scratch space, kept so it isn't reallocated each frame
+	std::vector<uint32_t> drawOrderTemp;
+
+	CommandRecorder commandRecorder;						// Filters redundant binds while recording
+	CommandRecorderStats recordingStats;					// Counters from the most recently recorded frame
+	GpuProfiler gpuProfiler;								// Timestamp queries around render passes and uploads
+	GpuTimeline graphicsTimeline;							// Progress of every submission to the graphics queue (frames and uploads)
+	UploadQueue uploadQueue;								// Budgeted staging uploads (textures, mesh buffers)
+	DeletionQueue deletionQueue;							// Resources waiting for the frames in flight to finish with them
+
 	// Main Vulkan Components
 	VkInstance instance;
 	struct {
@@ -69,95 +265,212 @@ private:
 	VkSwapchainKHR swapchain;
 	VkSampler textureSampler;
 
-	// These three are interconnected swapChainImages[0] uses swapChainFramebuffers[0] and commandBuffers[0] and so on
 	std::vector<SwapchainImage> swapChainImages;
-	std::vector<VkFramebuffer> swapChainFramebuffers;
-	std::vector<VkCommandBuffer> commandBuffers;
-
-	std::vector<VkImage> colorBufferImage;
-	std::vector<VkDeviceMemory> colorBufferImageMemory;
-	std::vector<VkImageView> colorBufferImageView;
-
-	std::vector<VkImage> depthBufferImage;
-	std::vector<VkDeviceMemory> depthBufferImageMemory;
-	std::vector<VkImageView> depthBufferImageView;
+	std::vector<uint64_t> imagesInFlight;					// Timeline value of the frame last rendered to each image (so an image is never used by two frames at once)
+	bool swapChainOutOfDate = false;						// Window resized, or the swapchain no longer matches the surface
+	std::vector<VkDescriptorSet> freeInputDescriptorSets;	// Input sets of attachments replaced by a resize, rewritten for the new ones
+
+	// Everything the CPU writes while recording a frame. There are framesInFlight of these used in a ring, so the CPU can
+	// fill one while the GPU is still reading the others. Waiting for the timeline to reach timelineValue makes all of it
+	// safe to reuse
+	struct FrameContext {
+		VkCommandPool commandPool;
+		VkCommandBuffer commandBuffer;
+
+		VkDeviceSize uniformOffset;							// Start of this frame's slice of the uniform buffer
+
+		// Transform of every object (model instance), packed contiguously and indexed by gl_InstanceIndex in shader.vert
+		VkBuffer objectBuffer;
+		VkDeviceMemory objectBufferMemory;
+		void* objectBufferMapped;
+		size_t objectBufferCapacity;						// Number of object transforms the buffer can hold
+
+		VkDescriptorSet descriptorSet;						// Set 0: this frame's uniform slice and object buffer
+		DescriptorAllocator descriptorAllocator;			// Transient sets, reset once the frame's last submission has completed
+
+		// Scene pass targets, sampled by the composite pass. Sized for the swapchain, the scene only renders to the top left
+		// part of them when the resolution is scaled down. Only one pair per frame in flight is needed
+		VkImage colorBufferImage;
+		VkDeviceMemory colorBufferImageMemory;
+		VkImageView colorBufferImageView;
+
+		VkImage depthBufferImage;
+		VkDeviceMemory depthBufferImageMemory;
+		VkImageView depthBufferImageView;
+
+		VkDescriptorSet inputDescriptorSet;					// This frame's color and depth for the composite pass
+		VkFramebuffer sceneFramebuffer;
+		float resolutionScale;								// Scale the frame was last rendered at (its timings are read back later)
+
+		VkSemaphore imageAvailable;
+		VkSemaphore renderFinished;
+		uint64_t timelineValue;								// Signalled by the frame's last submission (0 = never submitted)
+	};
+	std::vector<FrameContext> frames;
+
+	VkFormat colorBufferFormat;
+	VkFormat depthBufferFormat;
 
 	// Descriptors
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerSetLayout;
 	VkDescriptorSetLayout inputSetLayout;
-	VkPushConstantRange pushConstantRange;
 
-	VkDescriptorPool descriptorPool;
-	VkDescriptorPool samplerDescriptorPool;
-	VkDescriptorPool inputDescriptorPool;
-	std::vector<VkDescriptorSet> descriptorSets;
+	DescriptorAllocator descriptorAllocator;						// Long-lived sets (uniform, texture, composite input)
 	std::vector<VkDescriptorSet> samplerDescriptorSets;
-	std::vector<VkDescriptorSet> inputDescriptorSets;
 
-	std::vector<VkBuffer> uniformBuffer;
-	std::vector<VkDeviceMemory> uniformBufferMemory;
+	// Update Templates (write a whole set from one packed struct instead of a list of VkWriteDescriptorSet)
+	VkDescriptorUpdateTemplate uniformDescriptorTemplate;
+	VkDescriptorUpdateTemplate textureDescriptorTemplate;
+	VkDescriptorUpdateTemplate inputDescriptorTemplate;
+
+	struct UniformDescriptors {
+		VkDescriptorBufferInfo viewProjection;
+		VkDescriptorBufferInfo objects;
+	};
 
-	std::vector<VkBuffer> dynamicUniformBuffer;
-	std::vector<VkDeviceMemory> dynamicUniformBufferMemory;
+	struct CompositeInputDescriptors {
+		VkDescriptorImageInfo color;
+		VkDescriptorImageInfo depth;
+	};
 
+	// One uniform buffer split into a slice per frame in flight, persistently mapped
+	VkBuffer uniformBuffer;
+	VkDeviceMemory uniformBufferMemory;
+	void* uniformBufferMapped;
+	VkDeviceSize uniformSliceSize;							// sizeof(UboViewProjection) rounded up to minUniformBufferOffsetAlignment
 
-	/*VkDeviceSize minUniformBufferOffset;
-	size_t modelUniformAlignment;*/
-	//Model* modelTransferSpace;
+	std::vector<uint32_t> modelFirstObject;					// Index of each model's first instance within the object buffer
 
 	// Assets
-	std::vector<VkImage> textureImages;
-	std::vector<VkDeviceMemory> textureImageMemory;
-	std::vector<VkImageView> textureImageViews;
+	// A texture's image only holds its resident mip levels. A residency change builds a new image with the new set of
+	// levels and swaps it in (with a new descriptor set) once its upload completes
+	struct Texture {
+		UploadData pixels;									// Full mip chain, kept to stream levels back in after eviction
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+
+		VkImage image;
+		VkDeviceMemory imageMemory;
+		VkImageView imageView;
+
+		bool changing;										// Pending image is being uploaded
+		uint32_t pendingMip;
+		VkImage pendingImage;
+		VkDeviceMemory pendingImageMemory;
+		VkImageView pendingImageView;
+		uint64_t pendingBatch;
+
+		bool released;										// Slot is free for the next texture
+	};
+
+	// Image of a released texture's unfinished residency change. The upload queue still has to write it, so it's only
+	// handed to the deletion queue once its batch completes
+	struct AbandonedTextureLevels {
+		VkImage image;
+		VkDeviceMemory imageMemory;
+		VkImageView imageView;
+		uint64_t batch;
+	};
+
+	std::vector<Texture> textures;							// Same indices as samplerDescriptorSets and textureResidency
+	std::vector<AbandonedTextureLevels> abandonedTextureLevels;
+	std::vector<VkDescriptorSet> freeTextureDescriptorSets;	// Sets of destroyed textures, rewritten for new ones
+	TextureResidency textureResidency;
+	bool textureBudgetSet = false;
 
 	VkPipeline graphicsPipeline;
 	VkPipelineLayout pipelineLayout;
-	VkRenderPass renderPass;
+	VkPipeline depthPrepassPipeline;						// Depth only, reads the meshes' position streams. Null until the pre-pass is first on
+	VkPipeline depthEqualPipeline;							// graphicsPipeline testing EQUAL against the pre-pass' depth, no depth writes
+	bool depthPrepass = false;
+	VkRenderPass sceneRenderPass;							// Scene into the frame's color / depth targets
+	VkRenderPass sceneLoadRenderPass;						// Same, keeping what's already in them (second occlusion culling pass)
+	OcclusionCuller occlusionCuller;
+	bool occlusionCulling = false;
+
+	// CPU occlusion culling, and its scratch space kept between frames
+	struct OccluderInstance {
+		float distance;
+		Mesh* mesh;
+		const glm::vec4* worldRows;
+	};
+	SoftwareOcclusionCuller softwareOcclusion;
+	bool cpuOcclusionCulling = false;
+	std::vector<OccluderInstance> occluderInstances;
+	std::vector<OcclusionBox> occlusionBoxes;				// Every instance of every draw item, in draw item order
+	std::vector<uint8_t> occlusionVisible;
+	std::vector<uint32_t> visibleObjectIds;
 
 	VkPipeline secondPipeline;
 	VkPipelineLayout secondPipleineLayout;
+	VkRenderPass compositeRenderPass;						// Frame's targets upscaled into the swapchain image
+	std::vector<VkFramebuffer> swapChainFramebuffers;		// One per swapchain image
 
-	VkCommandPool graphicsCommandPool;
+	// Where the composite pass reads the scene from (renderExtent / full size, and the last texel centre to clamp to)
+	struct CompositePushConstant {
+		glm::vec2 uvScale;
+		glm::vec2 uvMax;
+	};
+	VkSampler attachmentSampler;							// Linear, clamped to the edge
+	DynamicResolution dynamicResolution;
+	VkExtent2D renderExtent;								// Part of the targets the scene renders to this frame
+
+	VkCommandPool graphicsCommandPool;						// Used for one-off transfer commands, frames record from their own pools
 
 	// Utility Vulkan Components
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
 
-	std::vector<VkSemaphore> imageAvailable;
-	std::vector<VkSemaphore> renderFinished;
-	std::vector<VkFence> drawFences;
-
 	// Vulkan Functions
+	int initVulkan();
 	void createInstance();
 	void createLogicalDevice();
 	void createSurface();
-	void createSwapChain();
-	void createRenderPass();
+	void createSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+	bool recreateSwapChain();
+	void createOffscreenTargets(uint32_t width, uint32_t height, uint32_t targetCount);
+	void chooseAttachmentFormats();
+	void createRenderPasses();
 	void createDescriptorSetLayout();
-	void createPushConstantRange();
 	void createGraphicsPipeline();
+	// Only once the depth pre-pass is turned on, so its shader isn't needed otherwise
+	void createDepthPrepassPipeline();
 	void createColorBufferImage();
 	void createDepthBufferImage();
 	void createFramebuffers();
+	void reportAttachmentMemory();
 	void createCommandPool();
 	void createCommandBuffers();
 	void createSynchronization();
-	void createTextureSampler();
+	void createSamplers();
 
 	void createUniformBuffers();
-	void createDescriptorPool();
+	void createObjectBuffers();
+	void createObjectBuffer(FrameContext& frame, size_t capacity);
+	void destroyObjectBuffer(FrameContext& frame);
+	void createDescriptorAllocators();
+	void createDescriptorUpdateTemplates();
 	void createDescriptorSets();
+	void writeUniformDescriptorSet(FrameContext& frame);
 	void createInputDescriptorSets();
 
-	void updateUniformBuffers(uint32_t imageIndex);
+	void updateProjection();
+	void updateUniformBuffers(FrameContext& frame);
+	void updateObjectBuffer(FrameContext& frame);
+	void buildDrawList();
+	// Drops the draw list's instances the software occlusion culler finds hidden, packing each draw item's remaining
+	// transforms at the start of its part of the object buffer
+	void cullDrawListOnCpu(FrameContext& frame);
 
-	void recordCommands(uint32_t currentImage);
+	void recordCommands(FrameContext& frame, uint32_t currentImage);
+	// Draws of the scene pass (and its depth pre-pass). cullPass < 0 draws every instance, otherwise the occlusion culler's
+	// indirect commands of that pass with objectSet in place of the frame's set
+	void recordSceneDraws(FrameContext& frame, VkDescriptorSet objectSet, int cullPass);
 
 	void getPhysicalDevice();
 
-	void allocateDynamicBufferTransferSpace();
-
 	bool checkInstanceExtensionSupport(std::vector<const char*>* checkExtensions);
 	bool checkDeviceSuitable(VkPhysicalDevice device);
 	bool checkValidationLayerSupport();
@@ -171,15 +484,32 @@ private:
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities);
 	VkFormat chooseSupportedFormat(const std::vector<VkFormat>& formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags);
 
-	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory* imageMemory);
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+	VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryCategory category, VkDeviceMemory* imageMemory, VkMemoryPropertyFlags preferredPropFlags = 0, uint32_t mipLevels = 1);
+	VkDeviceSize getImageMemorySize(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags useFlags);
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels = 1);
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 
-	int createTextureImage(std::string fileName);
-	int createTexture(std::string fileName);
-	int createTextureDescriptor(VkImageView textureImage);
+	// Texture uploads are queued in the upload queue's open batch
+	int createTexture(TextureData texture);
+	// Image and view holding levels firstMip and coarser of the texture, upload queued in the open batch
+	void createTextureLevels(const Texture& texture, uint32_t firstMip, VkImage* image, VkDeviceMemory* imageMemory, VkImageView* imageView);
+	VkDescriptorSet writeTextureDescriptorSet(VkImageView textureImage);
+
+	// Swaps in streamed textures whose upload completed and starts the changes the residency manager asks for
+	void updateTextureStreaming();
+
+	// Model id is in range and hasn't been unloaded
+	bool isModelLoaded(int modelId);
+
+	VkDescriptorSet allocateFrameDescriptorSet(VkDescriptorSetLayout layout);
+
+	// Creates the model's textures and mesh buffers, queueing their uploads in the upload queue's open batch
+	std::vector<Mesh> createModelResources(ImportedModel& model);
+	void processModelLoads();
 
-	stbi_uc* loadTextureFile(std::string fileName, int* width, int* height, VkDeviceSize* imageSize);
+	// CPU only (no Vulkan calls), safe to run on worker threads
+	static TextureData decodeTextureFile(std::string fileName);
+	static ImportedModel importModelFile(std::string modelFile);
 
 	void DebugInformation() {
 		uint32_t instanceExtensionCount = 0;
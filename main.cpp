@@ -5,7 +5,14 @@
 #include <stdexcept>
 #include <vector>
 #include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <cmath>
 #include "VulkanRenderer.h"
+#include "Benchmarks.h"
+#include "SceneBenchmark.h"
+#include "Tracer.h"
 
 GLFWwindow* gWindow;
 VulkanRenderer vulkanRenderer;
@@ -16,50 +23,359 @@ void initWindow(std::string wName = "Vulkan Window", const int width = 800, cons
 
 	// Set GLFW to NOT work with OpenGL
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	// Do not allow resizing of the window
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	// Allow resizing, the renderer rebuilds its swapchain to match
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 	// Create a window
 	gWindow = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
+
+	glfwSetFramebufferSizeCallback(gWindow, [](GLFWwindow*, int, int) {
+		vulkanRenderer.notifyFramebufferResized();
+	});
+
+	// P switches the depth pre-pass, O GPU occlusion culling and C CPU occlusion culling on and off, to compare the timings
+	// with and without them
+	glfwSetKeyCallback(gWindow, [](GLFWwindow*, int key, int, int action, int) {
+		if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+			vulkanRenderer.setDepthPrepass(!vulkanRenderer.isDepthPrepassEnabled());
+		}
+		if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+			vulkanRenderer.setOcclusionCulling(!vulkanRenderer.isOcclusionCullingEnabled());
+		}
+		if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+			vulkanRenderer.setCpuOcclusionCulling(!vulkanRenderer.isCpuOcclusionCullingEnabled());
+		}
+	});
 }
 
 double angle = 0.0;
 double deltaTime = 0.0;
 double lastTime = 0.0;
+double lastStatsTime = 0.0;
+double lastMemoryLogTime = 0.0;
 
-int main() {
-	// Create a window
-	initWindow("Vulkan Window", 1280, 960);
+// Command line values: prints what's wrong and returns false unless all of value is a number of at least minimum
+bool parseNumberOption(const std::string& option, const char* value, double minimum, double& result) {
+	char* end = nullptr;
+	double number = std::strtod(value, &end);
+	if (end == value || *end != '\0' || !std::isfinite(number) || number < minimum) {
+		std::cout << "Error: " << option << " needs a number of at least " << minimum << ", got \"" << value << "\"" << std::endl;
+		return false;
+	}
 
-	// Create Vulkan Renderer instance
-	if (vulkanRenderer.init(gWindow) == EXIT_FAILURE) {
-		return EXIT_FAILURE;
+	result = number;
+	return true;
+}
+
+bool parseCountOption(const std::string& option, const char* value, uint32_t minimum, uint32_t& result) {
+	char* end = nullptr;
+	errno = 0;
+	unsigned long long number = std::strtoull(value, &end, 10);
+	if (end == value || *end != '\0' || value[0] == '-' || errno == ERANGE || number < minimum || number > UINT32_MAX) {
+		std::cout << "Error: " << option << " needs a whole number of at least " << minimum << ", got \"" << value << "\"" << std::endl;
+		return false;
 	}
 
-	int modelLoc = vulkanRenderer.createMeshModel("Models/kitbash.gltf");
+	result = static_cast<uint32_t>(number);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	auto startTime = std::chrono::steady_clock::now();
+
+	bool headless = false;		// Render offscreen without a window (build servers, software Vulkan drivers)
+	int frameLimit = 0;			// Stop after this many frames (0 = run until the window is closed)
+	uint32_t traceFrames = 0;
+	std::string benchmarkScript;	// Scripted windowless benchmark (see SceneBenchmark.h)
+	std::string traceFile = "trace.json";
+	double memoryLogInterval = 0.0;		// Seconds between GPU memory reports (0 = only after loading)
+	bool asyncLoad = false;				// Start rendering straight away and stream the model in
+	VkDeviceSize uploadBudgetBytes = DEFAULT_UPLOAD_BUDGET_BYTES;
+	uint32_t uploadBudgetMicroseconds = DEFAULT_UPLOAD_BUDGET_MICROSECONDS;
+	double textureBudgetMiB = -1.0;		// Streamed texture memory (< 0 = half the device local budget, 0 = unlimited)
+	double dynamicResolutionMs = 0.0;	// Scene pass GPU time to hold by scaling its resolution (0 = always full resolution)
+	bool depthPrepass = false;			// Lay down depth first so the main pass shades each pixel once
+	bool occlusionCulling = false;		// Skip meshes hidden behind others (GPU Hi-Z culling)
+	bool cpuOcclusionCulling = false;	// Same with a software depth buffer of the largest meshes, when GPU culling is off
+
+	// Command line options
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		// CPU micro benchmarks run without creating a window or renderer
+		if (arg == "--bench-sort") {
+			runDrawSortBenchmark();
+			return 0;
+		}
+		if (arg == "--bench-transforms") {
+			try {
+				runTransformBenchmark();
+			} catch (const std::runtime_error& e) {
+				std::cout << "Error: " << e.what() << std::endl;
+				return EXIT_FAILURE;
+			}
+			return 0;
+		}
+		if (arg == "--bench-occlusion") {
+			try {
+				runOcclusionBenchmark();
+			} catch (const std::runtime_error& e) {
+				std::cout << "Error: " << e.what() << std::endl;
+				return EXIT_FAILURE;
+			}
+			return 0;
+		}
+
+		// Trade latency (fewer) against CPU/GPU overlap (more)
+		if (arg == "--frames-in-flight" && i + 1 < argc) {
+			uint32_t framesInFlight = 0;
+			if (!parseCountOption(arg, argv[++i], 1, framesInFlight)) {
+				return EXIT_FAILURE;
+			}
+			vulkanRenderer.setFramesInFlight(framesInFlight);
+		}
+
+		if (arg == "--benchmark" && i + 1 < argc) {
+			benchmarkScript = argv[++i];
+		}
+
+		if (arg == "--headless") {
+			headless = true;
+		}
+
+		if (arg == "--frames" && i + 1 < argc) {
+			uint32_t frames = 0;
+			if (!parseCountOption(arg, argv[++i], 0, frames)) {
+				return EXIT_FAILURE;
+			}
+			frameLimit = static_cast<int>(std::min<uint32_t>(frames, INT32_MAX));
+		}
 
-	while (!glfwWindowShouldClose(gWindow)) {
-		double now = glfwGetTime();
-		deltaTime = now - lastTime;
-		lastTime = now;
+		if (arg == "--async-load") {
+			asyncLoad = true;
+		}
 
-		glfwPollEvents();
+		// Most upload work per frame while streaming (MiB staged / microseconds of CPU time, 0 = unlimited)
+		if (arg == "--upload-budget" && i + 1 < argc) {
+			double uploadBudgetMiB = 0.0;
+			if (!parseNumberOption(arg, argv[++i], 0.0, uploadBudgetMiB)) {
+				return EXIT_FAILURE;
+			}
+			uploadBudgetBytes = static_cast<VkDeviceSize>(uploadBudgetMiB * 1024 * 1024);
+		}
 
-		angle = angle + 30.0f * deltaTime;
+		if (arg == "--upload-time-budget" && i + 1 < argc) {
+			if (!parseCountOption(arg, argv[++i], 0, uploadBudgetMicroseconds)) {
+				return EXIT_FAILURE;
+			}
+		}
 
-		glm::mat4 testMat(1.0f);
-		testMat = glm::rotate(testMat, glm::radians(180 + -(float)angle * 0.5f), glm::vec3(0.0, 1.0, 0.0));
-		testMat = glm::translate(testMat, glm::vec3(0.0, -30.0, 0.0));
-		//testMat = glm::rotate(testMat, glm::radians(15.0f * 9), glm::vec3(1.0, 0.0, 0.0));
-		testMat = glm::scale(testMat, glm::vec3(40.0, 40.0, 40.0));
+		if (arg == "--texture-budget" && i + 1 < argc) {
+			if (!parseNumberOption(arg, argv[++i], 0.0, textureBudgetMiB)) {
+				return EXIT_FAILURE;
+			}
+		}
 
-		vulkanRenderer.updateModel(modelLoc, testMat);
+		if (arg == "--dynamic-resolution" && i + 1 < argc) {
+			if (!parseNumberOption(arg, argv[++i], 0.0, dynamicResolutionMs)) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (arg == "--depth-prepass") {
+			depthPrepass = true;
+		}
+
+		if (arg == "--occlusion-culling") {
+			occlusionCulling = true;
+		}
+
+		if (arg == "--cpu-occlusion-culling") {
+			cpuOcclusionCulling = true;
+		}
+
+		if (arg == "--memory-log" && i + 1 < argc) {
+			if (!parseNumberOption(arg, argv[++i], 0.0, memoryLogInterval)) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		// Capture a CPU trace of start up and the first N frames (open in chrome://tracing or ui.perfetto.dev)
+		if (arg == "--trace" && i + 1 < argc) {
+			if (!parseCountOption(arg, argv[++i], 0, traceFrames)) {
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (arg == "--trace-file" && i + 1 < argc) {
+			traceFile = argv[++i];
+		}
+	}
+
+	// Started before init so the trace covers start up and asset loading too
+	if (traceFrames > 0) {
+		Tracer::beginCapture(traceFrames, traceFile);
+	}
+
+	// Benchmark runs its own fixed timestep loop and reports as JSON
+	if (!benchmarkScript.empty()) {
+		return runSceneBenchmark(vulkanRenderer, benchmarkScript);
+	}
+
+	// Headless always needs an end point
+	if (headless && frameLimit <= 0) {
+		frameLimit = 300;
+	}
+
+	vulkanRenderer.setUploadBudget(uploadBudgetBytes, uploadBudgetMicroseconds);
+	if (textureBudgetMiB >= 0.0) {
+		vulkanRenderer.setTextureBudget(static_cast<VkDeviceSize>(textureBudgetMiB * 1024 * 1024));
+	}
+	vulkanRenderer.setDynamicResolution(dynamicResolutionMs);
+	vulkanRenderer.setDepthPrepass(depthPrepass);
+	vulkanRenderer.setOcclusionCulling(occlusionCulling);
+	vulkanRenderer.setCpuOcclusionCulling(cpuOcclusionCulling);
+
+	// Model import doesn't need the device, let it run alongside renderer init
+	vulkanRenderer.prefetchMeshModel("Models/kitbash.gltf");
+
+	// Create Vulkan Renderer instance (with a window, or offscreen)
+	if (headless) {
+		if (vulkanRenderer.initHeadless(1280, 960) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		// Create a window
+		initWindow("Vulkan Window", 1280, 960);
+
+		if (vulkanRenderer.init(gWindow) == EXIT_FAILURE) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Asynchronously loaded model only gets an id once it's resident, until then there's nothing to update
+	int modelLoc = -1;
+	int modelLoad = -1;
+	if (asyncLoad) {
+		modelLoad = vulkanRenderer.createMeshModelAsync("Models/kitbash.gltf");
+	} else {
+		modelLoc = vulkanRenderer.createMeshModel("Models/kitbash.gltf");
+
+		// What the loaded assets cost in device memory
+		GpuMemoryTracker::printReport(std::cout);
+	}
+
+	int frameCount = 0;
+	while (headless ? frameCount < frameLimit : !glfwWindowShouldClose(gWindow) && (frameLimit <= 0 || frameCount < frameLimit)) {
+		double now = 0.0;
+		if (headless) {
+			// Fixed timestep so every headless run renders exactly the same frames
+			deltaTime = 1.0 / 60.0;
+		} else {
+			now = glfwGetTime();
+			deltaTime = now - lastTime;
+			lastTime = now;
+
+			glfwPollEvents();
+		}
+
+		if (modelLoc < 0 && modelLoad >= 0 && vulkanRenderer.getAsyncModelId(modelLoad) >= 0) {
+			modelLoc = vulkanRenderer.getAsyncModelId(modelLoad);
+			std::cout << "Model resident after " << frameCount << " frames\n";
+			GpuMemoryTracker::printReport(std::cout);
+		}
+
+		{
+			TRACE_SCOPE("Update scene");
+
+			angle = angle + 30.0f * deltaTime;
+
+			glm::mat4 testMat(1.0f);
+			testMat = glm::rotate(testMat, glm::radians(180 + -(float)angle * 0.5f), glm::vec3(0.0, 1.0, 0.0));
+			testMat = glm::translate(testMat, glm::vec3(0.0, -30.0, 0.0));
+			//testMat = glm::rotate(testMat, glm::radians(15.0f * 9), glm::vec3(1.0, 0.0, 0.0));
+			testMat = glm::scale(testMat, glm::vec3(40.0, 40.0, 40.0));
+
+			if (modelLoc >= 0) {
+				vulkanRenderer.updateModel(modelLoc, testMat);
+			}
+		}
 
 		vulkanRenderer.draw();
+		frameCount++;
+
+		TRACE_FRAME_END();
+
+		if (frameCount == 1) {
+			double firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+			std::cout << "Time to first frame: " << firstFrameMs << " ms\n";
+			vulkanRenderer.getStartupPhases().print(std::cout);
+		}
+
+		// Print the GPU memory report every memoryLogInterval seconds
+		// Scene time in headless runs, so the interval means the same thing in both modes
+		double elapsed = headless ? frameCount * deltaTime : now;
+		if (memoryLogInterval > 0.0 && elapsed - lastMemoryLogTime >= memoryLogInterval) {
+			lastMemoryLogTime = elapsed;
+			GpuMemoryTracker::printReport(std::cout);
+		}
+
+		// Show how many binds the recorder filtered out in the window title, once a second
+		if (!headless && now - lastStatsTime >= 1.0) {
+			lastStatsTime = now;
+
+			CommandRecorderStats stats = vulkanRenderer.getRecordingStats();
+			std::string title = "Vulkan Window | draws " + std::to_string(stats.draws) + " | binds issued " + std::to_string(stats.issued) + " elided " + std::to_string(stats.elided)
+				+ " | depth pre-pass " + (vulkanRenderer.isDepthPrepassEnabled() ? "on" : "off");
+			if (vulkanRenderer.isOcclusionCullingEnabled()) {
+				const OcclusionCullStats& culling = vulkanRenderer.getOcclusionStats();
+				title += " | triangles drawn " + std::to_string(culling.trianglesDrawn) + " of " + std::to_string(culling.trianglesSubmitted);
+			} else if (vulkanRenderer.isCpuOcclusionCullingEnabled()) {
+				const SoftwareOcclusionStats& culling = vulkanRenderer.getCpuOcclusionStats();
+				title += " | CPU culled " + std::to_string(culling.objectsCulled) + " of " + std::to_string(culling.objectsTested) + " objects";
+			} else {
+				title += " | occlusion culling off";
+			}
+			glfwSetWindowTitle(gWindow, title.c_str());
+		}
+	}
+
+	// Frame time summary for the frames-in-flight setting that was used
+	const RollingStatistics& frameTimes = vulkanRenderer.getFrameTimeStats();
+	const RollingStatistics& fenceWaits = vulkanRenderer.getFenceWaitStats();
+	std::cout << "Frames in flight: " << vulkanRenderer.getFramesInFlight() << " (last " << frameTimes.getSampleCount() << " frames)\n";
+	std::cout << "\tframe time ms : avg " << frameTimes.getAverage() << " | p50 " << frameTimes.getPercentile(50.0) << " | p95 " << frameTimes.getPercentile(95.0) << " | p99 " << frameTimes.getPercentile(99.0) << " | max " << frameTimes.getMax() << "\n";
+	std::cout << "\tfence wait ms : avg " << fenceWaits.getAverage() << " | p99 " << fenceWaits.getPercentile(99.0) << "\n";
+	if (dynamicResolutionMs > 0.0) {
+		std::cout << "\tresolution scale : last " << vulkanRenderer.getResolutionScale() << " | changes " << vulkanRenderer.getResolutionChangeCount() << "\n";
+	}
+	std::cout << "\tdepth pre-pass : " << (vulkanRenderer.isDepthPrepassEnabled() ? "on" : "off") << "\n";
+	if (vulkanRenderer.isOcclusionCullingEnabled()) {
+		const OcclusionCullStats& culling = vulkanRenderer.getOcclusionStats();
+		std::cout << "\tocclusion culling : objects " << culling.objects << " | drawn " << culling.drawnFirstPass << " + " << culling.drawnSecondPass
+			<< " | triangles " << culling.trianglesDrawn << " of " << culling.trianglesSubmitted << " (last frame read back)\n";
+	} else if (vulkanRenderer.isCpuOcclusionCullingEnabled()) {
+		const SoftwareOcclusionStats& culling = vulkanRenderer.getCpuOcclusionStats();
+		std::cout << "\tCPU occlusion culling : occluders " << culling.occluders << " (" << culling.occluderTriangles << " triangles) | culled " << culling.objectsCulled
+			<< " of " << culling.objectsTested << " objects | raster " << culling.rasterMs << " ms | test " << culling.testMs << " ms (last frame)\n";
+	} else {
+		std::cout << "\tocclusion culling : off\n";
+	}
+
+	for (const auto& timing : vulkanRenderer.getGpuTimings()) {
+		std::cout << "\tGPU " << timing.name << " ms : min " << timing.minMs << " | avg " << timing.avgMs << " | p99 " << timing.p99Ms << "\n";
 	}
 
+	// Run ended before the capture had all its frames, write what there is
+	Tracer::endCapture();
+
 	vulkanRenderer.cleanup();
 
+	// Nothing to tear down, and nobody to press a key, when headless
+	if (headless) {
+		return 0;
+	}
+
 	// Destroy the window
 	glfwDestroyWindow(gWindow);
 	